@@ -34,17 +34,21 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 
 #include "rtl.h"
 
-#define	XING_MAX			3					// number of stable samples before a valid zero crossing
+#define	XING_MAX			2					// number of stable samples before a valid zero crossing
+#define	DCSLICE_GAIN		0.0003				// slicer level follows over about half a second
+#define	FRAME_STAMPS		64					// frames in the buffer with a capture time
 #ifdef _WIN32
 typedef __ptw32_handle_t pthread_t;
 #endif
 
 struct dsp_threads_t {
 	int				exit;							// signals an exit
+	BOOL			running;						// the DSP thread is demodulating the receiver
 	int				debuglevel;						// current debuglevel
 
 	// these are used by the signal processing thread
@@ -55,22 +59,27 @@ struct dsp_threads_t {
 	pthread_cond_t	dsp_wait_cond;					// wait condition
 	pthread_t		dsp_thread;						// pointer to dsp thread
 
+	// capture times of the frames in the buffer
+	int64_t			frame_capture[FRAME_STAMPS];	// read from the pipe
+	int64_t			frame_queued[FRAME_STAMPS];		// put in the buffer
+	int				frame_end[FRAME_STAMPS];		// write pointer after the frame
+	int				frame_wr;						// next stamp to write
+	int				frame_rd;						// oldest stamp
+	int64_t			capture;						// of the sample being demodulated
+	int64_t			signalled;						// when the thread was last woken
+
 	// these are the demodulator thread
-	BOOL			insync;							// rx is in sync
+	DEMOD_CHAN		chan;							// bit recovery
 	pthread_mutex_t	sync_mutex;						// mutex for sync
 	void			(*byte_rx_func)(DEMOD_BYTE x);	// pointer to function that processes byte
+	int64_t			samples;						// samples demodulated by DSPDemodSync
+	uint64_t		position;						// samples demodulated at DEMOD_RATE, for tracing
 
 } dsp_threads;
 
-// bit decpder vars
-int divisor;					// outer divisor
-int swallow_ctr;				// swallow counter
-DEMOD_BYTE current_sense;		// current data sense
-BOOL bytesync;					// bytelevel sync
-RTL_SAMPLE dcslice_level;		// dc slicer level
-
 // forward refs
 static void *dsp_threads_fn(void *arg);
+static void dsp_process(struct dsp_threads_t *s, RTL_SAMPLE sample);
 
 void DSPInit(void (*rx_func)(DEMOD_BYTE x), int debuglevel)
 {
@@ -78,114 +87,295 @@ void DSPInit(void (*rx_func)(DEMOD_BYTE x), int debuglevel)
 	dsp_threads.debuglevel = debuglevel;
 	dsp_threads.wrptr = 0;
 	dsp_threads.rdptr = 0;
-	dsp_threads.insync = FALSE;
+	dsp_threads.frame_wr = dsp_threads.frame_rd = 0;
+	dsp_threads.capture = 0;
+	dsp_threads.position = 0;
+	DemodChanInit(&dsp_threads.chan);
 #ifdef _WIN32
 	dsp_threads.bfr_mutex = PTHREAD_MUTEX_INITIALIZER;
 	dsp_threads.sync_mutex = PTHREAD_MUTEX_INITIALIZER;
 	dsp_threads.dsp_wait_cond = PTHREAD_COND_INITIALIZER;
 #endif
 	dsp_threads.byte_rx_func = rx_func;
-	dsp_threads.insync = FALSE;
 
 	pthread_mutex_init(&dsp_threads.bfr_mutex, NULL);
 	pthread_mutex_init(&dsp_threads.sync_mutex, NULL);
 	pthread_cond_init(&dsp_threads.dsp_wait_cond, NULL);
 
 	pthread_create(&dsp_threads.dsp_thread, NULL, dsp_threads_fn, (void *)(&dsp_threads));
+	dsp_threads.running = TRUE;
+
+	// the per sample debug output goes to the trace file
+	if ((debuglevel & TRACE_FLAGS) && (trace_mask == 0))
+		TraceStart(TRACE_FILE, debuglevel);
 
 	// setup signal processing functions
-	FIRInit();
 	InitOsc();
+	FIRInit();
 }
 
 void SetDebugLevel(int debug)
 {
 	dsp_threads.debuglevel = debug;
+	if ((debug & TRACE_FLAGS) && (trace_mask == 0))
+		TraceStart(TRACE_FILE, debug);
 }
 
-void DSPDemod(RTL_SAMPLE *PipeBufferPtr, int samples_read)
+void DSPDemod(RTL_SAMPLE *PipeBufferPtr, int samples_read, int64_t capture)
 {
 	pthread_mutex_lock(&dsp_threads.bfr_mutex);
 
 	// copy the samples into buffer and decimate to 12 KHz
 	int wrptr = dsp_threads.wrptr;
+	int rdptr = dsp_threads.rdptr;
 	int sample, samplez1 = 0, sum;
 	for (int i = 0; i < samples_read; i++) {
 		sum = sample = (int)*PipeBufferPtr++;
 		sum += samplez1;
 		if (i & 1) {
-			dsp_threads.buffer[wrptr] = ((RTL_SAMPLE)(sum >> 1) & 0xffff);
-			wrptr = (wrptr + 1) & (SAMPLE_BFRSIZ - 1);
+			// drop rather than wrap onto samples not yet processed
+			if (((wrptr + 1) & (SAMPLE_BFRSIZ - 1)) == rdptr)
+				STATS_INC(STAT_DSP_OVERRUNS);
+			else {
+				dsp_threads.buffer[wrptr] = ((RTL_SAMPLE)(sum >> 1) & 0xffff);
+				wrptr = (wrptr + 1) & (SAMPLE_BFRSIZ - 1);
+			}
 		}
 		samplez1 = sample;
 	}
+	StatsMax(STAT_DSP_HIGHWATER, (wrptr - rdptr) & (SAMPLE_BFRSIZ - 1));
+
+	// stamp the frame, unless nothing was written or the stamps are full
+	int frame = dsp_threads.frame_wr, next = (frame + 1) & (FRAME_STAMPS - 1);
+	if ((wrptr != dsp_threads.wrptr) && (next != __atomic_load_n(&dsp_threads.frame_rd, __ATOMIC_ACQUIRE))) {
+		dsp_threads.frame_capture[frame] = capture;
+		dsp_threads.frame_queued[frame] = LatencyNow();
+		dsp_threads.frame_end[frame] = wrptr;
+		__atomic_store_n(&dsp_threads.frame_wr, next, __ATOMIC_RELEASE);
+	}
+	LatencyRecord(LAT_QUEUE, capture);
 	// signal the demod to start
 	DEBUGPRINTF("Wrote Samples: signalling DSP threads\n");
 	dsp_threads.wrptr = wrptr;
+	if (dsp_threads.signalled == 0)
+		dsp_threads.signalled = LatencyNow();
 	pthread_cond_signal(&dsp_threads.dsp_wait_cond);
 	pthread_mutex_unlock(&dsp_threads.bfr_mutex);
 
 }
 
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	DSPInitSync
+
+	INPUTS:		byte handler, debug level
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	reset the demodulator for use without the DSP thread;
+					samples are then demodulated in the caller's thread by
+					DSPDemodSync. Used by the offline tools, and never while
+					DSPRunning, as the state is the receiver's.
+
+---------------------------------------------------------------------------*/
+void DSPInitSync(void (*rx_func)(DEMOD_BYTE x), int debuglevel)
+{
+	dsp_threads.exit = FALSE;
+	dsp_threads.debuglevel = debuglevel;
+	dsp_threads.wrptr = 0;
+	dsp_threads.rdptr = 0;
+	dsp_threads.frame_wr = dsp_threads.frame_rd = 0;
+	dsp_threads.capture = 0;
+	dsp_threads.position = 0;
+	DemodChanInit(&dsp_threads.chan);
+	dsp_threads.byte_rx_func = rx_func;
+	dsp_threads.samples = 0;
+	pthread_mutex_init(&dsp_threads.sync_mutex, NULL);
+
+	InitOsc();
+	FIRInit();
+	DemodInit();
+}
+
+// same decimation as DSPDemod, but demodulate now
+void DSPDemodSync(RTL_SAMPLE *PipeBufferPtr, int samples_read)
+{
+	int sample, samplez1 = 0, sum;
+
+	for (int i = 0; i < samples_read; i++) {
+		sum = sample = (int)*PipeBufferPtr++;
+		sum += samplez1;
+		dsp_threads.samples++;
+		if (i & 1)
+			dsp_process(&dsp_threads, ((RTL_SAMPLE)(sum >> 1) & 0xffff));
+		samplez1 = sample;
+	}
+}
+
+// 24 KHz samples through DSPDemodSync since DSPInitSync
+int64_t DSPSampleCount(void)
+{
+	return dsp_threads.samples;
+}
+
+// capture time of the sample being demodulated, 0 when not stamped
+int64_t DSPCaptureTime(void)
+{
+	return dsp_threads.capture;
+}
+
+// TRUE between DSPInit and DSPStop
+BOOL DSPRunning(void)
+{
+	return dsp_threads.running;
+}
+
 void DSPStop(void)
 {
 	dsp_threads.exit = TRUE;
 	pthread_join(dsp_threads.dsp_thread, NULL);
+	dsp_threads.running = FALSE;
+	TraceStop();
 }
 
 void DSPClearSync(void)
 {
 	pthread_mutex_lock(&dsp_threads.sync_mutex);
-	dsp_threads.insync = FALSE;
+	if (dsp_threads.chan.insync) {
+		STATS_INC(STAT_SYNC_LOST);
+		TRACE(DEBUG_SYNC, TRACE_SYNC, dsp_threads.position, 0, 0, 0);
+	}
+	dsp_threads.chan.insync = FALSE;
 	pthread_mutex_unlock(&dsp_threads.sync_mutex);
 }
 
-static int xingcnt;
+// reset a channel's bit recovery to look for the sync code
+void DemodChanInit(DEMOD_CHAN *ch)
+{
+	memset(ch, 0, sizeof(DEMOD_CHAN));
+}
+
+// the discriminator output less the channel's dc level, which follows it
+int DCSlice(DEMOD_CHAN *ch, int phase)
+{
+	ch->dcslice_level = (int)(ch->dcslice_level*(1.0 - DCSLICE_GAIN)) + (int)(phase*DCSLICE_GAIN);
+	return phase - ch->dcslice_level;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	DemodSlice
 
-BOOL EdgeDetect(DEMOD_BYTE demod_out, BOOL firstTime)
+	INPUTS:		channel, discriminator output, its sample number
+
+	OUTPUTS:	byte received, or -1 if none
+
+	DESCRIPTION:	slice one discriminator output against the channel's
+					dc level, then look for the sync code, or once it has
+					been found clock the bits into bytes. Used by the
+					receiver's own thread and for each lane by lanes.c.
+
+---------------------------------------------------------------------------*/
+int DemodSlice(DEMOD_CHAN *ch, int phase, uint64_t n)
+{
+	DEMOD_BYTE demod_bit;			// demodulated bit
+	int byte = -1;
+
+	phase = DCSlice(ch, phase);
+	demod_bit = (phase > 0) ? 0 : 1;
+	TRACE(DEBUG_DEMOD, TRACE_DEMOD, n, phase, ch->dcslice_level, ch->bit_time);
+
+	// not in sync yet?
+	if (!ch->insync) {
+		ch->bytesync = FALSE;
+		ch->insync = SyncCorrelator(ch, demod_bit);
+
+		if (ch->insync) {
+			STATS_INC(STAT_SYNC_ACQUIRED);
+
+			// initialize edge detector and bit clock
+			EdgeDetect(ch, demod_bit, TRUE);
+			RunBitClock(ch, TRUE);
+			ch->bitctr = 0;
+			ch->demod_byte = 0;
+			TRACE(DEBUG_SYNC, TRACE_SYNC, n, 1, 0, 0);
+		}
+		return -1;
+	}
+
+	// we are in sync; gather the bits up
+	ch->bit_time = RunBitClock(ch, EdgeDetect(ch, demod_bit, FALSE));
+
+	TRACE(DEBUG_BITSHIFT, TRACE_BIT, n, ch->bit_time, demod_bit, 0);
+
+	if (ch->bit_time) {
+
+		// receive the byte and sync to the data
+		ch->demod_byte = (ch->demod_byte >> 1) | ((demod_bit & 1) << 7);
+		if (!ch->bytesync) {
+			if (ch->demod_byte == SYNC_BYTE) {
+				ch->bytesync = TRUE;
+				ch->bitctr = 0;
+				TRACE(DEBUG_BYTEOUT, TRACE_BYTE, n, ch->demod_byte, 0, 0);
+				byte = ch->demod_byte;
+			}
+		}
+		else {
+			if (ch->bitctr == BITSPERBYTE - 1) {
+				TRACE(DEBUG_BYTEOUT, TRACE_BYTE, n, ch->demod_byte, 1, 0);
+				byte = ch->demod_byte;
+				ch->bitctr = 0;
+			}
+			else ch->bitctr++;
+		}
+	}
+	return byte;
+}
+
+BOOL EdgeDetect(DEMOD_CHAN *ch, DEMOD_BYTE demod_out, BOOL firstTime)
 {
 	if (firstTime)	{
-		current_sense = demod_out;
-		xingcnt = 0;
+		ch->current_sense = demod_out;
+		ch->xingcnt = 0;
 		return FALSE;
 	}
 
-	if (demod_out == current_sense) {
+	if (demod_out == ch->current_sense) {
 		return FALSE;
 	}
 	
-	if (++xingcnt == XING_MAX) {
-		current_sense = demod_out;
-		xingcnt = 0;
+	if (++ch->xingcnt == XING_MAX) {
+		ch->current_sense = demod_out;
+		ch->xingcnt = 0;
 		return TRUE;
 	} 
 return FALSE;
 }
 
-BOOL RunBitClock(BOOL edgedetect)
+BOOL RunBitClock(DEMOD_CHAN *ch, BOOL edgedetect)
 {
 
 	// if an edge is detected, reset to mid-bit time
 	if (edgedetect) {
-		divisor = 1 * (BIT_DIVISOR) / 2;		// init to mid-bit time
-		swallow_ctr = SWALLOW_CTR;
+		ch->divisor = 1 * (BIT_DIVISOR) / 2;		// init to mid-bit time
+		ch->swallow_ctr = SWALLOW_CTR;
 		return FALSE;
 	}
 
 	BOOL bittime = FALSE;
-	if (divisor == 0) {
+	if (ch->divisor == 0) {
 		bittime = TRUE;
-		if (swallow_ctr == 0) {
-			divisor = BIT_DIVISOR - 1;
-			swallow_ctr = SWALLOW_CTR;
+		if (ch->swallow_ctr == 0) {
+			ch->divisor = BIT_DIVISOR - 1;
+			ch->swallow_ctr = SWALLOW_CTR;
 		}
 		else {
-			divisor = BIT_DIVISOR;
-			swallow_ctr -= 1;
+			ch->divisor = BIT_DIVISOR;
+			ch->swallow_ctr -= 1;
 		}
 	}
 	else {
-		divisor -= 1;
+		ch->divisor -= 1;
 	}
 	return bittime;
 }
@@ -193,12 +383,11 @@ BOOL RunBitClock(BOOL edgedetect)
 // signal processing thread
 static void *dsp_threads_fn(void *arg)
 {
-	DEMOD_BYTE demod_bit;			// demodulated bit
-	DEMOD_BYTE demod_byte;			// demodulated byte
-	BOOL bit_time = FALSE;			// at a bit time
-	int bitctr;						// bit counter
-
 	struct dsp_threads_t *s = arg;
+	uint64_t cpu = StatsThreadTime();
+
+	ArenaThread();
+	RTApply(RT_DSP);
 #ifdef WIN32
 	if (s->debuglevel & DEBUG_WRITE)
 		_setmode(_fileno(stdout), _O_BINARY);
@@ -207,8 +396,15 @@ static void *dsp_threads_fn(void *arg)
 		// see if we have any data to process
 		pthread_mutex_lock(&s->bfr_mutex);
 		if (BUFFER_EMPTY(dsp_threads)) {
+			// caught up: book the time spent since the last wait
+			uint64_t now = StatsThreadTime();
+			STATS_ADD(STAT_CPU_DEMOD, now - cpu);
+			cpu = now;
 			DEBUGPRINTF("MT wait\n");
+			s->signalled = 0;
 			pthread_cond_wait(&s->dsp_wait_cond, &s->bfr_mutex);
+			// how long the scheduler took to run us
+			LatencyRecord(LAT_WAKEUP, s->signalled);
 			DEBUGPRINTF("Got Data\n");
 		}
 		pthread_mutex_unlock(&s->bfr_mutex);
@@ -217,91 +413,50 @@ static void *dsp_threads_fn(void *arg)
 		RTL_SAMPLE sample = s->buffer[rdptr];
 		s->rdptr = (rdptr +1)  & (SAMPLE_BFRSIZ - 1);
 
+		// the stamp of the frame this sample came in
+		int frame = s->frame_rd;
+		BOOL stamped = (frame != __atomic_load_n(&s->frame_wr, __ATOMIC_ACQUIRE));
+		if (stamped)
+			s->capture = s->frame_capture[frame];
+
 		if (s->debuglevel & DEBUG_WRITE) {
 			fwrite(&sample, sizeof(RTL_SAMPLE), 1, stdout);
 		}
 		else {
-			// run the oscillator first
-			RTL_SAMPLE Iosc = RunOsc(I_CHANNEL);
-			RTL_SAMPLE Qosc = RunOsc(Q_CHANNEL);
-			BACKGDEBUG(DEBUG_OSC)
-				fprintf(stderr, "%04x %f\n", sample & 0xffff, ((double)sample / 32767.0));
-
-
-			// run the mixer
-			int Imix = (RTL_SAMPLE)(((int)Iosc*(int)sample) >> 15);
-			int Qmix = (RTL_SAMPLE)(((int)Qosc*(int)sample) >> 15);
-
-			// low pass filter the samples
-			int Iout = RunFIR(Imix, I_CHANNEL);
-			int Qout = RunFIR(Qmix, Q_CHANNEL);
-			BACKGDEBUG(DEBUG_LPF)
-				fprintf(stderr, "%04x %04x\n", Iout & 0xffff, Qout & 0xffff);
-
-			// now run the demodulator
-			int phase = PhaseDiscrim(Iout, Qout);
-			dcslice_level = (int)(dcslice_level*0.99985) + (int)(phase*.00015);
-			phase -= dcslice_level;
-
-			demod_bit = (phase > 0) ? 0 : 1;
-			BACKGDEBUG(DEBUG_DEMOD)
-				fprintf(stderr, "%f, %f, %d\n",  ((double)phase / 32767.0), ((double)dcslice_level / 32767.0), bit_time);
-
-			// not in sync yet?
-			if (!s->insync) {
-				bytesync = FALSE;
-
-				pthread_mutex_lock(&s->sync_mutex);
-				s->insync = SyncCorrelator(demod_bit);
-				BACKGDEBUG(DEBUG_SYNC)
-					fprintf(stderr, "DSP SYNC achieved\n");
-
-				if (s->insync) {
-					// initialize edge detector and bit clock
-					EdgeDetect(demod_bit, TRUE);
-					RunBitClock(TRUE);
-					bitctr = 0;
-					demod_byte = 0;
-					BACKGDEBUG(DEBUG_SYNC)
-						fprintf(stderr,"DSP SYNC achieved\n");
-				}
-				pthread_mutex_unlock(&s->sync_mutex);
+			dsp_process(s, sample);
+		}
 
-			}
-			// we are in sync; gather the bits up
-			else {
-				bit_time = RunBitClock(EdgeDetect(demod_bit, FALSE));
-
-				BACKGDEBUG(DEBUG_BITSHIFT)
-					fprintf(stderr, "%d %d\n", bit_time, demod_bit);
-
-				if (bit_time) {
-					BACKGDEBUG(DEBUG_BYTEOUT) {
-						if (bitctr == BITSPERBYTE - 1)
-							fprintf(stderr, "%d\n", demod_bit);
-						else
-							fprintf(stderr, "%d,", demod_bit);
-					}
-
-					// receive the byte and sync to the data
-					demod_byte = (demod_byte >> 1) | ((demod_bit & 1) << 7);
-					if (!bytesync) {
-						if (demod_byte == SYNC_BYTE) {
-							bytesync = TRUE;
-							bitctr = 0;
-							(*s->byte_rx_func)(demod_byte);
-						}
-					}
-					else {
-						if (bitctr == BITSPERBYTE - 1) {
-							(*s->byte_rx_func)(demod_byte);
-							bitctr = 0;
-						}
-						else bitctr++;
-					}
-				}
-			}
-		} 
+		// end of the frame: it has been through the demodulator
+		if (stamped && (s->rdptr == s->frame_end[frame])) {
+			LatencyRecord(LAT_DSP, s->frame_queued[frame]);
+			__atomic_store_n(&s->frame_rd, (frame + 1) & (FRAME_STAMPS - 1), __ATOMIC_RELEASE);
+		}
 	}
+	RTRelease(RT_DSP);
 	return NULL;
 }
+
+// demodulate one 12 KHz sample; the rest runs at DEMOD_RATE
+static void dsp_process(struct dsp_threads_t *s, RTL_SAMPLE sample)
+{
+	int Iout, Qout;
+
+	// mix and low pass filter, only for the samples kept
+	if (!RunDownconvert(sample, &Iout, &Qout))
+		return;
+	uint64_t n = s->position++;		// sample number for the trace
+	TRACE(DEBUG_OSC, TRACE_INPUT, n, sample, 0, 0);
+	TRACE(DEBUG_LPF, TRACE_LPF, n, Iout, Qout, 0);
+
+	// now run the demodulator; the framer clears the sync from its thread
+	int phase = PhaseDiscrim(Iout, Qout);
+	BOOL searching = !s->chan.insync;
+	if (searching)
+		pthread_mutex_lock(&s->sync_mutex);
+	int byte = DemodSlice(&s->chan, phase, n);
+	if (searching)
+		pthread_mutex_unlock(&s->sync_mutex);
+
+	if (byte >= 0)
+		(*s->byte_rx_func)((DEMOD_BYTE)byte);
+}
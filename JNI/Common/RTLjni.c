@@ -25,6 +25,9 @@
 
 ---------------------------------------------------------------------------*/
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "jni_md.h"
 #include "jni.h"
 #include "PiJNI_RTLsdrJNI.h"
@@ -72,6 +75,17 @@ JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_stopRTL
 	StopRTL();
 }
 
+// change the source without stopping the receiver
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_reconfigureSource
+(JNIEnv *env, jobject o, jstring cmd)
+{
+	const char *cmdline = (*env)->GetStringUTFChars(env, cmd, NULL);
+
+	jboolean retval = ReconfigureSource((char *)cmdline);
+	(*env)->ReleaseStringUTFChars(env, cmd, cmdline);
+	return retval;
+}
+
 /*------------------------------------------------------------------------------------------*/
 /*							Methods for FSK Data receiver 									*/
 /*------------------------------------------------------------------------------------------*/
@@ -117,3 +131,221 @@ JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_stopUDP
 {
 	StopUDP();
 }
+
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_startMulticast
+(JNIEnv *env, jobject o, jstring group, jint port, jint ttl, jstring iface, jint codec, jint gain)
+{
+	char *groupip = (char *)(*env)->GetStringUTFChars(env, group, NULL);
+	char *ifname = (iface != NULL) ? (char *)(*env)->GetStringUTFChars(env, iface, NULL) : NULL;
+
+	jboolean retval = StartMulticast(groupip, port, ttl, ifname, codec, gain);
+
+	(*env)->ReleaseStringUTFChars(env, group, groupip);
+	if (ifname != NULL)
+		(*env)->ReleaseStringUTFChars(env, iface, ifname);
+	return retval;
+}
+
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_stopMulticast
+(JNIEnv *env, jobject o)
+{
+	StopMulticast();
+}
+
+// select how source underruns are filled
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_setGapFill
+(JNIEnv *env, jobject o, jint mode)
+{
+	SetGapFill(mode);
+}
+
+// get the RTCP network statistics
+JNIEXPORT jintArray JNICALL Java_PiJNI_RTLsdrJNI_getRTCPStats
+(JNIEnv *env, jobject o)
+{
+	RTCP_STATS stats;
+	jint values[RTCP_STAT_COUNT];
+
+	GetRTCPStats(&stats);
+	values[RTCP_STAT_PACKETS] = stats.packets_sent;
+	values[RTCP_STAT_OCTETS] = stats.octets_sent;
+	values[RTCP_STAT_SR_SENT] = stats.reports_sent;
+	values[RTCP_STAT_RR_RCVD] = stats.reports_received;
+	values[RTCP_STAT_FRACTION] = stats.fraction_lost;
+	values[RTCP_STAT_LOST] = stats.cumulative_lost;
+	values[RTCP_STAT_HIGHSEQ] = stats.highest_seq;
+	values[RTCP_STAT_JITTER] = stats.jitter_us;
+	values[RTCP_STAT_RTT] = stats.rtt_ms;
+
+	jintArray retval = (*env)->NewIntArray(env, RTCP_STAT_COUNT);
+	if (retval != NULL)
+		(*env)->SetIntArrayRegion(env, retval, 0, RTCP_STAT_COUNT, values);
+	return retval;
+}
+
+// get the runtime counters, in STAT_ order
+JNIEXPORT jlongArray JNICALL Java_PiJNI_RTLsdrJNI_getStats
+(JNIEnv *env, jobject o)
+{
+	uint64_t stats[STAT_COUNT];
+	jlong values[STAT_COUNT];
+
+	GetStats(stats);
+	for (int i = 0; i < STAT_COUNT; i++)
+		values[i] = (jlong)stats[i];
+
+	jlongArray retval = (*env)->NewLongArray(env, STAT_COUNT);
+	if (retval != NULL)
+		(*env)->SetLongArrayRegion(env, retval, 0, STAT_COUNT, values);
+	return retval;
+}
+
+// capture time of the last byte from getRxByte, for recordLatency
+JNIEXPORT jlong JNICALL Java_PiJNI_RTLsdrJNI_getRxTimestamp
+(JNIEnv *env, jobject o)
+{
+	return (jlong)databuffer_capture();
+}
+
+// time a hop done in Java (framing, e-mail, SIP) from a capture time
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_recordLatency
+(JNIEnv *env, jobject o, jint hop, jlong capture)
+{
+	LatencyRecord(hop, capture);
+}
+
+// count, p50, p99 and max in us for each LAT_ hop
+JNIEXPORT jlongArray JNICALL Java_PiJNI_RTLsdrJNI_getLatency
+(JNIEnv *env, jobject o)
+{
+	jlong values[LAT_COUNT * LAT_FIELDS];
+
+	for (int hop = 0; hop < LAT_COUNT; hop++) {
+		LATENCY_SUMMARY s;
+		LatencyGet(hop, &s);
+		values[hop * LAT_FIELDS + LAT_FIELD_COUNT] = (jlong)s.count;
+		values[hop * LAT_FIELDS + LAT_FIELD_P50] = (jlong)s.p50_us;
+		values[hop * LAT_FIELDS + LAT_FIELD_P99] = (jlong)s.p99_us;
+		values[hop * LAT_FIELDS + LAT_FIELD_MAX] = (jlong)s.max_us;
+	}
+
+	jlongArray retval = (*env)->NewLongArray(env, LAT_COUNT * LAT_FIELDS);
+	if (retval != NULL)
+		(*env)->SetLongArrayRegion(env, retval, 0, LAT_COUNT * LAT_FIELDS, values);
+	return retval;
+}
+
+// trace the DEBUG_ flags in mask to a binary file, see tracedump
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_startTrace
+(JNIEnv *env, jobject o, jstring file, jint mask)
+{
+	const char *filename = (*env)->GetStringUTFChars(env, file, NULL);
+
+	jboolean retval = TraceStart((char *)filename, mask);
+	(*env)->ReleaseStringUTFChars(env, file, filename);
+	return retval;
+}
+
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_stopTrace
+(JNIEnv *env, jobject o)
+{
+	TraceStop();
+}
+
+// scheduling for an RT_ thread, as "fifo:80:1"; call before initRTL or while running
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_configureRealtime
+(JNIEnv *env, jobject o, jint thread, jstring spec)
+{
+	const char *s = (*env)->GetStringUTFChars(env, spec, NULL);
+
+	jboolean retval = RTConfigure(thread, (char *)s);
+	(*env)->ReleaseStringUTFChars(env, spec, s);
+	return retval;
+}
+
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_lockMemory
+(JNIEnv *env, jobject o, jboolean lock)
+{
+	return RTLockMemory(lock);
+}
+
+// keep the last minutes of audio, dumped to directory on decode trouble
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_startBlackbox
+(JNIEnv *env, jobject o, jint minutes, jboolean ulaw, jstring directory)
+{
+	const char *dir = (*env)->GetStringUTFChars(env, directory, NULL);
+
+	jboolean retval = BlackboxStart(minutes, ulaw, (char *)dir);
+	(*env)->ReleaseStringUTFChars(env, directory, dir);
+	return retval;
+}
+
+// the framer in Java found trouble, or someone asked
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_dumpBlackbox
+(JNIEnv *env, jobject o)
+{
+	BlackboxTrigger(BB_TRIG_REQUEST);
+}
+
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_stopBlackbox
+(JNIEnv *env, jobject o)
+{
+	BlackboxStop();
+}
+
+// serve the counters on a localhost port or a Unix socket path
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_startStatsServer
+(JNIEnv *env, jobject o, jstring endpoint)
+{
+	const char *ep = (*env)->GetStringUTFChars(env, endpoint, NULL);
+
+	jboolean retval = StatsServerStart((char *)ep);
+	(*env)->ReleaseStringUTFChars(env, endpoint, ep);
+	return retval;
+}
+
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_stopStatsServer
+(JNIEnv *env, jobject o)
+{
+	StatsServerStop();
+}
+
+// offline messages collected for decodeOffline
+static char **offline_msgs;
+static int offline_nmsgs;
+
+static void offline_msg(SAME_MESSAGE *msg)
+{
+	char **grown = realloc(offline_msgs, (offline_nmsgs + 1) * sizeof(char *));
+	if (grown == NULL)
+		return;
+	offline_msgs = grown;
+	if ((offline_msgs[offline_nmsgs] = malloc(SAME_MAXLEN + 24)) == NULL)
+		return;
+	sprintf(offline_msgs[offline_nmsgs++], "%lld %s", (long long)msg->sample, msg->raw);
+}
+
+// decode a recording faster than real time: returns "<sample offset> <header>" strings
+JNIEXPORT jobjectArray JNICALL Java_PiJNI_RTLsdrJNI_decodeOffline
+(JNIEnv *env, jobject o, jstring file, jint rate, jboolean bigendian)
+{
+	const char *filename = (*env)->GetStringUTFChars(env, file, NULL);
+	jobjectArray retval = NULL;
+
+	offline_msgs = NULL;
+	offline_nmsgs = 0;
+	BOOL decoded = DecodeOffline((char *)filename, rate, bigendian, &offline_msg, debuglevel);
+	(*env)->ReleaseStringUTFChars(env, file, filename);
+
+	if (decoded) {
+		jclass strclass = (*env)->FindClass(env, "java/lang/String");
+		retval = (*env)->NewObjectArray(env, offline_nmsgs, strclass, NULL);
+		for (int i = 0; (retval != NULL) && (i < offline_nmsgs); i++)
+			(*env)->SetObjectArrayElement(env, retval, i, (*env)->NewStringUTF(env, offline_msgs[i]));
+	}
+	for (int i = 0; i < offline_nmsgs; i++)
+		free(offline_msgs[i]);
+	free(offline_msgs);
+	offline_msgs = NULL;
+	return retval;
+}
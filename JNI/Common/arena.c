@@ -0,0 +1,240 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Buffer arena
+
+	File Name:		  arena.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Owns the frame, ring and packet buffers of the receive
+					  path. Memory is taken from the heap once, when the
+					  receiver is set up, and touched so it is resident;
+					  buffers are named and handed out again by name, so a
+					  restart reuses them instead of allocating more. Once
+					  the pipeline has warmed up the arena is sealed, and any
+					  heap allocation on a pipeline thread after that is
+					  counted, or is fatal in a build with ARENA_CHECK.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rtl.h"
+
+#define	ARENA_ALIGN			64					// cache line
+#define	ARENA_MAX_SLOTS		16					// named buffers
+#define	ARENA_MAX_BLOCKS	8					// heap blocks behind them
+#define	ARENA_NAME_LEN		16
+
+// a named buffer
+typedef struct arena_slot_t {
+	char		name[ARENA_NAME_LEN];
+	void		*ptr;
+	size_t		size;
+} ARENA_SLOT;
+
+// a block taken from the heap
+typedef struct arena_block_t {
+	unsigned char	*base;
+	size_t			size;
+	size_t			used;
+} ARENA_BLOCK;
+
+struct arena_t {
+	ARENA_BLOCK		blocks[ARENA_MAX_BLOCKS];
+	int				nblocks;
+	ARENA_SLOT		slots[ARENA_MAX_SLOTS];
+	int				nslots;
+	BOOL			sealed;						// warm up is over
+	BOOL			strict;						// heap use after it is fatal
+	pthread_mutex_t	arena_mutex;
+} arena = { .arena_mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread BOOL pipeline_thread;			// set by the receive threads
+
+// internals
+static BOOL add_block(size_t size);
+static void publish(void);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	ArenaInit
+
+	INPUTS:		bytes needed by the configuration
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	take the first block from the heap; later calls only
+					refresh the counters, the arena lives as long as the
+					process
+
+---------------------------------------------------------------------------*/
+BOOL ArenaInit(size_t size)
+{
+	BOOL retval = TRUE;
+
+	pthread_mutex_lock(&arena.arena_mutex);
+	if (arena.nblocks == 0)
+		retval = add_block(size);
+	publish();
+	pthread_mutex_unlock(&arena.arena_mutex);
+	return retval;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	ArenaAlloc
+
+	INPUTS:		buffer name, size in bytes
+
+	OUTPUTS:	the buffer, or NULL
+
+	DESCRIPTION:	the buffer with this name if it is big enough, else a
+					new one carved from the arena. A new block is taken
+					from the heap only when the arena is full, which after
+					warm up is counted as a heap allocation.
+
+---------------------------------------------------------------------------*/
+void *ArenaAlloc(char *name, size_t size)
+{
+	ARENA_SLOT *slot = NULL;
+	ARENA_BLOCK *b;
+	void *ptr = NULL;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	pthread_mutex_lock(&arena.arena_mutex);
+
+	for (int i = 0; i < arena.nslots; i++) {
+		if (!strcmp(arena.slots[i].name, name)) {
+			slot = &arena.slots[i];
+			break;
+		}
+	}
+	if ((slot != NULL) && (slot->size >= size)) {
+		ptr = slot->ptr;
+		goto done;
+	}
+
+	// the last block, or a new one; what a grown slot had is not given back
+	b = (arena.nblocks != 0) ? &arena.blocks[arena.nblocks - 1] : NULL;
+	if ((b == NULL) || (b->size - b->used < size)) {
+		if (arena.sealed)
+			ArenaHeapCheck(size);
+		if (!add_block(size))
+			goto done;
+		b = &arena.blocks[arena.nblocks - 1];
+		DEBUGLEVEL(DEBUG_MSGS)
+			fprintf(stderr, "Arena grown by %zu bytes for %s\n", size, name);
+	}
+	if ((slot == NULL) && (arena.nslots < ARENA_MAX_SLOTS)) {
+		slot = &arena.slots[arena.nslots++];
+		snprintf(slot->name, ARENA_NAME_LEN, "%s", name);
+	}
+	if (slot == NULL)
+		goto done;
+
+	ptr = slot->ptr = b->base + b->used;
+	slot->size = size;
+	b->used += size;
+	publish();
+
+done:
+	pthread_mutex_unlock(&arena.arena_mutex);
+	if (ptr == NULL)
+		DEBUGPRINTF("Arena allocation Error\n");
+	return ptr;
+}
+
+// warm up is over: from now on the pipeline threads must not use the heap
+void ArenaSeal(void)
+{
+	if (__atomic_exchange_n(&arena.sealed, TRUE, __ATOMIC_RELEASE))
+		return;
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "Arena sealed, %llu of %llu bytes in use\n",
+			(unsigned long long)rtl_counters[STAT_ARENA_USED], (unsigned long long)rtl_counters[STAT_ARENA_SIZE]);
+}
+
+// make a heap allocation after warm up fatal, for testing
+void ArenaStrict(BOOL strict)
+{
+	arena.strict = strict;
+}
+
+// called by each thread of the receive path as it starts
+void ArenaThread(void)
+{
+	pipeline_thread = TRUE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	ArenaHeapCheck
+
+	INPUTS:		size of a heap allocation about to be made
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	count it if a pipeline thread makes it after warm up.
+					Called by the arena itself, and by the malloc wrappers
+					of an ARENA_CHECK build, so it must not allocate.
+
+---------------------------------------------------------------------------*/
+void ArenaHeapCheck(size_t size)
+{
+	if (!pipeline_thread || !__atomic_load_n(&arena.sealed, __ATOMIC_ACQUIRE))
+		return;
+	STATS_INC(STAT_HEAP_ALLOCS);
+	if (arena.strict) {
+		fprintf(stderr, "Heap allocation of %zu bytes after warm up\n", size);
+		abort();
+	}
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// touched now, so the realtime threads do not take the page faults
+static BOOL add_block(size_t size)
+{
+	ARENA_BLOCK *b;
+
+	if (arena.nblocks == ARENA_MAX_BLOCKS)
+		return FALSE;
+	b = &arena.blocks[arena.nblocks];
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if ((b->base = aligned_alloc(ARENA_ALIGN, size)) == NULL)
+		return FALSE;
+	memset(b->base, 0, size);
+	b->size = size;
+	b->used = 0;
+	arena.nblocks++;
+	return TRUE;
+}
+
+static void publish(void)
+{
+	uint64_t size = 0, used = 0;
+
+	for (int i = 0; i < arena.nblocks; i++) {
+		size += arena.blocks[i].size;
+		used += arena.blocks[i].used;
+	}
+	__atomic_store_n(&rtl_counters[STAT_ARENA_SIZE], size, __ATOMIC_RELAXED);
+	__atomic_store_n(&rtl_counters[STAT_ARENA_USED], used, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,393 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Audio file reader
+
+	File Name:		  audiofile.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Reads a recording as blocks of 16 bit samples for the
+					  resampler, whatever it is stored as. The format is told
+					  from the first bytes: WAV (PCM of 8 to 32 bits, float,
+					  u-law or A-law), FLAC, or anything else as headerless
+					  raw samples at the rate and byte order given. A WAV or
+					  FLAC header gives the rate itself. A WAV file is read
+					  through a window mapped AF_MAP_WINDOW at a time, so
+					  replaying a large archive costs page faults rather than
+					  read() calls and never more memory than the window;
+					  mono 16 bit WAV goes to the resampler straight from the
+					  map. Only the first channel is used, as with USB.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rtl.h"
+
+#define	WAVE_FORMAT_PCM			0x0001
+#define	WAVE_FORMAT_FLOAT		0x0003
+#define	WAVE_FORMAT_ALAW		0x0006
+#define	WAVE_FORMAT_MULAW		0x0007
+#define	WAVE_FORMAT_EXTENSIBLE	0xFFFE
+#define	WAVE_UNKNOWN_SIZE		0xFFFFFFFF		// data size of a streamed WAV
+
+#define	HOST_BIGENDIAN	(__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+
+// internals
+static BOOL wav_header(AUDIO_FILE *af);
+static BOOL get(AUDIO_FILE *af, void *buf, int n);
+static uint32_t le(unsigned char *p, int n);
+static BOOL map_window(AUDIO_FILE *af);
+static int convert(AUDIO_FILE *af, unsigned char *in, int nframes);
+static int read_flac(AUDIO_FILE *af, int nsamples);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	AudioFileOpen
+
+	INPUTS:		reader, file name or "-" for stdin, rate and byte order of
+				a raw file
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	open a recording and read its header; af->rate and
+					af->bigendian are then what the resampler needs
+
+---------------------------------------------------------------------------*/
+BOOL AudioFileOpen(AUDIO_FILE *af, char *filename, int rate, BOOL bigendian)
+{
+	memset(af, 0, sizeof(AUDIO_FILE));
+	af->rate = rate;
+	af->bigendian = bigendian;
+
+	if (!strcmp(filename, "-"))
+		af->fp = stdin;
+	else if ((af->fp = fopen(filename, "rb")) == NULL) {
+		fprintf(stderr, "Cannot open input file %s\n", filename);
+		return FALSE;
+	}
+
+	af->nhead = (int)fread(af->head, 1, sizeof(af->head), af->fp);
+	af->pos = af->nhead;
+
+	if ((af->nhead == 4) && !memcmp(af->head, "fLaC", 4)) {
+		af->format = AF_FLAC;
+		if (((af->flac = malloc(sizeof(FLAC_DECODER))) == NULL) || !FlacOpen(af->flac, af->fp)) {
+			AudioFileClose(af);
+			return FALSE;
+		}
+		af->rate = af->flac->rate;
+		af->bigendian = HOST_BIGENDIAN;
+	} else if ((af->nhead == 4) && !memcmp(af->head, "RIFF", 4)) {
+		af->format = AF_WAV;
+		if (!wav_header(af)) {
+			AudioFileClose(af);
+			return FALSE;
+		}
+		// mono 16 bit goes straight from the file
+		af->bigendian = ((af->encoding == WAVE_FORMAT_PCM) && (af->align == 2)) ? FALSE : HOST_BIGENDIAN;
+	} else
+		af->format = AF_RAW;
+
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "%s is %s at %d Hz\n", filename, (af->format == AF_FLAC) ? "FLAC"
+			: (af->format == AF_WAV) ? (af->map ? "WAV, mapped" : "WAV") : "raw", af->rate);
+	return TRUE;
+}
+
+void AudioFileClose(AUDIO_FILE *af)
+{
+	if (af->map != NULL)
+		munmap(af->map, af->maplen);
+	if (af->flac != NULL) {
+		FlacFree(af->flac);
+		free(af->flac);
+	}
+	if ((af->fp != NULL) && (af->fp != stdin))
+		fclose(af->fp);
+	free(af->raw);
+	free(af->out);
+	memset(af, 0, sizeof(AUDIO_FILE));
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	AudioFileRead
+
+	INPUTS:		reader, where to put a pointer to the data, most bytes
+				wanted
+
+	OUTPUTS:	bytes of 16 bit samples, 0 at the end of the file
+
+	DESCRIPTION:	the next block, left in the map or the reader's own
+					buffers until the next call
+
+---------------------------------------------------------------------------*/
+int AudioFileRead(AUDIO_FILE *af, unsigned char **data, int nbytes)
+{
+	int nsamples = nbytes / (int)sizeof(RTL_SAMPLE), n;
+
+	// the buffers are only allocated or grown on the first read
+	if (af->outlen < nsamples) {
+		free(af->out);
+		if ((af->out = malloc(nsamples * sizeof(RTL_SAMPLE))) == NULL)
+			return 0;
+		af->outlen = nsamples;
+	}
+
+	switch (af->format) {
+
+	case AF_RAW:
+		// the bytes read to tell the format come first
+		n = af->nhead;
+		memcpy(af->out, af->head, n);
+		af->nhead = 0;
+		n += (int)fread((unsigned char *)af->out + n, 1, nbytes - n, af->fp);
+		*data = (unsigned char *)af->out;
+		return n;
+
+	case AF_FLAC:
+		*data = (unsigned char *)af->out;
+		return read_flac(af, nsamples) * sizeof(RTL_SAMPLE);
+
+	case AF_WAV:
+		if ((af->end - af->pos) / af->align < nsamples)
+			nsamples = (int)((af->end - af->pos) / af->align);
+		if (nsamples <= 0)
+			return 0;
+
+		if (af->map != NULL) {
+			if ((af->pos < af->mapoff) || (af->pos + af->align > af->mapoff + (int64_t)af->maplen)) {
+				if (!map_window(af))
+					return 0;
+			}
+			if ((af->mapoff + (int64_t)af->maplen - af->pos) / af->align < nsamples)
+				nsamples = (int)((af->mapoff + (int64_t)af->maplen - af->pos) / af->align);
+			unsigned char *in = af->map + (af->pos - af->mapoff);
+			af->pos += (int64_t)nsamples * af->align;
+			if ((af->encoding == WAVE_FORMAT_PCM) && (af->align == 2)) {
+				*data = in;
+				return nsamples * sizeof(RTL_SAMPLE);
+			}
+			*data = (unsigned char *)af->out;
+			return convert(af, in, nsamples) * sizeof(RTL_SAMPLE);
+		}
+
+		// from a pipe: read the frames, then take the first channel
+		if (af->rawlen < nsamples * af->align) {
+			free(af->raw);
+			if ((af->raw = malloc(nsamples * af->align)) == NULL)
+				return 0;
+			af->rawlen = nsamples * af->align;
+		}
+		n = (int)fread(af->raw, af->align, nsamples, af->fp);
+		af->pos += (int64_t)n * af->align;
+		*data = (unsigned char *)af->out;
+		return convert(af, af->raw, n) * sizeof(RTL_SAMPLE);
+	}
+	return 0;
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+/*
+ * The chunks up to "data", read in order so a WAV can come down a pipe.
+ * A data size of zero or all ones, as written by a recorder that could not
+ * go back to fill it in, means the data runs to the end of the file.
+ */
+static BOOL wav_header(AUDIO_FILE *af)
+{
+	unsigned char buf[40];
+	BOOL fmt = FALSE;
+	struct stat st;
+
+	if (!get(af, buf, 8) || memcmp(&buf[4], "WAVE", 4)) {
+		fprintf(stderr, "RIFF file is not a WAV\n");
+		return FALSE;
+	}
+
+	for (;;) {
+		uint32_t size;
+
+		if (!get(af, buf, 8)) {
+			fprintf(stderr, "WAV file has no data\n");
+			return FALSE;
+		}
+		size = le(&buf[4], 4);
+
+		if (!memcmp(buf, "fmt ", 4)) {
+			int n = (size < sizeof(buf)) ? (int)size : (int)sizeof(buf);
+			if ((size < 16) || !get(af, buf, n))
+				return FALSE;
+			size -= n;
+			af->encoding = le(&buf[0], 2);
+			af->channels = le(&buf[2], 2);
+			af->rate = le(&buf[4], 4);
+			af->align = le(&buf[12], 2);
+			if ((af->encoding == WAVE_FORMAT_EXTENSIBLE) && (n >= 26))
+				af->encoding = le(&buf[24], 2);
+			fmt = TRUE;
+		} else if (!memcmp(buf, "data", 4)) {
+			if (!fmt) {
+				fprintf(stderr, "WAV data comes before its format\n");
+				return FALSE;
+			}
+			af->end = ((size == 0) || (size == WAVE_UNKNOWN_SIZE)) ? INT64_MAX : af->pos + size;
+			break;
+		}
+
+		// the rest of this chunk, padded to an even length
+		for (size += size & 1; size > 0; ) {
+			int n = (size > sizeof(buf)) ? (int)sizeof(buf) : (int)size;
+			if (!get(af, buf, n))
+				return FALSE;
+			size -= n;
+		}
+	}
+
+	af->width = (af->channels != 0) ? af->align / af->channels : 0;
+	if (!((af->encoding == WAVE_FORMAT_PCM) && (af->width >= 1) && (af->width <= 4))
+		&& !((af->encoding == WAVE_FORMAT_FLOAT) && ((af->width == 4) || (af->width == 8)))
+		&& !(((af->encoding == WAVE_FORMAT_ALAW) || (af->encoding == WAVE_FORMAT_MULAW)) && (af->width == 1))) {
+		fprintf(stderr, "WAV format %04x with %d byte samples is not supported\n", af->encoding, af->width);
+		return FALSE;
+	}
+
+	// a file on disk is mapped rather than read
+	if ((af->fp != stdin) && !fstat(fileno(af->fp), &st) && S_ISREG(st.st_mode)) {
+		if (af->end > st.st_size)
+			af->end = st.st_size;
+		af->mapoff = af->pos;
+		if (!map_window(af))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+// header bytes, counting the file offset
+static BOOL get(AUDIO_FILE *af, void *buf, int n)
+{
+	if ((int)fread(buf, 1, n, af->fp) != n)
+		return FALSE;
+	af->pos += n;
+	return TRUE;
+}
+
+static uint32_t le(unsigned char *p, int n)
+{
+	uint32_t v = 0;
+
+	while (n-- > 0)
+		v = (v << 8) | p[n];
+	return v;
+}
+
+// the next AF_MAP_WINDOW of the file from the current frame
+static BOOL map_window(AUDIO_FILE *af)
+{
+	int64_t off = af->pos & ~(int64_t)(sysconf(_SC_PAGESIZE) - 1);
+	size_t len = (af->end - off > AF_MAP_WINDOW) ? AF_MAP_WINDOW : (size_t)(af->end - off);
+
+	if (af->map != NULL)
+		munmap(af->map, af->maplen);
+	af->map = NULL;
+	if (len == 0)
+		return TRUE;
+	if ((af->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(af->fp), off)) == MAP_FAILED) {
+		af->map = NULL;
+		fprintf(stderr, "Cannot map the WAV file\n");
+		return FALSE;
+	}
+	madvise(af->map, len, MADV_SEQUENTIAL);
+	af->mapoff = off;
+	af->maplen = len;
+	return TRUE;
+}
+
+// the first channel of each frame to 16 bits in host order
+static int convert(AUDIO_FILE *af, unsigned char *in, int nframes)
+{
+	for (int i = 0; i < nframes; i++, in += af->align) {
+		switch (af->encoding) {
+
+		case WAVE_FORMAT_PCM:
+			// the top 16 bits, 8 bit is unsigned
+			af->out[i] = (af->width == 1) ? (RTL_SAMPLE)((in[0] - 128) << 8)
+				: (RTL_SAMPLE)le(&in[af->width - 2], 2);
+			break;
+
+		case WAVE_FORMAT_FLOAT: {
+			double v;
+			if (af->width == 4) {
+				uint32_t u = le(in, 4);
+				float f;
+				memcpy(&f, &u, sizeof(f));
+				v = f;
+			} else {
+				uint64_t u = ((uint64_t)le(&in[4], 4) << 32) | le(in, 4);
+				memcpy(&v, &u, sizeof(v));
+			}
+			v = lrint(v * 32768.0);
+			af->out[i] = (RTL_SAMPLE)((v > 32767) ? 32767 : (v < -32768) ? -32768 : v);
+			break;
+		}
+
+		case WAVE_FORMAT_ALAW:
+			af->out[i] = (RTL_SAMPLE)alaw2linear(in[0]);
+			break;
+
+		case WAVE_FORMAT_MULAW:
+			af->out[i] = (RTL_SAMPLE)ulaw2linear(in[0]);
+			break;
+		}
+	}
+	return nframes;
+}
+
+// samples from as many frames as it takes, scaled to 16 bits
+static int read_flac(AUDIO_FILE *af, int nsamples)
+{
+	FLAC_DECODER *fl = af->flac;
+	int n = 0;
+
+	while (n < nsamples) {
+		if (af->flacpos == fl->blocksize) {
+			if (FlacDecode(fl) == 0)
+				break;
+			af->flacpos = 0;
+		}
+		int32_t *in = &fl->chan[0][af->flacpos];
+		int count = fl->blocksize - af->flacpos;
+		if (count > nsamples - n)
+			count = nsamples - n;
+		if (fl->framebits >= 16) {
+			for (int i = 0; i < count; i++)
+				af->out[n + i] = (RTL_SAMPLE)(in[i] >> (fl->framebits - 16));
+		} else {
+			for (int i = 0; i < count; i++)
+				af->out[n + i] = (RTL_SAMPLE)(in[i] << (16 - fl->framebits));
+		}
+		n += count;
+		af->flacpos += count;
+	}
+	return n;
+}
@@ -0,0 +1,298 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Black box audio recorder
+
+	File Name:		  blackbox.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Keeps the last few minutes of 24 KHz audio read from the
+					  pipe in a ring from the buffer arena, as 16 bit samples or
+					  u-law bytes. When a burst loses sync, a header is
+					  malformed or voted, Java asks for it or SIGUSR1 arrives,
+					  a background thread waits a few seconds for the rest of
+					  the transmission and writes the ring to a WAV file, so
+					  a bad decode can be looked at afterwards without
+					  recording everything all the time.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "rtl.h"
+
+#define	BB_POST_SECS		5					// audio kept after a trigger
+#define	BB_HOLDOFF_SECS		60					// between automatic dumps
+#define	BB_MARGIN_SECS		2					// oldest audio left alone, it is about to go
+#define	BB_CHUNK			4096				// samples converted at a time
+#define	BB_PATH_LEN			256					// dump file name
+
+static char *trigger_names[BB_TRIG_COUNT] = { "sync", "partial", "voted", "request", "signal" };
+
+struct blackbox_t {
+	unsigned char	*ring;						// the audio
+	uint64_t		capacity;					// samples it holds
+	BOOL			ulaw;						// one byte per sample
+	uint64_t		written;					// samples written since the start
+	BOOL			running;					// recording
+	BOOL			exit;						// stop the dump thread
+	int				pending;					// BB_TRIG_ bits waiting
+	time_t			lastdump;					// time of the last automatic dump
+	char			directory[BB_PATH_LEN];		// where the dumps go
+	sem_t			trigger_sem;				// wakes the dump thread
+	pthread_t		dump_thread;
+} blackbox;
+
+// internals
+static void *dump_thread_fn(void *arg);
+static void dump(int reasons);
+static void wav_header(FILE *fp, uint32_t nsamples);
+#ifndef _WIN32
+static void blackbox_signal(int sig);
+#endif
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	BlackboxStart
+
+	INPUTS:		minutes to keep, u-law or 16 bit, dump directory
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	take the ring from the arena and start the dump thread
+
+---------------------------------------------------------------------------*/
+BOOL BlackboxStart(int minutes, BOOL ulaw, char *directory)
+{
+	size_t bytes;
+
+	if (blackbox.running)
+		BlackboxStop();
+	if (minutes <= 0)
+		return FALSE;
+
+	blackbox.capacity = (uint64_t)minutes * 60 * SAMPLE_RATE;
+	blackbox.ulaw = ulaw;
+	bytes = BB_BYTES(minutes, ulaw);
+	if ((blackbox.ring = ArenaAlloc("blackbox", bytes)) == NULL)
+		return FALSE;
+	snprintf(blackbox.directory, BB_PATH_LEN, "%s", ((directory != NULL) && (directory[0] != '\0')) ? directory : ".");
+
+	blackbox.written = 0;
+	blackbox.pending = 0;
+	blackbox.lastdump = 0;
+	blackbox.exit = FALSE;
+	sem_init(&blackbox.trigger_sem, 0, 0);
+	pthread_create(&blackbox.dump_thread, NULL, dump_thread_fn, NULL);
+#ifndef _WIN32
+	signal(SIGUSR1, blackbox_signal);
+#endif
+	__atomic_store_n(&blackbox.running, TRUE, __ATOMIC_RELEASE);
+
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "Black box keeping %d minutes of %s audio, %zu KB, dumps to %s\n",
+			minutes, ulaw ? "u-law" : "16 bit", bytes / 1024, blackbox.directory);
+	return TRUE;
+}
+
+void BlackboxStop(void)
+{
+	if (!blackbox.running)
+		return;
+
+#ifndef _WIN32
+	signal(SIGUSR1, SIG_DFL);
+#endif
+	__atomic_store_n(&blackbox.running, FALSE, __ATOMIC_RELEASE);
+	blackbox.exit = TRUE;
+	sem_post(&blackbox.trigger_sem);
+	pthread_join(blackbox.dump_thread, NULL);
+	sem_destroy(&blackbox.trigger_sem);
+	blackbox.ring = NULL;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	BlackboxWrite
+
+	INPUTS:		samples at 24 KHz, number of them
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	add a frame to the ring; called by the timer thread only
+
+---------------------------------------------------------------------------*/
+void BlackboxWrite(RTL_SAMPLE *samples, int nsamples)
+{
+	uint64_t pos;
+
+	if (!__atomic_load_n(&blackbox.running, __ATOMIC_ACQUIRE))
+		return;
+
+	pos = blackbox.written;
+	for (int i = 0; i < nsamples; i++, pos++) {
+		uint64_t index = pos % blackbox.capacity;
+		if (blackbox.ulaw)
+			blackbox.ring[index] = linear2ulaw(samples[i]);
+		else
+			((RTL_SAMPLE *)blackbox.ring)[index] = samples[i];
+	}
+	__atomic_store_n(&blackbox.written, pos, __ATOMIC_RELEASE);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	BlackboxTrigger
+
+	INPUTS:		BB_TRIG_ reason
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	ask for a dump. Safe from a signal handler; triggers
+					that arrive while a dump is pending go into the same one.
+
+---------------------------------------------------------------------------*/
+void BlackboxTrigger(int reason)
+{
+	if (!__atomic_load_n(&blackbox.running, __ATOMIC_ACQUIRE) || (reason < 0) || (reason >= BB_TRIG_COUNT))
+		return;
+	if (__atomic_fetch_or(&blackbox.pending, 1 << reason, __ATOMIC_RELEASE) == 0)
+		sem_post(&blackbox.trigger_sem);
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+#ifndef _WIN32
+static void blackbox_signal(int sig)
+{
+	BlackboxTrigger(BB_TRIG_SIGNAL);
+}
+#endif
+
+static void *dump_thread_fn(void *arg)
+{
+	struct timespec ts = { 0, 100000000L };
+
+	for (;;) {
+		sem_wait(&blackbox.trigger_sem);
+		if (blackbox.exit)
+			break;
+
+		// let the rest of the transmission arrive
+		for (int i = 0; (i < BB_POST_SECS * 10) && !blackbox.exit; i++)
+			nanosleep(&ts, NULL);
+		if (blackbox.exit)
+			break;
+
+		int reasons = __atomic_exchange_n(&blackbox.pending, 0, __ATOMIC_ACQUIRE);
+		time_t now = time(NULL);
+
+		// a noisy channel must not fill the disk; asking for one always works
+		if (!(reasons & ((1 << BB_TRIG_REQUEST) | (1 << BB_TRIG_SIGNAL)))
+			&& ((now - blackbox.lastdump) < BB_HOLDOFF_SECS)) {
+			STATS_INC(STAT_BLACKBOX_SUPPRESSED);
+			continue;
+		}
+		blackbox.lastdump = now;
+		dump(reasons);
+	}
+	return NULL;
+}
+
+// write what the ring holds to a WAV file named for the time and reason
+static void dump(int reasons)
+{
+	char filename[BB_PATH_LEN + 64], stamp[32];
+	RTL_SAMPLE pcm[BB_CHUNK];
+	uint64_t end, pos, margin = (uint64_t)BB_MARGIN_SECS * SAMPLE_RATE;
+	uint32_t nsamples = 0;
+	time_t now = time(NULL);
+	struct tm tm;
+	int reason = 0;
+	FILE *fp;
+
+	while ((reason < BB_TRIG_COUNT - 1) && !(reasons & (1 << reason)))
+		reason++;
+	localtime_r(&now, &tm);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+	snprintf(filename, sizeof(filename), "%s/blackbox-%s-%s.wav", blackbox.directory, stamp, trigger_names[reason]);
+	if ((fp = fopen(filename, "wb")) == NULL) {
+		DEBUGLEVEL(DEBUG_MSGS)
+			fprintf(stderr, "Cannot open black box file %s\n", filename);
+		return;
+	}
+	wav_header(fp, 0);
+
+	// from the oldest audio that will not be overwritten while this runs
+	end = __atomic_load_n(&blackbox.written, __ATOMIC_ACQUIRE);
+	pos = (end > blackbox.capacity - margin) ? end - (blackbox.capacity - margin) : 0;
+	while (pos < end) {
+		int n = (end - pos > BB_CHUNK) ? BB_CHUNK : (int)(end - pos);
+
+		for (int i = 0; i < n; i++) {
+			uint64_t index = (pos + i) % blackbox.capacity;
+			pcm[i] = blackbox.ulaw ? (RTL_SAMPLE)ulaw2linear(blackbox.ring[index]) : ((RTL_SAMPLE *)blackbox.ring)[index];
+		}
+
+		// a slow disk can let the writer lap us, skip past what it took
+		uint64_t written = __atomic_load_n(&blackbox.written, __ATOMIC_ACQUIRE);
+		if (written > pos + blackbox.capacity) {
+			pos = written - (blackbox.capacity - margin);
+			continue;
+		}
+		fwrite(pcm, sizeof(RTL_SAMPLE), n, fp);
+		nsamples += n;
+		pos += n;
+	}
+
+	fseek(fp, 0, SEEK_SET);
+	wav_header(fp, nsamples);
+	fclose(fp);
+	STATS_INC(STAT_BLACKBOX_DUMPS);
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "Black box: %u samples written to %s\n", nsamples, filename);
+}
+
+// 16 bit mono PCM at SAMPLE_RATE, little endian as the samples are
+static void wav_header(FILE *fp, uint32_t nsamples)
+{
+	uint32_t datalen = nsamples * sizeof(RTL_SAMPLE);
+	unsigned char hdr[44];
+
+	memcpy(&hdr[0], "RIFF", 4);
+	hdr[4] = (36 + datalen) & 0xff; hdr[5] = ((36 + datalen) >> 8) & 0xff;
+	hdr[6] = ((36 + datalen) >> 16) & 0xff; hdr[7] = ((36 + datalen) >> 24) & 0xff;
+	memcpy(&hdr[8], "WAVEfmt ", 8);
+	hdr[16] = 16; hdr[17] = 0; hdr[18] = 0; hdr[19] = 0;			// fmt length
+	hdr[20] = 1; hdr[21] = 0;										// PCM
+	hdr[22] = 1; hdr[23] = 0;										// mono
+	hdr[24] = SAMPLE_RATE & 0xff; hdr[25] = (SAMPLE_RATE >> 8) & 0xff;
+	hdr[26] = (SAMPLE_RATE >> 16) & 0xff; hdr[27] = 0;
+	hdr[28] = (2 * SAMPLE_RATE) & 0xff; hdr[29] = ((2 * SAMPLE_RATE) >> 8) & 0xff;
+	hdr[30] = ((2 * SAMPLE_RATE) >> 16) & 0xff; hdr[31] = 0;		// bytes per second
+	hdr[32] = 2; hdr[33] = 0;										// block align
+	hdr[34] = 16; hdr[35] = 0;										// bits
+	memcpy(&hdr[36], "data", 4);
+	hdr[40] = datalen & 0xff; hdr[41] = (datalen >> 8) & 0xff;
+	hdr[42] = (datalen >> 16) & 0xff; hdr[43] = (datalen >> 24) & 0xff;
+	fwrite(hdr, sizeof(hdr), 1, fp);
+}
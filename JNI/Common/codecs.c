@@ -96,19 +96,21 @@ void stdioOutEncode(RTL_SAMPLE *buffer, int len, int gain)
 #if RAW_MODE
 	fwrite(buffer, len, sizeof(RTL_SAMPLE), stdout);
 #else
-	RTL_SAMPLE *outbuf = (RTL_SAMPLE *)malloc(len);
-	RTL_SAMPLE *encoded_buf = outbuf;
-	int encoded_len = 0;
-	for (int i = 0; i < len/3; i++) {
-		int decim_sample;
-		decim_sample = (int)*buffer++;
-		decim_sample += (int)*buffer++;
-		decim_sample += (int)*buffer++;
-		*encoded_buf++ = (RTL_SAMPLE)((decim_sample/3) & 0xffff);
-		encoded_len++;
+	// a frame at a time on the stack, this runs every 30 ms
+	RTL_SAMPLE outbuf[PIPE_READ_LEN/3];
+	int remaining = len/3;
+	while (remaining > 0) {
+		int encoded_len = (remaining > PIPE_READ_LEN/3) ? PIPE_READ_LEN/3 : remaining;
+		for (int i = 0; i < encoded_len; i++) {
+			int decim_sample;
+			decim_sample = (int)*buffer++;
+			decim_sample += (int)*buffer++;
+			decim_sample += (int)*buffer++;
+			outbuf[i] = (RTL_SAMPLE)((decim_sample/3) & 0xffff);
+		}
+		fwrite(outbuf, encoded_len, sizeof(RTL_SAMPLE), stdout);
+		remaining -= encoded_len;
 	}
-	fwrite(outbuf, encoded_len, sizeof(RTL_SAMPLE), stdout);
-	free(outbuf);
 #endif
 }
 
@@ -35,6 +35,9 @@ struct data_buffer_t {
 	int				wrptr;						// buffer write pointer
 	int				rdptr;						// read pointer
 	DEMOD_BYTE		buffer[bufferSIZE];		// data buffer
+	int64_t			capture[bufferSIZE];		// capture time of each byte
+	int64_t			put_time[bufferSIZE];		// when it was put in
+	int64_t			last_capture;				// of the byte last taken out
 	pthread_mutex_t	data_mutex;					// data mutex
 	pthread_cond_t	data_wait_cond;				// data wait condition
 } data_buffer;
@@ -43,6 +46,7 @@ void databuffer_init(void) {
 
 	// initialize the buffer to NO_DATA_RX in case of a pointer runaway
 	data_buffer.wrptr = data_buffer.rdptr = 0;
+	data_buffer.last_capture = 0;
 	for (int i = 0; i < bufferSIZE; i++)
 		data_buffer.buffer[i] = NO_BYTE;;
 
@@ -60,8 +64,20 @@ void databuffer_put(DEMOD_BYTE byterx)
 {
 	pthread_mutex_lock(&data_buffer.data_mutex);
 
+	// full: writing would make it look empty and lose the lot
+	int wrptr = (data_buffer.wrptr + 1) & (bufferSIZE - 1);
+	if (wrptr == data_buffer.rdptr) {
+		pthread_mutex_unlock(&data_buffer.data_mutex);
+		STATS_INC(STAT_BYTES_DROPPED);
+		return;
+	}
+	int64_t capture = DSPCaptureTime();
 	data_buffer.buffer[data_buffer.wrptr] = byterx;
-	data_buffer.wrptr = (data_buffer.wrptr + 1) & (bufferSIZE - 1);
+	data_buffer.capture[data_buffer.wrptr] = capture;
+	data_buffer.put_time[data_buffer.wrptr] = LatencyNow();
+	data_buffer.wrptr = wrptr;
+	STATS_INC(STAT_BYTES_EMITTED);
+	LatencyRecord(LAT_BYTE, capture);
 
 	pthread_cond_signal(&data_buffer.data_wait_cond);
 	pthread_mutex_unlock(&data_buffer.data_mutex);
@@ -83,8 +99,16 @@ DEMOD_BYTE databuffer_get(void)
 	pthread_mutex_unlock(&data_buffer.data_mutex);
 
 	char retval = data_buffer.buffer[data_buffer.rdptr];
+	data_buffer.last_capture = data_buffer.capture[data_buffer.rdptr];
+	LatencyRecord(LAT_READER, data_buffer.put_time[data_buffer.rdptr]);
 	data_buffer.rdptr = (data_buffer.rdptr + 1) & (bufferSIZE - 1);
 	DEBUGLEVEL(DEBUG_JNI)
 		fprintf(stderr, "read byte\n");
 	return retval;
 }
+
+// capture time of the byte last returned by databuffer_get
+int64_t databuffer_capture(void)
+{
+	return data_buffer.last_capture;
+}
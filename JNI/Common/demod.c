@@ -29,17 +29,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "rtl.h"
 
 // local defines
 
-#define		N_CORR_BITS		BITSPERBYTE*2
-#define		CORR_LENGTH		BIT_DIVISOR*N_CORR_BITS
 #define		DEMOD_DLY_LEN	64
 
 // correlator stuff
-DATA_BIT correlator[CORR_LENGTH];
 DATA_BIT sync_bits[N_CORR_BITS] = {
 	1, 0, 1, 0, 1, 0, 1, 1,					// Hex AB
 	1, 0, 1, 0, 1, 0, 1, 1					// Hex AB
@@ -52,16 +50,26 @@ int curr_index = 0;
 
 DATA_BIT last_demod_bit = 0;
 
-// look for the sync code in the correlator: AB (16)
-BOOL SyncCorrelator(DATA_BIT databit)
+// clear the delay lines
+void DemodInit(void)
 {
-	// bits are LSB first: so shift left to right
-	for (int i = CORR_LENGTH - 1; i > 0; i--)
-		correlator[i] = correlator[i - 1];
-	correlator[0] = databit;
+	memset(I_demod_dly, 0, sizeof(I_demod_dly));
+	memset(Q_demod_dly, 0, sizeof(Q_demod_dly));
+	curr_index = 0;
+}
+
+// look for the sync code in a channel's correlator: AB (16)
+BOOL SyncCorrelator(DEMOD_CHAN *ch, DATA_BIT databit)
+{
+	// bits are LSB first, so the newest goes in front; each is written
+	// twice, so the last CORR_LENGTH are in order without shifting them
+	if (--ch->corrptr < 0)
+		ch->corrptr = CORR_LENGTH - 1;
+	ch->correlator[ch->corrptr] = ch->correlator[ch->corrptr + CORR_LENGTH] = databit;
+	DATA_BIT *correlator = &ch->correlator[ch->corrptr];
 
 	for(int i=0;i < N_CORR_BITS; i++)
-		if (correlator[i*BIT_DIVISOR] != sync_bits[i]) {
+		if (correlator[BIT_OFFSET(i)] != sync_bits[i]) {
 			return FALSE;
 		}
 	return TRUE;
@@ -71,7 +79,7 @@ int PhaseDiscrim(int Iout, int Qout)
 {
 	int phase;
 	long lphase;
-	int previous_bit_index = (curr_index - 12) & (DEMOD_DLY_LEN - 1);
+	int previous_bit_index = (curr_index - DISCRIM_DELAY) & (DEMOD_DLY_LEN - 1);
 
 	I_demod_dly[curr_index] = Iout;
 	Q_demod_dly[curr_index] = Qout;
@@ -10,7 +10,12 @@
 	Revision:	      1.05
 
 	Description:	  This module implements an FIR filter to extract the modulated carrier
-                      post-mixing.
+                      post-mixing. The mixer is folded into the filter: the low pass
+                      taps times the oscillator make a complex band pass, which is
+                      only computed for the samples kept after decimating by
+                      DEMOD_DECIM, and its output is turned down to baseband by one
+                      rotation at the lower rate. The taps are symmetric, so each
+                      pair of samples costs one multiply for I and one for Q.
                   
                       This program is free software: you can redistribute it and/or modify
                       it under the terms of the GNU General Public License as published by
@@ -30,28 +35,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "rtl.h"
 
-// life changing parameters
-#define USE_HANN_LP		1					// use hann lp instead of kaiser
+// life changing parameters; the filter itself is chosen in rtl.h
 #define	FIR_DEBUG		0					// debug mode
 
-#if USE_HANN_LP
-#define N_FIR_TAPS      45					// number of taps
-#define MAC_SHIFT		16					// shift out of MAC
-#else
-#define N_FIR_TAPS      17					// number of taps
-#define MAC_SHIFT		15					// shift out of MAC
-#endif
-
-// FIR data struct
-typedef struct fir_data {
-	int chnum;
-	int wrptr;
-	int rdptr;
-	int firdata[N_FIR_TAPS];
-} FIR_DATA;
+// fused mixer and decimating filter
+typedef struct downconv_data {
+	unsigned	t;							// input sample number
+	int			wrptr;						// oldest sample in the window
+	RTL_SAMPLE	window[2*N_FIR_TAPS];		// each sample twice, so a window is contiguous
+} DOWNCONV_DATA;
 
 #if USE_HANN_LP
 // Hann Window low pass filter
@@ -127,84 +123,79 @@ FIR_COEFF Fir_Coeffs[N_FIR_TAPS] = {
 };
 #endif
 
-// FIR data for I and Q channels
-FIR_DATA I_Channel_FIR;
-FIR_DATA Q_Channel_FIR;
+// the low pass taps times the oscillator, about the centre tap; lanes.c
+// shares them
+FIR_COEFF Mix_Coeffs_I[FIR_CENTRE + 1];
+FIR_COEFF Mix_Coeffs_Q[FIR_CENTRE];
 
-// Internals
-int doFir(int sample, FIR_DATA *fir);
+DOWNCONV_DATA downconv;
 
-// initialize the FIR pointers
-void FIRInit(void)
-{
-	I_Channel_FIR.chnum = I_CHANNEL;
-	I_Channel_FIR.wrptr = 0;
-	I_Channel_FIR.rdptr = 0;
+/*---------------------------------------------------------------------------
 
-	Q_Channel_FIR.chnum = Q_CHANNEL;
-	Q_Channel_FIR.wrptr = 0;
-	Q_Channel_FIR.rdptr = 0;
-}
+	FUNCTION:	FIRInit
 
-int RunFIR(int input_sample, int channel)
-{
-	switch (channel) {
+	INPUTS:		none
 
-	case I_CHANNEL:
-		return(doFir(input_sample, &I_Channel_FIR));
+	OUTPUTS:	none
 
-	case Q_CHANNEL:
-		return(doFir(input_sample, &Q_Channel_FIR));
+	DESCRIPTION:	fold the oscillator into the filter and clear its history;
+					InitOsc must have been called first
 
-	default:
-		return 0;
+---------------------------------------------------------------------------*/
+void FIRInit(void)
+{
+	for (int k = 0; k < FIR_CENTRE; k++) {
+		Mix_Coeffs_I[k] = (FIR_COEFF)(((int)Fir_Coeffs[k] * OscAt(I_CHANNEL, k - FIR_CENTRE) + 0x4000) >> 15);
+		Mix_Coeffs_Q[k] = (FIR_COEFF)((-(int)Fir_Coeffs[k] * OscAt(Q_CHANNEL, k - FIR_CENTRE) + 0x4000) >> 15);
 	}
+	Mix_Coeffs_I[FIR_CENTRE] = Fir_Coeffs[FIR_CENTRE];
+
+	downconv.t = 0;
+	downconv.wrptr = 0;
+	memset(downconv.window, 0, sizeof(downconv.window));
 }
 
-// run the FIR filter
-int doFir(int sample, FIR_DATA *fir)
-{
-	fir->firdata[fir->wrptr] = sample;
-	fir->rdptr = fir->wrptr;
+/*---------------------------------------------------------------------------
 
-	if (fir->wrptr == N_FIR_TAPS - 1)
-		fir->wrptr = 0;
-	else
-		fir->wrptr = fir->wrptr + 1;
+	FUNCTION:	RunDownconvert
 
-	int term1, term2;
-	int macin, macout;
-	long mac = 0l;
+	INPUTS:		FSK sample, where to put I and Q
 
-#if FIR_DEBUG
-	int rd = fir->rdptr;
-	if (fir->chnum == 0) fprintf(stderr, "[%02d:%02d->%04x] ", fir->wrptr, rd, sample&0xffff);
-	for (int j = 0; j < N_FIR_TAPS; j++) {
-		if (fir->chnum == 0) fprintf(stderr, "%04x ", fir->firdata[rd]&0xffff);
-		if(rd == 0)
-			rd = N_FIR_TAPS - 1;
-		else
-			rd = rd - 1;
-	}
-#endif
+	OUTPUTS:	TRUE when I and Q are ready, every DEMOD_DECIM samples
 
-	for (int i = 0; i < N_FIR_TAPS; i++) {
-		term1 = (int)fir->firdata[fir->rdptr];
-		term2 = (int)Fir_Coeffs[i];
-		macin = term1 * term2;
-		mac += (long)macin;
-		if (fir->rdptr == 0)
-			fir->rdptr = N_FIR_TAPS - 1;
-		else
-			fir->rdptr = fir->rdptr - 1;
+	DESCRIPTION:	mix to baseband and low pass filter in one step. With
+					the oscillator at sample t e^(jwt), the mixed and filtered
+					sample is e^(jw(t-c)) times the sum over the taps of
+					h(k) e^(-jw(k-c)) x(t-k), c the centre tap
+
+---------------------------------------------------------------------------*/
+BOOL RunDownconvert(int sample, int *Iout, int *Qout)
+{
+	DOWNCONV_DATA *dc = &downconv;
+	unsigned t = dc->t++;
+
+	dc->window[dc->wrptr] = dc->window[dc->wrptr + N_FIR_TAPS] = (RTL_SAMPLE)sample;
+	if (++dc->wrptr == N_FIR_TAPS)
+		dc->wrptr = 0;
+	if ((t % DEMOD_DECIM) != DEMOD_DECIM - 1)
+		return FALSE;
+
+	// oldest to newest, so x[k] and x[N-1-k] share a tap
+	const RTL_SAMPLE *x = &dc->window[dc->wrptr];
+	int32_t macI = (int32_t)Mix_Coeffs_I[FIR_CENTRE] * x[FIR_CENTRE], macQ = 0;
+	for (int k = 0; k < FIR_CENTRE; k++) {
+		int newer = x[N_FIR_TAPS - 1 - k], older = x[k];
+		macI += (int32_t)Mix_Coeffs_I[k] * (newer + older);
+		macQ += (int32_t)Mix_Coeffs_Q[k] * (newer - older);
 	}
 
-	macout = (int)(mac >> MAC_SHIFT);
+	// down to baseband at the decimated rate
+	int64_t c = OscAt(I_CHANNEL, t - FIR_CENTRE), s = OscAt(Q_CHANNEL, t - FIR_CENTRE);
+	*Iout = (int)((c * macI - s * macQ) >> (15 + MAC_SHIFT));
+	*Qout = (int)((s * macI + c * macQ) >> (15 + MAC_SHIFT));
 
 #if FIR_DEBUG
-	if (fir->chnum == 0) fprintf(stderr, "= %08lx:%08x->%f\n", mac, macout, (double)macout/32767.0);
+	fprintf(stderr, "[%u] %08x:%08x->%d,%d\n", t, macI, macQ, *Iout, *Qout);
 #endif
-
-	return (macout);
-
+	return TRUE;
 }
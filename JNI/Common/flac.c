@@ -0,0 +1,381 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      FLAC decoder
+
+	File Name:		  flac.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Decodes a native FLAC stream a frame at a time, reading
+					  the file through a small buffer, so an archive of any
+					  length is replayed in a few hundred KB: the frame
+					  buffers are sized from STREAMINFO. All the subframe
+					  types and channel decorrelations are handled, for
+					  samples of up to FLAC_MAX_BITS; the CRCs are not
+					  checked, but a damaged frame is skipped by looking for
+					  the next frame sync. Only the first channel is kept.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtl.h"
+
+#define	FLAC_STREAMINFO		0				// metadata block type
+#define	FLAC_SYNC			0xFFF8			// 14 sync bits and a zero, fixed block size
+#define	FLAC_LEFT_SIDE		8				// channel assignments
+#define	FLAC_SIDE_RIGHT		9
+#define	FLAC_MID_SIDE		10
+#define	FLAC_MAX_ORDER		32				// LPC
+
+// internals
+static uint32_t nextbyte(FLAC_DECODER *fl);
+static uint32_t getbits(FLAC_DECODER *fl, int n);
+static int32_t getsbits(FLAC_DECODER *fl, int n);
+static uint32_t unary(FLAC_DECODER *fl);
+static BOOL frame(FLAC_DECODER *fl);
+static BOOL subframe(FLAC_DECODER *fl, int32_t *out, int n, int bps);
+static BOOL residual(FLAC_DECODER *fl, int32_t *out, int n, int order);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	FlacOpen
+
+	INPUTS:		decoder, file just after its "fLaC"
+
+	OUTPUTS:	TRUE, or FALSE if the stream cannot be decoded
+
+	DESCRIPTION:	read the metadata and size the frame buffers
+
+---------------------------------------------------------------------------*/
+BOOL FlacOpen(FLAC_DECODER *fl, FILE *fp)
+{
+	BOOL last = FALSE, info = FALSE;
+
+	memset(fl, 0, sizeof(FLAC_DECODER));
+	fl->fp = fp;
+
+	while (!last && !fl->eof) {
+		int type, len;
+		last = getbits(fl, 1);
+		type = getbits(fl, 7);
+		len = getbits(fl, 24);
+		if (type == FLAC_STREAMINFO) {
+			getbits(fl, 16);
+			fl->maxblock = getbits(fl, 16);
+			getbits(fl, 24);
+			getbits(fl, 24);
+			fl->rate = getbits(fl, 20);
+			fl->channels = getbits(fl, 3) + 1;
+			fl->bits = getbits(fl, 5) + 1;
+			fl->total = ((int64_t)getbits(fl, 4) << 32) | getbits(fl, 32);
+			len -= 18;
+			info = TRUE;
+		}
+		// the rest of it, and every other block
+		while ((len-- > 0) && !fl->eof)
+			getbits(fl, 8);
+	}
+
+	if (!info || fl->eof || (fl->bits > FLAC_MAX_BITS)) {
+		fprintf(stderr, "FLAC stream %s\n", !info ? "has no STREAMINFO" : fl->eof ? "has no audio"
+			: "samples are too wide");
+		return FALSE;
+	}
+	if (fl->maxblock < 16)
+		fl->maxblock = 65535;
+	for (int i = 0; i < 3; i++)
+		if ((fl->chan[i] = malloc(fl->maxblock * sizeof(int32_t))) == NULL) {
+			FlacFree(fl);
+			return FALSE;
+		}
+
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "FLAC %d Hz, %d channels, %d bits, %lld samples\n", fl->rate, fl->channels,
+			fl->bits, (long long)fl->total);
+	return TRUE;
+}
+
+void FlacFree(FLAC_DECODER *fl)
+{
+	for (int i = 0; i < 3; i++) {
+		free(fl->chan[i]);
+		fl->chan[i] = NULL;
+	}
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	FlacDecode
+
+	INPUTS:		decoder
+
+	OUTPUTS:	samples in chan[0], 0 at the end of the stream
+
+	DESCRIPTION:	decode the next frame; one that cannot be decoded is
+					passed over
+
+---------------------------------------------------------------------------*/
+int FlacDecode(FLAC_DECODER *fl)
+{
+	while (!fl->eof) {
+		if (frame(fl))
+			return fl->blocksize;
+		if (fl->eof)
+			break;
+		DEBUGLEVEL(DEBUG_MSGS)
+			fprintf(stderr, "FLAC frame cannot be decoded, skipping to the next\n");
+	}
+	return 0;
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// the next byte of the file, zero past its end
+static uint32_t nextbyte(FLAC_DECODER *fl)
+{
+	if (fl->inpos == fl->inlen) {
+		fl->inlen = (int)fread(fl->in, 1, FLAC_INBUF, fl->fp);
+		fl->inpos = 0;
+		if (fl->inlen == 0) {
+			fl->eof = TRUE;
+			return 0;
+		}
+	}
+	return fl->in[fl->inpos++];
+}
+
+// up to 32 bits, MSB first
+static uint32_t getbits(FLAC_DECODER *fl, int n)
+{
+	while (fl->nbits < n) {
+		fl->cache = (fl->cache << 8) | nextbyte(fl);
+		fl->nbits += 8;
+	}
+	fl->nbits -= n;
+	return (uint32_t)((fl->cache >> fl->nbits) & ((1ULL << n) - 1));
+}
+
+static int32_t getsbits(FLAC_DECODER *fl, int n)
+{
+	if (n == 0)
+		return 0;
+	return (int32_t)(getbits(fl, n) << (32 - n)) >> (32 - n);
+}
+
+// zeros before the next one
+static uint32_t unary(FLAC_DECODER *fl)
+{
+	uint32_t q = 0;
+
+	for (;;) {
+		if (fl->nbits == 0) {
+			if (fl->eof)
+				return q;
+			fl->cache = (fl->cache << 8) | nextbyte(fl);
+			fl->nbits = 8;
+		}
+		uint64_t bits = fl->cache & ((1ULL << fl->nbits) - 1);
+		if (bits == 0) {
+			q += fl->nbits;
+			fl->nbits = 0;
+			continue;
+		}
+		int top = 63 - __builtin_clzll(bits);
+		q += fl->nbits - 1 - top;
+		fl->nbits = top;
+		return q;
+	}
+}
+
+/*
+ * One frame: find its sync, read the header, the subframes for every
+ * channel, then undo the stereo decorrelation into the first channel.
+ */
+static BOOL frame(FLAC_DECODER *fl)
+{
+	static const int sizes[8] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+	uint32_t sync = 0;
+	int code, rate, assign, nchan, bps, ones;
+
+	// frames start on a byte
+	fl->nbits -= fl->nbits % 8;
+	while (((sync & 0xFFFE) != FLAC_SYNC) && !fl->eof)
+		sync = ((sync << 8) | getbits(fl, 8)) & 0xFFFF;
+	if (fl->eof)
+		return FALSE;
+
+	code = getbits(fl, 4);
+	rate = getbits(fl, 4);
+	assign = getbits(fl, 4);
+	bps = getbits(fl, 3);
+	getbits(fl, 1);
+
+	// frame or sample number, UTF-8 coded
+	uint32_t x = getbits(fl, 8);
+	for (ones = 0; x & 0x80; x = (x << 1) & 0xFF)
+		ones++;
+	if (ones == 1)
+		return FALSE;
+	for (int i = 1; i < ones; i++)
+		getbits(fl, 8);
+
+	if (code == 0)
+		return FALSE;
+	else if (code == 1)
+		fl->blocksize = 192;
+	else if (code <= 5)
+		fl->blocksize = 576 << (code - 2);
+	else if (code == 6)
+		fl->blocksize = getbits(fl, 8) + 1;
+	else if (code == 7)
+		fl->blocksize = getbits(fl, 16) + 1;
+	else
+		fl->blocksize = 256 << (code - 8);
+
+	if (rate == 12)
+		getbits(fl, 8);
+	else if ((rate == 13) || (rate == 14))
+		getbits(fl, 16);
+	else if (rate == 15)
+		return FALSE;
+	getbits(fl, 8);						// CRC-8
+
+	fl->framebits = (bps == 0) ? fl->bits : sizes[bps];
+	nchan = (assign < FLAC_LEFT_SIDE) ? assign + 1 : 2;
+	if ((fl->framebits == 0) || (fl->framebits > FLAC_MAX_BITS) || (assign > FLAC_MID_SIDE)
+		|| (fl->blocksize > fl->maxblock))
+		return FALSE;
+
+	for (int ch = 0; ch < nchan; ch++) {
+		// the side channel has one more bit
+		BOOL side = ((assign == FLAC_LEFT_SIDE) && (ch == 1)) || ((assign == FLAC_SIDE_RIGHT) && (ch == 0))
+			|| ((assign == FLAC_MID_SIDE) && (ch == 1));
+		if (!subframe(fl, fl->chan[(ch < 2) ? ch : 2], fl->blocksize, fl->framebits + side))
+			return FALSE;
+	}
+	fl->nbits -= fl->nbits % 8;
+	getbits(fl, 16);					// CRC-16
+	if (fl->eof)
+		return FALSE;
+
+	int32_t *a = fl->chan[0], *b = fl->chan[1];
+	if (assign == FLAC_SIDE_RIGHT) {
+		for (int i = 0; i < fl->blocksize; i++)
+			a[i] += b[i];
+	} else if (assign == FLAC_MID_SIDE) {
+		for (int i = 0; i < fl->blocksize; i++)
+			a[i] = (((a[i] << 1) | (b[i] & 1)) + b[i]) >> 1;
+	}
+	return TRUE;
+}
+
+static BOOL subframe(FLAC_DECODER *fl, int32_t *out, int n, int bps)
+{
+	int type, wasted = 0, order;
+
+	getbits(fl, 1);
+	type = getbits(fl, 6);
+	if (getbits(fl, 1)) {
+		wasted = unary(fl) + 1;
+		if (wasted >= bps)
+			return FALSE;
+		bps -= wasted;
+	}
+
+	if (type == 0) {
+		int32_t v = getsbits(fl, bps);
+		for (int i = 0; i < n; i++)
+			out[i] = v;
+	} else if (type == 1) {
+		for (int i = 0; i < n; i++)
+			out[i] = getsbits(fl, bps);
+	} else if ((type & 0x38) == 0x08) {
+		// fixed polynomial predictors
+		if ((order = type & 0x07) > 4)
+			return FALSE;
+		for (int i = 0; i < order; i++)
+			out[i] = getsbits(fl, bps);
+		if (!residual(fl, out, n, order))
+			return FALSE;
+		for (int i = order; i < n; i++)
+			switch (order) {
+			case 1: out[i] += out[i-1]; break;
+			case 2: out[i] += 2*out[i-1] - out[i-2]; break;
+			case 3: out[i] += 3*out[i-1] - 3*out[i-2] + out[i-3]; break;
+			case 4: out[i] += 4*out[i-1] - 6*out[i-2] + 4*out[i-3] - out[i-4]; break;
+			}
+	} else if (type & 0x20) {
+		int32_t coeffs[FLAC_MAX_ORDER];
+		int precision, shift;
+
+		order = (type & 0x1F) + 1;
+		for (int i = 0; i < order; i++)
+			out[i] = getsbits(fl, bps);
+		precision = getbits(fl, 4) + 1;
+		shift = getsbits(fl, 5);
+		if ((precision == 16) || (shift < 0))
+			return FALSE;
+		for (int i = 0; i < order; i++)
+			coeffs[i] = getsbits(fl, precision);
+		if (!residual(fl, out, n, order))
+			return FALSE;
+		for (int i = order; i < n; i++) {
+			int64_t sum = 0;
+			for (int j = 0; j < order; j++)
+				sum += (int64_t)coeffs[j] * out[i - 1 - j];
+			out[i] += (int32_t)(sum >> shift);
+		}
+	} else
+		return FALSE;
+
+	for (int i = 0; (wasted != 0) && (i < n); i++)
+		out[i] <<= wasted;
+	return !fl->eof;
+}
+
+// Rice coded partitions of the prediction error, after the warmup samples
+static BOOL residual(FLAC_DECODER *fl, int32_t *out, int n, int order)
+{
+	int method = getbits(fl, 2), porder, psamples, i = order;
+	int pbits = method ? 5 : 4, escape = method ? 31 : 15;
+
+	if (method > 1)
+		return FALSE;
+	porder = getbits(fl, 4);
+	psamples = n >> porder;
+	if (((psamples << porder) != n) || (psamples < order))
+		return FALSE;
+
+	for (int p = 0; p < (1 << porder); p++) {
+		int k = getbits(fl, pbits), count = (p == 0) ? psamples - order : psamples;
+		if (k == escape) {
+			int width = getbits(fl, 5);
+			while (count-- > 0)
+				out[i++] = getsbits(fl, width);
+		} else {
+			while (count-- > 0) {
+				uint32_t u = (unary(fl) << k) | getbits(fl, k);
+				out[i++] = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+			}
+		}
+		if (fl->eof)
+			return FALSE;
+	}
+	return TRUE;
+}
@@ -0,0 +1,219 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Halfband decimator
+
+	File Name:		  halfband.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Turns raw 48 KHz bytes from a file or the USB device into
+					  24 KHz samples a block at a time: the bytes are put in
+					  host order and split into even and odd samples, then a
+					  31 tap halfband FIR, every other coefficient zero, is
+					  run on them with the gain and saturation folded into
+					  the final shift. Flat to 8 KHz, at least 72 dB down
+					  from 16 KHz where the two tap average was 6 dB. NEON
+					  and SSE2 do eight outputs at a time, and give the same
+					  samples as the plain C.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+
+#include "rtl.h"
+
+#if defined(__ARM_NEON) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#include <arm_neon.h>
+#define	HB_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define	HB_SSE2
+#endif
+
+#define	HB_CENTER_SHIFT		14					// centre tap is 0.5 in Q15
+
+// the non zero taps either side of the centre, Q15, Kaiser beta 8
+static const int16_t hb_coeffs[HB_PAIRS] = { 10258, -2989, 1361, -630, 263, -90, 21, -2 };
+
+// internals
+static void split(HALFBAND *hb, unsigned char *in, int npairs);
+static void filter(HALFBAND *hb, int npairs, RTL_SAMPLE *out);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	HalfbandInit
+
+	INPUTS:		decimator, byte order of the input, gain as a left shift
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	clear the filter history
+
+---------------------------------------------------------------------------*/
+void HalfbandInit(HALFBAND *hb, BOOL bigendian, int gain)
+{
+	memset(hb, 0, sizeof(HALFBAND));
+	hb->bigendian = bigendian;
+	if (gain < 0)
+		gain = 0;
+	if (gain > 15)
+		gain = 15;
+	hb->shift = 15 - gain;
+	hb->round = (hb->shift != 0) ? 1 << (hb->shift - 1) : 0;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	HalfbandDecimate
+
+	INPUTS:		decimator, raw bytes, how many, output buffer
+
+	OUTPUTS:	samples written, at most (nbytes + 3) / 4
+
+	DESCRIPTION:	decimate by two; a partial sample pair at the end is
+					kept for the next call
+
+---------------------------------------------------------------------------*/
+int HalfbandDecimate(HALFBAND *hb, unsigned char *in, int nbytes, RTL_SAMPLE *out)
+{
+	int nout = 0, npairs, done;
+
+	// finish the pair left from the last call
+	if (hb->ncarry != 0) {
+		while ((hb->ncarry < 4) && (nbytes > 0)) {
+			hb->carry[hb->ncarry++] = *in++;
+			nbytes--;
+		}
+		if (hb->ncarry < 4)
+			return 0;
+		split(hb, hb->carry, 1);
+		hb->ncarry = 0;
+		filter(hb, 1, out);
+		nout++;
+	}
+
+	npairs = nbytes / 4;
+	for (done = 0; done < npairs; ) {
+		int n = (npairs - done > HB_BLOCK) ? HB_BLOCK : npairs - done;
+		split(hb, &in[done * 4], n);
+		filter(hb, n, &out[nout]);
+		nout += n;
+		done += n;
+	}
+
+	for (int i = npairs * 4; i < nbytes; i++)
+		hb->carry[hb->ncarry++] = in[i];
+	return nout;
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// bytes to even and odd samples after the history
+static void split(HALFBAND *hb, unsigned char *in, int npairs)
+{
+	int16_t *even = &hb->even[HB_HIST], *odd = &hb->odd[HB_HIST];
+	int i = 0;
+
+#if defined(HB_NEON)
+	for (; i + 8 <= npairs; i += 8) {
+		int16x8x2_t v = vld2q_s16((const int16_t *)&in[i * 4]);
+		if (hb->bigendian) {
+			v.val[0] = vreinterpretq_s16_u8(vrev16q_u8(vreinterpretq_u8_s16(v.val[0])));
+			v.val[1] = vreinterpretq_s16_u8(vrev16q_u8(vreinterpretq_u8_s16(v.val[1])));
+		}
+		vst1q_s16(&even[i], v.val[0]);
+		vst1q_s16(&odd[i], v.val[1]);
+	}
+#elif defined(HB_SSE2)
+	for (; i + 8 <= npairs; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)&in[i * 4]);
+		__m128i b = _mm_loadu_si128((const __m128i *)&in[i * 4 + 16]);
+		if (hb->bigendian) {
+			a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+			b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+		}
+		// low halves of each 32 bits are the even samples
+		__m128i ea = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16), eb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+		_mm_storeu_si128((__m128i *)&even[i], _mm_packs_epi32(ea, eb));
+		_mm_storeu_si128((__m128i *)&odd[i], _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+	}
+#endif
+	int shift1 = hb->bigendian ? 8 : 0, shift2 = hb->bigendian ? 0 : 8;
+	for (; i < npairs; i++) {
+		unsigned char *p = &in[i * 4];
+		even[i] = (int16_t)((p[0] << shift1) | (p[1] << shift2));
+		odd[i] = (int16_t)((p[2] << shift1) | (p[3] << shift2));
+	}
+}
+
+/*
+ * Output m is centred on even sample m-K+1; the taps either side of it fall
+ * on odd samples m-K+i and m-K-i+1 for i = 1..K, so the history needs 2K-1
+ * odd samples.
+ */
+static void filter(HALFBAND *hb, int npairs, RTL_SAMPLE *out)
+{
+	const int16_t *even = &hb->even[HB_HIST - HB_PAIRS + 1], *odd = &hb->odd[HB_HIST - HB_PAIRS];
+	int m = 0;
+
+#if defined(HB_NEON)
+	int32x4_t shift = vdupq_n_s32(-hb->shift);
+	for (; m + 8 <= npairs; m += 8) {
+		int16x8_t e = vld1q_s16(&even[m]);
+		int32x4_t lo = vshll_n_s16(vget_low_s16(e), HB_CENTER_SHIFT);
+		int32x4_t hi = vshll_n_s16(vget_high_s16(e), HB_CENTER_SHIFT);
+		for (int i = 1; i <= HB_PAIRS; i++) {
+			int16x8_t a = vld1q_s16(&odd[m + i]), b = vld1q_s16(&odd[m - i + 1]);
+			lo = vmlal_n_s16(lo, vget_low_s16(a), hb_coeffs[i - 1]);
+			lo = vmlal_n_s16(lo, vget_low_s16(b), hb_coeffs[i - 1]);
+			hi = vmlal_n_s16(hi, vget_high_s16(a), hb_coeffs[i - 1]);
+			hi = vmlal_n_s16(hi, vget_high_s16(b), hb_coeffs[i - 1]);
+		}
+		// rounding shift, then saturate to 16 bits
+		vst1q_s16(&out[m], vcombine_s16(vqmovn_s32(vrshlq_s32(lo, shift)), vqmovn_s32(vrshlq_s32(hi, shift))));
+	}
+#elif defined(HB_SSE2)
+	__m128i center = _mm_set1_epi32(1 << HB_CENTER_SHIFT), zero = _mm_setzero_si128();
+	__m128i round = _mm_set1_epi32(hb->round), shift = _mm_cvtsi32_si128(hb->shift);
+	for (; m + 8 <= npairs; m += 8) {
+		__m128i e = _mm_loadu_si128((const __m128i *)&even[m]);
+		__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(e, zero), center);
+		__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(e, zero), center);
+		for (int i = 1; i <= HB_PAIRS; i++) {
+			__m128i a = _mm_loadu_si128((const __m128i *)&odd[m + i]);
+			__m128i b = _mm_loadu_si128((const __m128i *)&odd[m - i + 1]);
+			__m128i c = _mm_set1_epi16(hb_coeffs[i - 1]);
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c));
+		}
+		lo = _mm_sra_epi32(_mm_add_epi32(lo, round), shift);
+		hi = _mm_sra_epi32(_mm_add_epi32(hi, round), shift);
+		_mm_storeu_si128((__m128i *)&out[m], _mm_packs_epi32(lo, hi));
+	}
+#endif
+	for (; m < npairs; m++) {
+		int32_t acc = (int32_t)even[m] << HB_CENTER_SHIFT;
+		for (int i = 1; i <= HB_PAIRS; i++)
+			acc += hb_coeffs[i - 1] * ((int32_t)odd[m + i] + (int32_t)odd[m - i + 1]);
+		acc = (acc + hb->round) >> hb->shift;
+		out[m] = (RTL_SAMPLE)((acc > 32767) ? 32767 : (acc < -32768) ? -32768 : acc);
+	}
+
+	// the last samples are the history for the next block
+	memmove(hb->even, &hb->even[npairs], HB_HIST * sizeof(int16_t));
+	memmove(hb->odd, &hb->odd[npairs], HB_HIST * sizeof(int16_t));
+}
@@ -0,0 +1,201 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Alert latency histograms
+
+	File Name:		  latency.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Each frame read from the pipe is stamped with its capture
+					  time, and the stamp follows the samples through the DSP
+					  ring and the bytes through the data buffer to the framer
+					  and the forwarding. The time taken at each hop goes into
+					  a log-linear (HDR) histogram of 32 sub-buckets per octave,
+					  about 3% resolution from 1 us up to days, recorded with
+					  relaxed atomics so the realtime threads never block.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "rtl.h"
+
+#define	SUB_BITS			5					// 32 sub-buckets per octave
+#define	SUB_COUNT			(1 << SUB_BITS)
+#define	HIST_OCTAVES		34					// 1 us to about 6 days
+#define	HIST_BUCKETS		((HIST_OCTAVES + 2) * SUB_COUNT)
+
+// one hop
+typedef struct latency_hist_t {
+	uint64_t	counts[HIST_BUCKETS];			// values per bucket
+	uint64_t	sum_us;							// their sum
+	uint64_t	max_us;							// the largest
+} LATENCY_HIST;
+
+static LATENCY_HIST latency[LAT_COUNT];
+
+static char *hop_names[LAT_COUNT] = { "timer", "queue", "dsp", "byte", "reader", "framed", "delivered", "wakeup" };
+
+// internals
+static int bucket_index(uint64_t us);
+static uint64_t bucket_value(int index);
+static uint64_t percentile(uint64_t *counts, uint64_t total, double p);
+
+// clear the histograms
+void LatencyInit(void)
+{
+	memset(latency, 0, sizeof(latency));
+}
+
+// monotonic time in ns, the time base of every stamp
+int64_t LatencyNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	LatencyRecord
+
+	INPUTS:		hop, time at its start in LatencyNow ns
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	add the time since the start to the hop's histogram.
+					A stamp of 0 means the data was not stamped (offline
+					decodes) and is ignored.
+
+---------------------------------------------------------------------------*/
+void LatencyRecord(int hop, int64_t start)
+{
+	LATENCY_HIST *h = &latency[hop];
+	int64_t elapsed;
+	uint64_t us, max;
+
+	if ((start == 0) || (hop < 0) || (hop >= LAT_COUNT))
+		return;
+	elapsed = LatencyNow() - start;
+	us = (elapsed > 0) ? (uint64_t)elapsed / 1000 : 0;
+
+	__atomic_add_fetch(&h->counts[bucket_index(us)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->sum_us, us, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+	while ((us > max) && !__atomic_compare_exchange_n(&h->max_us, &max, us, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	LatencyGet
+
+	INPUTS:		hop, summary to fill in
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	count, sum, p50, p99 and max of a hop in us
+
+---------------------------------------------------------------------------*/
+void LatencyGet(int hop, LATENCY_SUMMARY *summary)
+{
+	uint64_t counts[HIST_BUCKETS];
+	LATENCY_HIST *h = &latency[hop];
+	uint64_t total = 0;
+
+	// a snapshot, so the percentiles agree with each other
+	for (int i = 0; i < HIST_BUCKETS; i++)
+		total += counts[i] = __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+
+	summary->count = total;
+	summary->sum_us = __atomic_load_n(&h->sum_us, __ATOMIC_RELAXED);
+	summary->p50_us = percentile(counts, total, 0.50);
+	summary->p99_us = percentile(counts, total, 0.99);
+	summary->max_us = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+
+	// a bucket's top can be above anything recorded in it
+	if (summary->p50_us > summary->max_us)
+		summary->p50_us = summary->max_us;
+	if (summary->p99_us > summary->max_us)
+		summary->p99_us = summary->max_us;
+}
+
+// latency summaries in Prometheus text format
+int LatencyFormat(char *buf, int size, char *receiver)
+{
+	int len = snprintf(buf, size, "# HELP piwxrx_latency_seconds Time taken by each hop from capture to forwarding\n"
+		"# TYPE piwxrx_latency_seconds summary\n");
+
+	for (int hop = 0; (hop < LAT_COUNT) && (len < size); hop++) {
+		LATENCY_SUMMARY s;
+		LatencyGet(hop, &s);
+		len += snprintf(&buf[len], size - len,
+			"piwxrx_latency_seconds{receiver=\"%s\",hop=\"%s\",quantile=\"0.5\"} %.6f\n"
+			"piwxrx_latency_seconds{receiver=\"%s\",hop=\"%s\",quantile=\"0.99\"} %.6f\n"
+			"piwxrx_latency_seconds{receiver=\"%s\",hop=\"%s\",quantile=\"1\"} %.6f\n"
+			"piwxrx_latency_seconds_sum{receiver=\"%s\",hop=\"%s\"} %.6f\n"
+			"piwxrx_latency_seconds_count{receiver=\"%s\",hop=\"%s\"} %llu\n",
+			receiver, hop_names[hop], s.p50_us * 1e-6, receiver, hop_names[hop], s.p99_us * 1e-6,
+			receiver, hop_names[hop], s.max_us * 1e-6, receiver, hop_names[hop], s.sum_us * 1e-6,
+			receiver, hop_names[hop], (unsigned long long)s.count);
+	}
+	return (len < size) ? len : size - 1;
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// values below 2 * SUB_COUNT have a bucket each, then SUB_COUNT per octave
+static int bucket_index(uint64_t us)
+{
+	int shift;
+
+	if (us < 2 * SUB_COUNT)
+		return (int)us;
+	shift = 63 - __builtin_clzll(us) - SUB_BITS;
+	if (shift > HIST_OCTAVES)
+		return HIST_BUCKETS - 1;
+	return shift * SUB_COUNT + (int)(us >> shift);
+}
+
+// the highest value a bucket holds
+static uint64_t bucket_value(int index)
+{
+	int shift;
+
+	if (index < 2 * SUB_COUNT)
+		return index;
+	shift = index / SUB_COUNT - 1;
+	return (((uint64_t)(index - shift * SUB_COUNT) + 1) << shift) - 1;
+}
+
+static uint64_t percentile(uint64_t *counts, uint64_t total, double p)
+{
+	uint64_t rank = (uint64_t)(p * total + 0.5), seen = 0;
+
+	if (total == 0)
+		return 0;
+	if (rank < 1)
+		rank = 1;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += counts[i];
+		if (seen >= rank)
+			return bucket_value(i);
+	}
+	return bucket_value(HIST_BUCKETS - 1);
+}
@@ -9,7 +9,10 @@
 
 	Revision:	      1.05
 
-	Description:	Linux code only for creating a child process
+	Description:	Linux code only for creating a child process, and a
+					supervisor that restarts it when it dies. There are two
+					slots, so a new source can be started while the old one
+					still feeds the receiver
 
 					This program is free software: you can redistribute it and/or modify
 					it under the terms of the GNU General Public License as published by
@@ -22,6 +25,9 @@
 	Revision History:
 
 ---------------------------------------------------------------------------*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                         // pipe2
+#endif
 #include <unistd.h>
 #include <sys/types.h>
 #include <string.h>
@@ -31,173 +37,744 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
 #include <errno.h>
 
 #include "rtl.h"
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open     434              // the same on every architecture
+#endif
+
 #define NUM_PIPES          2
- 
-#define PARENT_WRITE_PIPE  0
-#define PARENT_READ_PIPE   1
 
 #define READ_FD            0
 #define WRITE_FD           1
 
-#define CHILD_STDERR_WR    WRITE_FD
-#define PARENT_STDERR_RD   READ_FD
+#define SPAWN_SLOTS        2                // the source in use, and the one replacing it
+#define SPAWN_MAX_ARGS     24
+#define SPAWN_BACKOFF_MIN  10               // ms before the first restart
+#define SPAWN_BACKOFF_MAX  5000             // and the longest wait between them
+#define SPAWN_STABLE_MS    10000            // a child up this long resets the backoff
+#define SPAWN_TERM_MS      1000             // SIGTERM to SIGKILL
 
-#define PARENT_READ_FD  ( pipes[PARENT_READ_PIPE][READ_FD]   )
-#define PARENT_WRITE_FD ( pipes[PARENT_WRITE_PIPE][WRITE_FD] )
- 
-#define CHILD_READ_FD   ( pipes[PARENT_WRITE_PIPE][READ_FD]  )
-#define CHILD_WRITE_FD  ( pipes[PARENT_READ_PIPE][WRITE_FD]  )
+// what a slot is doing
+#define SLOT_IDLE          0                // no child, or one being stopped
+#define SLOT_ACTIVE        1                // read by the timer thread
+#define SLOT_PENDING       2                // started, waiting for its first samples
+#define SLOT_RETIRING      3                // replaced, to be stopped
 
-pid_t child_proc;
-int pipes[NUM_PIPES][NUM_PIPES];
+// what woke the supervisor: per slot in the low byte, the slot above it
+#define EV_STDERR          0
+#define EV_CHILD           1
+#define EV_RESTART         2
+#define EV_WAKE            3
+#define EV_SIGCHLD         4
+#define EV_MAX             8
+#define EV_SLOT(ev,slot)   ((ev) | ((slot) << 8))
 
-// background process and structs to capture stderr from child
-struct stderr_capture_t {
-    BOOL        exit;
-    int         stderr_pipe[NUM_PIPES];
-    pthread_t   capture_fn;
-} stderr_capture;
+// one child and the pipes it writes, which outlive it
+struct child_t {
+    int         role;
+    pid_t       pid;
+    int         pidfd;              // readable when it exits, -1 if none
+    int         timerfd;            // restart backoff
+    int         in[NUM_PIPES];      // its stdin, never written
+    int         out[NUM_PIPES];     // samples
+    int         err[NUM_PIPES];     // messages and markers
+    char        *cmd;
+    char        *argv[SPAWN_MAX_ARGS+1];
+    int         backoff;            // ms before the next restart
+    int64_t     started;            // when it was forked, ms
+    char        line[256];
+    int         nline;
+};
 
-static void *capture_fn(void *arg)
-{
-    char buffer[256];
-    ssize_t nRead;
-    struct stderr_capture_t *s = arg;
-    while(!s->exit) {
-        int num_to_read = 256;
-        if((nRead = read(s->stderr_pipe[PARENT_STDERR_RD], buffer, num_to_read)) > 0) {
-            buffer[nRead] = '\0';
-            fprintf(stderr,"%s",buffer);
-        }
-    }
-}
+// the supervisor: one thread asleep in epoll for stderr, exits and restarts
+struct supervisor_t {
+    BOOL            exit;
+    BOOL            ready;          // descriptors and thread set up
+    int             epfd;
+    int             sigfd;          // eventfd written on SIGCHLD, without pidfds
+    int             wakefd;         // requests from other threads
+    int             active;         // slot being read, -1 for none
+    char            *request;       // command line to switch to
+    int64_t         requested;      // when, ms
+    pthread_mutex_t lock;           // roles, active and request
+    pthread_mutex_t readlock;       // held by the timer thread while it reads a pipe
+    struct child_t  child[SPAWN_SLOTS];
+    pthread_t       supervisor_fn;
+} supervisor = { .active = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .readlock = PTHREAD_MUTEX_INITIALIZER };
+
+// internals
+static BOOL supervisor_init(struct supervisor_t *s);
+static void *supervisor_fn(void *arg);
+static void requests(struct supervisor_t *s);
+static BOOL slot_open(struct supervisor_t *s, int slot, char *cmdline);
+static BOOL spawn(struct supervisor_t *s, int slot);
+static void reap(struct supervisor_t *s, int slot, BOOL wait);
+static void schedule(struct supervisor_t *s, int slot);
+static void terminate(struct supervisor_t *s, int slot);
+static void drain_stderr(struct child_t *c);
+static void drain_stdout(struct child_t *c);
+static void capture_line(char *line);
+static BOOL watch(struct supervisor_t *s, int fd, int ev);
+static void wake(struct supervisor_t *s);
+static int64_t now_ms(void);
+static void closefd(int *fd);
 
-// child process signal handler
-void handle_sigchild(int sig)
+// without pidfds SIGCHLD only pokes the supervisor, which reaps its own children
+static void handle_sigchild(int sig)
 {
     int saved_errno = errno;
-    while (waitpid((pid_t)-1, 0, WNOHANG) > 0);
+    uint64_t one = 1;
 
-    fprintf(stderr, "Caught SIGCHILD: %s\n", geterrno(errno));
+    if(supervisor.sigfd >= 0)
+        (void)!write(supervisor.sigfd, &one, sizeof(one));
     errno = saved_errno;
 }
 
-// start the child process
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	initChildProcess
+
+	INPUTS:		command line of the source
+
+	OUTPUTS:	TRUE if it was started
+
+	DESCRIPTION:	create the pipes, fork the source and start the supervisor
+                    that restarts it if it dies. The pipes belong to the
+                    parent and outlive any one child, so the reader only sees
+                    a quiet pipe while a new one is started
+
+---------------------------------------------------------------------------*/
 BOOL initChildProcess(char *cmdline)
 {
-    // set up  a handler to catch a SIGCHILD
-    struct sigaction sa;
-    sa.sa_handler = &handle_sigchild;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
-    if(sigaction(SIGCHLD, &sa, 0) < 0) {
-        fprintf(stderr,"Sigaction for child failed\n");
+    struct supervisor_t *s = &supervisor;
+
+    if(!supervisor_init(s) || !slot_open(s, 0, cmdline))
+        return FALSE;
+    // active before the fork, so one that dies at once is restarted
+    pthread_mutex_lock(&s->lock);
+    s->child[0].role = SLOT_ACTIVE;
+    s->active = 0;
+    pthread_mutex_unlock(&s->lock);
+    if(!spawn(s, 0)) {
+        CloseChildProcess();
         return FALSE;
     }
-    
-    // parse the command line
-    int argc=0;
-    char *argv[24], *tok;
-    char *cmd = strdup(cmdline);
+    return TRUE;  
+}
 
-    while((tok=strsep(&cmd," ")) != NULL)	{
-	argv[argc++] = tok;
-    }
-    argv[argc++] = NULL;
+/*---------------------------------------------------------------------------
 
-    // pipes for parent to write and read
-    if(pipe(pipes[PARENT_READ_PIPE]) != -1) {
-        if(pipe(pipes[PARENT_WRITE_PIPE]) == -1)    {
-            fprintf(stderr,"Pipe Create failed\n");
-            return FALSE;
-        }
-    }
-    
-    // setup the stderr pipe
-    if(pipe(stderr_capture.stderr_pipe) == -1)  {
-        fprintf(stderr, "Stderr capture pipe create failed\n");
+	FUNCTION:	ReconfigureChild
+
+	INPUTS:		command line of the new source
+
+	OUTPUTS:	TRUE if the supervisor has it
+
+	DESCRIPTION:	start a new source in the spare slot. The old one carries
+                    on until SwitchChild finds the new one has samples; a
+                    second request before then replaces the first
+
+---------------------------------------------------------------------------*/
+BOOL ReconfigureChild(char *cmdline)
+{
+    struct supervisor_t *s = &supervisor;
+    char *cmd;
+
+    if(!supervisor_init(s) || ((cmd = strdup(cmdline)) == NULL))
+        return FALSE;
+    pthread_mutex_lock(&s->lock);
+    free(s->request);
+    s->request = cmd;
+    s->requested = now_ms();
+    pthread_mutex_unlock(&s->lock);
+    wake(s);
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SwitchChild
+
+	INPUTS:		none
+
+	OUTPUTS:	TRUE if the receiver now reads a new source
+
+	DESCRIPTION:	called by the timer thread each tick; when the pending
+                    child has written its first samples it becomes the one
+                    read, and the old one is handed back to be stopped
+
+---------------------------------------------------------------------------*/
+BOOL SwitchChild(void)
+{
+    struct supervisor_t *s = &supervisor;
+    int old, slot = -1;
+
+    // never wait behind the supervisor: try again next tick
+    if(!s->ready || (pthread_mutex_trylock(&s->lock) != 0))
         return FALSE;
+    for(int i=0;i<SPAWN_SLOTS;i++)
+        if(s->child[i].role == SLOT_PENDING)
+            slot = i;
+    if(slot >= 0) {
+        struct pollfd pfd = { .fd = s->child[slot].out[READ_FD], .events = POLLIN };
+        if(poll(&pfd, 1, 0) <= 0)
+            slot = -1;
     }
-    
-    // for..
-    child_proc=fork();
-    if(child_proc == -1)    {
-        fprintf(stderr,"Fork failed\n");
+    if(slot < 0) {
+        pthread_mutex_unlock(&s->lock);
         return FALSE;
     }
-    if(child_proc == 0) {
-        // redirect stderr before anything else
-        int dupestat = dup2(stderr_capture.stderr_pipe[CHILD_STDERR_WR], STDERR_FILENO);
-        if(dupestat < 0)    {
-            fprintf(stderr, "Stderr Pipe failure\n");
-            exit(0);
-        }        
-        // create a pipe to write
-        int dup1stat = dup2(CHILD_READ_FD, STDIN_FILENO);
-        int dup2stat = dup2(CHILD_WRITE_FD, STDOUT_FILENO);
-        if((dup1stat < 0) || (dup2stat == 0))	{
-            fprintf(stderr,"Pipe dup failure %d:%d\n", dup1stat, dup2stat);
-            exit(0);
-        } else {
-            if(dup1stat != STDIN_FILENO)
-                fprintf(stderr,"Pipe create (in) returned: %d\n", dup1stat);
-            if(dup2stat != STDOUT_FILENO)
-                fprintf(stderr,"Pipe create (out) returned: %d\n", dup1stat);
-        }
-    
-        close(PARENT_READ_FD);
-        close(PARENT_WRITE_FD);
+    old = s->active;
+    if(old >= 0)
+        s->child[old].role = SLOT_RETIRING;
+    s->child[slot].role = SLOT_ACTIVE;
+    s->active = slot;
+    DEBUGLEVEL(DEBUG_MSGS)
+        fprintf(stderr, "Source switched to %s after %lld ms\n", s->child[slot].argv[0],
+            (long long)(now_ms() - s->requested));
+    pthread_mutex_unlock(&s->lock);
+    wake(s);
+    return TRUE;
+}
 
-        // start the processs
-        int execstat = execv(argv[0], argv);
-        // only returns if an error occurred
-        if(execstat < 0)
-            fprintf(stderr, "execv returned: %s\n", geterrno(errno));
-        exit(0);
-        
-    } else {
-        // parent process: start the stderr capture
-        stderr_capture.exit = FALSE;
-        pthread_create(&stderr_capture.capture_fn, NULL, capture_fn, (void *)(&stderr_capture));
-        
-        close(CHILD_READ_FD);
-        close(CHILD_WRITE_FD);
-    }
-    return TRUE;  
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	RetireChildren
+
+	INPUTS:		none
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	another kind of source has taken over: stop every child,
+                    keeping the supervisor for a later switch back
+
+---------------------------------------------------------------------------*/
+void RetireChildren(void)
+{
+    struct supervisor_t *s = &supervisor;
+
+    if(!s->ready)
+        return;
+    pthread_mutex_lock(&s->lock);
+    for(int i=0;i<SPAWN_SLOTS;i++)
+        if(s->child[i].role != SLOT_IDLE)
+            s->child[i].role = SLOT_RETIRING;
+    s->active = -1;
+    free(s->request);
+    s->request = NULL;
+    pthread_mutex_unlock(&s->lock);
+    wake(s);
 }
 
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	CloseChildProcess
+
+	INPUTS:		none
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	stop the supervisor, which sends its children SIGTERM and
+                    waits at most SPAWN_TERM_MS for each before SIGKILL. The
+                    timer thread may still be running, so it is told there is
+                    no pipe and any read under way finishes before they close
+
+---------------------------------------------------------------------------*/
 void CloseChildProcess()
 {
+    struct supervisor_t *s = &supervisor;
+
     DEBUGPRINTF("Shutting Down..\n");
-    stderr_capture.exit = TRUE;
-    
-    close(CHILD_WRITE_FD);
-    close(PARENT_READ_FD);
-    
-    kill(child_proc, SIGTERM);
-    sleep(2);
-    kill(child_proc, SIGKILL);
+    if(!s->ready)
+        return;
+    pthread_mutex_lock(&s->lock);
+    s->active = -1;
+    pthread_mutex_unlock(&s->lock);
+    s->exit = TRUE;
+    wake(s);
+    pthread_join(s->supervisor_fn, NULL);
+
+    pthread_mutex_lock(&s->readlock);
+
+    if(s->sigfd >= 0)
+        signal(SIGCHLD, SIG_DFL);
+    closefd(&s->epfd);
+    closefd(&s->wakefd);
+    closefd(&s->sigfd);
+    for(int i=0;i<SPAWN_SLOTS;i++) {
+        struct child_t *c = &s->child[i];
+        closefd(&c->timerfd);
+        for(int p=0;p<NUM_PIPES;p++) {
+            closefd(&c->in[p]);
+            closefd(&c->out[p]);
+            closefd(&c->err[p]);
+        }
+        free(c->cmd);
+        c->cmd = NULL;
+    }
+    free(s->request);
+    s->request = NULL;
+    s->ready = FALSE;
+    pthread_mutex_unlock(&s->readlock);
 }
 
 // Read output from the child process's pipe for STDOUT
 // and write to the parent process's pipe for STDOUT. 
-// Stop when there is no more data.  
+// Wait no longer than a tick, so a source being restarted
+// does not stall the timer thread
 int ReadFromPipe(RTL_SAMPLE *buffer, int bfrsiz) 
 { 
 	ssize_t dwRead; 
 	size_t num_to_read = bfrsiz*sizeof(RTL_SAMPLE);
+	struct pollfd pfd = { .fd = -1, .events = POLLIN };
 
 	DEBUGLEVEL(DEBUG_MSGS)
 	 fprintf(stderr, "Reading %d samples from pipe\n", bfrsiz);
 
-	dwRead = read(PARENT_READ_FD, buffer, num_to_read);
+	// the pipe stays open until the read is done
+	pthread_mutex_lock(&supervisor.readlock);
+	pthread_mutex_lock(&supervisor.lock);
+	if(supervisor.active >= 0)
+		pfd.fd = supervisor.child[supervisor.active].out[READ_FD];
+	pthread_mutex_unlock(&supervisor.lock);
+	if((pfd.fd < 0) || (poll(&pfd, 1, TIMER_VALUE) <= 0)) {
+		pthread_mutex_unlock(&supervisor.readlock);
+		return 0;
+	}
+	dwRead = read(pfd.fd, buffer, num_to_read);
+	pthread_mutex_unlock(&supervisor.readlock);
+	STATS_INC(STAT_PIPE_READS);
+	if (dwRead < (ssize_t)num_to_read)
+		STATS_INC(STAT_SHORT_READS);
 
 	if(dwRead <= 0)
 		return dwRead;
-	else 
+	else {
+		STATS_ADD(STAT_SAMPLES_READ, dwRead/sizeof(RTL_SAMPLE));
 		return (dwRead/sizeof(RTL_SAMPLE));
+	}
+}
+
+/**** Local Methods ****/
+
+// descriptors and thread, the first time a child is wanted
+static BOOL supervisor_init(struct supervisor_t *s)
+{
+    int probe;
+
+    if(s->ready)
+        return TRUE;
+    s->exit = FALSE;
+    s->active = -1;
+    s->sigfd = -1;
+    for(int i=0;i<SPAWN_SLOTS;i++) {
+        struct child_t *c = &s->child[i];
+        memset(c, 0, sizeof(struct child_t));
+        c->pidfd = c->timerfd = -1;
+        for(int p=0;p<NUM_PIPES;p++)
+            c->in[p] = c->out[p] = c->err[p] = -1;
+    }
+
+    s->epfd = epoll_create1(EPOLL_CLOEXEC);
+    s->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if((s->epfd < 0) || (s->wakefd < 0) || !watch(s, s->wakefd, EV_WAKE)) {
+        fprintf(stderr, "Supervisor setup failed: %s\n", geterrno(errno));
+        closefd(&s->epfd);
+        closefd(&s->wakefd);
+        return FALSE;
+    }
+
+    // older kernels have no pidfds: fall back to SIGCHLD
+    if((probe = syscall(SYS_pidfd_open, getpid(), 0)) >= 0) {
+        close(probe);
+    } else {
+        struct sigaction sa;
+        s->sigfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        sa.sa_handler = &handle_sigchild;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+        if((s->sigfd < 0) || !watch(s, s->sigfd, EV_SIGCHLD) || (sigaction(SIGCHLD, &sa, 0) < 0)) {
+            fprintf(stderr,"Sigaction for child failed\n");
+            closefd(&s->sigfd);
+            closefd(&s->epfd);
+            closefd(&s->wakefd);
+            return FALSE;
+        }
+    }
+
+    if(pthread_create(&s->supervisor_fn, NULL, supervisor_fn, (void *)s) != 0) {
+        closefd(&s->sigfd);
+        closefd(&s->epfd);
+        closefd(&s->wakefd);
+        return FALSE;
+    }
+    s->ready = TRUE;
+    return TRUE;
+}
+
+// sleeps in epoll until a child writes stderr, exits or is to be restarted
+static void *supervisor_fn(void *arg)
+{
+    struct supervisor_t *s = arg;
+    struct epoll_event ev[EV_MAX];
+    uint64_t count;
+
+    RTApply(RT_CAPTURE);
+    while(!s->exit) {
+        int n = epoll_wait(s->epfd, ev, EV_MAX, -1);
+        if((n < 0) && (errno != EINTR)) {
+            fprintf(stderr, "Supervisor wait failed: %s\n", geterrno(errno));
+            break;
+        }
+        for(int i=0;i<n;i++) {
+            int slot = ev[i].data.u32 >> 8;
+            struct child_t *c = &s->child[slot];
+
+            switch(ev[i].data.u32 & 0xff) {
+            case EV_STDERR:
+                drain_stderr(c);
+                break;
+
+            case EV_CHILD:
+                reap(s, slot, FALSE);
+                break;
+
+            case EV_SIGCHLD:
+                (void)!read(s->sigfd, &count, sizeof(count));
+                for(int k=0;k<SPAWN_SLOTS;k++)
+                    reap(s, k, FALSE);
+                break;
+
+            case EV_RESTART:
+                if((read(c->timerfd, &count, sizeof(count)) > 0) && (c->pid <= 0)
+                    && ((c->role == SLOT_ACTIVE) || (c->role == SLOT_PENDING))) {
+                    STATS_INC(STAT_SOURCE_RESTARTS);
+                    if(!spawn(s, slot))
+                        schedule(s, slot);
+                }
+                break;
+
+            case EV_WAKE:
+                (void)!read(s->wakefd, &count, sizeof(count));
+                if(!s->exit)
+                    requests(s);
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&s->lock);
+    for(int i=0;i<SPAWN_SLOTS;i++)
+        s->child[i].role = SLOT_IDLE;
+    pthread_mutex_unlock(&s->lock);
+    for(int i=0;i<SPAWN_SLOTS;i++) {
+        struct child_t *c = &s->child[i];
+        terminate(s, i);
+        drain_stderr(c);
+        if(c->nline != 0) {
+            c->line[c->nline] = '\0';
+            capture_line(c->line);
+            c->nline = 0;
+        }
+    }
+    RTRelease(RT_CAPTURE);
+    return NULL;
+}
+
+// stop what has been replaced, then start what was asked for
+static void requests(struct supervisor_t *s)
+{
+    int retire[SPAWN_SLOTS], slot;
+    char *cmd;
+
+    pthread_mutex_lock(&s->lock);
+    for(int i=0;i<SPAWN_SLOTS;i++) {
+        retire[i] = (s->child[i].role == SLOT_RETIRING);
+        if(retire[i])
+            s->child[i].role = SLOT_IDLE;
+    }
+    cmd = s->request;
+    s->request = NULL;
+    // the spare slot, out of reach of SwitchChild from here on
+    slot = (s->active == 0) ? 1 : 0;
+    if(cmd != NULL) {
+        retire[slot] |= (s->child[slot].role != SLOT_IDLE);
+        s->child[slot].role = SLOT_IDLE;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    for(int i=0;i<SPAWN_SLOTS;i++)
+        if(retire[i])
+            terminate(s, i);
+    if(cmd == NULL)
+        return;
+
+    if(slot_open(s, slot, cmd)) {
+        pthread_mutex_lock(&s->lock);
+        s->child[slot].role = SLOT_PENDING;
+        pthread_mutex_unlock(&s->lock);
+        if(!spawn(s, slot))
+            schedule(s, slot);
+    }
+    free(cmd);
+}
+
+// pipes once per slot, and the command line for every restart
+static BOOL slot_open(struct supervisor_t *s, int slot, char *cmdline)
+{
+    struct child_t *c = &s->child[slot];
+    int argc = 0;
+    char *tok, *cmd;
+
+    if(c->out[READ_FD] < 0) {
+        if((pipe2(c->out, O_CLOEXEC) == -1) || (pipe2(c->in, O_CLOEXEC) == -1))   {
+            fprintf(stderr,"Pipe Create failed\n");
+            return FALSE;
+        }
+        if(pipe2(c->err, O_CLOEXEC) == -1)  {
+            fprintf(stderr, "Stderr capture pipe create failed\n");
+            return FALSE;
+        }
+        fcntl(c->err[READ_FD], F_SETFL, O_NONBLOCK);
+        c->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if((c->timerfd < 0) || !watch(s, c->err[READ_FD], EV_SLOT(EV_STDERR, slot))
+            || !watch(s, c->timerfd, EV_SLOT(EV_RESTART, slot))) {
+            fprintf(stderr, "Supervisor setup failed: %s\n", geterrno(errno));
+            return FALSE;
+        }
+    } else {
+        // whatever the last child here left unread is not the new source
+        drain_stdout(c);
+    }
+
+    // parse the command line
+    free(c->cmd);
+    if((c->cmd = cmd = strdup(cmdline)) == NULL)
+        return FALSE;
+    while(((tok=strsep(&cmd," ")) != NULL) && (argc < SPAWN_MAX_ARGS))	{
+	c->argv[argc++] = tok;
+    }
+    c->argv[argc] = NULL;
+    c->backoff = SPAWN_BACKOFF_MIN;
+    return TRUE;
+}
+
+// fork and exec the source on the slot's pipes
+static BOOL spawn(struct supervisor_t *s, int slot)
+{
+    struct child_t *c = &s->child[slot];
+    pid_t pid = fork();
+
+    if(pid == -1)    {
+        fprintf(stderr,"Fork failed: %s\n", geterrno(errno));
+        return FALSE;
+    }
+    if(pid == 0) {
+        // only async signal safe calls until the exec
+        if((dup2(c->err[WRITE_FD], STDERR_FILENO) < 0)
+            || (dup2(c->in[READ_FD], STDIN_FILENO) < 0)
+            || (dup2(c->out[WRITE_FD], STDOUT_FILENO) < 0))
+            _exit(127);
+        execv(c->argv[0], c->argv);
+        // only returns if an error occurred
+        static const char msg[] = "execv of the source failed\n";
+        (void)!write(STDERR_FILENO, msg, sizeof(msg)-1);
+        _exit(127);
+    }
+
+    c->pid = pid;
+    c->started = now_ms();
+    if(s->sigfd < 0) {
+        if(((c->pidfd = syscall(SYS_pidfd_open, pid, 0)) < 0) || !watch(s, c->pidfd, EV_SLOT(EV_CHILD, slot))) {
+            fprintf(stderr, "Cannot watch source process %d: %s\n", pid, geterrno(errno));
+            closefd(&c->pidfd);
+        }
+    } else {
+        // it may have died before there was a pid to reap
+        uint64_t one = 1;
+        (void)!write(s->sigfd, &one, sizeof(one));
+    }
+    DEBUGLEVEL(DEBUG_MSGS)
+        fprintf(stderr, "Source process %d started: %s\n", pid, c->argv[0]);
+    return TRUE;
+}
+
+// collect the child if it has gone, and schedule its restart if it failed
+static void reap(struct supervisor_t *s, int slot, BOOL wait)
+{
+    struct child_t *c = &s->child[slot];
+    int status;
+    pid_t pid = c->pid;
+    int64_t ran;
+
+    if((pid <= 0) || (waitpid(pid, &status, wait ? 0 : WNOHANG) != pid))
+        return;
+    c->pid = 0;
+    if(c->pidfd >= 0) {
+        epoll_ctl(s->epfd, EPOLL_CTL_DEL, c->pidfd, NULL);
+        closefd(&c->pidfd);
+    }
+    if(s->exit || ((c->role != SLOT_ACTIVE) && (c->role != SLOT_PENDING)))
+        return;
+
+    // a source that finished, such as a file played to its end, is left alone
+    ran = now_ms() - c->started;
+    if(WIFEXITED(status) && (WEXITSTATUS(status) == 0)) {
+        fprintf(stderr, "Source process %d finished after %lld ms, not restarted\n", pid, (long long)ran);
+        return;
+    }
+
+    // quick deaths back off, a source that ran a while is restarted at once
+    if(ran >= SPAWN_STABLE_MS)
+        c->backoff = SPAWN_BACKOFF_MIN;
+    if(WIFSIGNALED(status))
+        fprintf(stderr, "Source process %d killed by signal %d after %lld ms, restarting in %d ms\n",
+            pid, WTERMSIG(status), (long long)ran, c->backoff);
+    else
+        fprintf(stderr, "Source process %d exited with %d after %lld ms, restarting in %d ms\n",
+            pid, WEXITSTATUS(status), (long long)ran, c->backoff);
+    schedule(s, slot);
+}
+
+// arm the restart timer, backing off for the next one
+static void schedule(struct supervisor_t *s, int slot)
+{
+    struct child_t *c = &s->child[slot];
+    struct itimerspec its = { .it_value = { c->backoff / 1000, (c->backoff % 1000) * 1000000L } };
+
+    timerfd_settime(c->timerfd, 0, &its, NULL);
+    c->backoff *= 2;
+    if(c->backoff > SPAWN_BACKOFF_MAX)
+        c->backoff = SPAWN_BACKOFF_MAX;
+}
+
+// SIGTERM, a bounded wait, then SIGKILL; the slot is no longer restarted
+static void terminate(struct supervisor_t *s, int slot)
+{
+    struct child_t *c = &s->child[slot];
+    struct itimerspec off = { { 0, 0 }, { 0, 0 } };
+    pid_t pid = c->pid;
+    int64_t deadline = now_ms() + SPAWN_TERM_MS;
+
+    if(c->timerfd >= 0)
+        timerfd_settime(c->timerfd, 0, &off, NULL);
+    if(pid <= 0)
+        return;
+    kill(pid, SIGTERM);
+    for(int64_t left=SPAWN_TERM_MS; left>0; left=deadline-now_ms()) {
+        if(c->pidfd >= 0) {
+            struct pollfd pfd = { .fd = c->pidfd, .events = POLLIN };
+            if(poll(&pfd, 1, (int)left) > 0)
+                break;
+        } else {
+            if(waitpid(pid, NULL, WNOHANG) == pid) {
+                c->pid = 0;
+                return;
+            }
+            usleep(10000);
+        }
+    }
+    if(waitpid(pid, NULL, WNOHANG) != pid) {
+        DEBUGLEVEL(DEBUG_MSGS)
+            fprintf(stderr, "Source process %d ignored SIGTERM\n", pid);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+    c->pid = 0;
+    if(c->pidfd >= 0) {
+        epoll_ctl(s->epfd, EPOLL_CTL_DEL, c->pidfd, NULL);
+        closefd(&c->pidfd);
+    }
+}
+
+// whatever the child has written, a line at a time so a split marker is still seen
+static void drain_stderr(struct child_t *c)
+{
+    char buffer[256];
+    ssize_t nRead;
+
+    if(c->err[READ_FD] < 0)
+        return;
+    while((nRead = read(c->err[READ_FD], buffer, sizeof(buffer))) > 0) {
+        for(int i=0;i<nRead;i++) {
+            c->line[c->nline++] = buffer[i];
+            if((buffer[i] == '\n') || (c->nline == sizeof(c->line) - 1)) {
+                c->line[c->nline] = '\0';
+                capture_line(c->line);
+                c->nline = 0;
+            }
+        }
+    }
+}
+
+static void drain_stdout(struct child_t *c)
+{
+    char buffer[4096];
+    struct pollfd pfd = { .fd = c->out[READ_FD], .events = POLLIN };
+
+    while((poll(&pfd, 1, 0) > 0) && (read(pfd.fd, buffer, sizeof(buffer)) > 0))
+        ;
+}
+
+// a gap marker from the source is counted, anything else printed
+static void capture_line(char *line)
+{
+    int xrun;
+    long long samples;
+    double when;
+    size_t len = strlen(SOURCE_GAP_MARKER);
+
+    if(!strncmp(line, SOURCE_GAP_MARKER, len)
+        && (sscanf(&line[len], "%d %lld %lf", &xrun, &samples, &when) == 3)) {
+        STATS_INC(STAT_SOURCE_GAPS);
+        STATS_ADD(STAT_SOURCE_GAP_SAMPLES, samples);
+        DEBUGLEVEL(DEBUG_MSGS)
+            fprintf(stderr, "Source overrun %d at %.6f: %lld samples of silence\n", xrun, when, samples);
+        return;
+    }
+    len = strlen(SOURCE_RECONNECT_MARKER);
+    if(!strncmp(line, SOURCE_RECONNECT_MARKER, len)
+        && (sscanf(&line[len], "%d %lf", &xrun, &when) == 2)) {
+        STATS_INC(STAT_SOURCE_RECONNECTS);
+        DEBUGLEVEL(DEBUG_MSGS)
+            fprintf(stderr, "Source device reconnected at %.6f, %d times\n", when, xrun);
+        return;
+    }
+    fprintf(stderr,"%s",line);
+}
+
+static BOOL watch(struct supervisor_t *s, int fd, int ev)
+{
+    struct epoll_event e = { .events = EPOLLIN, .data.u32 = ev };
+    return (epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &e) == 0);
+}
+
+static void wake(struct supervisor_t *s)
+{
+    uint64_t one = 1;
+    (void)!write(s->wakefd, &one, sizeof(one));
+}
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void closefd(int *fd)
+{
+    if(*fd >= 0)
+        close(*fd);
+    *fd = -1;
 }
@@ -0,0 +1,227 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Multicast RTP output
+
+	File Name:	      multicast.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Sends the receiver audio as an always-on RTP stream to a
+					  multicast group, so any number of LAN listeners can join
+					  without a SIP call each.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rtl.h"
+
+//header feilds
+#define	HDR1		0		// first header byte
+#define	HDR2		1		// Second header
+#define	SSEQ		2		// sequence ID
+#define	TIMESTAMP	4		// timestamp
+#define	SYNCSRC		8		// sync src ID
+
+#define	MARK		0x80	// mark bit
+#define	RTP_V2		0x80	// version 2, no padding, no CSRC
+
+// multicast stream state
+struct mcast_stream_t {
+	int				codec;						// codec of choice
+	int				gain;						// gain shift
+	uint16_t		sequence;					// current sequence
+	uint32_t		timestamp;					// current timestamp
+	int				gapframes;					// consecutive frames filled
+	RTL_SAMPLE		lastFrame[PIPE_READ_LEN];	// last frame sent, for concealment
+	int				lastFrameLen;
+	char			buffer[RTP_HDRLEN + MAXUDPLEN + SPARE];	// packet buffer
+} mcast_stream;
+
+// internals
+static BOOL mcast_send(int payloadlen, int elapsed);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	InitMulticast
+
+	INPUTS:		group, port, ttl, interface, codec, gain
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	open the multicast socket and build the RTP header. The
+					stream gets its own random SSRC, sequence and timestamp.
+
+---------------------------------------------------------------------------*/
+BOOL InitMulticast(char *group, int port, int ttl, char *ifname, int codec, int gain)
+{
+	if ((codec != CODEC_PCMU) && (codec != CODEC_PCMA)) {
+		fprintf(stderr, "Multicast codec %d not supported\n", codec);
+		return FALSE;
+	}
+
+	mcast_stream.codec = codec;
+	mcast_stream.gain = gain;
+	mcast_stream.gapframes = 0;
+	mcast_stream.lastFrameLen = 0;
+
+	// a generator of its own, rand() belongs to the gap concealment
+	unsigned int seed = (unsigned int)time(NULL) ^ (unsigned int)port ^ ((unsigned int)getpid() << 16);
+	uint32_t ssrc = ((uint32_t)rand_r(&seed) << 16) ^ (uint32_t)rand_r(&seed);
+	mcast_stream.sequence = (uint16_t)rand_r(&seed);
+	mcast_stream.timestamp = ((uint32_t)rand_r(&seed) << 16) ^ (uint32_t)rand_r(&seed);
+
+	mcast_stream.buffer[HDR1] = RTP_V2;
+	mcast_stream.buffer[HDR2] = MARK | codec;
+	mcast_stream.buffer[SYNCSRC] = (ssrc >> 24) & 0xff;
+	mcast_stream.buffer[SYNCSRC + 1] = (ssrc >> 16) & 0xff;
+	mcast_stream.buffer[SYNCSRC + 2] = (ssrc >> 8) & 0xff;
+	mcast_stream.buffer[SYNCSRC + 3] = ssrc & 0xff;
+
+	DEBUGLEVEL(DEBUG_UDP)
+		fprintf(stderr, "Multicast to [%s]:%d ttl %d if %s\n", group, port, ttl,
+			((ifname != NULL) && (*ifname != '\0')) ? ifname : "default");
+
+	return OpenMulticastSocket(group, port, ttl, ifname);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SendMulticastPacket
+
+	INPUTS:		24 KHz samples, number of samples, TRUE if the unicast
+				stream has just encoded the same frame
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	send a frame to the group, reusing the unicast payload
+					when it was encoded with the same codec, gain and
+					deemphasis, so the frame is only encoded once
+
+---------------------------------------------------------------------------*/
+BOOL SendMulticastPacket(RTL_SAMPLE *PipeBuffer, int samplesread, BOOL shared)
+{
+	char *buf = mcast_stream.buffer;
+	int decimlength = 0;
+
+	// keep a copy to conceal a later underrun
+	if (samplesread <= PIPE_READ_LEN) {
+		memcpy(mcast_stream.lastFrame, PipeBuffer, samplesread * sizeof(RTL_SAMPLE));
+		mcast_stream.lastFrameLen = samplesread;
+	}
+
+	if (shared)
+		decimlength = GetUDPPayload(mcast_stream.codec, mcast_stream.gain, &buf[RTP_HDRLEN]);
+	if (decimlength == 0)
+		decimlength = PCMEncode(PipeBuffer, samplesread, &buf[RTP_HDRLEN], mcast_stream.codec, mcast_stream.gain);
+
+	// first packet after comfort noise starts a new talkspurt
+	if (mcast_stream.gapframes != 0) {
+		if (GetGapFill() == GAP_FILL_CN)
+			buf[HDR2] |= MARK;
+		mcast_stream.gapframes = 0;
+	}
+
+	return mcast_send(decimlength, decimlength);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SendMulticastGap
+
+	INPUTS:		number of source samples missing
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	fill a source underrun as SendUDPGap does for the
+					unicast stream, in the same gap fill mode, so the
+					group's RTP clock keeps running
+
+---------------------------------------------------------------------------*/
+BOOL SendMulticastGap(int samplesmissing)
+{
+	char *buf = mcast_stream.buffer;
+	int gapfill = GetGapFill();
+
+	if (gapfill == GAP_FILL_NONE)
+		return FALSE;
+
+	if (gapfill == GAP_FILL_CN) {
+		// only the first CN packet is needed, after that just advance the clock
+		BOOL sent = (mcast_stream.gapframes++ == 0);
+		if (sent) {
+			char pt = buf[HDR2];
+			buf[HDR2] = (pt & MARK) | CODEC_CN;
+			buf[RTP_HDRLEN] = CN_LEVEL;
+			mcast_send(1, 0);
+			buf[HDR2] = pt & ~MARK;
+		}
+		mcast_stream.timestamp += samplesmissing / AUDIO_DECIM;
+		return TRUE;
+	}
+
+	// packet loss concealment
+	RTL_SAMPLE fill[PIPE_READ_LEN];
+	if (samplesmissing > PIPE_READ_LEN)
+		samplesmissing = PIPE_READ_LEN;
+	ConcealFrame(fill, samplesmissing, ++mcast_stream.gapframes, mcast_stream.lastFrame, mcast_stream.lastFrameLen);
+
+	int decimlength = PCMEncode(fill, samplesmissing, &buf[RTP_HDRLEN], mcast_stream.codec, mcast_stream.gain);
+	return mcast_send(decimlength, decimlength);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	CloseMulticast
+
+	INPUTS:		none
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	stop sending to the group
+
+---------------------------------------------------------------------------*/
+void CloseMulticast(void)
+{
+	CloseMulticastSocket();
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// send the payload in the buffer, then move the header on to the next packet
+static BOOL mcast_send(int payloadlen, int elapsed)
+{
+	char *buf = mcast_stream.buffer;
+
+	buf[SSEQ] = (mcast_stream.sequence >> 8) & 0xff;
+	buf[SSEQ + 1] = mcast_stream.sequence & 0xff;
+	buf[TIMESTAMP] = (mcast_stream.timestamp >> 24) & 0xff;
+	buf[TIMESTAMP + 1] = (mcast_stream.timestamp >> 16) & 0xff;
+	buf[TIMESTAMP + 2] = (mcast_stream.timestamp >> 8) & 0xff;
+	buf[TIMESTAMP + 3] = mcast_stream.timestamp & 0xff;
+
+	BOOL sent = SendMulticast(buf, payloadlen + RTP_HDRLEN);
+
+	mcast_stream.sequence++;
+	mcast_stream.timestamp += elapsed;
+	buf[HDR2] &= ~MARK;
+
+	return sent;
+}
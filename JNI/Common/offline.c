@@ -0,0 +1,155 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Offline decoder
+
+	File Name:	      offline.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Decodes recorded audio as fast as the demodulator can go.
+					  There is no child process and no timer: samples are read
+					  from a file or stdin and demodulated in the caller's
+					  thread, and messages are stamped with their sample offset
+					  instead of the time of day.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtl.h"
+
+#define	OFFLINE_READ_LEN	(64*PIPE_READ_LEN)	// samples per read
+
+// offline decoder state
+struct offline_t {
+	int64_t		base;						// pipe samples before this decode
+	RTL_SAMPLE	buffer[OFFLINE_READ_LEN];	// samples at the pipe rate
+	AUDIO_FILE	file;						// the recording
+	RESAMPLER	rs;							// to the pipe rate
+} offline;
+
+// internals
+static int64_t offline_clock(void);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	OfflineInit
+
+	INPUTS:		sample offset of the first sample, message handler,
+				debug level
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	reset the demodulator and framer for offline decoding
+
+---------------------------------------------------------------------------*/
+void OfflineInit(int64_t base, void (*msg_func)(SAME_MESSAGE *msg), int debug)
+{
+	offline.base = base;
+	DSPInitSync(&SameFramerByte, debug);
+	SameFramerInit(msg_func, &DSPClearSync);
+	SameFramerClock(&offline_clock);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	OfflineDecode
+
+	INPUTS:		samples at the pipe rate, number of samples
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	demodulate and frame a block of samples
+
+---------------------------------------------------------------------------*/
+void OfflineDecode(RTL_SAMPLE *samples, int nsamples)
+{
+	for (int i = 0; i < nsamples; i += PIPE_READ_LEN)
+		DSPDemodSync(&samples[i], (nsamples - i < PIPE_READ_LEN) ? nsamples - i : PIPE_READ_LEN);
+}
+
+// end of the input: pass up anything still held by the framer
+void OfflineFlush(void)
+{
+	SameFramerFlush();
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	DecodeOffline
+
+	INPUTS:		file name or "-" for stdin, sample rate and TRUE for big
+				endian samples if it is raw, message handler, debug level
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	decode a whole recording, raw, WAV or FLAC. Input at
+					another rate than 24 KHz is converted the same way as
+					filereader does it. The demodulator and framer are the
+					receiver's, so this fails while it is running.
+
+---------------------------------------------------------------------------*/
+BOOL DecodeOffline(char *filename, int rate, BOOL bigendian, void (*msg_func)(SAME_MESSAGE *msg), int debug)
+{
+	unsigned char *data;
+	int bytesRead, readlen = RAW_DECIM_RATE * OFFLINE_READ_LEN * sizeof(RTL_SAMPLE);
+	int saved = debuglevel;
+
+	if (DSPRunning()) {
+		fprintf(stderr, "Offline decode refused: the receiver is running\n");
+		return FALSE;
+	}
+	debuglevel = debug;
+	if (!AudioFileOpen(&offline.file, filename, rate, bigendian)) {
+		debuglevel = saved;
+		return FALSE;
+	}
+	if (!ResampleInit(&offline.rs, offline.file.rate, offline.file.bigendian, 0)) {
+		fprintf(stderr, "Offline sample rate %d cannot be converted\n", offline.file.rate);
+		AudioFileClose(&offline.file);
+		debuglevel = saved;
+		return FALSE;
+	}
+
+	// a low rate gives more samples out than bytes in
+	while (ResampleMaxOut(&offline.rs, readlen) > OFFLINE_READ_LEN)
+		readlen /= 2;
+
+	OfflineInit(0, msg_func, debug);
+
+	// the converter keeps any partial sample itself
+	while ((bytesRead = AudioFileRead(&offline.file, &data, readlen)) > 0)
+		OfflineDecode(offline.buffer, Resample(&offline.rs, data, bytesRead, offline.buffer));
+	OfflineFlush();
+
+	AudioFileClose(&offline.file);
+	ResampleFree(&offline.rs);
+
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "Offline decode: %lld samples, %.1f seconds\n", (long long)DSPSampleCount(),
+			(double)DSPSampleCount() / SAMPLE_RATE);
+	debuglevel = saved;
+	return TRUE;
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+static int64_t offline_clock(void)
+{
+	return offline.base + DSPSampleCount();
+}
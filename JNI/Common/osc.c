@@ -44,8 +44,7 @@
 #endif
 OSC_VALUE oscLut[LUT_SIZE];
 
-int		i_Phase = 0;
-int		q_Phase = (3* (LUT_SIZE)) / 4;
+#define	Q_PHASE			((3*LUT_SIZE)/4)	// sin is cos a quarter turn on
 
 void InitOsc(void)
 {
@@ -53,25 +52,21 @@ void InitOsc(void)
 		oscLut[i] = (OSC_VALUE)((cos(2.0 * PI*(double)i / (double)LUT_SIZE))*32767.0);
 }
 
-RTL_SAMPLE RunOsc(int channel)
+// the oscillator at FSK sample n, which may be negative; as LUT_SIZE
+// divides 2^32, n can count up for ever
+RTL_SAMPLE OscAt(int channel, unsigned n)
 {
-	OSC_VALUE oscout;
+	unsigned phase = n * INJ_FREQ;
 
 	switch (channel) {
 
 	case I_CHANNEL:
-		oscout = oscLut[i_Phase];
-		i_Phase = (i_Phase + INJ_FREQ) & (LUT_SIZE -1);
-		break;
+		return((RTL_SAMPLE)oscLut[phase & (LUT_SIZE - 1)]);
 
 	case Q_CHANNEL:
-		oscout = oscLut[q_Phase];
-		q_Phase = (q_Phase + INJ_FREQ) & (LUT_SIZE - 1);;
-		break;
+		return((RTL_SAMPLE)oscLut[(phase + Q_PHASE) & (LUT_SIZE - 1)]);
 
 	default:
 		return 0;
-
 	}
-	return((RTL_SAMPLE)oscout);
 }
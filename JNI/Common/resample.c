@@ -0,0 +1,295 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Sample rate converter
+
+	File Name:		  resample.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Turns raw 16 bit audio at whatever rate the device or
+					  file has into 24 KHz samples. 24 KHz only has its bytes
+					  put in order and 48 KHz goes through the halfband
+					  decimator; any other rate is taken by L/M, reduced to
+					  lowest terms, through a polyphase FIR: a Kaiser windowed
+					  sinc designed at init for the pair of rates, split into
+					  L phases of Q14 taps, so each output costs one short
+					  dot product and no interpolated coefficients. NEON and
+					  SSE2 do eight taps at a time.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "rtl.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define	RS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define	RS_SSE2
+#endif
+
+#define	RS_COEFF_BITS		14					// taps are Q14, a phase sums to 1
+#define	RS_ZEROS			24					// sinc zero crossings in the filter
+#define	RS_BETA				8.0					// Kaiser window, about 80 dB
+#define	RS_MIN_RATE			8000
+#define	RS_MAX_RATE			192000
+
+// internals
+static int gcd(int a, int b);
+static BOOL design(RESAMPLER *rs);
+static double bessel_i0(double x);
+static int convert(RESAMPLER *rs, unsigned char *in, int nbytes, int16_t *out);
+static int32_t dot(const int16_t *c, const int16_t *x, int n);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	ResampleInit
+
+	INPUTS:		converter, input rate, byte order of the input, gain as a
+				left shift
+
+	OUTPUTS:	TRUE, or FALSE if the rate cannot be converted
+
+	DESCRIPTION:	set up the conversion to SAMPLE_RATE; the filter for an
+					odd rate is designed here, outside the sample path
+
+---------------------------------------------------------------------------*/
+BOOL ResampleInit(RESAMPLER *rs, int rate, BOOL bigendian, int gain)
+{
+	int div;
+
+	memset(rs, 0, sizeof(RESAMPLER));
+	if ((rate < RS_MIN_RATE) || (rate > RS_MAX_RATE))
+		return FALSE;
+
+	div = gcd(rate, SAMPLE_RATE);
+	rs->rate = rate;
+	rs->up = SAMPLE_RATE / div;
+	rs->down = rate / div;
+	rs->bigendian = bigendian;
+	if (gain < 0)
+		gain = 0;
+	if (gain > RS_COEFF_BITS)
+		gain = RS_COEFF_BITS;
+	rs->gain = gain;
+	rs->shift = RS_COEFF_BITS - gain;
+	rs->round = (rs->shift != 0) ? 1 << (rs->shift - 1) : 0;
+
+	if (rate == RAW_SAMPLE_RATE) {
+		HalfbandInit(&rs->hb, bigendian, gain);
+		return TRUE;
+	}
+	if (rate == SAMPLE_RATE)
+		return TRUE;
+
+	if (rs->up > RS_MAX_PHASES)
+		return FALSE;
+	if (!design(rs))
+		return FALSE;
+
+	// the first output has only zeros before it
+	rs->next = rs->taps - 1;
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "Resampling %d to %d Hz: %d/%d, %d taps per phase\n", rate, SAMPLE_RATE,
+			rs->up, rs->down, rs->taps);
+	return TRUE;
+}
+
+void ResampleFree(RESAMPLER *rs)
+{
+	free(rs->coeffs);
+	rs->coeffs = NULL;
+}
+
+// most samples a call with this many bytes can give
+int ResampleMaxOut(RESAMPLER *rs, int nbytes)
+{
+	return (int)(((int64_t)(nbytes / (int)sizeof(RTL_SAMPLE) + 1) * rs->up + rs->down - 1) / rs->down) + 1;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	Resample
+
+	INPUTS:		converter, raw bytes, how many, output buffer of at least
+				ResampleMaxOut samples
+
+	OUTPUTS:	samples written
+
+	DESCRIPTION:	convert a block to SAMPLE_RATE; a partial sample at the
+					end is kept for the next call
+
+---------------------------------------------------------------------------*/
+int Resample(RESAMPLER *rs, unsigned char *in, int nbytes, RTL_SAMPLE *out)
+{
+	int nout = 0;
+
+	if (rs->rate == RAW_SAMPLE_RATE)
+		return HalfbandDecimate(&rs->hb, in, nbytes, out);
+
+	while (nbytes > 0) {
+		int16_t *x = (rs->rate == SAMPLE_RATE) ? (int16_t *)&out[nout] : &rs->hist[rs->taps - 1];
+		int used = (nbytes > RS_BLOCK * (int)sizeof(RTL_SAMPLE)) ? RS_BLOCK * (int)sizeof(RTL_SAMPLE) : nbytes;
+		int n = convert(rs, in, used, x);
+
+		in += used;
+		nbytes -= used;
+		if (rs->rate == SAMPLE_RATE) {
+			// only the gain to apply
+			for (int i = 0; (rs->gain != 0) && (i < n); i++) {
+				int32_t v = (int32_t)x[i] << rs->gain;
+				x[i] = (int16_t)((v > 32767) ? 32767 : (v < -32768) ? -32768 : v);
+			}
+			nout += n;
+			continue;
+		}
+
+		// every output whose newest input sample has arrived
+		while (rs->next < rs->taps - 1 + n) {
+			int32_t acc = dot(&rs->coeffs[rs->phase * rs->taps], &rs->hist[rs->next - rs->taps + 1], rs->taps);
+			acc = (acc + rs->round) >> rs->shift;
+			out[nout++] = (RTL_SAMPLE)((acc > 32767) ? 32767 : (acc < -32768) ? -32768 : acc);
+			rs->phase += rs->down;
+			rs->next += rs->phase / rs->up;
+			rs->phase %= rs->up;
+		}
+
+		// the last samples are the history for the next block
+		memmove(rs->hist, &rs->hist[n], (rs->taps - 1) * sizeof(int16_t));
+		rs->next -= n;
+	}
+	return nout;
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+static int gcd(int a, int b)
+{
+	while (b != 0) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/*
+ * The prototype runs at up times the input rate with its cutoff at the lower
+ * of the two Nyquist rates. Phase p is every up'th tap from p, stored time
+ * reversed so the dot product runs forwards over the input, and scaled to
+ * sum to exactly 1 so no phase is louder than another.
+ */
+static BOOL design(RESAMPLER *rs)
+{
+	int wider = (rs->up > rs->down) ? rs->up : rs->down;
+	int ntaps = (RS_ZEROS * wider + rs->up - 1) / rs->up;
+	double fc = 0.5 / wider, centre, *proto;
+
+	rs->taps = (ntaps + 7) & ~7;
+	if (rs->taps > RS_MAX_TAPS)
+		return FALSE;
+	ntaps = rs->taps * rs->up;
+	centre = (ntaps - 1) / 2.0;
+
+	if ((proto = malloc(ntaps * sizeof(double))) == NULL)
+		return FALSE;
+	if ((rs->coeffs = malloc(ntaps * sizeof(int16_t))) == NULL) {
+		free(proto);
+		return FALSE;
+	}
+
+	for (int m = 0; m < ntaps; m++) {
+		double t = m - centre, r = t / (centre + 1.0);
+		double sinc = (t == 0.0) ? 1.0 : sin(2.0 * M_PI * fc * t) / (M_PI * fc * t * 2.0);
+		proto[m] = sinc * bessel_i0(RS_BETA * sqrt(1.0 - r * r)) / bessel_i0(RS_BETA);
+	}
+
+	for (int p = 0; p < rs->up; p++) {
+		double sum = 0.0;
+		for (int k = 0; k < rs->taps; k++)
+			sum += proto[k * rs->up + p];
+		for (int k = 0; k < rs->taps; k++)
+			rs->coeffs[p * rs->taps + rs->taps - 1 - k] = (int16_t)lrint(proto[k * rs->up + p] * (1 << RS_COEFF_BITS) / sum);
+	}
+	free(proto);
+	return TRUE;
+}
+
+// modified Bessel function of the first kind, order 0, by its series
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+// raw bytes to host order samples, keeping an odd byte for the next call
+static int convert(RESAMPLER *rs, unsigned char *in, int nbytes, int16_t *out)
+{
+	int shift1 = rs->bigendian ? 8 : 0, shift2 = rs->bigendian ? 0 : 8;
+	int n = 0;
+
+	if (rs->ncarry != 0) {
+		out[n++] = (int16_t)((rs->carry << shift1) | (in[0] << shift2));
+		in++;
+		nbytes--;
+		rs->ncarry = 0;
+	}
+	for (; nbytes >= 2; nbytes -= 2, in += 2)
+		out[n++] = (int16_t)((in[0] << shift1) | (in[1] << shift2));
+	if (nbytes != 0) {
+		rs->carry = in[0];
+		rs->ncarry = 1;
+	}
+	return n;
+}
+
+// n is a multiple of eight
+static int32_t dot(const int16_t *c, const int16_t *x, int n)
+{
+#if defined(RS_NEON)
+	int32x4_t acc = vdupq_n_s32(0);
+	for (int k = 0; k < n; k += 8) {
+		int16x8_t cv = vld1q_s16(&c[k]), xv = vld1q_s16(&x[k]);
+		acc = vmlal_s16(acc, vget_low_s16(cv), vget_low_s16(xv));
+		acc = vmlal_s16(acc, vget_high_s16(cv), vget_high_s16(xv));
+	}
+	int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+	return vget_lane_s32(vpadd_s32(sum, sum), 0);
+#elif defined(RS_SSE2)
+	__m128i acc = _mm_setzero_si128();
+	for (int k = 0; k < n; k += 8)
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)&c[k]),
+			_mm_loadu_si128((const __m128i *)&x[k])));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(acc);
+#else
+	int32_t acc = 0;
+	for (int k = 0; k < n; k++)
+		acc += c[k] * x[k];
+	return acc;
+#endif
+}
@@ -0,0 +1,337 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      RTCP sender and receiver reports
+
+	File Name:	      rtcp.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Sends RTCP sender reports on the odd port paired with the RTP
+					  stream, and parses the receiver reports coming back from the
+					  far end to extract loss, jitter and round trip time.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "rtl.h"
+
+// RTCP packet types
+#define	RTCP_SR			200			// sender report
+#define	RTCP_RR			201			// receiver report
+#define	RTCP_SDES		202			// source description
+#define	RTCP_BYE		203			// goodbye
+
+#define	RTCP_VERSION	0x80		// version 2, no padding
+#define	SDES_CNAME		1			// canonical name item
+#define	RTCP_BFRSIZ		512			// sizeof(rtcp packet buffer)
+#define	REPORT_BLKLEN	24			// sizeof(report block)
+#define	RTCP_INTERVAL	5000		// ms between sender reports
+#define	NTP_OFFSET		2208988800u	// seconds from 1900 to 1970
+
+// RTCP state, shared with the JNI stats call
+struct rtcp_state_t {
+	BOOL			active;						// RTCP is running
+	uint32_t		ssrc;						// our SSRC from the RTP header
+	uint32_t		rtp_timestamp;				// last RTP timestamp sent
+	long long		next_report;				// monotonic ms of next SR
+	char			cname[64];					// SDES canonical name
+	RTCP_STATS		stats;						// what we know so far
+	pthread_mutex_t	stats_mutex;				// guards stats
+} rtcp_state = { .stats_mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// internals
+static long long rtcp_ms_now(void);
+static void rtcp_ntp_now(uint32_t *msw, uint32_t *lsw);
+static void rtcp_put32(unsigned char *p, uint32_t val);
+static uint32_t rtcp_get32(unsigned char *p);
+static int rtcp_build_sdes(unsigned char *p);
+static void rtcp_send_report(void);
+static void rtcp_parse(unsigned char *p, int len);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	InitRTCP
+
+	INPUTS:		RTP header, remote ip/port, my ip/port (RTP ports)
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	open the RTCP socket on the next port up from RTP and
+					reset the statistics
+
+---------------------------------------------------------------------------*/
+BOOL InitRTCP(unsigned char *hdrPtr, char *remoteip, int remotePort, char *myip, int myport)
+{
+	rtcp_state.active = FALSE;
+	rtcp_state.ssrc = rtcp_get32(&hdrPtr[8]);
+	rtcp_state.rtp_timestamp = rtcp_get32(&hdrPtr[4]);
+	snprintf(rtcp_state.cname, sizeof(rtcp_state.cname), "piwxrx@%s", myip);
+
+	pthread_mutex_lock(&rtcp_state.stats_mutex);
+	memset(&rtcp_state.stats, 0, sizeof(rtcp_state.stats));
+	pthread_mutex_unlock(&rtcp_state.stats_mutex);
+
+	if (!OpenRTCPSocket(remoteip, remotePort + 1, myip, myport + 1)) {
+		DEBUGLEVEL(DEBUG_UDP)
+			fprintf(stderr, "RTCP disabled: cannot open port %d\n", myport + 1);
+		return FALSE;
+	}
+
+	// first report goes out quickly so the far end can sync
+	rtcp_state.next_report = rtcp_ms_now() + RTCP_INTERVAL / 2;
+	rtcp_state.active = TRUE;
+	return TRUE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	RTCPPacketSent
+
+	INPUTS:		payload length, RTP timestamp of packet
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	account for an RTP packet, then poll for receiver reports
+					and send a sender report when one is due
+
+---------------------------------------------------------------------------*/
+void RTCPPacketSent(int payloadlen, uint32_t timestamp)
+{
+	unsigned char rxbuf[RTCP_BFRSIZ];
+	int nbytes;
+
+	if (!rtcp_state.active)
+		return;
+
+	pthread_mutex_lock(&rtcp_state.stats_mutex);
+	rtcp_state.stats.packets_sent++;
+	rtcp_state.stats.octets_sent += payloadlen;
+	pthread_mutex_unlock(&rtcp_state.stats_mutex);
+	rtcp_state.rtp_timestamp = timestamp;
+
+	while ((nbytes = ReceiveRTCP((char *)rxbuf, sizeof(rxbuf))) > 0)
+		rtcp_parse(rxbuf, nbytes);
+
+	if (rtcp_ms_now() >= rtcp_state.next_report) {
+		rtcp_send_report();
+		rtcp_state.next_report += RTCP_INTERVAL;
+	}
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	CloseRTCP
+
+	INPUTS:		none
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	send a BYE and close the RTCP socket
+
+---------------------------------------------------------------------------*/
+void CloseRTCP(void)
+{
+	unsigned char txbuf[RTCP_BFRSIZ];
+	unsigned char *p = txbuf;
+
+	if (!rtcp_state.active)
+		return;
+	rtcp_state.active = FALSE;
+
+	// empty RR + SDES + BYE is the minimal compound packet
+	p[0] = RTCP_VERSION;
+	p[1] = RTCP_RR;
+	p[2] = 0; p[3] = 1;
+	rtcp_put32(&p[4], rtcp_state.ssrc);
+	p += 8;
+	p += rtcp_build_sdes(p);
+	p[0] = RTCP_VERSION | 1;
+	p[1] = RTCP_BYE;
+	p[2] = 0; p[3] = 1;
+	rtcp_put32(&p[4], rtcp_state.ssrc);
+	p += 8;
+
+	SendRTCP((char *)txbuf, (int)(p - txbuf));
+	CloseRTCPSocket();
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	GetRTCPStats
+
+	INPUTS:		stats struct to fill in
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	return a consistent copy of the network statistics
+
+---------------------------------------------------------------------------*/
+void GetRTCPStats(RTCP_STATS *stats)
+{
+	pthread_mutex_lock(&rtcp_state.stats_mutex);
+	*stats = rtcp_state.stats;
+	pthread_mutex_unlock(&rtcp_state.stats_mutex);
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+static long long rtcp_ms_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// wall clock in NTP format
+static void rtcp_ntp_now(uint32_t *msw, uint32_t *lsw)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	*msw = (uint32_t)tv.tv_sec + NTP_OFFSET;
+	*lsw = (uint32_t)(((uint64_t)tv.tv_usec << 32) / 1000000);
+}
+
+static void rtcp_put32(unsigned char *p, uint32_t val)
+{
+	p[0] = (val >> 24) & 0xff;
+	p[1] = (val >> 16) & 0xff;
+	p[2] = (val >> 8) & 0xff;
+	p[3] = val & 0xff;
+}
+
+static uint32_t rtcp_get32(unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+		| ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+// SDES with a single CNAME item, padded to a word boundary
+static int rtcp_build_sdes(unsigned char *p)
+{
+	int namelen = (int)strlen(rtcp_state.cname);
+	int len = 4 + 4 + 2 + namelen + 1;			// hdr, ssrc, item hdr, name, end
+	len = (len + 3) & ~3;
+
+	memset(p, 0, len);
+	p[0] = RTCP_VERSION | 1;
+	p[1] = RTCP_SDES;
+	p[2] = ((len / 4 - 1) >> 8) & 0xff;
+	p[3] = (len / 4 - 1) & 0xff;
+	rtcp_put32(&p[4], rtcp_state.ssrc);
+	p[8] = SDES_CNAME;
+	p[9] = namelen;
+	memcpy(&p[10], rtcp_state.cname, namelen);
+	return len;
+}
+
+// sender report with no report blocks, we never receive RTP
+static void rtcp_send_report(void)
+{
+	unsigned char txbuf[RTCP_BFRSIZ];
+	unsigned char *p = txbuf;
+	uint32_t msw, lsw;
+
+	rtcp_ntp_now(&msw, &lsw);
+
+	pthread_mutex_lock(&rtcp_state.stats_mutex);
+	p[0] = RTCP_VERSION;
+	p[1] = RTCP_SR;
+	p[2] = 0; p[3] = 6;
+	rtcp_put32(&p[4], rtcp_state.ssrc);
+	rtcp_put32(&p[8], msw);
+	rtcp_put32(&p[12], lsw);
+	rtcp_put32(&p[16], rtcp_state.rtp_timestamp);
+	rtcp_put32(&p[20], rtcp_state.stats.packets_sent);
+	rtcp_put32(&p[24], rtcp_state.stats.octets_sent);
+	rtcp_state.stats.reports_sent++;
+	pthread_mutex_unlock(&rtcp_state.stats_mutex);
+	p += 28;
+	p += rtcp_build_sdes(p);
+
+	SendRTCP((char *)txbuf, (int)(p - txbuf));
+
+	DEBUGLEVEL(DEBUG_UDP)
+		fprintf(stderr, "RTCP SR sent: %u packets\n", rtcp_state.stats.packets_sent);
+}
+
+// walk a compound packet looking for report blocks about our stream
+static void rtcp_parse(unsigned char *p, int len)
+{
+	uint32_t msw, lsw;
+	rtcp_ntp_now(&msw, &lsw);
+	uint32_t now = (msw << 16) | (lsw >> 16);
+
+	while (len >= 4) {
+		int pktlen = (((int)p[2] << 8) | p[3]) * 4 + 4;
+		int count = p[0] & 0x1f;
+		int pt = p[1];
+		unsigned char *blk;
+
+		if (((p[0] & 0xc0) != RTCP_VERSION) || (pktlen > len))
+			return;
+
+		switch (pt) {
+
+		case RTCP_SR:
+			blk = p + 28;
+			break;
+
+		case RTCP_RR:
+			blk = p + 8;
+			break;
+
+		default:
+			blk = NULL;
+			break;
+		}
+
+		for (int i = 0; (blk != NULL) && (i < count); i++, blk += REPORT_BLKLEN) {
+			if (blk + REPORT_BLKLEN > p + pktlen)
+				break;
+			if (rtcp_get32(blk) != rtcp_state.ssrc)
+				continue;
+
+			uint32_t lost = rtcp_get32(&blk[4]);
+			uint32_t lsr = rtcp_get32(&blk[16]);
+			uint32_t dlsr = rtcp_get32(&blk[20]);
+
+			pthread_mutex_lock(&rtcp_state.stats_mutex);
+			rtcp_state.stats.reports_received++;
+			rtcp_state.stats.fraction_lost = (lost >> 24) & 0xff;
+			rtcp_state.stats.cumulative_lost = lost & 0x00ffffff;
+			rtcp_state.stats.highest_seq = rtcp_get32(&blk[8]);
+			// jitter is in timestamp units, convert to us
+			rtcp_state.stats.jitter_us = rtcp_get32(&blk[12]) * (1000000 / CODEC_SAMPLE_RATE);
+			// round trip is in 1/65536 s, convert to ms
+			if (lsr != 0)
+				rtcp_state.stats.rtt_ms = (uint32_t)(((uint64_t)(now - lsr - dlsr) * 1000) >> 16);
+			pthread_mutex_unlock(&rtcp_state.stats_mutex);
+
+			DEBUGLEVEL(DEBUG_UDP)
+				fprintf(stderr, "RTCP RR: lost %d/256, jitter %u us, rtt %u ms\n",
+					rtcp_state.stats.fraction_lost, rtcp_state.stats.jitter_us, rtcp_state.stats.rtt_ms);
+		}
+
+		p += pktlen;
+		len -= pktlen;
+	}
+}
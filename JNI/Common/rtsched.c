@@ -0,0 +1,234 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Realtime scheduling
+
+	File Name:		  rtsched.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Scheduling policy, priority and CPU affinity for the
+					  timer, DSP and stderr capture threads, and locking the
+					  process in memory. Each thread applies its settings as
+					  it starts, and settings made while it runs are applied
+					  to it at once. Without the privilege for SCHED_FIFO or
+					  SCHED_RR the thread carries on as it was, and the
+					  refusal is counted.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#ifndef _GNU_SOURCE
+#define	_GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "rtl.h"
+
+#define	RT_MAX_CPUS			64					// in an affinity mask
+
+// one pipeline thread
+typedef struct rt_thread_t {
+	BOOL		configured;						// settings given
+	int			policy;							// SCHED_
+	int			priority;						// for FIFO and RR
+	uint64_t	cpus;							// affinity mask, 0 for any
+	BOOL		running;						// thread is registered
+	pthread_t	thread;
+} RT_THREAD;
+
+static char *thread_names[RT_THREADS] = { "timer", "dsp", "capture" };
+
+struct rtsched_t {
+	RT_THREAD		threads[RT_THREADS];
+	pthread_mutex_t	rt_mutex;
+} rtsched = { .rt_mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// internals
+static BOOL parse_cpus(char *list, uint64_t *mask);
+static void apply(int thread);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	RTConfigure
+
+	INPUTS:		RT_ thread, "policy[:priority[:cpus]]"
+
+	OUTPUTS:	TRUE if the settings were understood
+
+	DESCRIPTION:	set the scheduling of a pipeline thread. The policy is
+					fifo, rr or other, and cpus a list such as 0,2-3; for
+					example "fifo:80:1" runs the thread at FIFO priority 80
+					on core 1.
+
+---------------------------------------------------------------------------*/
+BOOL RTConfigure(int thread, char *spec)
+{
+	char work[128], *fields = work, *policy, *priority, *cpus;
+	RT_THREAD t = { 0 };
+
+	if ((thread < 0) || (thread >= RT_THREADS) || (spec == NULL))
+		return FALSE;
+	snprintf(work, sizeof(work), "%s", spec);
+	policy = strsep(&fields, ":");
+	priority = strsep(&fields, ":");
+	cpus = fields;
+
+	if (!strcmp(policy, "fifo"))
+		t.policy = SCHED_FIFO;
+	else if (!strcmp(policy, "rr"))
+		t.policy = SCHED_RR;
+	else if (!strcmp(policy, "other") || (policy[0] == '\0'))
+		t.policy = SCHED_OTHER;
+	else
+		return FALSE;
+
+	if (t.policy != SCHED_OTHER) {
+		t.priority = (priority != NULL) ? atoi(priority) : sched_get_priority_min(t.policy);
+		if ((t.priority < sched_get_priority_min(t.policy)) || (t.priority > sched_get_priority_max(t.policy)))
+			return FALSE;
+	}
+	if ((cpus != NULL) && !parse_cpus(cpus, &t.cpus))
+		return FALSE;
+
+	pthread_mutex_lock(&rtsched.rt_mutex);
+	t.running = rtsched.threads[thread].running;
+	t.thread = rtsched.threads[thread].thread;
+	t.configured = TRUE;
+	rtsched.threads[thread] = t;
+	if (t.running)
+		apply(thread);
+	pthread_mutex_unlock(&rtsched.rt_mutex);
+	return TRUE;
+}
+
+// called by a pipeline thread as it starts
+void RTApply(int thread)
+{
+	pthread_mutex_lock(&rtsched.rt_mutex);
+	rtsched.threads[thread].thread = pthread_self();
+	rtsched.threads[thread].running = TRUE;
+	apply(thread);
+	pthread_mutex_unlock(&rtsched.rt_mutex);
+}
+
+// and as it stops, so a later RTConfigure does not touch a dead thread
+void RTRelease(int thread)
+{
+	pthread_mutex_lock(&rtsched.rt_mutex);
+	rtsched.threads[thread].running = FALSE;
+	pthread_mutex_unlock(&rtsched.rt_mutex);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	RTLockMemory
+
+	INPUTS:		TRUE to lock
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	keep the whole process, and what it maps later, in RAM so
+					the pipeline never waits for a page to come back in.
+					This is per process, not per thread.
+
+---------------------------------------------------------------------------*/
+BOOL RTLockMemory(BOOL lock)
+{
+#ifndef _WIN32
+	if ((lock ? mlockall(MCL_CURRENT | MCL_FUTURE) : munlockall()) == 0) {
+		DEBUGLEVEL(DEBUG_MSGS)
+			fprintf(stderr, "Memory %s\n", lock ? "locked" : "unlocked");
+		return TRUE;
+	}
+	STATS_INC(STAT_RT_DENIED);
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "Cannot lock memory: %s\n", geterrno(errno));
+#endif
+	return FALSE;
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// called with the mutex held; a refusal leaves the thread as it was
+static void apply(int thread)
+{
+	RT_THREAD *t = &rtsched.threads[thread];
+	struct sched_param param = { 0 };
+	int err;
+
+	if (!t->configured)
+		return;
+
+	param.sched_priority = t->priority;
+	if ((err = pthread_setschedparam(t->thread, t->policy, &param)) != 0) {
+		STATS_INC(STAT_RT_DENIED);
+		DEBUGLEVEL(DEBUG_MSGS)
+			fprintf(stderr, "Cannot set %s thread scheduling, left as it is: %s\n", thread_names[thread], geterrno(err));
+	}
+
+#ifdef CPU_SET
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu = 0; cpu < RT_MAX_CPUS; cpu++) {
+		if ((t->cpus == 0) || (t->cpus & (1ull << cpu)))
+			CPU_SET(cpu, &set);
+	}
+	if ((err = pthread_setaffinity_np(t->thread, sizeof(set), &set)) != 0) {
+		STATS_INC(STAT_RT_DENIED);
+		DEBUGLEVEL(DEBUG_MSGS)
+			fprintf(stderr, "Cannot set %s thread affinity: %s\n", thread_names[thread], geterrno(err));
+	}
+#endif
+
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "%s thread: policy %d priority %d cpus %llx\n", thread_names[thread],
+			t->policy, t->priority, (unsigned long long)t->cpus);
+}
+
+// 0,2-3 style
+static BOOL parse_cpus(char *list, uint64_t *mask)
+{
+	char *end;
+
+	*mask = 0;
+	while (*list != '\0') {
+		long first = strtol(list, &end, 10), last;
+		if ((end == list) || (first < 0) || (first >= RT_MAX_CPUS))
+			return FALSE;
+		last = first;
+		if (*end == '-') {
+			list = end + 1;
+			last = strtol(list, &end, 10);
+			if ((end == list) || (last < first) || (last >= RT_MAX_CPUS))
+				return FALSE;
+		}
+		for (long cpu = first; cpu <= last; cpu++)
+			*mask |= 1ull << cpu;
+		if (*end == ',')
+			end++;
+		else if (*end != '\0')
+			return FALSE;
+		list = end;
+	}
+	return TRUE;
+}
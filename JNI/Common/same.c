@@ -0,0 +1,353 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      SAME message framer
+
+	File Name:	      same.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Assembles the bytes from the FSK demodulator into SAME
+					  headers and end of message markers. Each header is sent
+					  three times; the bursts are voted on before the message
+					  is passed up.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rtl.h"
+
+#define	SAME_BURSTS			3			// number of bursts per header
+#define	SAME_GROUP_TIME		15			// seconds that bursts are grouped
+
+// framer state
+struct same_framer_t {
+	char		burst[SAME_MAXLEN + 1];				// burst being assembled
+	int			len;								// bytes in burst
+	int			dashes;								// dashes after the '+'
+	BOOL		plus;								// seen the '+'
+	char		group[SAME_BURSTS][SAME_MAXLEN + 1];	// bursts of this header
+	int			ngroup;								// bursts in the group
+	BOOL		delivered;							// group has been passed up
+	time_t		grouptime;							// time of first burst
+	int64_t		groupsample;						// sample offset of first burst
+	time_t		eomtime;							// time of last EOM passed up
+	BOOL		everyeom;							// pass up every EOM burst
+	int64_t		(*sample_clock)(void);				// offline sample clock, or NULL
+	void		(*clr_sync)(void);					// restart the sync search
+	void		(*msg_func)(SAME_MESSAGE *msg);		// message handler
+} same_framer;
+
+// internals
+static void same_burst_done(void);
+static void same_deliver(char *header, int64_t sample);
+static time_t same_now(void);
+static void same_vote(char *result);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameFramerInit
+
+	INPUTS:		message callback, function to clear the demodulator sync
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	reset the framer
+
+---------------------------------------------------------------------------*/
+void SameFramerInit(void (*msg_func)(SAME_MESSAGE *msg), void (*clr_sync)(void))
+{
+	memset(&same_framer, 0, sizeof(same_framer));
+	same_framer.msg_func = msg_func;
+	same_framer.clr_sync = clr_sync;
+	same_framer.eomtime = -(SAME_GROUP_TIME + 1);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameFramerClock
+
+	INPUTS:		function returning the current sample offset at the pipe
+				rate, or NULL for the wall clock
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	when decoding faster than real time the bursts are grouped
+					by sample time, and messages carry their sample offset
+
+---------------------------------------------------------------------------*/
+void SameFramerClock(int64_t (*sample_clock)(void))
+{
+	same_framer.sample_clock = sample_clock;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameFramerEveryEOM
+
+	INPUTS:		TRUE to pass up every EOM burst
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	normally an EOM within SAME_GROUP_TIME of the last one
+					is held back. A caller decoding a recording in pieces
+					holds them back itself, over the whole recording, as
+					the pieces cannot know what came before them.
+
+---------------------------------------------------------------------------*/
+void SameFramerEveryEOM(BOOL every)
+{
+	same_framer.everyeom = every;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameFramerFlush
+
+	INPUTS:		none
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	at the end of the input, pass up a header that was only
+					heard once
+
+---------------------------------------------------------------------------*/
+void SameFramerFlush(void)
+{
+	struct same_framer_t *s = &same_framer;
+
+	if ((s->ngroup != 0) && !s->delivered)
+		same_deliver(s->group[0], s->groupsample);
+	s->ngroup = 0;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameFramerByte
+
+	INPUTS:		byte from the demodulator
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	add a byte to the current burst. Once a burst is complete,
+					or is obviously not SAME, the sync is cleared so the
+					demodulator looks for the next preamble.
+
+---------------------------------------------------------------------------*/
+void SameFramerByte(DEMOD_BYTE data)
+{
+	struct same_framer_t *s = &same_framer;
+
+	// skip the rest of the preamble
+	if ((s->len == 0) && (data == SYNC_BYTE))
+		return;
+
+	// anything unprintable means we have lost it
+	if ((data < ' ') || (data > '~') || (s->len == SAME_MAXLEN)) {
+		if (s->len > 4)
+			BlackboxTrigger(BB_TRIG_SYNC);
+		s->len = 0;
+		(*s->clr_sync)();
+		return;
+	}
+
+	s->burst[s->len++] = (char)data;
+	s->burst[s->len] = '\0';
+
+	if (s->len < 4)
+		return;
+
+	if (s->len == 4) {
+		if (!strcmp(s->burst, "NNNN")) {
+			same_burst_done();
+			return;
+		}
+		if (strcmp(s->burst, "ZCZC")) {
+			s->len = 0;
+			(*s->clr_sync)();
+			return;
+		}
+		s->plus = FALSE;
+		s->dashes = 0;
+		return;
+	}
+
+	// header ends with the dash after the sender ID: +TTTT-JJJHHMM-LLLLLLLL-
+	if (data == '+')
+		s->plus = TRUE;
+	else if (s->plus && (data == '-') && (++s->dashes == 3))
+		same_burst_done();
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameParse
+
+	INPUTS:		header string, message struct
+
+	OUTPUTS:	TRUE if the header is well formed
+
+	DESCRIPTION:	split a ZCZC header into its fields
+
+---------------------------------------------------------------------------*/
+BOOL SameParse(char *header, SAME_MESSAGE *msg)
+{
+	char work[SAME_MAXLEN + 1];
+	char *fields, *tok;
+
+	memset(msg, 0, sizeof(SAME_MESSAGE));
+	strncpy(msg->raw, header, SAME_MAXLEN);
+
+	if (!strcmp(header, "NNNN")) {
+		msg->eom = TRUE;
+		return TRUE;
+	}
+
+	strncpy(work, header, SAME_MAXLEN);
+	work[SAME_MAXLEN] = '\0';
+	fields = work;
+
+	// ZCZC-ORG-EEE-
+	if (((tok = strsep(&fields, "-")) == NULL) || strcmp(tok, "ZCZC"))
+		return FALSE;
+	if (((tok = strsep(&fields, "-")) == NULL) || (strlen(tok) != 3))
+		return FALSE;
+	strcpy(msg->originator, tok);
+	if (((tok = strsep(&fields, "-")) == NULL) || (strlen(tok) != 3))
+		return FALSE;
+	strcpy(msg->event, tok);
+
+	// PSSCCC-PSSCCC+TTTT
+	while ((tok = strsep(&fields, "-")) != NULL) {
+		char *plus = strchr(tok, '+');
+		if (plus != NULL)
+			*plus++ = '\0';
+		if ((strlen(tok) != 6) || (msg->nlocations == SAME_MAXLOC))
+			return FALSE;
+		strcpy(msg->locations[msg->nlocations++], tok);
+		if (plus != NULL) {
+			if (strlen(plus) != 4)
+				return FALSE;
+			strcpy(msg->purge, plus);
+			break;
+		}
+	}
+
+	// JJJHHMM-LLLLLLLL-
+	if (((tok = strsep(&fields, "-")) == NULL) || (strlen(tok) != 7))
+		return FALSE;
+	strcpy(msg->issued, tok);
+	if (((tok = strsep(&fields, "-")) == NULL) || (strlen(tok) == 0) || (strlen(tok) > 8))
+		return FALSE;
+	strcpy(msg->sender, tok);
+
+	return (msg->nlocations > 0);
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+static void same_burst_done(void)
+{
+	struct same_framer_t *s = &same_framer;
+	time_t now = same_now();
+	int64_t sample = (s->sample_clock != NULL) ? (*s->sample_clock)() : 0;
+
+	s->len = 0;
+	(*s->clr_sync)();
+
+	// the end of message flushes a header that was only heard once
+	if (!strcmp(s->burst, "NNNN")) {
+		if ((s->ngroup != 0) && !s->delivered)
+			same_deliver(s->group[0], s->groupsample);
+		s->ngroup = 0;
+		if (s->everyeom || ((now - s->eomtime) > SAME_GROUP_TIME)) {
+			s->eomtime = now;
+			same_deliver(s->burst, sample);
+		}
+		return;
+	}
+
+	// a new group starts after a quiet period
+	if ((s->ngroup != 0) && ((now - s->grouptime) > SAME_GROUP_TIME)) {
+		if (!s->delivered)
+			same_deliver(s->group[0], s->groupsample);
+		s->ngroup = 0;
+	}
+	if (s->ngroup == 0) {
+		s->grouptime = now;
+		s->groupsample = sample;
+		s->delivered = FALSE;
+	}
+	if (s->ngroup == SAME_BURSTS)
+		return;
+
+	// two identical bursts are good enough
+	for (int i = 0; i < s->ngroup; i++) {
+		if (!strcmp(s->group[i], s->burst) && !s->delivered) {
+			same_deliver(s->burst, s->groupsample);
+			s->delivered = TRUE;
+		}
+	}
+	strcpy(s->group[s->ngroup++], s->burst);
+
+	// three different ones get a character by character vote
+	if ((s->ngroup == SAME_BURSTS) && !s->delivered) {
+		char voted[SAME_MAXLEN + 1];
+		same_vote(voted);
+		BlackboxTrigger(BB_TRIG_VOTED);
+		same_deliver(voted, s->groupsample);
+		s->delivered = TRUE;
+	}
+}
+
+static void same_deliver(char *header, int64_t sample)
+{
+	SAME_MESSAGE msg;
+
+	if (!SameParse(header, &msg)) {
+		DEBUGLEVEL(DEBUG_SYNC)
+			fprintf(stderr, "Malformed SAME header: %s\n", header);
+		BlackboxTrigger(BB_TRIG_PARTIAL);
+		return;
+	}
+	msg.sample = sample;
+	(*same_framer.msg_func)(&msg);
+}
+
+// seconds, from the sample clock when there is one
+static time_t same_now(void)
+{
+	if (same_framer.sample_clock != NULL)
+		return (time_t)((*same_framer.sample_clock)() / SAMPLE_RATE);
+	return time(NULL);
+}
+
+static void same_vote(char *result)
+{
+	char (*g)[SAME_MAXLEN + 1] = same_framer.group;
+	size_t len = strlen(g[0]);
+
+	if ((strlen(g[1]) != len) || (strlen(g[2]) != len)) {
+		strcpy(result, g[0]);
+		return;
+	}
+	for (size_t i = 0; i < len; i++)
+		result[i] = (g[1][i] == g[2][i]) ? g[1][i] : g[0][i];
+	result[len] = '\0';
+}
@@ -0,0 +1,339 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Shared memory source
+
+	File Name:		  shmsource.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Lets one filereader feed several receivers. filereader
+					  creates a shared memory segment with a ring of 24 KHz
+					  samples for each device, tagged with its name, and
+					  writes each device's audio into its own ring. A
+					  receiver whose source is "shm:<name>:<tag>" attaches to
+					  that ring instead of starting a child process, and
+					  reads it in place of the pipe, waiting on a futex in
+					  the ring when it is empty. Each ring has one writer,
+					  and any number of receivers can read it.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "rtl.h"
+
+#define	SHM_NAME_LEN		64
+#define	SHM_NAME_PREFIX		"/piwxrx-"
+
+// the receiver's end
+struct shmsource_t {
+	BOOL		active;						// reading shared memory, not a pipe
+	SHM_HEADER	*shm;
+	size_t		size;						// mapped
+	SHM_STREAM	*stream;					// the one being read
+	RTL_SAMPLE	*ring;
+	uint64_t	rdpos;						// next sample to read
+	uint64_t	gaps;						// device gaps already counted
+	uint64_t	gapSamples;
+	uint32_t	reconnects;
+} shmsource;
+
+// internals
+static BOOL shm_name(char *name, char *buf);
+static RTL_SAMPLE *ring_of(SHM_HEADER *shm, int stream);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	ShmSourceCreate
+
+	INPUTS:		segment name, number of streams, their tags
+
+	OUTPUTS:	the segment, or NULL
+
+	DESCRIPTION:	create the shared memory for filereader to write, or
+					take it over from an earlier run
+
+---------------------------------------------------------------------------*/
+SHM_HEADER *ShmSourceCreate(char *name, int nstreams, char **tags)
+{
+	char path[SHM_NAME_LEN];
+	size_t size = sizeof(SHM_HEADER) + (size_t)nstreams * SHM_RING_LEN * sizeof(RTL_SAMPLE);
+	SHM_HEADER *shm;
+	int fd;
+
+	if ((nstreams < 1) || (nstreams > SHM_MAX_STREAMS) || !shm_name(name, path))
+		return NULL;
+	if ((fd = shm_open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+		fprintf(stderr, "Cannot create shared memory %s\n", path);
+		return NULL;
+	}
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return NULL;
+	}
+	shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		return NULL;
+
+	// receivers still attached see written go back and start again
+	memset(shm, 0, sizeof(SHM_HEADER));
+	shm->version = SHM_VERSION;
+	shm->nstreams = nstreams;
+	shm->ringlen = SHM_RING_LEN;
+	for (int i = 0; i < nstreams; i++)
+		snprintf(shm->streams[i].tag, SHM_TAG_LEN, "%s", tags[i]);
+	__atomic_store_n(&shm->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+	return shm;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	ShmSourceWrite
+
+	INPUTS:		segment, stream, samples at 24 KHz, number of them
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	add samples to a ring and wake its readers. A reader
+					too slow to keep up is lapped, and finds out.
+
+---------------------------------------------------------------------------*/
+void ShmSourceWrite(SHM_HEADER *shm, int stream, RTL_SAMPLE *samples, int nsamples)
+{
+	SHM_STREAM *st = &shm->streams[stream];
+	RTL_SAMPLE *ring = ring_of(shm, stream);
+	uint64_t pos = st->written;
+
+	while (nsamples > 0) {
+		int index = (int)(pos % SHM_RING_LEN);
+		int n = (nsamples > SHM_RING_LEN - index) ? SHM_RING_LEN - index : nsamples;
+		memcpy(&ring[index], samples, n * sizeof(RTL_SAMPLE));
+		samples += n;
+		nsamples -= n;
+		pos += n;
+	}
+	__atomic_store_n(&st->written, pos, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&st->seq, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &st->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// overruns and the silence the device filled in, for the readers' counters
+void ShmSourceGap(SHM_HEADER *shm, int stream, int gaps, int64_t samples)
+{
+	__atomic_add_fetch(&shm->streams[stream].gapSamples, (uint64_t)samples, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&shm->streams[stream].gaps, (uint64_t)gaps, __ATOMIC_RELEASE);
+}
+
+void ShmSourceReconnect(SHM_HEADER *shm, int stream)
+{
+	__atomic_add_fetch(&shm->streams[stream].reconnects, 1, __ATOMIC_RELEASE);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	ShmSourceOpen
+
+	INPUTS:		source "shm:<name>:<tag>"
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	attach the receiver to a ring; it starts with the next
+					samples written, not what the ring already holds
+
+---------------------------------------------------------------------------*/
+BOOL ShmSourceOpen(char *spec)
+{
+	char work[SHM_NAME_LEN + SHM_TAG_LEN], path[SHM_NAME_LEN], *name, *tag;
+	struct stat st;
+	SHM_HEADER *shm;
+	size_t size;
+	int fd;
+
+	snprintf(work, sizeof(work), "%s", &spec[strlen(SHM_PREFIX)]);
+	name = work;
+	if ((tag = strchr(work, ':')) == NULL) {
+		fprintf(stderr, "Source %s has no tag\n", spec);
+		return FALSE;
+	}
+	*tag++ = '\0';
+
+	// the ring in use is kept until the new one is known to be good
+	if (!shm_name(name, path))
+		return FALSE;
+	if ((fd = shm_open(path, O_RDONLY, 0)) < 0) {
+		fprintf(stderr, "Cannot open shared memory %s, is filereader running?\n", path);
+		return FALSE;
+	}
+	fstat(fd, &st);
+	size = st.st_size;
+	shm = (size >= sizeof(SHM_HEADER)) ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (shm == MAP_FAILED) {
+		fprintf(stderr, "Cannot map shared memory %s\n", path);
+		return FALSE;
+	}
+
+	if ((__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) || (shm->version != SHM_VERSION)
+		|| (shm->nstreams > SHM_MAX_STREAMS)
+		|| (size < sizeof(SHM_HEADER) + (size_t)shm->nstreams * shm->ringlen * sizeof(RTL_SAMPLE))) {
+		fprintf(stderr, "%s is not a filereader source\n", path);
+		munmap(shm, size);
+		return FALSE;
+	}
+	for (uint32_t i = 0; i < shm->nstreams; i++) {
+		if (!strncmp(shm->streams[i].tag, tag, SHM_TAG_LEN)) {
+			if (shmsource.shm != NULL)
+				munmap(shmsource.shm, shmsource.size);
+			shmsource.shm = shm;
+			shmsource.size = size;
+			shmsource.stream = &shm->streams[i];
+			shmsource.ring = ring_of(shm, i);
+			shmsource.rdpos = __atomic_load_n(&shmsource.stream->written, __ATOMIC_ACQUIRE);
+			shmsource.gaps = __atomic_load_n(&shmsource.stream->gaps, __ATOMIC_ACQUIRE);
+			shmsource.gapSamples = __atomic_load_n(&shmsource.stream->gapSamples, __ATOMIC_ACQUIRE);
+			shmsource.reconnects = __atomic_load_n(&shmsource.stream->reconnects, __ATOMIC_ACQUIRE);
+			shmsource.active = TRUE;
+			DEBUGLEVEL(DEBUG_MSGS)
+				fprintf(stderr, "Reading %s stream %u, %s\n", path, i, tag);
+			return TRUE;
+		}
+	}
+	fprintf(stderr, "%s has no stream %s\n", path, tag);
+	munmap(shm, size);
+	return FALSE;
+}
+
+BOOL ShmSourceActive(void)
+{
+	return shmsource.active;
+}
+
+// the timer thread may still be in ShmSourceRead, so the ring is
+// unmapped when the next one is opened
+void ShmSourceClose(void)
+{
+	shmsource.active = FALSE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	ShmSourceRead
+
+	INPUTS:		buffer, most samples to read
+
+	OUTPUTS:	samples read, 0 if none came within a timer tick
+
+	DESCRIPTION:	the shared memory counterpart of ReadFromPipe
+
+---------------------------------------------------------------------------*/
+int ShmSourceRead(RTL_SAMPLE *buffer, int bfrsiz)
+{
+	SHM_STREAM *st = shmsource.stream;
+	struct timespec timeout = { 0, MSTONS(TIMER_VALUE) };
+	uint64_t written, avail, gaps;
+	int nread = 0;
+
+	written = __atomic_load_n(&st->written, __ATOMIC_ACQUIRE);
+	if (written == shmsource.rdpos) {
+		uint32_t seq = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE);
+		written = __atomic_load_n(&st->written, __ATOMIC_ACQUIRE);
+		if (written == shmsource.rdpos) {
+			syscall(SYS_futex, &st->seq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+			written = __atomic_load_n(&st->written, __ATOMIC_ACQUIRE);
+		}
+	}
+	STATS_INC(STAT_PIPE_READS);
+
+	// filereader has started again
+	if (written < shmsource.rdpos)
+		shmsource.rdpos = written;
+
+	// lapped: skip to half a ring behind the writer
+	avail = written - shmsource.rdpos;
+	if (avail > SHM_RING_LEN - (uint64_t)bfrsiz) {
+		uint64_t lost = avail - SHM_RING_LEN / 2;
+		shmsource.rdpos += lost;
+		STATS_INC(STAT_SOURCE_GAPS);
+		STATS_ADD(STAT_SOURCE_GAP_SAMPLES, lost);
+		DEBUGLEVEL(DEBUG_MSGS)
+			fprintf(stderr, "Shared memory source lapped, %llu samples lost\n", (unsigned long long)lost);
+		avail = SHM_RING_LEN / 2;
+	}
+
+	while ((nread < bfrsiz) && (avail > 0)) {
+		int index = (int)(shmsource.rdpos % SHM_RING_LEN);
+		int n = bfrsiz - nread;
+		if ((uint64_t)n > avail)
+			n = (int)avail;
+		if (n > SHM_RING_LEN - index)
+			n = SHM_RING_LEN - index;
+		memcpy(&buffer[nread], &shmsource.ring[index], n * sizeof(RTL_SAMPLE));
+		nread += n;
+		avail -= n;
+		shmsource.rdpos += n;
+	}
+
+	// the device's own overruns and reconnections
+	if ((gaps = __atomic_load_n(&st->gaps, __ATOMIC_ACQUIRE)) != shmsource.gaps) {
+		uint64_t samples = __atomic_load_n(&st->gapSamples, __ATOMIC_RELAXED);
+		STATS_ADD(STAT_SOURCE_GAPS, gaps - shmsource.gaps);
+		STATS_ADD(STAT_SOURCE_GAP_SAMPLES, samples - shmsource.gapSamples);
+		shmsource.gaps = gaps;
+		shmsource.gapSamples = samples;
+	}
+
+	uint32_t reconnects = __atomic_load_n(&st->reconnects, __ATOMIC_ACQUIRE);
+	if (reconnects != shmsource.reconnects) {
+		STATS_ADD(STAT_SOURCE_RECONNECTS, reconnects - shmsource.reconnects);
+		shmsource.reconnects = reconnects;
+	}
+
+	if (nread < bfrsiz)
+		STATS_INC(STAT_SHORT_READS);
+	STATS_ADD(STAT_SAMPLES_READ, nread);
+	return nread;
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// the POSIX name of a segment, refusing one too long to fit
+static BOOL shm_name(char *name, char *buf)
+{
+	int maxlen = SHM_NAME_LEN - (int)sizeof(SHM_NAME_PREFIX);
+
+	if ((int)strlen(name) > maxlen) {
+		fprintf(stderr, "Shared memory name %s is longer than %d characters\n", name, maxlen);
+		return FALSE;
+	}
+	snprintf(buf, SHM_NAME_LEN, SHM_NAME_PREFIX "%.*s", maxlen, name);
+	return TRUE;
+}
+
+static RTL_SAMPLE *ring_of(SHM_HEADER *shm, int stream)
+{
+	return (RTL_SAMPLE *)(shm + 1) + (size_t)stream * shm->ringlen;
+}
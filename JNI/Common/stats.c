@@ -0,0 +1,316 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Runtime counters
+
+	File Name:		  stats.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Counters kept by the receive path: pipe reads, timer
+					  overruns, DSP ring depth, sync, data buffer, RTP and CPU
+					  time per stage. They are updated with relaxed atomics so
+					  the realtime threads never take a lock, and read out by
+					  getStats or served in Prometheus text format on a
+					  localhost port or a Unix socket.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "rtl.h"
+
+#define	STATS_TEXT_LEN		16384		// room for the whole exposition
+#define	RECEIVER_LEN		64			// receiver label
+
+uint64_t rtl_counters[STAT_COUNT];
+
+// how each counter is exposed
+static const struct stat_desc_t {
+	char		*name;					// metric name
+	char		*stage;					// stage label, CPU time only
+	char		*type;					// counter or gauge
+	char		*help;					// description
+} stat_desc[STAT_COUNT] = {
+	{ "piwxrx_samples_read_total", NULL, "counter", "Samples read from the source pipe" },
+	{ "piwxrx_pipe_reads_total", NULL, "counter", "Reads of the source pipe" },
+	{ "piwxrx_pipe_short_reads_total", NULL, "counter", "Pipe reads returning less than a full frame" },
+	{ "piwxrx_timer_ticks_total", NULL, "counter", "Timer signals received" },
+	{ "piwxrx_timer_overruns_total", NULL, "counter", "Timer expiries missed" },
+	{ "piwxrx_dsp_ring_highwater", NULL, "gauge", "Most samples waiting in the DSP ring" },
+	{ "piwxrx_dsp_ring_overruns_total", NULL, "counter", "Samples dropped with the DSP ring full" },
+	{ "piwxrx_sync_acquired_total", NULL, "counter", "FSK sync acquisitions" },
+	{ "piwxrx_sync_lost_total", NULL, "counter", "FSK sync cleared" },
+	{ "piwxrx_bytes_emitted_total", NULL, "counter", "Demodulated bytes put in the data buffer" },
+	{ "piwxrx_bytes_dropped_total", NULL, "counter", "Demodulated bytes dropped with the data buffer full" },
+	{ "piwxrx_rtp_packets_total", NULL, "counter", "RTP packets sent" },
+	{ "piwxrx_send_errors_total", NULL, "counter", "Socket send failures" },
+	{ "piwxrx_cpu_seconds_total", "pipe", "counter", "CPU time per stage" },
+	{ "piwxrx_cpu_seconds_total", "rtp", "counter", "CPU time per stage" },
+	{ "piwxrx_cpu_seconds_total", "queue", "counter", "CPU time per stage" },
+	{ "piwxrx_cpu_seconds_total", "demod", "counter", "CPU time per stage" },
+	{ "piwxrx_trace_events_total", NULL, "counter", "Trace events recorded" },
+	{ "piwxrx_trace_dropped_total", NULL, "counter", "Trace events dropped with the ring full" },
+	{ "piwxrx_blackbox_dumps_total", NULL, "counter", "Black box audio files written" },
+	{ "piwxrx_blackbox_suppressed_total", NULL, "counter", "Black box triggers held off" },
+	{ "piwxrx_arena_bytes", NULL, "gauge", "Size of the buffer arena" },
+	{ "piwxrx_arena_used_bytes", NULL, "gauge", "Bytes handed out from the buffer arena" },
+	{ "piwxrx_heap_allocs_total", NULL, "counter", "Heap allocations on pipeline threads after warm up" },
+	{ "piwxrx_rt_denied_total", NULL, "counter", "Realtime scheduling, affinity or memory locks refused" },
+	{ "piwxrx_source_gaps_total", NULL, "counter", "Capture overruns reported by the audio source" },
+	{ "piwxrx_source_gap_samples_total", NULL, "counter", "Samples of silence the source filled in for overruns" },
+	{ "piwxrx_source_reconnects_total", NULL, "counter", "USB devices the source lost and opened again" },
+	{ "piwxrx_source_restarts_total", NULL, "counter", "Source processes restarted after they died" },
+	{ "piwxrx_source_switches_total", NULL, "counter", "Sources swapped without stopping the receiver" },
+};
+
+struct stats_server_t {
+	char			receiver[RECEIVER_LEN];	// receiver label
+	int				listenfd;				// listening socket
+	BOOL			unixsock;				// Unix socket, no HTTP
+	char			path[108];				// its path, to remove
+	BOOL			running;				// server thread started
+	pthread_t		server_thread;			// server thread
+} stats_server = { .receiver = "piwxrx", .listenfd = -1 };
+
+// internals
+#ifndef _WIN32
+static void *stats_server_fn(void *arg);
+#endif
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	StatsInit
+
+	INPUTS:		receiver name for the metric labels
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	clear the counters
+
+---------------------------------------------------------------------------*/
+void StatsInit(char *receiver)
+{
+	for (int i = 0; i < STAT_COUNT; i++)
+		__atomic_store_n(&rtl_counters[i], 0, __ATOMIC_RELAXED);
+	LatencyInit();
+	if (receiver != NULL)
+		snprintf(stats_server.receiver, RECEIVER_LEN, "%s", receiver);
+}
+
+// raise a high water mark
+void StatsMax(int stat, uint64_t value)
+{
+	uint64_t current = __atomic_load_n(&rtl_counters[stat], __ATOMIC_RELAXED);
+
+	while ((value > current) && !__atomic_compare_exchange_n(&rtl_counters[stat], &current, value,
+		FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+// CPU time of the calling thread in ns
+uint64_t StatsThreadTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// snapshot of all the counters, in STAT_ order
+void GetStats(uint64_t *values)
+{
+	for (int i = 0; i < STAT_COUNT; i++)
+		values[i] = __atomic_load_n(&rtl_counters[i], __ATOMIC_RELAXED);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	StatsFormat
+
+	INPUTS:		buffer, size
+
+	OUTPUTS:	length of the text
+
+	DESCRIPTION:	format the counters and latencies in Prometheus text
+					format
+
+---------------------------------------------------------------------------*/
+int StatsFormat(char *buf, int size)
+{
+	uint64_t values[STAT_COUNT];
+	int len = 0;
+
+	GetStats(values);
+	buf[0] = '\0';
+	for (int i = 0; (i < STAT_COUNT) && (len < size); i++) {
+		const struct stat_desc_t *d = &stat_desc[i];
+
+		// one HELP and TYPE for a family of labelled values
+		if ((i == 0) || strcmp(d->name, stat_desc[i - 1].name))
+			len += snprintf(&buf[len], size - len, "# HELP %s %s\n# TYPE %s %s\n", d->name, d->help, d->name, d->type);
+		if (len >= size)
+			break;
+		if (d->stage != NULL)
+			len += snprintf(&buf[len], size - len, "%s{receiver=\"%s\",stage=\"%s\"} %.6f\n",
+				d->name, stats_server.receiver, d->stage, (double)values[i] * 1e-9);
+		else
+			len += snprintf(&buf[len], size - len, "%s{receiver=\"%s\"} %llu\n",
+				d->name, stats_server.receiver, (unsigned long long)values[i]);
+	}
+	if (len < size)
+		len += LatencyFormat(&buf[len], size - len, stats_server.receiver);
+	return (len < size) ? len : size - 1;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	StatsServerStart
+
+	INPUTS:		port number, or the path of a Unix socket
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	serve the counters: HTTP on 127.0.0.1:port for a
+					Prometheus scrape, or the bare text to anything that
+					connects to the Unix socket
+
+---------------------------------------------------------------------------*/
+#ifndef _WIN32
+BOOL StatsServerStart(char *endpoint)
+{
+	int fd, on = 1;
+
+	if (stats_server.running)
+		return TRUE;
+
+	if (endpoint[0] == '/') {
+		struct sockaddr_un addr;
+
+		if (strlen(endpoint) >= sizeof(addr.sun_path))
+			return FALSE;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, endpoint);
+		unlink(endpoint);
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			return FALSE;
+		if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			DEBUGLEVEL(DEBUG_MSGS)
+				fprintf(stderr, "Stats socket %s: %s\n", endpoint, geterrno(errno));
+			close(fd);
+			return FALSE;
+		}
+		stats_server.unixsock = TRUE;
+		strcpy(stats_server.path, endpoint);
+	} else {
+		struct sockaddr_in addr;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(atoi(endpoint));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+			return FALSE;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			DEBUGLEVEL(DEBUG_MSGS)
+				fprintf(stderr, "Stats port %s: %s\n", endpoint, geterrno(errno));
+			close(fd);
+			return FALSE;
+		}
+		stats_server.unixsock = FALSE;
+	}
+
+	if (listen(fd, 4) < 0) {
+		close(fd);
+		return FALSE;
+	}
+	stats_server.listenfd = fd;
+	stats_server.running = TRUE;
+	pthread_create(&stats_server.server_thread, NULL, stats_server_fn, NULL);
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "Serving stats on %s\n", endpoint);
+	return TRUE;
+}
+
+void StatsServerStop(void)
+{
+	if (!stats_server.running)
+		return;
+
+	// wakes the accept
+	shutdown(stats_server.listenfd, SHUT_RDWR);
+	pthread_join(stats_server.server_thread, NULL);
+	close(stats_server.listenfd);
+	if (stats_server.unixsock)
+		unlink(stats_server.path);
+	stats_server.listenfd = -1;
+	stats_server.running = FALSE;
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// one connection at a time; a scrape is a single short write
+static void *stats_server_fn(void *arg)
+{
+	char text[STATS_TEXT_LEN], header[128], request[512];
+	int conn;
+
+	while ((conn = accept(stats_server.listenfd, NULL, NULL)) >= 0) {
+		int len = StatsFormat(text, sizeof(text));
+		BOOL ok = TRUE;
+
+		if (!stats_server.unixsock) {
+			// the request itself does not matter, only that it has arrived
+			struct timeval tv = { 1, 0 };
+			setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+			if (recv(conn, request, sizeof(request), 0) < 0)
+				ok = FALSE;
+			int hlen = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n", len);
+			if (ok && (send(conn, header, hlen, MSG_NOSIGNAL) != hlen))
+				ok = FALSE;
+		}
+		if (ok)
+			send(conn, text, len, MSG_NOSIGNAL);
+		close(conn);
+	}
+	return NULL;
+}
+#else
+BOOL StatsServerStart(char *endpoint)
+{
+	return FALSE;
+}
+
+void StatsServerStop(void)
+{
+}
+#endif
@@ -0,0 +1,222 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Binary event trace
+
+	File Name:		  trace.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Replaces the per sample fprintf debugging of the DSP thread
+					  with fixed size binary events. Each thread that traces
+					  gets its own single producer ring, so recording an event
+					  is a few stores and never blocks; when a ring is full the
+					  event is counted and dropped. A low priority thread drains
+					  the rings to a file, which tracedump turns into CSV.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "rtl.h"
+
+#define	TRACE_RING_LEN		65536				// events per thread, power of 2
+#define	TRACE_MAX_RINGS		8					// threads that can trace
+#define	TRACE_PREALLOC		2					// rings allocated by TraceStart
+#define	TRACE_DRAIN_MS		100					// drain interval
+
+// one producer, one consumer
+typedef struct trace_ring_t {
+	uint32_t	head;							// next to write, producer
+	char		pad1[60];
+	uint32_t	tail;							// next to read, drain thread
+	char		pad2[60];
+	TRACE_EVENT	events[TRACE_RING_LEN];
+} TRACE_RING;
+
+int trace_mask;									// DEBUG_ flags being traced
+
+struct trace_t {
+	FILE			*fp;						// trace file
+	BOOL			exit;						// stop the drain thread
+	int				nrings;						// rings handed out
+	int				nalloc;						// rings allocated
+	TRACE_RING		*rings[TRACE_MAX_RINGS];
+	pthread_mutex_t	ring_mutex;					// handing out rings
+	pthread_t		drain_thread;
+} trace = { .ring_mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread TRACE_RING *my_ring;			// this thread's ring
+static __thread BOOL no_ring;					// none left for this thread
+
+// internals
+static TRACE_RING *get_ring(void);
+static void *drain_thread_fn(void *arg);
+static void drain(void);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	TraceStart
+
+	INPUTS:		file name, DEBUG_ flags to trace
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	open the trace file and start the drain thread
+
+---------------------------------------------------------------------------*/
+BOOL TraceStart(char *filename, int mask)
+{
+	TRACE_HEADER hdr = { TRACE_MAGIC, TRACE_VERSION, DEMOD_RATE, sizeof(TRACE_EVENT) };
+
+	if (trace.fp != NULL)
+		TraceStop();
+	if ((trace.fp = fopen(filename, "wb")) == NULL) {
+		fprintf(stderr, "Cannot open trace file %s\n", filename);
+		return FALSE;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, trace.fp);
+
+	// rings left from an earlier trace are emptied, not freed: their threads may still hold them
+	for (int i = 0; i < trace.nrings; i++)
+		trace.rings[i]->tail = __atomic_load_n(&trace.rings[i]->head, __ATOMIC_ACQUIRE);
+
+	// the tracing threads are realtime, they take rings allocated here
+	pthread_mutex_lock(&trace.ring_mutex);
+	while ((trace.nalloc < trace.nrings + TRACE_PREALLOC) && (trace.nalloc < TRACE_MAX_RINGS)
+		&& ((trace.rings[trace.nalloc] = calloc(1, sizeof(TRACE_RING))) != NULL))
+		trace.nalloc++;
+	pthread_mutex_unlock(&trace.ring_mutex);
+
+	trace.exit = FALSE;
+	pthread_create(&trace.drain_thread, NULL, drain_thread_fn, NULL);
+	__atomic_store_n(&trace_mask, mask & TRACE_FLAGS, __ATOMIC_RELEASE);
+	fprintf(stderr, "Tracing %x to %s\n", mask & TRACE_FLAGS, filename);
+	return TRUE;
+}
+
+void TraceStop(void)
+{
+	if (trace.fp == NULL)
+		return;
+
+	__atomic_store_n(&trace_mask, 0, __ATOMIC_RELEASE);
+	trace.exit = TRUE;
+	pthread_join(trace.drain_thread, NULL);
+	drain();
+	fclose(trace.fp);
+	trace.fp = NULL;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	TraceEvent
+
+	INPUTS:		event type, sample number, values
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	put an event in the calling thread's ring; use the TRACE
+					macro so nothing is done when the event is not traced
+
+---------------------------------------------------------------------------*/
+void TraceEvent(int type, uint64_t sample, int a, int b, int c)
+{
+	TRACE_RING *r = (my_ring != NULL) ? my_ring : get_ring();
+	uint32_t head, tail;
+
+	if (r == NULL)
+		return;
+	head = r->head;
+	tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= TRACE_RING_LEN) {
+		STATS_INC(STAT_TRACE_DROPPED);
+		return;
+	}
+
+	TRACE_EVENT *e = &r->events[head & (TRACE_RING_LEN - 1)];
+	e->sample = sample;
+	e->type = (uint8_t)type;
+	e->a = (int16_t)a;
+	e->b = (int16_t)b;
+	e->c = (int16_t)c;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// the first event from a thread takes a ring for it
+static TRACE_RING *get_ring(void)
+{
+	if (no_ring)
+		return NULL;
+
+	pthread_mutex_lock(&trace.ring_mutex);
+	if (trace.nrings < trace.nalloc)
+		my_ring = trace.rings[trace.nrings++];
+	else
+		no_ring = TRUE;
+	pthread_mutex_unlock(&trace.ring_mutex);
+	return my_ring;
+}
+
+// runs at idle priority, so it only uses time nothing else wants
+static void *drain_thread_fn(void *arg)
+{
+	struct timespec ts = { 0, TRACE_DRAIN_MS * 1000000L };
+#ifdef SCHED_IDLE
+	struct sched_param param = { 0 };
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+	while (!trace.exit) {
+		nanosleep(&ts, NULL);
+		drain();
+	}
+	return NULL;
+}
+
+static void drain(void)
+{
+	pthread_mutex_lock(&trace.ring_mutex);
+	int nrings = trace.nrings;
+	pthread_mutex_unlock(&trace.ring_mutex);
+
+	for (int i = 0; i < nrings; i++) {
+		TRACE_RING *r = trace.rings[i];
+		uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint32_t tail = r->tail;
+
+		// in at most two pieces, around the end of the ring
+		while (tail != head) {
+			uint32_t start = tail & (TRACE_RING_LEN - 1);
+			uint32_t n = head - tail;
+			if (n > TRACE_RING_LEN - start)
+				n = TRACE_RING_LEN - start;
+			for (uint32_t j = 0; j < n; j++)
+				r->events[start + j].ring = (uint8_t)i;
+			fwrite(&r->events[start], sizeof(TRACE_EVENT), n, trace.fp);
+			STATS_ADD(STAT_TRACE_EVENTS, n);
+			tail += n;
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	}
+	fflush(trace.fp);
+}
@@ -46,12 +46,23 @@
 
 #define	MARK		0x80	// mark bit
 
+#define	PLC_NOISE	16		// peak of the concealment noise floor
+
 short int sequence;         // current sequence from Java
 unsigned int timestamp;     // time stamp
 int codec;                  // codec of choice
 int gain;
+int gapfill = GAP_FILL_PLC; // how source underruns are filled
+int gapframes = 0;          // consecutive frames filled
 
 char *UDPbufferPtr  = NULL;
+RTL_SAMPLE lastFrame[PIPE_READ_LEN];	// last frame sent, for concealment
+int lastFrameLen = 0;
+int lastPayloadLen = 0;					// encoded length of last frame
+BOOL lastPayloadDeemph = FALSE;			// and whether it had deemphasis
+
+// internals
+static void udp_next_header(int decimlength, BOOL sent);
 
 BOOL InitUDP(unsigned char *hdrPtr, int nhdrbytes, char *remoteip, int remotePort, char *myip, int myport, int codectype, int gainvalue)
 {
@@ -65,7 +76,7 @@ BOOL InitUDP(unsigned char *hdrPtr, int nhdrbytes, char *remoteip, int remotePor
 		return TRUE;
 	}
 
-    if ((UDPbufferPtr = (char *)malloc((size_t)(2 * RTP_HDRLEN + (MAXUDPLEN+SPARE)))) == NULL)
+    if ((UDPbufferPtr = (char *)ArenaAlloc("rtp", (size_t)(2 * RTP_HDRLEN + (MAXUDPLEN+SPARE)))) == NULL)
       return(FALSE);
   
 	// process the header
@@ -79,6 +90,10 @@ BOOL InitUDP(unsigned char *hdrPtr, int nhdrbytes, char *remoteip, int remotePor
 				| ((unsigned int)UDPbufferPtr[TIMESTAMP + 2] & 0xff) << 8
 				| ((unsigned int)UDPbufferPtr[TIMESTAMP + 3] & 0xff);
 
+	gapframes = 0;
+	lastFrameLen = 0;
+	lastPayloadLen = 0;
+
 	// open the send socket: skip over leading "/" courtesy of Java
 	remoteip++; myip++;
 	DEBUGLEVEL(DEBUG_UDP)
@@ -90,6 +105,9 @@ BOOL InitUDP(unsigned char *hdrPtr, int nhdrbytes, char *remoteip, int remotePor
 		return(FALSE);
 	}
 
+	// RTCP is best effort; the stream runs without it
+	InitRTCP((unsigned char *)UDPbufferPtr, remoteip, remotePort, myip, myport);
+
     return TRUE;
   
 }
@@ -102,24 +120,177 @@ BOOL InitUDP(unsigned char *hdrPtr, int nhdrbytes, char *remoteip, int remotePor
 
 	OUTPUTS:	FALSE
 
-	DESCRIPTION:	free the buffers, if allocated
+	DESCRIPTION:	encode and send a frame of audio
 
 ---------------------------------------------------------------------------*/
 BOOL SendUDPPacket(RTL_SAMPLE *PipeBuffer, int samplesread)
 {
+	// keep a copy to conceal a later underrun
+	if ((codec != CODEC_NONE) && (samplesread <= PIPE_READ_LEN)) {
+		memcpy(lastFrame, PipeBuffer, samplesread * sizeof(RTL_SAMPLE));
+		lastFrameLen = samplesread;
+	}
+
     int decimlength = PCMEncode(PipeBuffer, samplesread, &UDPbufferPtr[RTP_HDRLEN], codec, gain);
 
 	// if we are writing to stdout, just return here...
 	if (codec == CODEC_NONE)
 		return TRUE;
+	lastPayloadLen = decimlength;
+	lastPayloadDeemph = ((debuglevel & DEBUG_DEEMPHASIS) != 0);
+
+	// first packet after comfort noise starts a new talkspurt
+	if (gapframes != 0) {
+		if (gapfill == GAP_FILL_CN)
+			UDPbufferPtr[HDR2] |= MARK;
+		gapframes = 0;
+	}
 
 	Send(UDPbufferPtr, decimlength +RTP_HDRLEN);
+	RTCPPacketSent(decimlength, timestamp);
 
 	DEBUGLEVEL(DEBUG_UDP)
 		fprintf(stderr, "s: %d..", decimlength + RTP_HDRLEN);
 
+	udp_next_header(decimlength, TRUE);
+
+	DEBUGLEVEL(DEBUG_UDP)
+		fprintf(stderr, "%d bytes sent: ts %d: seq %d\n", decimlength, timestamp, sequence);
+
+	return TRUE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SendUDPGap
+
+	INPUTS:		number of source samples missing
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	fill a source underrun so the RTP clock keeps running. In
+					CN mode an RFC 3389 comfort noise packet is sent, otherwise
+					the last frame is repeated at reduced level, then faded
+					to a low noise floor in the negotiated codec.
+
+---------------------------------------------------------------------------*/
+BOOL SendUDPGap(int samplesmissing)
+{
+	int decimlength = samplesmissing / AUDIO_DECIM;
+
+	if ((codec == CODEC_NONE) || (gapfill == GAP_FILL_NONE))
+		return FALSE;
+
+	if (gapfill == GAP_FILL_CN) {
+		// only the first CN packet is needed, after that just advance the clock
+		BOOL sent = (gapframes++ == 0);
+		if (sent) {
+			char pt = UDPbufferPtr[HDR2];
+			UDPbufferPtr[HDR2] = (pt & MARK) | CODEC_CN;
+			UDPbufferPtr[RTP_HDRLEN] = CN_LEVEL;
+			Send(UDPbufferPtr, RTP_HDRLEN + 1);
+			UDPbufferPtr[HDR2] = pt & ~MARK;
+			RTCPPacketSent(1, timestamp);
+		}
+		udp_next_header(decimlength, sent);
+		DEBUGLEVEL(DEBUG_UDP)
+			fprintf(stderr, "CN gap: ts %d: seq %d\n", timestamp, sequence);
+		return TRUE;
+	}
+
+	// packet loss concealment
+	RTL_SAMPLE fill[PIPE_READ_LEN];
+	if (samplesmissing > PIPE_READ_LEN)
+		samplesmissing = PIPE_READ_LEN;
+	ConcealFrame(fill, samplesmissing, ++gapframes, lastFrame, lastFrameLen);
+
+	decimlength = PCMEncode(fill, samplesmissing, &UDPbufferPtr[RTP_HDRLEN], codec, gain);
+	Send(UDPbufferPtr, decimlength + RTP_HDRLEN);
+	RTCPPacketSent(decimlength, timestamp);
+	udp_next_header(decimlength, TRUE);
+
+	DEBUGLEVEL(DEBUG_UDP)
+		fprintf(stderr, "PLC gap %d: ts %d: seq %d\n", gapframes, timestamp, sequence);
+	return TRUE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SetGapFill
+
+	INPUTS:		gap fill mode
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	select how source underruns are filled. CN should only be
+					used when payload type 13 was negotiated in the SDP.
+
+---------------------------------------------------------------------------*/
+void SetGapFill(int mode)
+{
+	gapfill = mode;
+}
+
+// the gap fill mode, which the multicast stream follows too
+int GetGapFill(void)
+{
+	return gapfill;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	ConcealFrame
+
+	INPUTS:		destination, samples wanted, frames filled so far
+				including this one, last frame sent and its length
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	build a frame to fill a gap: the last frame repeated
+					and attenuated by 6 dB per repeat, under a low noise
+					floor that is all that is left after the third
+
+---------------------------------------------------------------------------*/
+void ConcealFrame(RTL_SAMPLE *fill, int nsamples, int repeat, RTL_SAMPLE *last, int lastlen)
+{
+	for (int i = 0; i < nsamples; i++) {
+		int noise = (rand() % (2 * PLC_NOISE + 1)) - PLC_NOISE;
+		if ((repeat < 4) && (lastlen != 0))
+			fill[i] = (RTL_SAMPLE)((last[i % lastlen] >> repeat) + noise);
+		else
+			fill[i] = (RTL_SAMPLE)noise;
+	}
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	GetUDPPayload
+
+	INPUTS:		codec and gain wanted, destination buffer
+
+	OUTPUTS:	payload length, or 0 if not available
+
+	DESCRIPTION:	copy out the payload of the last frame sent, if it was
+					encoded the way it is wanted: same codec, same gain
+					and deemphasis the same as it is now
+
+---------------------------------------------------------------------------*/
+int GetUDPPayload(int wantcodec, int wantgain, char *dest)
+{
+	if ((codec != wantcodec) || (gain != wantgain) || (lastPayloadLen == 0)
+		|| (lastPayloadDeemph != ((debuglevel & DEBUG_DEEMPHASIS) != 0)))
+		return 0;
+
+	memcpy(dest, &UDPbufferPtr[RTP_HDRLEN], lastPayloadLen);
+	return lastPayloadLen;
+}
+
+// advance the timestamp in the header, and the sequence if a packet went out
+static void udp_next_header(int decimlength, BOOL sent)
+{
 	timestamp += decimlength;
-	sequence += 1;
+	if (sent)
+		sequence += 1;
 	UDPbufferPtr[HDR2] &= ~MARK;
 	UDPbufferPtr[SSEQ] = (sequence >> 8) & 0xff;
 	UDPbufferPtr[SSEQ + 1] = sequence & 0xff;
@@ -127,11 +298,6 @@ BOOL SendUDPPacket(RTL_SAMPLE *PipeBuffer, int samplesread)
 	UDPbufferPtr[TIMESTAMP + 1] = (timestamp >> 16) & 0xff;
 	UDPbufferPtr[TIMESTAMP + 2] = (timestamp >> 8) & 0xff;
 	UDPbufferPtr[TIMESTAMP + 3] = timestamp & 0xff;
-
-	DEBUGLEVEL(DEBUG_UDP)
-		fprintf(stderr, "%d bytes sent: ts %d: seq %d\n", decimlength, timestamp, sequence);
-
-	return TRUE;
 }
 
 /*---------------------------------------------------------------------------
@@ -142,14 +308,15 @@ BOOL SendUDPPacket(RTL_SAMPLE *PipeBuffer, int samplesread)
 
 	OUTPUTS:	none
 
-	DESCRIPTION:	Close socket and deallocate memory
+	DESCRIPTION:	Close the sockets. The packet buffer stays valid, in the
+					arena for the next InitUDP
 
 ---------------------------------------------------------------------------*/
 void CloseUDP(void)
 {
+	lastPayloadLen = 0;
 	if (codec != CODEC_NONE) {
-		if (UDPbufferPtr != NULL)
-			free(UDPbufferPtr);
+		CloseRTCP();
 		CloseSocket();
 	}
 }
@@ -39,19 +39,33 @@ WSADATA wsaData;
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <net/if.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #define	SOCKET_ERROR	-1
 typedef int		SOCKET;
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include "rtl.h"
 
 SOCKET datagram;
 struct sockaddr_in remote_addr;
 struct sockaddr_in my_addr;
 
+// RTCP runs on the paired odd port
+SOCKET rtcp_datagram = SOCKET_ERROR;
+struct sockaddr_in rtcp_remote_addr;
+struct sockaddr_in rtcp_my_addr;
+
+// multicast output, either IPv4 or IPv6
+SOCKET mcast_datagram = SOCKET_ERROR;
+struct sockaddr_storage mcast_addr;
+socklen_t mcast_addrlen;
+
 // return platform dependent error
 int PrintErr(void)
 {
@@ -121,8 +135,11 @@ BOOL OpenSocket(char *remoteip, int remoteport, char *myip, int myport)
 BOOL Send(const char *buffer, int nbytes)
 {
 	if (sendto(datagram, (const char *)buffer, nbytes, 0, (const struct sockaddr *)&remote_addr, sizeof(remote_addr))
-		!= SOCKET_ERROR)
+		!= SOCKET_ERROR) {
+		STATS_INC(STAT_RTP_PACKETS);
 		return TRUE;
+	}
+	STATS_INC(STAT_SEND_ERRORS);
     
 	DEBUGLEVEL(DEBUG_UDP)
 		fprintf(stderr, "Send failed %d\n", PrintErr());
@@ -149,3 +166,258 @@ void CloseSocket(void)
 	close(datagram);
 #endif
 }
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	OpenRTCPSocket
+
+	INPUTS:		remoteIP, remote RTCP port, myIP, my RTCP port
+
+	OUTPUTS:	RTCP socket created, TRUE if successful, FALSE otherwise
+
+	DESCRIPTION:	the RTCP socket is non-blocking so that receiver reports
+					can be polled from the timer thread
+
+---------------------------------------------------------------------------*/
+BOOL OpenRTCPSocket(char *remoteip, int remoteport, char *myip, int myport)
+{
+	rtcp_my_addr.sin_family = AF_INET;
+	rtcp_my_addr.sin_port = htons(myport);
+	inet_pton(AF_INET, myip, &rtcp_my_addr.sin_addr.s_addr);
+
+	rtcp_remote_addr.sin_family = AF_INET;
+	rtcp_remote_addr.sin_port = htons(remoteport);
+	inet_pton(AF_INET, remoteip, &rtcp_remote_addr.sin_addr.s_addr);
+
+	if ((rtcp_datagram = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		DEBUGLEVEL(DEBUG_UDP)
+			fprintf(stderr, "RTCP Socket error %d\n", PrintErr());
+		rtcp_datagram = SOCKET_ERROR;
+		return FALSE;
+	}
+
+	if (bind(rtcp_datagram, (const struct sockaddr *)&rtcp_my_addr, sizeof(rtcp_my_addr)) < 0) {
+		DEBUGLEVEL(DEBUG_UDP)
+			fprintf(stderr, "RTCP Bind failed %d\n", PrintErr());
+		CloseRTCPSocket();
+		return FALSE;
+	}
+
+#ifdef _WIN32
+	u_long nonblock = 1;
+	ioctlsocket(rtcp_datagram, FIONBIO, &nonblock);
+#else
+	fcntl(rtcp_datagram, F_SETFL, fcntl(rtcp_datagram, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	DEBUGPRINTF("Open RTCP Socket passed\n");
+
+	return TRUE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	    SendRTCP
+
+	INPUTS:		    buffer, length
+
+	OUTPUTS:	    TRUE if successful, FALSE otherwise
+
+	DESCRIPTION:	send a compound RTCP packet to the remote end
+
+---------------------------------------------------------------------------*/
+BOOL SendRTCP(const char *buffer, int nbytes)
+{
+	if (rtcp_datagram == SOCKET_ERROR)
+		return FALSE;
+
+	if (sendto(rtcp_datagram, (const char *)buffer, nbytes, 0, (const struct sockaddr *)&rtcp_remote_addr, sizeof(rtcp_remote_addr))
+		!= SOCKET_ERROR)
+		return TRUE;
+	STATS_INC(STAT_SEND_ERRORS);
+
+	DEBUGLEVEL(DEBUG_UDP)
+		fprintf(stderr, "RTCP Send failed %d\n", PrintErr());
+
+	return FALSE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	    ReceiveRTCP
+
+	INPUTS:		    buffer, buffer size
+
+	OUTPUTS:	    number of bytes received, 0 if nothing is waiting
+
+	DESCRIPTION:	poll the RTCP socket for a report from the remote end
+
+---------------------------------------------------------------------------*/
+int ReceiveRTCP(char *buffer, int bfrsiz)
+{
+	if (rtcp_datagram == SOCKET_ERROR)
+		return 0;
+
+	int nbytes = recvfrom(rtcp_datagram, buffer, bfrsiz, 0, NULL, NULL);
+	if (nbytes < 0)
+		return 0;
+
+	return nbytes;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	    CloseRTCPSocket
+
+	INPUTS:		    none
+
+	OUTPUTS:	    none
+
+	DESCRIPTION:	close the RTCP socket
+
+---------------------------------------------------------------------------*/
+void CloseRTCPSocket(void)
+{
+	if (rtcp_datagram == SOCKET_ERROR)
+		return;
+#ifdef _WIN32
+	closesocket(rtcp_datagram);
+#else
+	close(rtcp_datagram);
+#endif
+	rtcp_datagram = SOCKET_ERROR;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	OpenMulticastSocket
+
+	INPUTS:		group address (IPv4 or IPv6), port, ttl/hop limit,
+				interface name or NULL for the default route
+
+	OUTPUTS:	TRUE if successful, FALSE otherwise
+
+	DESCRIPTION:	open a socket to send to a multicast group
+
+---------------------------------------------------------------------------*/
+BOOL OpenMulticastSocket(char *group, int port, int ttl, char *ifname)
+{
+	struct addrinfo hints, *res;
+	char portstr[16];
+	unsigned int ifindex = 0;
+
+	if (mcast_datagram != SOCKET_ERROR) {
+		fprintf(stderr, "Multicast socket already open\n");
+		return FALSE;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST;
+	sprintf(portstr, "%d", port);
+
+	if (getaddrinfo(group, portstr, &hints, &res) != 0) {
+		fprintf(stderr, "Invalid multicast group %s\n", group);
+		return FALSE;
+	}
+	memcpy(&mcast_addr, res->ai_addr, res->ai_addrlen);
+	mcast_addrlen = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	// a unicast address here would send the stream to one host
+	if ((mcast_addr.ss_family == AF_INET6)
+		? !IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6 *)&mcast_addr)->sin6_addr)
+		: !IN_MULTICAST(ntohl(((struct sockaddr_in *)&mcast_addr)->sin_addr.s_addr))) {
+		fprintf(stderr, "%s is not a multicast group\n", group);
+		return FALSE;
+	}
+
+	if ((ifname != NULL) && (*ifname != '\0')) {
+		if ((ifindex = if_nametoindex(ifname)) == 0) {
+			fprintf(stderr, "Unknown multicast interface %s\n", ifname);
+			return FALSE;
+		}
+	}
+
+	if ((mcast_datagram = socket(mcast_addr.ss_family, SOCK_DGRAM, 0)) < 0) {
+		DEBUGLEVEL(DEBUG_UDP)
+			fprintf(stderr, "Multicast socket error %d\n", PrintErr());
+		mcast_datagram = SOCKET_ERROR;
+		return FALSE;
+	}
+
+	int status;
+	if (mcast_addr.ss_family == AF_INET6) {
+		status = setsockopt(mcast_datagram, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+		if ((status == 0) && (ifindex != 0))
+			status = setsockopt(mcast_datagram, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex));
+	} else {
+		unsigned char ttl4 = (unsigned char)ttl;
+		status = setsockopt(mcast_datagram, IPPROTO_IP, IP_MULTICAST_TTL, &ttl4, sizeof(ttl4));
+		if ((status == 0) && (ifindex != 0)) {
+			struct ip_mreqn mreq;
+			memset(&mreq, 0, sizeof(mreq));
+			mreq.imr_ifindex = ifindex;
+			status = setsockopt(mcast_datagram, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq));
+		}
+	}
+	if (status < 0) {
+		fprintf(stderr, "Multicast socket options failed %d\n", PrintErr());
+		CloseMulticastSocket();
+		return FALSE;
+	}
+
+	DEBUGPRINTF("Open Multicast Socket passed\n");
+
+	return TRUE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	    SendMulticast
+
+	INPUTS:		    buffer, length
+
+	OUTPUTS:	    TRUE if successful, FALSE otherwise
+
+	DESCRIPTION:	send a datagram to the multicast group
+
+---------------------------------------------------------------------------*/
+BOOL SendMulticast(const char *buffer, int nbytes)
+{
+	if (sendto(mcast_datagram, (const char *)buffer, nbytes, 0, (const struct sockaddr *)&mcast_addr, mcast_addrlen)
+		!= SOCKET_ERROR) {
+		STATS_INC(STAT_RTP_PACKETS);
+		return TRUE;
+	}
+	STATS_INC(STAT_SEND_ERRORS);
+
+	DEBUGLEVEL(DEBUG_UDP)
+		fprintf(stderr, "Multicast send failed %d\n", PrintErr());
+
+	return FALSE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	    CloseMulticastSocket
+
+	INPUTS:		    none
+
+	OUTPUTS:	    none
+
+	DESCRIPTION:	close the multicast socket
+
+---------------------------------------------------------------------------*/
+void CloseMulticastSocket(void)
+{
+	if (mcast_datagram == SOCKET_ERROR)
+		return;
+#ifdef _WIN32
+	closesocket(mcast_datagram);
+#else
+	close(mcast_datagram);
+#endif
+	mcast_datagram = SOCKET_ERROR;
+}
@@ -85,6 +85,158 @@ JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_startUDP
 JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_stopUDP
   (JNIEnv *, jobject);
 
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    startMulticast
+ * Signature: (Ljava/lang/String;IILjava/lang/String;II)Z
+ */
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_startMulticast
+  (JNIEnv *, jobject, jstring, jint, jint, jstring, jint, jint);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    stopMulticast
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_stopMulticast
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    setGapFill
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_setGapFill
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    getRTCPStats
+ * Signature: ()[I
+ */
+JNIEXPORT jintArray JNICALL Java_PiJNI_RTLsdrJNI_getRTCPStats
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    getStats
+ * Signature: ()[J
+ */
+JNIEXPORT jlongArray JNICALL Java_PiJNI_RTLsdrJNI_getStats
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    getRxTimestamp
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_PiJNI_RTLsdrJNI_getRxTimestamp
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    recordLatency
+ * Signature: (IJ)V
+ */
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_recordLatency
+  (JNIEnv *, jobject, jint, jlong);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    getLatency
+ * Signature: ()[J
+ */
+JNIEXPORT jlongArray JNICALL Java_PiJNI_RTLsdrJNI_getLatency
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    startTrace
+ * Signature: (Ljava/lang/String;I)Z
+ */
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_startTrace
+  (JNIEnv *, jobject, jstring, jint);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    stopTrace
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_stopTrace
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    configureRealtime
+ * Signature: (ILjava/lang/String;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_configureRealtime
+  (JNIEnv *, jobject, jint, jstring);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    lockMemory
+ * Signature: (Z)Z
+ */
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_lockMemory
+  (JNIEnv *, jobject, jboolean);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    startBlackbox
+ * Signature: (IZLjava/lang/String;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_startBlackbox
+  (JNIEnv *, jobject, jint, jboolean, jstring);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    dumpBlackbox
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_dumpBlackbox
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    stopBlackbox
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_stopBlackbox
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    startStatsServer
+ * Signature: (Ljava/lang/String;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_startStatsServer
+  (JNIEnv *, jobject, jstring);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    stopStatsServer
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_PiJNI_RTLsdrJNI_stopStatsServer
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    decodeOffline
+ * Signature: (Ljava/lang/String;IZ)[Ljava/lang/String;
+ */
+JNIEXPORT jobjectArray JNICALL Java_PiJNI_RTLsdrJNI_decodeOffline
+  (JNIEnv *, jobject, jstring, jint, jboolean);
+
+/*
+ * Class:     PiJNI_RTLsdrJNI
+ * Method:    reconfigureSource
+ * Signature: (Ljava/lang/String;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_PiJNI_RTLsdrJNI_reconfigureSource
+  (JNIEnv *, jobject, jstring);
+
 #ifdef __cplusplus
 }
 #endif
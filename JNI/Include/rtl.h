@@ -39,7 +39,9 @@ typedef unsigned short BOOL;
 char *geterrno(int errnum);
 #endif
 
+#include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 
 // debug modes
 #define	DEBUG_NONE		0x0000		// placeholder for no debug
@@ -60,6 +62,11 @@ char *geterrno(int errnum);
 #define	DEBUGLEVEL(x)	if(debuglevel&x)
 #define	BACKGDEBUG(x)	if(s->debuglevel&x) 
 
+// the debug flags that are traced to a file rather than printed
+#define	TRACE_FLAGS		(DEBUG_OSC|DEBUG_LPF|DEBUG_DEMOD|DEBUG_BITSHIFT|DEBUG_BYTEOUT|DEBUG_SYNC)
+#define	TRACE_FILE		"piwxrx.trace"	// default trace file
+#define	TRACE(x, type, n, a, b, c)	if(trace_mask&(x)) TraceEvent(type, n, a, b, c)
+
 extern int debuglevel;
 
 // local data types
@@ -87,6 +94,8 @@ extern "C" {
 #define		RAW_DECIM_RATE		(RAW_SAMPLE_RATE/SAMPLE_RATE)
 #define		AUDIO_DECIM			3         // audio decimate by 3
 #define		FSK_DECIM			2         // FSK decimate by 2
+#define		DEMOD_DECIM			2         // and by 2 again in the downconverter
+#define		DEMOD_RATE			(SAMPLE_RATE/FSK_DECIM/DEMOD_DECIM)	// discriminator and bit clock
 #define		PIPE_DECIM_RATE		1
 
 // stdio pipe defines
@@ -95,6 +104,15 @@ extern "C" {
 
 #define		USB_FRAME_SIZE		2		  // bytes in a frame
 #define		USB_READ_SIZE		1024	  // sizeof frame to read from USB
+#define		USB_PERIODS			8		  // periods in the capture ring
+#define		USB_POLL_MS			2000	  // no audio for this long is an error
+#define		USB_MAX_GAP_SECS	10		  // longest overrun made up with silence
+#define		SOURCE_GAP_MARKER	"piwxrx-gap"	// stderr line from the source for a gap
+#define		USB_MAX_DEVICES		8		  // open at once in one filereader
+#define		USB_MAX_FDS			4		  // poll descriptors for one device
+#define		USB_HOTPLUG_FDS		8		  // poll descriptors for hotplug events
+#define		USB_RETRY_MS		100		  // a lost device is looked for this often
+#define		SOURCE_RECONNECT_MARKER	"piwxrx-reconnect"	// stderr line from the source when a device is back
 #define		FILE_READ_SIZE		(PIPE_READ_LEN*RAW_DECIM_RATE)
 
 #define		MAXFSKLEN			(PIPE_READ_LEN/AUDIO_DECIM)
@@ -103,6 +121,11 @@ extern "C" {
 #define		RTP_HDRLEN			12
 #define		TIMER_VALUE			30
 
+// buffer arena: the pipe frame and the RTP packet, with room for alignment
+#define		ARENA_PIPELINE_SIZE	(sizeof(RTL_SAMPLE)*(PIPE_READ_SIZE+SPARE) + 2*RTP_HDRLEN+MAXUDPLEN+SPARE + 4*64)
+#define		ARENA_WARMUP_TICKS	33		  // about 1 s of timer ticks
+#define		BB_BYTES(m, ulaw)	((size_t)(m) * 60 * SAMPLE_RATE * ((ulaw) ? 1 : sizeof(RTL_SAMPLE)))
+
 #define		MSTONS(x)		((long long)x*(long long)1000000)
 // codec types in SDP
 #define		CODEC_NONE			-1		// no codec
@@ -118,9 +141,15 @@ extern "C" {
 #define		CODEC_G728	        15		// G728
 #define		CODEC_G729	        18		// G729
 
+// how to fill an underrun of the audio source
+#define		GAP_FILL_NONE		0		// send nothing
+#define		GAP_FILL_PLC		1		// repeat and fade the last frame
+#define		GAP_FILL_CN			2		// RFC 3389 comfort noise
+#define		CN_LEVEL			70		// comfort noise level, -dBov
+
 #define		BITSPERBYTE			8		// demod bits/byte
-#define		BIT_DIVISOR			23		// bit time divisor
-#define		SWALLOW_CTR			23		// swallow ctr init
+#define		BIT_DIVISOR			11		// bit time divisor
+#define		SWALLOW_CTR			1		// swallow ctr init
 #define		SYNC_BYTE			0xAB	// sync byte
 
 // sample rates
@@ -130,11 +159,45 @@ extern "C" {
 #define I_CHANNEL				0             // I demod channel
 #define Q_CHANNEL				1             // Q demod channel
 #define	SAMPLE_BFRSIZ			4096		  // sizeof (sample buffer)
-#define	BIT_TIME				23			  // nominal bit time
-#define DUAL_MODULUS			24			  // interval for dual modulus prescaler	
+#define	BIT_TIME				11			  // nominal bit time
+#define DUAL_MODULUS			2			  // interval for dual modulus prescaler
+
+// downconverter filter, see fir.c
+#define USE_HANN_LP				1			  // use hann lp instead of kaiser
+#if USE_HANN_LP
+#define N_FIR_TAPS				45			  // number of taps
+#define MAC_SHIFT				16			  // shift out of MAC
+#else
+#define N_FIR_TAPS				17			  // number of taps
+#define MAC_SHIFT				15			  // shift out of MAC
+#endif
+#define	FIR_CENTRE				(N_FIR_TAPS/2)	// taps are symmetric about this one
+
+// discriminator and sync correlator, see demod.c
+#define	DISCRIM_DELAY			(DEMOD_RATE/1000)	// 1 ms
+#define	N_CORR_BITS				(BITSPERBYTE*2)	  // two sync bytes
+#define	SAME_BAUD_X6			3125		  // 520.83 baud, times 6
+#define	BIT_OFFSET(i)			(((i)*DEMOD_RATE*6 + SAME_BAUD_X6/2) / SAME_BAUD_X6)	// nearest sample to bit i
+#define	CORR_LENGTH				(BIT_OFFSET(N_CORR_BITS - 1) + 1)
 
 #define BUFFER_EMPTY(x)		((x.rdptr) == (x.wrptr))
 
+// bit and byte recovery for one channel, after the discriminator
+typedef struct demod_chan_t {
+	RTL_SAMPLE	dcslice_level;			// dc slicer level
+	BOOL		insync;					// sync code found
+	BOOL		bytesync;				// sync byte found
+	BOOL		bit_time;				// at a bit time
+	int			bitctr;					// bit counter
+	DEMOD_BYTE	demod_byte;				// byte being received
+	DEMOD_BYTE	current_sense;			// current data sense
+	int			xingcnt;				// samples since the sense changed
+	int			divisor;				// outer divisor
+	int			swallow_ctr;			// swallow counter
+	int			corrptr;				// newest bit in the correlator
+	DATA_BIT	correlator[2*CORR_LENGTH];	// recent bits, newest first, twice over
+} DEMOD_CHAN;
+
 typedef uint16_t	USB_DEV_ID;			// device ID
 
 // USB device ID's
@@ -145,24 +208,445 @@ typedef struct usb_dev_t	{
 	uint32_t	partID;					// ID of the part found
 	uint8_t		cardNum;				// card number
 	int			recordSize;				// record size
+	// what the device gave
+	int			sampleRate;				// its own rate
+	int			channels;				// only the first is used
+	int			slot;					// capture state in usb.c
+	int			xruns;					// overruns so far
+	int64_t		gapSamples;				// silence filled in for them, at 24 KHz
 } USB_AUDIO_DEV;
 
+// several sources in one process, see shmsource.c
+#define		SHM_MAGIC			0x52585750		// "PWXR"
+#define		SHM_VERSION			1
+#define		SHM_MAX_STREAMS		8
+#define		SHM_TAG_LEN			16
+#define		SHM_RING_LEN		65536			// samples per stream, about 2.7 s
+#define		SHM_PREFIX			"shm:"			// source cmdline shm:<name>:<tag>
+#define		SHM_RETRY_TICKS		33				// a ring switched to is looked for once a second
+
+// one stream, a cache line to itself
+typedef struct shm_stream_t {
+	char		tag[SHM_TAG_LEN];		// which device
+	uint64_t	written;				// samples ever written
+	uint64_t	gaps;					// overruns reported by the device
+	uint64_t	gapSamples;				// silence filled in for them
+	uint32_t	seq;					// bumped after a write, futex for readers
+	uint32_t	reconnects;				// times the device was lost and found again
+	uint32_t	pad[6];
+} SHM_STREAM;
+
+// at the start of the shared memory, the rings follow it
+typedef struct shm_header_t {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	nstreams;
+	uint32_t	ringlen;				// samples in each ring
+	char		pad[48];
+	SHM_STREAM	streams[SHM_MAX_STREAMS];
+} SHM_HEADER;
+
+// trace events, in a file after a TRACE_HEADER
+#define		TRACE_MAGIC		0x52545750		// "PWTR"
+#define		TRACE_VERSION	1
+
+#define		TRACE_INPUT		1		// demod input sample
+#define		TRACE_LPF		2		// I and Q after the low pass filter
+#define		TRACE_DEMOD		3		// phase, dc slice level, bit time
+#define		TRACE_BIT		4		// bit time, bit decision
+#define		TRACE_BYTE		5		// byte out, bytes since sync
+#define		TRACE_SYNC		6		// 1 acquired, 0 cleared
+
+typedef struct trace_header_t {
+	uint32_t	magic;					// TRACE_MAGIC
+	uint32_t	version;				// TRACE_VERSION
+	uint32_t	rate;					// sample rate of the sample numbers
+	uint32_t	eventsize;				// sizeof(TRACE_EVENT)
+} TRACE_HEADER;
+
+typedef struct trace_event_t {
+	uint64_t	sample;					// demod sample number
+	uint8_t		type;					// TRACE_ type
+	uint8_t		ring;					// ring, one per thread
+	int16_t		a, b, c;				// values
+} TRACE_EVENT;
+
+extern int trace_mask;
+
+// SAME message fields
+#define		SAME_MAXLEN		268		// longest header
+#define		SAME_MAXLOC		31		// most locations in a header
+
+typedef struct same_msg_t	{
+	char		raw[SAME_MAXLEN + 1];	// header as received
+	BOOL		eom;					// end of message marker
+	char		originator[4];			// ORG
+	char		event[4];				// EEE
+	int			nlocations;				// number of locations
+	char		locations[SAME_MAXLOC][7];	// PSSCCC
+	char		purge[5];				// TTTT
+	char		issued[8];				// JJJHHMM
+	char		sender[9];				// LLLLLLLL
+	int64_t		sample;					// offset at the pipe rate, offline only
+	int64_t		capture;				// capture time of the last byte, LatencyNow ns
+} SAME_MESSAGE;
+
+// SAME generator settings
+typedef struct same_gen_t	{
+	double		amplitude;				// peak tone amplitude
+	BOOL		noise;					// add white noise
+	double		snr_db;					// tone to noise ratio over the band
+	BOOL		fm_noise;				// noise rising with frequency
+	double		carrier_offset;			// tone offset, Hz
+	double		clock_ppm;				// bit clock offset, ppm
+	double		fade_hz;				// Rayleigh fading doppler, 0 for none
+	double		click_rate;				// FM discriminator clicks/sec
+	double		wat_seconds;			// length of the alarm tone
+	unsigned	seed;					// noise seed
+} SAME_GEN;
+
+// RTCP network statistics
+typedef struct rtcp_stats_t	{
+	uint32_t	packets_sent;			// RTP packets sent
+	uint32_t	octets_sent;			// RTP payload octets sent
+	uint32_t	reports_sent;			// sender reports sent
+	uint32_t	reports_received;		// receiver reports received
+	uint32_t	fraction_lost;			// loss since last RR, in 1/256
+	uint32_t	cumulative_lost;		// total packets lost
+	uint32_t	highest_seq;			// extended highest sequence received
+	uint32_t	jitter_us;				// interarrival jitter
+	uint32_t	rtt_ms;					// round trip time
+} RTCP_STATS;
+
+// order of the fields returned by getRTCPStats
+#define		RTCP_STAT_PACKETS		0
+#define		RTCP_STAT_OCTETS		1
+#define		RTCP_STAT_SR_SENT		2
+#define		RTCP_STAT_RR_RCVD		3
+#define		RTCP_STAT_FRACTION		4
+#define		RTCP_STAT_LOST			5
+#define		RTCP_STAT_HIGHSEQ		6
+#define		RTCP_STAT_JITTER		7
+#define		RTCP_STAT_RTT			8
+#define		RTCP_STAT_COUNT			9
+
+// runtime counters, in the order returned by getStats
+#define		STAT_SAMPLES_READ		0		// samples read from the pipe
+#define		STAT_PIPE_READS			1		// reads of the pipe
+#define		STAT_SHORT_READS		2		// reads returning less than asked
+#define		STAT_TIMER_TICKS		3		// timer signals
+#define		STAT_TIMER_OVERRUNS		4		// timer expiries missed
+#define		STAT_DSP_HIGHWATER		5		// most samples waiting in the DSP ring
+#define		STAT_DSP_OVERRUNS		6		// samples dropped, DSP ring full
+#define		STAT_SYNC_ACQUIRED		7		// sync correlator matches
+#define		STAT_SYNC_LOST			8		// sync cleared
+#define		STAT_BYTES_EMITTED		9		// bytes put in the data buffer
+#define		STAT_BYTES_DROPPED		10		// bytes dropped, data buffer full
+#define		STAT_RTP_PACKETS		11		// RTP packets sent, unicast and multicast
+#define		STAT_SEND_ERRORS		12		// sendto failures
+#define		STAT_CPU_PIPE			13		// ns reading and decimating the pipe
+#define		STAT_CPU_RTP			14		// ns encoding and sending RTP
+#define		STAT_CPU_QUEUE			15		// ns queueing samples to the DSP ring
+#define		STAT_CPU_DEMOD			16		// ns in the DSP thread
+#define		STAT_TRACE_EVENTS		17		// trace events recorded
+#define		STAT_TRACE_DROPPED		18		// trace events dropped, ring full
+#define		STAT_BLACKBOX_DUMPS		19		// black box files written
+#define		STAT_BLACKBOX_SUPPRESSED 20		// black box triggers held off
+#define		STAT_ARENA_SIZE			21		// bytes in the buffer arena
+#define		STAT_ARENA_USED			22		// bytes handed out from it
+#define		STAT_HEAP_ALLOCS		23		// heap allocations on pipeline threads after warm up
+#define		STAT_RT_DENIED			24		// scheduling, affinity or memory locks refused
+#define		STAT_SOURCE_GAPS		25		// overruns reported by the source
+#define		STAT_SOURCE_GAP_SAMPLES	26		// samples of silence filled in for them
+#define		STAT_SOURCE_RECONNECTS	27		// devices the source lost and found again
+#define		STAT_SOURCE_RESTARTS	28		// source processes started again after dying
+#define		STAT_SOURCE_SWITCHES	29		// sources changed by ReconfigureSource
+#define		STAT_COUNT				30
+
+extern uint64_t rtl_counters[STAT_COUNT];
+
+// pipeline threads with their own scheduling
+#define		RT_TIMER				0		// reads the pipe
+#define		RT_DSP					1		// demodulates
+#define		RT_CAPTURE				2		// supervises the source and its stderr
+#define		RT_THREADS				3
+
+// black box dump reasons
+#define		BB_TRIG_SYNC			0		// sync lost in the middle of a header
+#define		BB_TRIG_PARTIAL			1		// header framed but malformed
+#define		BB_TRIG_VOTED			2		// three different bursts, voted
+#define		BB_TRIG_REQUEST			3		// asked for by Java
+#define		BB_TRIG_SIGNAL			4		// SIGUSR1
+#define		BB_TRIG_COUNT			5
+
+// latency hops, in the order returned by getLatency
+#define		LAT_TIMER				0		// timer expiry to the timer thread running
+#define		LAT_QUEUE				1		// pipe read to samples in the DSP ring
+#define		LAT_DSP					2		// samples in the DSP ring to demodulated
+#define		LAT_BYTE				3		// capture to byte in the data buffer
+#define		LAT_READER				4		// byte in the data buffer to the reader
+#define		LAT_FRAMED				5		// capture to header framed
+#define		LAT_DELIVERED			6		// capture to forwarded
+#define		LAT_WAKEUP				7		// samples queued to the DSP thread running
+#define		LAT_COUNT				8
+
+// fields per hop returned by getLatency, in us
+#define		LAT_FIELD_COUNT			0
+#define		LAT_FIELD_P50			1
+#define		LAT_FIELD_P99			2
+#define		LAT_FIELD_MAX			3
+#define		LAT_FIELDS				4
+
+// 48 to 24 KHz halfband decimator, see halfband.c
+#define		HB_PAIRS				8		// non zero taps each side of the centre
+#define		HB_HIST					16		// history kept, at least 2*HB_PAIRS-1
+#define		HB_BLOCK				256		// sample pairs filtered at a time
+
+typedef struct halfband_t {
+	int16_t		even[HB_HIST + HB_BLOCK];	// even input samples
+	int16_t		odd[HB_HIST + HB_BLOCK];	// odd ones
+	unsigned char carry[4];				// partial pair from the last call
+	int			ncarry;
+	BOOL		bigendian;				// input byte order
+	int			shift;					// 15 less the gain
+	int			round;					// half an output bit
+} HALFBAND;
+
+// any other input rate to 24 KHz, see resample.c
+#define		RS_BLOCK				512		// input samples converted at a time
+#define		RS_MAX_TAPS				192		// per phase
+#define		RS_MAX_PHASES			512		// the L of L/M
+
+typedef struct resampler_t {
+	int			rate;					// input rate
+	int			up;						// L
+	int			down;					// M
+	int			taps;					// per phase
+	int16_t		*coeffs;				// up phases of taps, time reversed
+	int16_t		hist[RS_MAX_TAPS + RS_BLOCK];	// input samples
+	int			next;					// newest input sample of the next output
+	int			phase;					// of the next output
+	unsigned char carry;				// odd byte from the last call
+	int			ncarry;
+	BOOL		bigendian;				// input byte order
+	int			gain;					// as a left shift
+	int			shift;					// RS_COEFF_BITS less the gain
+	int			round;					// half an output bit
+	HALFBAND	hb;						// 48 KHz is done by the halfband
+} RESAMPLER;
+
+// several channels demodulated together, one to a SIMD lane, see lanes.c;
+// built into dspbench only, it is not in the library
+#define		DSP_LANES				8		// most channels in one demodulator
+#define		LANE_DLY_LEN			8		// discriminator history, more than DISCRIM_DELAY
+
+typedef struct lane_demod_t {
+	int			nlanes;					// channels in use
+	unsigned	t;						// 12 KHz sample number, the same on every lane
+	int			wrptr;					// oldest sample in the window
+	int16_t		window[2*N_FIR_TAPS][DSP_LANES];	// each sample twice, the lanes side by side
+	RTL_SAMPLE	Idly[LANE_DLY_LEN][DSP_LANES];		// downconverter outputs for the discriminator
+	RTL_SAMPLE	Qdly[LANE_DLY_LEN][DSP_LANES];
+	int			dlyptr;					// newest in the history
+	uint64_t	position;				// samples demodulated at DEMOD_RATE
+	DEMOD_CHAN	chan[DSP_LANES];		// bit recovery, one per channel
+	void		(*byte_rx_func)(int lane, DEMOD_BYTE x);	// gets the bytes of every channel
+} LANE_DEMOD;
+
+// FLAC frames one at a time, see flac.c
+#define		FLAC_INBUF				4096	// bytes read from the file at a time
+#define		FLAC_MAX_BITS			24		// widest samples decoded
+
+typedef struct flac_decoder_t {
+	FILE		*fp;
+	unsigned char in[FLAC_INBUF];
+	int			inpos;					// next byte in it
+	int			inlen;
+	uint64_t	cache;					// bits not yet taken
+	int			nbits;
+	BOOL		eof;
+	// from STREAMINFO
+	int			rate;
+	int			channels;
+	int			bits;
+	int			maxblock;
+	int64_t		total;					// samples, 0 if not known
+	// the last frame
+	int32_t		*chan[3];				// first two channels, then the rest in turn
+	int			blocksize;
+	int			framebits;				// of its samples
+} FLAC_DECODER;
+
+// WAV, FLAC or raw files, see audiofile.c
+#define		AF_RAW					0
+#define		AF_WAV					1
+#define		AF_FLAC					2
+#define		AF_MAP_WINDOW			(16*1024*1024)	// of a WAV file mapped at once
+
+typedef struct audio_file_t {
+	int			format;					// AF_...
+	int			rate;					// from the header, or as given for raw
+	BOOL		bigendian;				// of the samples AudioFileRead gives
+	FILE		*fp;
+	unsigned char head[4];				// read to tell the format
+	int			nhead;					// still to be given, raw only
+	// WAV
+	int			encoding;				// WAVE_FORMAT_ tag
+	int			channels;
+	int			width;					// bytes per sample
+	int			align;					// bytes per frame
+	int64_t		pos;					// file offset of the next frame
+	int64_t		end;					// and of the end of the data
+	unsigned char *map;					// window on a WAV file, or NULL if streamed
+	int64_t		mapoff;
+	size_t		maplen;
+	// samples as read or converted
+	unsigned char *raw;
+	int			rawlen;
+	RTL_SAMPLE	*out;
+	int			outlen;
+	FLAC_DECODER *flac;
+	int			flacpos;				// next sample of the frame
+} AUDIO_FILE;
+
+typedef struct latency_summary_t {
+	uint64_t	count;					// values recorded
+	uint64_t	sum_us;					// their sum
+	uint64_t	p50_us;					// median
+	uint64_t	p99_us;					// 99th percentile
+	uint64_t	max_us;					// largest
+} LATENCY_SUMMARY;
+
+#define		STATS_ADD(n, v)		__atomic_add_fetch(&rtl_counters[n], (uint64_t)(v), __ATOMIC_RELAXED)
+#define		STATS_INC(n)		STATS_ADD(n, 1)
+
 // from RTL.c: these are links in from the JNI
 BOOL InitRTL(char *cmdline, void (*rx_func)(DEMOD_BYTE x), int debuglevel);
 BOOL RunRTL(void);
 void StopRTL(void);
+BOOL ReconfigureSource(char *cmdline);
 void ClrFSKSync(void);
 BOOL StartUDP(unsigned char *hdrPtr, int nhdrbytes, char *remoteip, int remotePort, char *myip, int myport, int codec, int gain);
 void StopUDP(void);
+BOOL StartMulticast(char *group, int port, int ttl, char *ifname, int codec, int gain);
+void StopMulticast(void);
+
+// from offline.c
+void OfflineInit(int64_t base, void (*msg_func)(SAME_MESSAGE *msg), int debug);
+void OfflineDecode(RTL_SAMPLE *samples, int nsamples);
+void OfflineFlush(void);
+BOOL DecodeOffline(char *filename, int rate, BOOL bigendian, void (*msg_func)(SAME_MESSAGE *msg), int debug);
+
+// from stats.c
+void StatsInit(char *receiver);
+void StatsMax(int stat, uint64_t value);
+uint64_t StatsThreadTime(void);
+void GetStats(uint64_t *values);
+int StatsFormat(char *buf, int size);
+BOOL StatsServerStart(char *endpoint);
+void StatsServerStop(void);
+
+// from trace.c
+BOOL TraceStart(char *filename, int mask);
+void TraceStop(void);
+void TraceEvent(int type, uint64_t sample, int a, int b, int c);
+
+// from arena.c
+BOOL ArenaInit(size_t size);
+void *ArenaAlloc(char *name, size_t size);
+void ArenaSeal(void);
+void ArenaStrict(BOOL strict);
+void ArenaThread(void);
+void ArenaHeapCheck(size_t size);
+
+// from rtsched.c
+BOOL RTConfigure(int thread, char *spec);
+void RTApply(int thread);
+void RTRelease(int thread);
+BOOL RTLockMemory(BOOL lock);
+
+// from halfband.c
+void HalfbandInit(HALFBAND *hb, BOOL bigendian, int gain);
+int HalfbandDecimate(HALFBAND *hb, unsigned char *in, int nbytes, RTL_SAMPLE *out);
+
+// from resample.c
+BOOL ResampleInit(RESAMPLER *rs, int rate, BOOL bigendian, int gain);
+void ResampleFree(RESAMPLER *rs);
+int ResampleMaxOut(RESAMPLER *rs, int nbytes);
+int Resample(RESAMPLER *rs, unsigned char *in, int nbytes, RTL_SAMPLE *out);
+
+// from lanes.c
+void LaneDemodInit(LANE_DEMOD *ld, int nlanes, void (*rx_func)(int lane, DEMOD_BYTE x));
+void LaneDemod(LANE_DEMOD *ld, RTL_SAMPLE *in[], int samples_read);
+void LaneClearSync(LANE_DEMOD *ld, int lane);
+
+// from flac.c
+BOOL FlacOpen(FLAC_DECODER *fl, FILE *fp);
+int FlacDecode(FLAC_DECODER *fl);
+void FlacFree(FLAC_DECODER *fl);
+
+// from audiofile.c
+BOOL AudioFileOpen(AUDIO_FILE *af, char *filename, int rate, BOOL bigendian);
+int AudioFileRead(AUDIO_FILE *af, unsigned char **data, int nbytes);
+void AudioFileClose(AUDIO_FILE *af);
+
+// from shmsource.c
+SHM_HEADER *ShmSourceCreate(char *name, int nstreams, char **tags);
+void ShmSourceWrite(SHM_HEADER *shm, int stream, RTL_SAMPLE *samples, int nsamples);
+void ShmSourceGap(SHM_HEADER *shm, int stream, int gaps, int64_t samples);
+void ShmSourceReconnect(SHM_HEADER *shm, int stream);
+BOOL ShmSourceOpen(char *spec);
+BOOL ShmSourceActive(void);
+int ShmSourceRead(RTL_SAMPLE *buffer, int bfrsiz);
+void ShmSourceClose(void);
+
+// from blackbox.c
+BOOL BlackboxStart(int minutes, BOOL ulaw, char *directory);
+void BlackboxStop(void);
+void BlackboxWrite(RTL_SAMPLE *samples, int nsamples);
+void BlackboxTrigger(int reason);
+
+// from latency.c
+void LatencyInit(void);
+int64_t LatencyNow(void);
+void LatencyRecord(int hop, int64_t start);
+void LatencyGet(int hop, LATENCY_SUMMARY *summary);
+int LatencyFormat(char *buf, int size, char *receiver);
 
 // from databuffer.c
 void databuffer_init(void);
 void databuffer_put(DEMOD_BYTE byterx);
 DEMOD_BYTE databuffer_get(void);
+int64_t databuffer_capture(void);
+
+// from same.c
+void SameFramerInit(void (*msg_func)(SAME_MESSAGE *msg), void (*clr_sync)(void));
+void SameFramerClock(int64_t (*sample_clock)(void));
+void SameFramerEveryEOM(BOOL every);
+void SameFramerFlush(void);
+void SameFramerByte(DEMOD_BYTE data);
+BOOL SameParse(char *header, SAME_MESSAGE *msg);
+
+// from samegen.c
+int SameGenerate(SAME_GEN *g, char *header, RTL_SAMPLE **out);
+
+// from samedb.c
+BOOL SameDBLoad(char *filename);
+BOOL SameDBCompile(char *jsonfile, char *imagefile);
+char *SameDBAgency(char *sender);
+char *SameDBEvent(char *event);
+char *SameDBLocation(char *location);
+int SameDBDateOffset(void);
+int SameDBHourOffset(void);
 
 // from UDP.c
 BOOL InitUDP(unsigned char *hdrPtr, int nhdrbytes, char *remoteip, int remotePort, char *myip, int myport, int codec, int gain);
 BOOL SendUDPPacket(RTL_SAMPLE *PipeBuffer, int bytesread);
+BOOL SendUDPGap(int samplesmissing);
+void SetGapFill(int mode);
+int GetGapFill(void);
+void ConcealFrame(RTL_SAMPLE *fill, int nsamples, int repeat, RTL_SAMPLE *last, int lastlen);
+int GetUDPPayload(int wantcodec, int wantgain, char *dest);
 void CloseUDP(void);
 
 // from child.c
@@ -171,16 +655,41 @@ BOOL initChildProcess(char *cmdline);
 BOOL CreateChildProcess(char *szCmdline);
 void CloseChildProcess();
 int ReadFromPipe(RTL_SAMPLE *buffer, int bfrsiz);
+BOOL ReconfigureChild(char *cmdline);
+BOOL SwitchChild(void);
+void RetireChildren(void);
 
 // from UDPSocket.cpp
 BOOL OpenSocket(char *remoteip, int remoteport, char *myip, int myport);
 BOOL Send(const char *buffer, int nbytes);
 void CloseSocket(void);
+BOOL OpenRTCPSocket(char *remoteip, int remoteport, char *myip, int myport);
+BOOL SendRTCP(const char *buffer, int nbytes);
+int ReceiveRTCP(char *buffer, int bfrsiz);
+void CloseRTCPSocket(void);
+BOOL OpenMulticastSocket(char *group, int port, int ttl, char *ifname);
+BOOL SendMulticast(const char *buffer, int nbytes);
+void CloseMulticastSocket(void);
+
+// from multicast.c
+BOOL InitMulticast(char *group, int port, int ttl, char *ifname, int codec, int gain);
+BOOL SendMulticastPacket(RTL_SAMPLE *PipeBuffer, int samplesread, BOOL shared);
+BOOL SendMulticastGap(int samplesmissing);
+void CloseMulticast(void);
+
+// from rtcp.c
+BOOL InitRTCP(unsigned char *hdrPtr, char *remoteip, int remotePort, char *myip, int myport);
+void RTCPPacketSent(int payloadlen, uint32_t timestamp);
+void CloseRTCP(void);
+void GetRTCPStats(RTCP_STATS *stats);
 
 // from codec.c
 int PCMEncode(RTL_SAMPLE *buffer, int len, char *encoded_buf, int codec, int gain);
 int PCMDecode(CODEC_BYTE *inbuf, RTL_SAMPLE *buffer, int len, int codec);
 int PipeDecimate(RTL_SAMPLE *Buffer, int readlen, int decimlen);
+int G711uLawEncode(RTL_SAMPLE *buffer, CODEC_BYTE *outbuf, int len, int gain);
+int G711aLawEncode(RTL_SAMPLE *buffer, CODEC_BYTE *outbuf, int len, int gain);
+RTL_SAMPLE deemph(RTL_SAMPLE input);
 
 // from g711.c
 CODEC_BYTE linear2alaw(int pcm_val);
@@ -193,28 +702,47 @@ CODEC_BYTE ulaw2alaw(CODEC_BYTE uval);
 // from FSKdsp.c
 void DSPInit(void (*rx_func)(DEMOD_BYTE x), int debuglevel);
 void SetDebugLevel(int level);
-void DSPDemod(RTL_SAMPLE *PipeBufferPtr, int bytesread);
+void DSPDemod(RTL_SAMPLE *PipeBufferPtr, int bytesread, int64_t capture);
+int64_t DSPCaptureTime(void);
 void DSPStop(void);
+BOOL DSPRunning(void);
 void DSPClearSync(void);
+void DSPInitSync(void (*rx_func)(DEMOD_BYTE x), int debuglevel);
+void DSPDemodSync(RTL_SAMPLE *PipeBufferPtr, int samples_read);
+int64_t DSPSampleCount(void);
+void DemodChanInit(DEMOD_CHAN *ch);
+int DCSlice(DEMOD_CHAN *ch, int phase);
+int DemodSlice(DEMOD_CHAN *ch, int phase, uint64_t n);
+BOOL EdgeDetect(DEMOD_CHAN *ch, DEMOD_BYTE demod_out, BOOL firstTime);
+BOOL RunBitClock(DEMOD_CHAN *ch, BOOL edgedetect);
 
 // From Demod.c
-BOOL SyncCorrelator(DATA_BIT databit);
+void DemodInit(void);
+BOOL SyncCorrelator(DEMOD_CHAN *ch, DATA_BIT databit);
 int PhaseDiscrim(int Iout, int Qout);
 
 // from fir.c
+extern FIR_COEFF Mix_Coeffs_I[FIR_CENTRE + 1];
+extern FIR_COEFF Mix_Coeffs_Q[FIR_CENTRE];
 void FIRInit(void);
-int RunFIR(int input_sample, int channel);
+BOOL RunDownconvert(int sample, int *Iout, int *Qout);
 int RunDeemph(int input_sample);
 
 // from osc.c
 void InitOsc(void);
-RTL_SAMPLE RunOsc(int channel);
+RTL_SAMPLE OscAt(int channel, unsigned n);
 
 // from usb.c
+struct pollfd;
 BOOL InitUSB(int debug);
 BOOL FindUSBDevice(USB_AUDIO_DEV *usrdev);
 BOOL OpenUSBDevice(USB_AUDIO_DEV *usrdev);
-int readUSB(void *buffer, int len);
+void CloseUSBDevice(USB_AUDIO_DEV *usrdev);
+int USBPollDescriptors(USB_AUDIO_DEV *usrdev, struct pollfd *fds);
+int readUSB(USB_AUDIO_DEV *usrdev, void *buffer, int len);
+BOOL USBHotplugInit(void);
+int USBHotplugDescriptors(struct pollfd *fds);
+BOOL USBHotplugEvents(void);
 
 //from errno.c
 char *geterrno(int errnum);
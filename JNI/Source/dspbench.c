@@ -0,0 +1,433 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      DSP microbenchmark
+
+	File Name:		  dspbench.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Times each stage of the audio and FSK demodulator chain on
+					  synthetic SAME audio, and optionally on a recording, and
+					  prints one CSV line per stage so runs on different boards
+					  can be compared. The input is first run through the whole
+					  chain once to capture what each stage really sees, then
+					  each stage is timed on its own captured input. The lane
+					  demodulator is timed with the input on every lane, and
+					  its cost given per channel.
+
+					  Usage: dspbench [-f <24 KHz raw file>] [-t <seconds per stage>]
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/perf_event.h>
+
+#include "rtl.h"
+
+#define	BENCH_SECONDS		0.5				// default time per stage
+#define	SYNTH_SECONDS		4				// length of the synthetic input
+#define	MARK_FREQ			2083.3			// SAME mark
+#define	SPACE_FREQ			1562.5			// SAME space
+#define	BAUD_RATE			520.83			// SAME bit rate
+#define	FSK_RATE			(SAMPLE_RATE/FSK_DECIM)
+#define	G711_RATE			CODEC_SAMPLE_RATE
+
+int debuglevel = 0;
+
+// one input, run through the chain once to capture every stage's input
+typedef struct bench_input_t {
+	char		*name;						// synthetic or file name
+	int			nraw;						// samples at 24 KHz
+	RTL_SAMPLE	*raw;						// 24 KHz samples
+	int			n;							// samples at 12 KHz
+	RTL_SAMPLE	*fsk;						// 12 KHz samples
+	int			m;							// samples at DEMOD_RATE
+	int			*ifir, *qfir;				// downconverter outputs
+	int			*phase;						// discriminator output
+	DATA_BIT	*bits;						// sliced bits
+} BENCH_INPUT;
+
+// what is timed
+enum { ST_DOWNCONV, ST_DISCRIM, ST_DCSLICE, ST_SYNC, ST_BITCLOCK,
+	ST_DEMOD, ST_LANES, ST_ULAW, ST_ALAW, ST_DEEMPH, N_STAGES };
+
+struct bench_stage_t {
+	char	*name;							// stage name
+	int		rate;							// sample rate it runs at
+} stages[N_STAGES] = {
+	{ "RunDownconvert", FSK_RATE },
+	{ "PhaseDiscrim", DEMOD_RATE },
+	{ "DCSlice", DEMOD_RATE },
+	{ "SyncCorrelator", DEMOD_RATE },
+	{ "EdgeDetect+RunBitClock", DEMOD_RATE },
+	{ "demod_total", FSK_RATE },
+	{ "LaneDemod_per_channel", FSK_RATE },
+	{ "G711uLawEncode", SAMPLE_RATE },
+	{ "G711aLawEncode", SAMPLE_RATE },
+	{ "deemph", G711_RATE },
+};
+
+volatile int bench_sink;					// keeps the optimizer honest
+int cycle_fd = -1;							// perf cycle counter
+DEMOD_CHAN bench_chan;						// bit recovery of the single channel stages
+LANE_DEMOD bench_lanes;						// DSP_LANES channels at once
+
+// internals
+static BOOL synth_input(BENCH_INPUT *in);
+static BOOL file_input(BENCH_INPUT *in, char *filename);
+static BOOL capture_stages(BENCH_INPUT *in);
+static long run_stage(int stage, BENCH_INPUT *in);
+static void bench_stage(int stage, BENCH_INPUT *in, double seconds);
+static void lane_byte(int lane, DEMOD_BYTE x);
+static void print_board(void);
+static void open_cycle_counter(void);
+static long long read_cycles(void);
+static double now_ns(void);
+
+int main(int argc, char *argv[])
+{
+	double seconds = BENCH_SECONDS;
+	char *filename = NULL;
+	BENCH_INPUT synth, file;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:t:")) != -1) {
+		switch (opt) {
+
+		case 'f':
+			filename = optarg;
+			break;
+
+		case 't':
+			seconds = atof(optarg);
+			break;
+
+		default:
+			fprintf(stderr, "Usage: dspbench [-f <24 KHz raw file>] [-t <seconds per stage>]\n");
+			exit(100);
+		}
+	}
+
+	InitOsc();
+	FIRInit();
+	LaneDemodInit(&bench_lanes, DSP_LANES, &lane_byte);
+	open_cycle_counter();
+	print_board();
+	printf("stage,input,rate_hz,samples,ns_per_sample,cycles_per_sample,samples_per_sec,realtime_x\n");
+
+	if (!synth_input(&synth) || !capture_stages(&synth))
+		exit(200);
+	for (int i = 0; i < N_STAGES; i++)
+		bench_stage(i, &synth, seconds);
+
+	if (filename != NULL) {
+		if (!file_input(&file, filename) || !capture_stages(&file))
+			exit(200);
+		for (int i = 0; i < N_STAGES; i++)
+			bench_stage(i, &file, seconds);
+	}
+	return 0;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	bench_stage
+
+	INPUTS:		stage, input, time to spend
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	repeat a stage over its captured input until the time is
+					up, then print the per sample cost
+
+---------------------------------------------------------------------------*/
+static void bench_stage(int stage, BENCH_INPUT *in, double seconds)
+{
+	long long samples = 0, cycles;
+	double start, elapsed;
+
+	run_stage(stage, in);					// warm the caches
+	cycles = read_cycles();
+	start = now_ns();
+	do {
+		samples += run_stage(stage, in);
+		elapsed = now_ns() - start;
+	} while (elapsed < seconds * 1e9);
+	cycles = (cycle_fd >= 0) ? read_cycles() - cycles : -1;
+
+	double ns = elapsed / (double)samples;
+	double rate = 1e9 / ns;
+	printf("%s,%s,%d,%lld,%.3f,", stages[stage].name, in->name, stages[stage].rate, samples, ns);
+	if (cycles >= 0)
+		printf("%.2f,", (double)cycles / (double)samples);
+	else
+		printf("NA,");
+	printf("%.0f,%.1f\n", rate, rate / (double)stages[stage].rate);
+	fflush(stdout);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	run_stage
+
+	INPUTS:		stage, input
+
+	OUTPUTS:	number of samples processed
+
+	DESCRIPTION:	one pass of a stage over the captured input. The inner
+					loops are the same code as dsp_threads_fn and codecs.c.
+
+---------------------------------------------------------------------------*/
+static long run_stage(int stage, BENCH_INPUT *in)
+{
+	int sink = 0, n = in->n, m = in->m, Iout, Qout;
+	CODEC_BYTE g711[PIPE_READ_LEN / AUDIO_DECIM];
+	RTL_SAMPLE *lanein[DSP_LANES];
+
+	switch (stage) {
+
+	case ST_DOWNCONV:
+		for (int i = 0; i < n; i++)
+			if (RunDownconvert(in->fsk[i], &Iout, &Qout))
+				sink += Iout ^ Qout;
+		break;
+
+	case ST_DISCRIM:
+		for (int i = 0; i < m; i++)
+			sink += PhaseDiscrim(in->ifir[i], in->qfir[i]);
+		bench_sink += sink;
+		return m;
+
+	case ST_DCSLICE:
+		for (int i = 0; i < m; i++)
+			sink += (DCSlice(&bench_chan, in->phase[i]) > 0) ? 0 : 1;
+		bench_sink += sink;
+		return m;
+
+	case ST_SYNC:
+		for (int i = 0; i < m; i++)
+			sink += SyncCorrelator(&bench_chan, in->bits[i]);
+		bench_sink += sink;
+		return m;
+
+	case ST_BITCLOCK:
+		EdgeDetect(&bench_chan, in->bits[0], TRUE);
+		RunBitClock(&bench_chan, TRUE);
+		for (int i = 0; i < m; i++)
+			sink += RunBitClock(&bench_chan, EdgeDetect(&bench_chan, in->bits[i], FALSE));
+		bench_sink += sink;
+		return m;
+
+	case ST_DEMOD:
+		for (int i = 0; i < n; i++) {
+			if (!RunDownconvert(in->fsk[i], &Iout, &Qout))
+				continue;
+			sink += DemodSlice(&bench_chan, PhaseDiscrim(Iout, Qout), i);
+		}
+		break;
+
+	// every lane gets the 24 KHz input; the cost is per channel
+	case ST_LANES:
+		for (int l = 0; l < DSP_LANES; l++)
+			lanein[l] = in->raw;
+		LaneDemod(&bench_lanes, lanein, 2 * n);
+		return (long)n * DSP_LANES;
+
+	case ST_ULAW:
+	case ST_ALAW:
+		for (int i = 0; i + PIPE_READ_LEN <= in->nraw; i += PIPE_READ_LEN) {
+			if (stage == ST_ULAW)
+				G711uLawEncode(&in->raw[i], g711, PIPE_READ_LEN, 0);
+			else
+				G711aLawEncode(&in->raw[i], g711, PIPE_READ_LEN, 0);
+			sink += g711[0];
+		}
+		return (in->nraw / PIPE_READ_LEN) * PIPE_READ_LEN;
+
+	case ST_DEEMPH:
+		for (int i = 0; i < in->nraw; i += AUDIO_DECIM)
+			sink += deemph(in->raw[i]);
+		bench_sink += sink;
+		return (in->nraw + AUDIO_DECIM - 1) / AUDIO_DECIM;
+	}
+
+	bench_sink += sink;
+	return n;
+}
+
+/****************************************************************************
+ * 			Input generation
+ ***************************************************************************/
+// phase continuous AFSK of a SAME header, LSB first, with some noise
+static BOOL synth_input(BENCH_INPUT *in)
+{
+	static char header[] = "ZCZC-WXR-TOR-048113-048439+0030-1231517-KOUN/NWS-";
+	double phase = 0.0, bitclock = 0.0;
+	int byte = 0, bit = 0, nbytes = 16 + (int)strlen(header);
+
+	in->name = "synthetic";
+	in->nraw = SYNTH_SECONDS * SAMPLE_RATE;
+	if ((in->raw = malloc(in->nraw * sizeof(RTL_SAMPLE))) == NULL)
+		return FALSE;
+
+	srand(1);
+	for (int i = 0; i < in->nraw; i++) {
+		int c = (byte < 16) ? SYNC_BYTE : header[byte - 16];
+		double freq = ((c >> bit) & 1) ? MARK_FREQ : SPACE_FREQ;
+
+		phase += 2.0 * M_PI * freq / SAMPLE_RATE;
+		in->raw[i] = (RTL_SAMPLE)(12000.0 * sin(phase) + (rand() % 1001) - 500);
+
+		bitclock += BAUD_RATE / SAMPLE_RATE;
+		if (bitclock >= 1.0) {
+			bitclock -= 1.0;
+			if (++bit == BITSPERBYTE) {
+				bit = 0;
+				byte = (byte + 1) % nbytes;
+			}
+		}
+	}
+	return TRUE;
+}
+
+// raw 16 bit samples at 24 KHz, as written to the pipe
+static BOOL file_input(BENCH_INPUT *in, char *filename)
+{
+	FILE *fp;
+	long len;
+
+	if ((fp = fopen(filename, "rb")) == NULL) {
+		fprintf(stderr, "Cannot open %s\n", filename);
+		return FALSE;
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp) / sizeof(RTL_SAMPLE);
+	fseek(fp, 0, SEEK_SET);
+	if ((len < 2 * PIPE_READ_LEN) || ((in->raw = malloc(len * sizeof(RTL_SAMPLE))) == NULL)) {
+		fprintf(stderr, "%s is too short\n", filename);
+		fclose(fp);
+		return FALSE;
+	}
+	in->nraw = (int)fread(in->raw, sizeof(RTL_SAMPLE), len, fp);
+	fclose(fp);
+	in->name = filename;
+	return TRUE;
+}
+
+// run the chain once, keeping the input of every stage
+static BOOL capture_stages(BENCH_INPUT *in)
+{
+	DEMOD_CHAN chan;
+	int n = in->n = in->nraw / FSK_DECIM, m = 0;
+
+	in->fsk = malloc(n * sizeof(RTL_SAMPLE));
+	in->ifir = malloc(n * sizeof(int));
+	in->qfir = malloc(n * sizeof(int));
+	in->phase = malloc(n * sizeof(int));
+	in->bits = malloc(n * sizeof(DATA_BIT));
+	if (!in->fsk || !in->ifir || !in->qfir || !in->phase || !in->bits) {
+		fprintf(stderr, "Out of memory\n");
+		return FALSE;
+	}
+
+	DemodChanInit(&chan);
+
+	// same averaging decimator as DSPDemod
+	for (int i = 0; i < n; i++)
+		in->fsk[i] = (RTL_SAMPLE)((((int)in->raw[2 * i] + (int)in->raw[2 * i + 1]) >> 1) & 0xffff);
+
+	for (int i = 0; i < n; i++) {
+		if (!RunDownconvert(in->fsk[i], &in->ifir[m], &in->qfir[m]))
+			continue;
+		in->phase[m] = PhaseDiscrim(in->ifir[m], in->qfir[m]);
+		in->bits[m] = (DCSlice(&chan, in->phase[m]) > 0) ? 0 : 1;
+		m++;
+	}
+	in->m = m;
+	return TRUE;
+}
+
+// bytes from the lane demodulator
+static void lane_byte(int lane, DEMOD_BYTE x)
+{
+	bench_sink += lane + x;
+}
+
+/****************************************************************************
+ * 			Board and timer support
+ ***************************************************************************/
+// identify the board in the output, as comments
+static void print_board(void)
+{
+	struct utsname uts;
+	char line[256], model[256] = "unknown";
+	FILE *fp;
+
+	if ((fp = fopen("/proc/cpuinfo", "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			char *colon = strchr(line, ':');
+			if ((colon == NULL) || (strncmp(line, "model name", 10) && strncmp(line, "Model", 5)))
+				continue;
+			snprintf(model, sizeof(model), "%s", colon + 2);
+			model[strcspn(model, "\n")] = '\0';
+			if (!strncmp(line, "Model", 5))
+				break;
+		}
+		fclose(fp);
+	}
+	uname(&uts);
+	printf("# host %s, %s %s, %s\n", uts.nodename, uts.sysname, uts.machine, model);
+	printf("# cycle counter %s\n", (cycle_fd >= 0) ? "perf" : "not available");
+}
+
+static void open_cycle_counter(void)
+{
+	struct perf_event_attr pe;
+
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(pe);
+	pe.config = PERF_COUNT_HW_CPU_CYCLES;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	cycle_fd = (int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+	if (cycle_fd >= 0)
+		ioctl(cycle_fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static long long read_cycles(void)
+{
+	long long count = 0;
+
+	if ((cycle_fd < 0) || (read(cycle_fd, &count, sizeof(count)) != sizeof(count)))
+		return 0;
+	return count;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
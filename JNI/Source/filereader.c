@@ -27,6 +27,9 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -40,6 +43,8 @@
 #define	USB_MODE_BY_ID		1			// reading a USB device
 #define USB_MODE_BY_CARD	2			// USB by card numner
 
+#define	USAGE	"Usage: filereader [ -f <file> -[b|l] -r <rate> | [ -ui <vendor> <product> | -uc <card> ] -t <tag> ... ] -s <name> -g <gain> -d\n"
+
 char *filename;						// filename
 
 char *modes[] = {
@@ -48,22 +53,52 @@ char *modes[] = {
 		"usb by Card"
 };
 
+// one device, or the file
+typedef struct input_t {
+	int				mode;				// how it was given
+	USB_AUDIO_DEV	usb;
+	char			*tag;				// its stream in shared memory
+	char			tagbuf[SHM_TAG_LEN];
+	RESAMPLER		rs;					// to 24 KHz
+	BOOL			open;
+	int				xruns;				// overruns passed on
+	int64_t			gapSamples;
+	// while it is lost
+	struct timespec	lostAt;
+	struct timespec	lastTry;			// last looked for
+	int64_t			silence;			// samples written in its place
+	int				reconnects;
+} INPUT;
+
+INPUT inputs[USB_MAX_DEVICES];
+int ninputs = 0;
+
 unsigned char *readBuf;
 RTL_SAMPLE *writeBuf;
-
-USB_AUDIO_DEV usbdev;
+int wrBufSize = 0;						// samples in it
+int gain = 0;
+SHM_HEADER *shm;						// several receivers' sources, or NULL for stdout
+
+// internals
+static void writeSamples(int stream, RTL_SAMPLE *samples, int nsamples);
+static void passGaps(int stream);
+static void lose(int stream);
+static void keepAlive(int stream);
+static BOOL reacquire(int stream);
+static int64_t elapsedMs(struct timespec *since);
 
 int main(int argc, char *argv[])
 {
 	int bytesRead;
-	int shift1 = 8, shift2 = 0;
+	BOOL bigendian = TRUE;
 	int debug = 0;
-	FILE *infile = stdin;
-	int gain = 0;
-	BOOL running = TRUE;
+	AUDIO_FILE infile;
 	int mode = NO_MODE;
-	int rdBufSize;
-	int wrBufSize;
+	int rate = RAW_SAMPLE_RATE;
+	int rdBufSize = 0;
+	int nusb = 0;							// USB devices, open or lost
+	char *shmname = NULL;
+	INPUT *in = NULL;
 
 	for (int i = 0; i < argc; i++) {
 
@@ -73,25 +108,39 @@ int main(int argc, char *argv[])
 			case 'f':
 				filename = argv[++i];
 				rdBufSize = FILE_READ_SIZE*sizeof(RTL_SAMPLE);
-				wrBufSize = FILE_READ_SIZE;
+				if ((mode != NO_MODE) && (mode != FILE_MODE)) {
+					fprintf(stderr, "A file cannot be read with USB devices\n");
+					exit(100);
+				}
 				mode = FILE_MODE;
+				in = &inputs[0];
+				in->mode = FILE_MODE;
+				ninputs = 1;
 				break;
 
 			case 'u':
 				rdBufSize = USB_READ_SIZE*sizeof(RTL_SAMPLE);
-				wrBufSize = USB_READ_SIZE;
+				if (mode == FILE_MODE) {
+					fprintf(stderr, "A file cannot be read with USB devices\n");
+					exit(100);
+				}
+				if (ninputs == USB_MAX_DEVICES) {
+					fprintf(stderr, "No more than %d USB devices\n", USB_MAX_DEVICES);
+					exit(100);
+				}
+				in = &inputs[ninputs++];
 
 				switch(argv[i][2])	{
 
 				case 'i':
-					mode = USB_MODE_BY_ID;
-					sscanf(argv[++i], "%x", (unsigned int *) &usbdev.idVendor);
-					sscanf(argv[++i], "%x", (unsigned int *) &usbdev.idProduct);
+					mode = in->mode = USB_MODE_BY_ID;
+					sscanf(argv[++i], "%x", (unsigned int *) &in->usb.idVendor);
+					sscanf(argv[++i], "%x", (unsigned int *) &in->usb.idProduct);
 					break;
 
 				case 'c':
-					mode = USB_MODE_BY_CARD;
-					sscanf(argv[++i], "%x", (unsigned int *) &usbdev.cardNum);
+					mode = in->mode = USB_MODE_BY_CARD;
+					sscanf(argv[++i], "%x", (unsigned int *) &in->usb.cardNum);
 					break;
 
 				default:
@@ -100,40 +149,51 @@ int main(int argc, char *argv[])
 				}
 				break;
 
+			case 't':
+				if (in == NULL) {
+					fprintf(stderr, "-t names the input before it\n");
+					exit(100);
+				}
+				in->tag = argv[++i];
+				break;
+
+			case 's':
+				shmname = argv[++i];
+				break;
+
 			case 'g':
 				sscanf(argv[++i], "%d", &gain);
 				break;
 
+			case 'r':
+				sscanf(argv[++i], "%d", &rate);
+				break;
+
 			case 'd':
 				debug++;
 				break;
 
 			case 'l':
-				shift1 = 0; shift2 = 8;
+				bigendian = FALSE;
 				break;
 
 			case 'b':
-				shift1 = 8; shift2 = 0;
+				bigendian = TRUE;
 				break;
 
 			default:
-				fprintf(stderr, "Usage: filereader [ -f <file> -[b|l] | [ -ui <vendor> <product> | -uc <card> ]]-g <gain> -d\n");
+				fprintf(stderr, USAGE);
 				exit(100);
 			}
 
 	}
 
-	// allocate the buffers
-	if((readBuf=malloc(rdBufSize)) == NULL)	{
-		fprintf(stderr, "Cannot alloc memory for read buffer\n");
-		exit(200);
-	}
-	if((writeBuf=malloc(wrBufSize)) == NULL)	{
-		fprintf(stderr, "Cannot alloc memory for read buffer\n");
-		exit(200);
+	if ((ninputs > 1) && (shmname == NULL)) {
+		fprintf(stderr, "Several USB devices need -s, stdout only takes one\n");
+		exit(100);
 	}
 
-	// check the mode and open the device
+	// check the mode and open the devices
 	switch(mode)		{
 
 	case NO_MODE:
@@ -141,81 +201,258 @@ int main(int argc, char *argv[])
 		exit(100);
 
 	case FILE_MODE:
-		if((infile=fopen(filename, "rb")) == NULL)	{
-			fprintf(stderr, "Cannot open input file %s\n", filename);
+		// WAV and FLAC give their own rate
+		debuglevel = debug ? DEBUG_MSGS : 0;
+		if(!AudioFileOpen(&infile, filename, rate, bigendian))
+			exit(100);
+		if(inputs[0].tag == NULL)
+			inputs[0].tag = "file";
+		if(!ResampleInit(&inputs[0].rs, infile.rate, infile.bigendian, gain))	{
+			fprintf(stderr, "Cannot convert %d Hz to %d Hz\n", infile.rate, SAMPLE_RATE);
 			exit(100);
 		}
+		wrBufSize = ResampleMaxOut(&inputs[0].rs, rdBufSize);
 		break;
 
 	case USB_MODE_BY_ID:
 	case USB_MODE_BY_CARD:
 		InitUSB(debug ? DEBUG_USB : 0);
-		if(mode == USB_MODE_BY_ID)	{
-			if(!FindUSBDevice(&usbdev))	{
-				fprintf(stderr, "Cannot find card number for USB device %04x:%04x\n", usbdev.idVendor, usbdev.idProduct);
+		// one at a time, so identical devices find successive cards
+		for (int i = 0; i < ninputs; i++) {
+			in = &inputs[i];
+			if(in->mode == USB_MODE_BY_ID)	{
+				if(!FindUSBDevice(&in->usb))	{
+					fprintf(stderr, "Cannot find card number for USB device %04x:%04x\n", in->usb.idVendor, in->usb.idProduct);
+					exit(100);
+				}
+			}
+			in->usb.recordSize = USB_READ_SIZE;
+			if(!OpenUSBDevice(&in->usb)) {
+				fprintf(stderr, "Cannot open USB device\n");
 				exit(100);
 			}
+			if(debug)
+				fprintf(stderr, "USB device successfully opened on card %d at %d Hz\n", in->usb.cardNum, in->usb.sampleRate);
+			if(in->tag == NULL)	{
+				snprintf(in->tagbuf, SHM_TAG_LEN, "usb%d", in->usb.cardNum);
+				in->tag = in->tagbuf;
+			}
+			// LE from the device, at its own rate
+			if(!ResampleInit(&in->rs, in->usb.sampleRate, FALSE, gain))	{
+				fprintf(stderr, "Cannot convert %d Hz to %d Hz\n", in->usb.sampleRate, SAMPLE_RATE);
+				exit(100);
+			}
+			if(ResampleMaxOut(&in->rs, rdBufSize) > wrBufSize)
+				wrBufSize = ResampleMaxOut(&in->rs, rdBufSize);
+			in->open = TRUE;
+			nusb++;
 		}
-		usbdev.recordSize = USB_READ_SIZE;
-		if(!OpenUSBDevice(&usbdev)) {
-			fprintf(stderr, "Cannot open USB device\n");
-			exit(100);
-		}
-		if(debug)
-			fprintf(stderr, "USB device successfully opened\n");
-		shift1 = 0; shift2 = 8;				// set LE by default
 		break;
 	}
 
 	if (debug)
 		fprintf(stderr, "Filereader started in %s mode\n", modes[mode]);
 
+	// allocate the buffers
+	if((readBuf=malloc(rdBufSize)) == NULL)	{
+		fprintf(stderr, "Cannot alloc memory for read buffer\n");
+		exit(200);
+	}
+	if((writeBuf=malloc(wrBufSize*sizeof(RTL_SAMPLE))) == NULL)	{
+		fprintf(stderr, "Cannot alloc memory for read buffer\n");
+		exit(200);
+	}
+
+	// a stream for each input, named by its tag
+	if(shmname != NULL)	{
+		char *tags[USB_MAX_DEVICES];
+		for (int i = 0; i < ninputs; i++)
+			tags[i] = inputs[i].tag;
+		if((shm=ShmSourceCreate(shmname, ninputs, tags)) == NULL)	{
+			fprintf(stderr, "Cannot create shared memory source %s\n", shmname);
+			exit(100);
+		}
+		if(debug)
+			for (int i = 0; i < ninputs; i++)
+				fprintf(stderr, "Stream %d is shm:%s:%s\n", i, shmname, tags[i]);
+	}
+
 #ifdef _WIN32
 		_setmode(_fileno(stdin), _O_BINARY);
 		_setmode(_fileno(stdout), _O_BINARY);
 #endif
 
+	if (mode == FILE_MODE) {
+		struct timespec due;
+		clock_gettime(CLOCK_MONOTONIC, &due);
+
+		unsigned char *data;
+		while ((bytesRead = AudioFileRead(&infile, &data, rdBufSize)) > 0) {
+			if (debug)
+				fprintf(stderr, "Filereader: Read %d bytes\n", bytesRead);
+
+			// a partial sample is held over to the next block
+			int samplestowrite = Resample(&inputs[0].rs, data, bytesRead, writeBuf);
+			writeSamples(0, writeBuf, samplestowrite);
+
+			// nothing holds shared memory back, so play it in real time
+			if (shm != NULL) {
+				due.tv_nsec += (long)samplestowrite*1000000000L/SAMPLE_RATE;
+				due.tv_sec += due.tv_nsec/1000000000L;
+				due.tv_nsec %= 1000000000L;
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+			}
+		}
+		fprintf(stderr, "End of file reached\n");
+		AudioFileClose(&infile);
+	}
 
-	while (running) {
-		if(mode == FILE_MODE)
-			bytesRead = (int)fread(readBuf, sizeof(char), FILE_READ_SIZE*sizeof(RTL_SAMPLE), infile);
-		else
-			bytesRead = readUSB(readBuf, usbdev.recordSize);
-		
-		unsigned char *inbuf = readBuf;
-		RTL_SAMPLE *outbuf = writeBuf;
-
-		if (debug)
-			fprintf(stderr, "Filereader: Read %d bytes\n", bytesRead);
+	if ((nusb > 0) && !USBHotplugInit())
+		fprintf(stderr, "No hotplug events, a lost device is looked for every %d ms\n", USB_RETRY_MS);
 
-		if (bytesRead == 0) {
-			fprintf(stderr, "End of file reached\n");
-			running = FALSE;
-			break;
-		}
+	// wait on all the devices together, and take what each has
+	while (nusb > 0) {
+		struct pollfd fds[USB_MAX_DEVICES*USB_MAX_FDS + USB_HOTPLUG_FDS];
+		int nfds = 0, nlost = 0;
+		BOOL arrived = FALSE;
 
-		// make sure we have an even number of samples...
-		if (bytesRead & 1)
-			bytesRead--;
-
-		RTL_SAMPLE insample;
-		int decimsample, samplez1 = 0;
-		for (int i = 0; i < bytesRead; i += 2) {
-			insample = (((RTL_SAMPLE)*inbuf++) << shift1);
-			insample |= (((RTL_SAMPLE)*inbuf++) << shift2);
-			decimsample = (int)insample + (int)samplez1;
-		
-			if((i>>1) & 1)
-				*outbuf++ = (RTL_SAMPLE) ((decimsample>>1) & 0xffff) << gain;
-			samplez1 = insample;
+		for (int i = 0; i < ninputs; i++) {
+			if (inputs[i].open)
+				nfds += USBPollDescriptors(&inputs[i].usb, &fds[nfds]);
+			else
+				nlost++;
 		}
-		int samplestowrite = bytesRead / 4;
+		if (nlost > 0)
+			nfds += USBHotplugDescriptors(&fds[nfds]);
+		poll(fds, nfds, (nlost > 0) ? USB_RETRY_MS : USB_POLL_MS);
+		if (nlost > 0)
+			arrived = USBHotplugEvents();
+
+		for (int i = 0; i < ninputs; i++) {
+			in = &inputs[i];
+
+			// silence in its place until it comes back
+			if (!in->open) {
+				keepAlive(i);
+				if ((arrived || (elapsedMs(&in->lastTry) >= USB_RETRY_MS)) && !reacquire(i))
+					clock_gettime(CLOCK_MONOTONIC, &in->lastTry);
+				continue;
+			}
 
-		fwrite((void *)writeBuf, sizeof(RTL_SAMPLE), samplestowrite, stdout);
-		if (debug)
-			fprintf(stderr, "Filereader: Wrote %d 16-bit samples\n", samplestowrite);
+			while ((bytesRead = readUSB(&in->usb, readBuf, in->usb.recordSize)) > 0) {
+				int samplestowrite = Resample(&in->rs, readBuf, bytesRead, writeBuf);
+				writeSamples(i, writeBuf, samplestowrite);
+			}
+			passGaps(i);
 
+			// the others carry on without it
+			if (bytesRead < 0)
+				lose(i);
+		}
 	}
 	fprintf(stderr, "Filereader exiting\n");
 	return 0;
 }
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+static void writeSamples(int stream, RTL_SAMPLE *samples, int nsamples)
+{
+	if (shm != NULL)
+		ShmSourceWrite(shm, stream, samples, nsamples);
+	else
+		fwrite((void *)samples, sizeof(RTL_SAMPLE), nsamples, stdout);
+}
+
+// on stdout the gap marker has already gone to the parent on stderr
+static void passGaps(int stream)
+{
+	INPUT *in = &inputs[stream];
+
+	if ((shm == NULL) || (in->usb.xruns == in->xruns))
+		return;
+	ShmSourceGap(shm, stream, in->usb.xruns - in->xruns, in->usb.gapSamples - in->gapSamples);
+	in->xruns = in->usb.xruns;
+	in->gapSamples = in->usb.gapSamples;
+}
+
+static void lose(int stream)
+{
+	INPUT *in = &inputs[stream];
+
+	fprintf(stderr, "Lost USB device %04x:%04x on card %d, waiting for it to come back\n",
+		in->usb.idVendor, in->usb.idProduct, in->usb.cardNum);
+	CloseUSBDevice(&in->usb);
+	in->open = FALSE;
+	in->silence = 0;
+	clock_gettime(CLOCK_MONOTONIC, &in->lostAt);
+	in->lastTry = in->lostAt;
+}
+
+// the receiver keeps its clock while the device is away
+static void keepAlive(int stream)
+{
+	INPUT *in = &inputs[stream];
+	int64_t owed = elapsedMs(&in->lostAt)*SAMPLE_RATE/1000 - in->silence;
+
+	memset(writeBuf, 0, wrBufSize*sizeof(RTL_SAMPLE));
+	while (owed > 0) {
+		int n = (owed > wrBufSize) ? wrBufSize : (int)owed;
+		writeSamples(stream, writeBuf, n);
+		in->silence += n;
+		owed -= n;
+	}
+}
+
+/*
+ * Look for a lost device: by its ID, which a device given by card has
+ * read from ALSA when it was opened, or else on the same card. When it is
+ * back, the silence written in its place is reported as one gap.
+ */
+static BOOL reacquire(int stream)
+{
+	INPUT *in = &inputs[stream];
+	struct timespec now;
+
+	if ((in->usb.idVendor != 0) && !FindUSBDevice(&in->usb))
+		return FALSE;
+	if (!OpenUSBDevice(&in->usb))
+		return FALSE;
+
+	// the rate may not be what it was
+	keepAlive(stream);
+	ResampleFree(&in->rs);
+	if (!ResampleInit(&in->rs, in->usb.sampleRate, FALSE, gain)
+		|| (ResampleMaxOut(&in->rs, in->usb.recordSize*sizeof(RTL_SAMPLE)) > wrBufSize)) {
+		fprintf(stderr, "Cannot convert %d Hz to %d Hz\n", in->usb.sampleRate, SAMPLE_RATE);
+		CloseUSBDevice(&in->usb);
+		return FALSE;
+	}
+	in->open = TRUE;
+	in->xruns = 0;
+	in->gapSamples = 0;
+	in->reconnects++;
+
+	fprintf(stderr, "USB device %04x:%04x back on card %d after %lld ms\n", in->usb.idVendor,
+		in->usb.idProduct, in->usb.cardNum, (long long)elapsedMs(&in->lostAt));
+	if (shm != NULL) {
+		ShmSourceGap(shm, stream, 1, in->silence);
+		ShmSourceReconnect(shm, stream);
+	} else {
+		clock_gettime(CLOCK_REALTIME, &now);
+		fprintf(stderr, SOURCE_GAP_MARKER " %d %lld %ld.%06ld\n", in->reconnects, (long long)in->silence,
+			(long)now.tv_sec, now.tv_nsec/1000);
+		fprintf(stderr, SOURCE_RECONNECT_MARKER " %d %ld.%06ld\n", in->reconnects,
+			(long)now.tv_sec, now.tv_nsec/1000);
+	}
+	return TRUE;
+}
+
+static int64_t elapsedMs(struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)(now.tv_sec - since->tv_sec)*1000 + (now.tv_nsec - since->tv_nsec)/1000000;
+}
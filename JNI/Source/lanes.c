@@ -0,0 +1,235 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Lane parallel FSK demodulator
+
+	File Name:		  lanes.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Demodulates up to DSP_LANES channels clocked together,
+					  such as the devices of one filereader, one channel to
+					  each SIMD lane. The filter history is kept with the
+					  lanes side by side, so one load gets a sample of every
+					  channel, and the fused downconverter of fir.c is run on
+					  all of them with its coefficients, which are the same
+					  for every lane. The rotation to baseband and the phase
+					  discriminator are done lane by lane on the result, then
+					  each channel has its own slicer, bit clock and byte
+					  recovery from FSKdsp.c. NEON and SSE2 filter eight
+					  channels in one pass over the taps, and every lane
+					  gives the same bytes as the receiver's own demodulator
+					  would on that channel. No receiver takes several
+					  channels yet, so it is built into dspbench only.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+
+#include "rtl.h"
+
+// a vector of eight 16 bit samples is one sample of every lane
+#if (DSP_LANES == 8) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define	LANE_NEON
+#elif (DSP_LANES == 8) && defined(__SSE2__)
+#include <emmintrin.h>
+#define	LANE_SSE2
+#endif
+
+#if defined(LANE_SSE2)
+// the tap pairs for madd, (h, h) for I and (h, -h) for Q, shared by every
+// demodulator; set up from the fir.c taps by LaneDemodInit
+static __m128i lane_coeffs_I[FIR_CENTRE + 1], lane_coeffs_Q[FIR_CENTRE];
+#endif
+
+// internals
+static void lane_sample(LANE_DEMOD *ld, int16_t *x);
+static void lane_filter(LANE_DEMOD *ld, int32_t *macI, int32_t *macQ);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	LaneDemodInit
+
+	INPUTS:		demodulator, channels in it, byte handler
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	clear the filter and the bit recovery of every lane.
+					The oscillator and filter must have been set up by
+					InitOsc and FIRInit.
+
+---------------------------------------------------------------------------*/
+void LaneDemodInit(LANE_DEMOD *ld, int nlanes, void (*rx_func)(int lane, DEMOD_BYTE x))
+{
+	memset(ld, 0, sizeof(LANE_DEMOD));
+	if (nlanes < 1)
+		nlanes = 1;
+	if (nlanes > DSP_LANES)
+		nlanes = DSP_LANES;
+	ld->nlanes = nlanes;
+	ld->byte_rx_func = rx_func;
+	for (int l = 0; l < DSP_LANES; l++)
+		DemodChanInit(&ld->chan[l]);
+
+#if defined(LANE_SSE2)
+	// the centre tap has no partner
+	for (int k = 0; k < FIR_CENTRE; k++) {
+		lane_coeffs_I[k] = _mm_set1_epi16(Mix_Coeffs_I[k]);
+		lane_coeffs_Q[k] = _mm_set1_epi32((int32_t)(((uint32_t)(uint16_t)-Mix_Coeffs_Q[k] << 16) | (uint16_t)Mix_Coeffs_Q[k]));
+	}
+	lane_coeffs_I[FIR_CENTRE] = _mm_set1_epi32((uint16_t)Mix_Coeffs_I[FIR_CENTRE]);
+#endif
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	LaneDemod
+
+	INPUTS:		demodulator, 24 KHz samples of each channel, how many
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	the same decimation as DSPDemodSync on every channel,
+					then demodulate them together; in[] has nlanes entries,
+					each with samples_read samples
+
+---------------------------------------------------------------------------*/
+void LaneDemod(LANE_DEMOD *ld, RTL_SAMPLE *in[], int samples_read)
+{
+	int16_t x[DSP_LANES];
+
+	// lanes not in use filter zeros
+	memset(x, 0, sizeof(x));
+	for (int i = 1; i < samples_read; i += 2) {
+		for (int l = 0; l < ld->nlanes; l++)
+			x[l] = (RTL_SAMPLE)((((int)in[l][i - 1] + (int)in[l][i]) >> 1) & 0xffff);
+		lane_sample(ld, x);
+	}
+}
+
+// look for the sync code again on one channel, from the thread calling LaneDemod
+void LaneClearSync(LANE_DEMOD *ld, int lane)
+{
+	if ((lane >= 0) && (lane < ld->nlanes)) {
+		if (ld->chan[lane].insync)
+			STATS_INC(STAT_SYNC_LOST);
+		ld->chan[lane].insync = FALSE;
+	}
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// one 12 KHz sample of every lane, demodulated at DEMOD_RATE
+static void lane_sample(LANE_DEMOD *ld, int16_t *x)
+{
+	int32_t macI[DSP_LANES], macQ[DSP_LANES];
+	unsigned t = ld->t++;
+
+	memcpy(ld->window[ld->wrptr], x, sizeof(ld->window[0]));
+	memcpy(ld->window[ld->wrptr + N_FIR_TAPS], x, sizeof(ld->window[0]));
+	if (++ld->wrptr == N_FIR_TAPS)
+		ld->wrptr = 0;
+	if ((t % DEMOD_DECIM) != DEMOD_DECIM - 1)
+		return;
+
+	lane_filter(ld, macI, macQ);
+
+	// down to baseband and the discriminator, as RunDownconvert and PhaseDiscrim
+	int64_t c = OscAt(I_CHANNEL, t - FIR_CENTRE), s = OscAt(Q_CHANNEL, t - FIR_CENTRE);
+	int cur = ld->dlyptr, prev = (cur - DISCRIM_DELAY) & (LANE_DLY_LEN - 1);
+	int phase[DSP_LANES];
+	for (int l = 0; l < DSP_LANES; l++) {
+		int I = (int)((c * macI[l] - s * macQ[l]) >> (15 + MAC_SHIFT));
+		int Q = (int)((s * macI[l] + c * macQ[l]) >> (15 + MAC_SHIFT));
+		ld->Idly[cur][l] = I;
+		ld->Qdly[cur][l] = Q;
+		long lphase = (long)ld->Idly[prev][l] * (long)Q - (long)I * (long)ld->Qdly[prev][l];
+		phase[l] = (int)(lphase) >> 11;
+	}
+	ld->dlyptr = (cur + 1) & (LANE_DLY_LEN - 1);
+
+	// then each channel on its own
+	uint64_t n = ld->position++;
+	for (int l = 0; l < ld->nlanes; l++) {
+		int byte = DemodSlice(&ld->chan[l], phase[l], n);
+		if (byte >= 0)
+			(*ld->byte_rx_func)(l, (DEMOD_BYTE)byte);
+	}
+}
+
+/*
+ * The folded complex filter of RunDownconvert on every lane: row k of the
+ * window holds sample k, oldest first, of each channel.
+ */
+static void lane_filter(LANE_DEMOD *ld, int32_t *macI, int32_t *macQ)
+{
+	const int16_t (*x)[DSP_LANES] = &ld->window[ld->wrptr];
+
+#if defined(LANE_NEON)
+	int16x8_t xc = vld1q_s16(x[FIR_CENTRE]);
+	int32x4_t ilo = vmull_n_s16(vget_low_s16(xc), Mix_Coeffs_I[FIR_CENTRE]);
+	int32x4_t ihi = vmull_n_s16(vget_high_s16(xc), Mix_Coeffs_I[FIR_CENTRE]);
+	int32x4_t qlo = vdupq_n_s32(0), qhi = vdupq_n_s32(0);
+	for (int k = 0; k < FIR_CENTRE; k++) {
+		int16x8_t newer = vld1q_s16(x[N_FIR_TAPS - 1 - k]), older = vld1q_s16(x[k]);
+		ilo = vmlal_n_s16(ilo, vget_low_s16(newer), Mix_Coeffs_I[k]);
+		ilo = vmlal_n_s16(ilo, vget_low_s16(older), Mix_Coeffs_I[k]);
+		ihi = vmlal_n_s16(ihi, vget_high_s16(newer), Mix_Coeffs_I[k]);
+		ihi = vmlal_n_s16(ihi, vget_high_s16(older), Mix_Coeffs_I[k]);
+		qlo = vmlal_n_s16(qlo, vget_low_s16(newer), Mix_Coeffs_Q[k]);
+		qlo = vmlsl_n_s16(qlo, vget_low_s16(older), Mix_Coeffs_Q[k]);
+		qhi = vmlal_n_s16(qhi, vget_high_s16(newer), Mix_Coeffs_Q[k]);
+		qhi = vmlsl_n_s16(qhi, vget_high_s16(older), Mix_Coeffs_Q[k]);
+	}
+	vst1q_s32(&macI[0], ilo);
+	vst1q_s32(&macI[4], ihi);
+	vst1q_s32(&macQ[0], qlo);
+	vst1q_s32(&macQ[4], qhi);
+#elif defined(LANE_SSE2)
+	// newer and older side by side, so one madd does a tap pair
+	__m128i zero = _mm_setzero_si128();
+	__m128i xc = _mm_loadu_si128((const __m128i *)x[FIR_CENTRE]);
+	__m128i ilo = _mm_madd_epi16(_mm_unpacklo_epi16(xc, zero), lane_coeffs_I[FIR_CENTRE]);
+	__m128i ihi = _mm_madd_epi16(_mm_unpackhi_epi16(xc, zero), lane_coeffs_I[FIR_CENTRE]);
+	__m128i qlo = zero, qhi = zero;
+	for (int k = 0; k < FIR_CENTRE; k++) {
+		__m128i newer = _mm_loadu_si128((const __m128i *)x[N_FIR_TAPS - 1 - k]);
+		__m128i older = _mm_loadu_si128((const __m128i *)x[k]);
+		__m128i lo = _mm_unpacklo_epi16(newer, older), hi = _mm_unpackhi_epi16(newer, older);
+		ilo = _mm_add_epi32(ilo, _mm_madd_epi16(lo, lane_coeffs_I[k]));
+		ihi = _mm_add_epi32(ihi, _mm_madd_epi16(hi, lane_coeffs_I[k]));
+		qlo = _mm_add_epi32(qlo, _mm_madd_epi16(lo, lane_coeffs_Q[k]));
+		qhi = _mm_add_epi32(qhi, _mm_madd_epi16(hi, lane_coeffs_Q[k]));
+	}
+	_mm_storeu_si128((__m128i *)&macI[0], ilo);
+	_mm_storeu_si128((__m128i *)&macI[4], ihi);
+	_mm_storeu_si128((__m128i *)&macQ[0], qlo);
+	_mm_storeu_si128((__m128i *)&macQ[4], qhi);
+#else
+	for (int l = 0; l < DSP_LANES; l++) {
+		macI[l] = (int32_t)Mix_Coeffs_I[FIR_CENTRE] * x[FIR_CENTRE][l];
+		macQ[l] = 0;
+	}
+	for (int k = 0; k < FIR_CENTRE; k++) {
+		const int16_t *newer = x[N_FIR_TAPS - 1 - k], *older = x[k];
+		for (int l = 0; l < DSP_LANES; l++) {
+			macI[l] += (int32_t)Mix_Coeffs_I[k] * (newer[l] + older[l]);
+			macQ[l] += (int32_t)Mix_Coeffs_Q[k] * (newer[l] - older[l]);
+		}
+	}
+#endif
+}
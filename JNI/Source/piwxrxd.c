@@ -0,0 +1,677 @@
+/*---------------------------------------------------------------------------
+
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Native receiver daemon
+
+	File Name:		  piwxrxd.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Runs the receiver without the JVM. Reads the same PiWxRx.xml
+				  as the Java code, starts the audio source and demodulator,
+				  frames the SAME messages and forwards them using the dump or
+				  post methods. SIP, RTP and e-mail still need the Java receiver.
+				  SIGHUP reads the source from the file again and switches
+				  to it without stopping the receiver.
+				  With -F, decodes a recording as fast as possible instead and
+				  prints each message with its offset into the recording.
+				  Built with -DARENA_CHECK (make piwxrxd-check), any heap
+				  allocation on a pipeline thread after warm up aborts.
+
+				  This program is free software: you can redistribute it and/or modify
+				  it under the terms of the GNU General Public License as published by
+				  the Free Software Foundation, either version 2 of the License, or
+				  (at your option) any later version, provided this copyright notice
+				  is included.
+
+				  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "rtl.h"
+
+#define	PIWXRXD_VERSION		"4.4.2"
+#define	ATTR_LEN			256				// longest attribute value
+#define	HTTP_BFRSIZ			8192			// sizeof(http request)
+#define	HTTP_TIMEOUT		10				// seconds to wait for the server
+#define	FIELD_LEN			(4*ATTR_LEN)	// substituted field
+
+// forwarding methods
+#define	FWD_DUMP			0				// dump to stdout
+#define	FWD_POST			1				// post to a web site
+
+// configuration from PiWxRx.xml
+struct piwxrxd_config_t {
+	char		cmdline[ATTR_LEN];			// source command line
+	char		originator[ATTR_LEN];		// our callsign
+	char		database[ATTR_LEN];			// SAME database
+	int			method;						// forwarding method
+	char		serveraddr[ATTR_LEN];		// web server
+	char		port[ATTR_LEN];				// web server port
+	char		protocol[ATTR_LEN];			// http or soap
+	char		pagename[ATTR_LEN];			// page on the server
+	char		xmlcmd[ATTR_LEN];			// SOAP prototype file
+	char		webmethod[ATTR_LEN];		// SOAP method
+	char		bbminutes[ATTR_LEN];		// black box length, none if empty
+	char		bbencoding[ATTR_LEN];		// ulaw or pcm
+	char		bbdirectory[ATTR_LEN];		// where it dumps
+	char		rtspec[RT_THREADS][ATTR_LEN];	// scheduling per pipeline thread
+	char		lockmemory[ATTR_LEN];		// mlockall
+	char		mcgroup[ATTR_LEN];			// multicast group, none if empty
+	char		mcport[ATTR_LEN];			// its port
+	char		mcttl[ATTR_LEN];			// ttl or hop limit
+	char		mcinterface[ATTR_LEN];		// interface to send on
+	char		mccodec[ATTR_LEN];			// pcmu or pcma
+	char		mcgain[ATTR_LEN];			// gain shift
+} config;
+
+int shutdown_pipe[2];						// signal handler to shutdown thread
+static char *xmlfile = "PiWxRx.xml";
+
+// internals
+static BOOL read_config(char *filename);
+static char *load_xml(char *filename);
+static void reload_source(void);
+static BOOL xml_attr(char *xml, char *tag, char *attr, char *value);
+static void byteRx(DEMOD_BYTE data);
+static void messageRx(SAME_MESSAGE *msg);
+static void *post_thread_fn(void *arg);
+static void format_fields(SAME_MESSAGE *msg, char fields[][FIELD_LEN]);
+static BOOL http_request(char *request);
+static void url_encode(char *dest, char *src, int maxlen);
+static void *shutdown_thread_fn(void *arg);
+static void *rtl_thread_fn(void *arg);
+static void handle_shutdown(int sig);
+static void offlineRx(SAME_MESSAGE *msg);
+
+// substitution fields, in the order of the @ codes below
+#define	FIELD_CODES		"UOABTDPR"
+enum { F_URL, F_ORIG, F_AGENCY, F_BULLETIN, F_TIME, F_DATE, F_PURGE, F_AREAS, N_FIELDS };
+
+int main(int argc, char *argv[])
+{
+	char *recording = NULL, *statsendpoint = NULL, *tracefile = NULL;
+	int debug = 0, rate = SAMPLE_RATE;
+	BOOL bigendian = FALSE;
+	pthread_t rtl_thread, shutdown_thread;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-b")) {
+			bigendian = TRUE;
+			continue;
+		}
+		if ((argv[i][0] == '-') && (i + 1 < argc))
+			switch (argv[i][1]) {
+
+			case 'X':
+				xmlfile = argv[++i];
+				continue;
+
+			case 'd':
+				sscanf(argv[++i], "%x", (unsigned int *)&debug);
+				continue;
+
+			case 'F':
+				recording = argv[++i];
+				continue;
+
+			case 'R':
+				rate = atoi(argv[++i]);
+				continue;
+
+			case 'm':
+				statsendpoint = argv[++i];
+				continue;
+
+			case 't':
+				tracefile = argv[++i];
+				continue;
+			}
+		fprintf(stderr, "Usage: piwxrxd [-X <xml file>] [-d <hex debug flags>] [-m <stats port|socket path>]\n"
+			"       [-t <trace file>]\n"
+			"       piwxrxd -F <recording|-> [-R 24000|48000] [-b] [-d <hex debug flags>]\n");
+		exit(100);
+	}
+
+	// offline decode of a recording, no configuration needed
+	if (recording != NULL) {
+		debuglevel = debug;
+		exit(DecodeOffline(recording, rate, bigendian, &offlineRx, debug) ? 0 : 200);
+	}
+
+	fprintf(stderr, "PiWxRx native receiver %s starting\n", PIWXRXD_VERSION);
+	debuglevel = debug;
+
+	if (!read_config(xmlfile))
+		exit(100);
+	if (!SameDBLoad(config.database))
+		exit(100);
+
+	// shut down cleanly on SIGINT or SIGTERM, from whichever thread gets it;
+	// SIGHUP goes the same way to switch sources
+	struct sigaction sa;
+	if (pipe(shutdown_pipe) < 0) {
+		fprintf(stderr, "Shutdown pipe create failed\n");
+		exit(200);
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_shutdown;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	// everything, unless the debug flags pick some events
+	if (tracefile != NULL)
+		TraceStart(tracefile, (debug & TRACE_FLAGS) ? debug : TRACE_FLAGS);
+
+	// every buffer of the receive path, taken from the heap once
+	size_t arenasize = ARENA_PIPELINE_SIZE;
+	if (config.bbminutes[0] != '\0')
+		arenasize += BB_BYTES(atoi(config.bbminutes), !strcmp(config.bbencoding, "ulaw"));
+	if (!ArenaInit(arenasize)) {
+		fprintf(stderr, "Cannot allocate %zu bytes of buffers\n", arenasize);
+		exit(200);
+	}
+#ifdef ARENA_CHECK
+	ArenaStrict(TRUE);
+#endif
+
+	// the threads pick these up as they start; refusals only cost latency
+	for (int i = 0; i < RT_THREADS; i++) {
+		if ((config.rtspec[i][0] != '\0') && !RTConfigure(i, config.rtspec[i]))
+			fprintf(stderr, "Bad realtime setting %s\n", config.rtspec[i]);
+	}
+	if (!strcmp(config.lockmemory, "yes") && !RTLockMemory(TRUE))
+		fprintf(stderr, "Memory not locked, running without\n");
+
+	fprintf(stderr, "Starting: %s at debug level %x\n", config.cmdline, debug);
+	if (!InitRTL(config.cmdline, &byteRx, debug)) {
+		fprintf(stderr, "Exec failed\n");
+		exit(200);
+	}
+	databuffer_init();
+	SameFramerInit(&messageRx, &ClrFSKSync);
+	if ((statsendpoint != NULL) && !StatsServerStart(statsendpoint))
+		fprintf(stderr, "Cannot serve stats on %s\n", statsendpoint);
+	if ((config.bbminutes[0] != '\0')
+		&& !BlackboxStart(atoi(config.bbminutes), !strcmp(config.bbencoding, "ulaw"), config.bbdirectory))
+		fprintf(stderr, "Cannot start the black box\n");
+	if ((config.mcgroup[0] != '\0')
+		&& !StartMulticast(config.mcgroup, atoi(config.mcport), (config.mcttl[0] != '\0') ? atoi(config.mcttl) : 1,
+			config.mcinterface, !strcmp(config.mccodec, "pcma") ? CODEC_PCMA : CODEC_PCMU, atoi(config.mcgain)))
+		fprintf(stderr, "Cannot multicast to %s\n", config.mcgroup);
+
+	pthread_create(&shutdown_thread, NULL, shutdown_thread_fn, NULL);
+	pthread_create(&rtl_thread, NULL, rtl_thread_fn, NULL);
+
+	// same as the Java receive thread: pull bytes and frame them
+	for (;;)
+		SameFramerByte(databuffer_get());
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	read_config
+
+	INPUTS:		xml file name
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	pull the source and forwarding stanzas out of the XML file
+
+---------------------------------------------------------------------------*/
+static BOOL read_config(char *filename)
+{
+	char *xml;
+	char method[ATTR_LEN];
+
+	if ((xml = load_xml(filename)) == NULL)
+		return FALSE;
+
+	if (!xml_attr(xml, "source", "cmdline", config.cmdline)) {
+		fprintf(stderr, "No source cmdline in %s\n", filename);
+		free(xml);
+		return FALSE;
+	}
+	if (!xml_attr(xml, "forwarding", "database", config.database)
+		|| !xml_attr(xml, "forwarding", "method", method)) {
+		fprintf(stderr, "Forwarding database and method are required in %s\n", filename);
+		free(xml);
+		return FALSE;
+	}
+	xml_attr(xml, "forwarding", "originator", config.originator);
+	xml_attr(xml, "forwarding", "serveraddr", config.serveraddr);
+	xml_attr(xml, "forwarding", "port", config.port);
+	xml_attr(xml, "forwarding", "protocol", config.protocol);
+	xml_attr(xml, "forwarding", "pagename", config.pagename);
+	xml_attr(xml, "forwarding", "xmlcmd", config.xmlcmd);
+	xml_attr(xml, "forwarding", "webmethod", config.webmethod);
+	xml_attr(xml, "blackbox", "minutes", config.bbminutes);
+	xml_attr(xml, "blackbox", "encoding", config.bbencoding);
+	xml_attr(xml, "blackbox", "directory", config.bbdirectory);
+	xml_attr(xml, "realtime", "timer", config.rtspec[RT_TIMER]);
+	xml_attr(xml, "realtime", "dsp", config.rtspec[RT_DSP]);
+	xml_attr(xml, "realtime", "capture", config.rtspec[RT_CAPTURE]);
+	xml_attr(xml, "realtime", "lockmemory", config.lockmemory);
+	xml_attr(xml, "multicast", "group", config.mcgroup);
+	xml_attr(xml, "multicast", "port", config.mcport);
+	xml_attr(xml, "multicast", "ttl", config.mcttl);
+	xml_attr(xml, "multicast", "interface", config.mcinterface);
+	xml_attr(xml, "multicast", "codec", config.mccodec);
+	xml_attr(xml, "multicast", "gain", config.mcgain);
+	free(xml);
+
+	if (!strcmp(method, "dump")) {
+		config.method = FWD_DUMP;
+	} else if (!strcmp(method, "post")) {
+		config.method = FWD_POST;
+		if ((config.serveraddr[0] == '\0') || (config.port[0] == '\0')) {
+			fprintf(stderr, "Post method requires serveraddr and port\n");
+			return FALSE;
+		}
+	} else {
+		fprintf(stderr, "Forwarding method %s needs the Java receiver\n", method);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// the whole file, with the comments blanked out as they contain sample stanzas
+static char *load_xml(char *filename)
+{
+	FILE *fp;
+	char *xml, *start, *end;
+	long len;
+
+	if ((fp = fopen(filename, "rb")) == NULL) {
+		fprintf(stderr, "Cannot open configuration file %s\n", filename);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if ((xml = malloc(len + 1)) == NULL) {
+		fclose(fp);
+		return NULL;
+	}
+	len = (long)fread(xml, 1, len, fp);
+	xml[len] = '\0';
+	fclose(fp);
+
+	while ((start = strstr(xml, "<!--")) != NULL) {
+		if ((end = strstr(start, "-->")) == NULL)
+			end = start + strlen(start) - 3;
+		memset(start, ' ', end - start + 3);
+	}
+	return xml;
+}
+
+// SIGHUP: only the source is taken from the file again
+static void reload_source(void)
+{
+	char *xml, cmdline[ATTR_LEN];
+
+	if ((xml = load_xml(xmlfile)) == NULL)
+		return;
+	if (!xml_attr(xml, "source", "cmdline", cmdline)) {
+		fprintf(stderr, "No source cmdline in %s\n", xmlfile);
+	} else if (strcmp(cmdline, config.cmdline) != 0) {
+		fprintf(stderr, "Switching to: %s\n", cmdline);
+		if (ReconfigureSource(cmdline))
+			strcpy(config.cmdline, cmdline);
+		else
+			fprintf(stderr, "Cannot switch to %s\n", cmdline);
+	}
+	free(xml);
+}
+
+// find attr="value" inside the first <tag ...> element
+static BOOL xml_attr(char *xml, char *tag, char *attr, char *value)
+{
+	char pattern[64];
+	char *elem, *close, *p;
+	size_t attrlen = strlen(attr);
+
+	value[0] = '\0';
+	sprintf(pattern, "<%s", tag);
+	for (elem = strstr(xml, pattern); elem != NULL; elem = strstr(elem + 1, pattern)) {
+		char next = elem[strlen(pattern)];
+		if ((next == ' ') || (next == '\t') || (next == '\r') || (next == '\n') || (next == '/') || (next == '>'))
+			break;
+	}
+	if ((elem == NULL) || ((close = strchr(elem, '>')) == NULL))
+		return FALSE;
+
+	for (p = elem + strlen(pattern); p < close; p++) {
+		if (strncmp(p, attr, attrlen) || ((p[-1] != ' ') && (p[-1] != '\t') && (p[-1] != '\n') && (p[-1] != '\r')))
+			continue;
+		char *q = p + attrlen;
+		while ((*q == ' ') || (*q == '\t'))
+			q++;
+		if (*q++ != '=')
+			continue;
+		while ((*q == ' ') || (*q == '\t'))
+			q++;
+		char quote = *q++;
+		if ((quote != '"') && (quote != '\''))
+			continue;
+		char *endq = strchr(q, quote);
+		if ((endq == NULL) || (endq - q >= ATTR_LEN))
+			return FALSE;
+		memcpy(value, q, endq - q);
+		value[endq - q] = '\0';
+		return TRUE;
+	}
+	return FALSE;
+}
+
+// callback for data rx puts data in the buffer
+static void byteRx(DEMOD_BYTE data)
+{
+	databuffer_put(data);
+}
+
+// offline messages: seconds and sample offset into the recording, then the header
+static void offlineRx(SAME_MESSAGE *msg)
+{
+	fprintf(stdout, "%.3f %lld %s\n", (double)msg->sample / SAMPLE_RATE, (long long)msg->sample, msg->raw);
+	fflush(stdout);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	messageRx
+
+	INPUTS:		framed SAME message
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	forward a message. Posting is done on its own thread so
+					that the byte stream keeps being drained.
+
+---------------------------------------------------------------------------*/
+static void messageRx(SAME_MESSAGE *msg)
+{
+	msg->capture = databuffer_capture();
+	LatencyRecord(LAT_FRAMED, msg->capture);
+
+	switch (config.method) {
+
+	case FWD_DUMP:
+		fprintf(stdout, "%s\n", msg->raw);
+		fflush(stdout);
+		LatencyRecord(LAT_DELIVERED, msg->capture);
+		break;
+
+	case FWD_POST:
+		if (msg->eom)
+			break;
+		SAME_MESSAGE *copy = malloc(sizeof(SAME_MESSAGE));
+		if (copy != NULL) {
+			pthread_t post_thread;
+			memcpy(copy, msg, sizeof(SAME_MESSAGE));
+			if (pthread_create(&post_thread, NULL, post_thread_fn, copy) == 0)
+				pthread_detach(post_thread);
+			else
+				free(copy);
+		}
+		break;
+	}
+}
+
+static void *post_thread_fn(void *arg)
+{
+	SAME_MESSAGE *msg = arg;
+	char fields[N_FIELDS][FIELD_LEN];
+	char *request = malloc(HTTP_BFRSIZ);
+
+	if (request == NULL) {
+		free(msg);
+		return NULL;
+	}
+	format_fields(msg, fields);
+
+	if (strcmp(config.protocol, "soap")) {
+		// HTTP post of the fields as a url encoded form
+		static char *names[N_FIELDS] = { "", "Originator", "Agency", "Bulletin",
+			"TimeofIssue", "DateofIssue", "PurgeTime", "Areas" };
+		char body[HTTP_BFRSIZ / 2];
+		int blen = 0;
+		for (int i = F_ORIG; (i < N_FIELDS) && (blen < (int)sizeof(body)); i++) {
+			char encoded[3*FIELD_LEN];
+			url_encode(encoded, fields[i], sizeof(encoded));
+			blen += snprintf(&body[blen], sizeof(body) - blen, "%s%s=%s", (i == F_ORIG) ? "" : "&", names[i], encoded);
+		}
+		if (blen >= (int)sizeof(body))
+			blen = sizeof(body) - 1;
+
+		snprintf(request, HTTP_BFRSIZ, "POST /%s HTTP/1.0\r\nHost: %s:%s\r\n"
+			"Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %d\r\n"
+			"Connection: close\r\n\r\n%s",
+			config.pagename, config.serveraddr, config.port, blen, body);
+	} else {
+		// SOAP post of the prototype file with the fields substituted
+		char body[HTTP_BFRSIZ / 2];
+		int blen = 0, c;
+		FILE *fp = fopen(config.xmlcmd, "r");
+		if (fp == NULL) {
+			fprintf(stderr, "Cannot open SOAP prototype %s\n", config.xmlcmd);
+			free(request);
+			free(msg);
+			return NULL;
+		}
+		while (((c = fgetc(fp)) != EOF) && (blen < (int)sizeof(body) - FIELD_LEN)) {
+			char *code;
+			if ((c == '@') && ((c = fgetc(fp)) != EOF) && ((code = strchr(FIELD_CODES, c)) != NULL))
+				blen += snprintf(&body[blen], sizeof(body) - blen, "%s", fields[code - FIELD_CODES]);
+			else if (c != EOF)
+				body[blen++] = (char)c;
+		}
+		body[blen] = '\0';
+		fclose(fp);
+
+		snprintf(request, HTTP_BFRSIZ, "POST /%s HTTP/1.0\r\nHost: %s:%s\r\n"
+			"Content-Type: text/xml; charset=utf-8\r\nContent-Length: %d\r\n"
+			"SOAPAction: \"%s/%s\"\r\nConnection: close\r\n\r\n%s",
+			config.pagename, config.serveraddr, config.port, blen, fields[F_URL], config.webmethod, body);
+	}
+
+	if (!http_request(request))
+		fprintf(stderr, "Post of %s failed\n", msg->raw);
+	else
+		LatencyRecord(LAT_DELIVERED, msg->capture);
+
+	free(request);
+	free(msg);
+	return NULL;
+}
+
+// fill in the substitution fields for a message
+static void format_fields(SAME_MESSAGE *msg, char f[][FIELD_LEN])
+{
+	char *name;
+	int jday, hour, minute;
+
+	snprintf(f[F_URL], FIELD_LEN, "http://%s:%s/%s", config.serveraddr, config.port, config.pagename);
+	snprintf(f[F_ORIG], FIELD_LEN, "%s", config.originator);
+	name = SameDBAgency(msg->sender);
+	snprintf(f[F_AGENCY], FIELD_LEN, "%s", (name != NULL) ? name : msg->sender);
+	name = SameDBEvent(msg->event);
+	snprintf(f[F_BULLETIN], FIELD_LEN, "%s", (name != NULL) ? name : msg->event);
+
+	// JJJHHMM is in UTC, the day is counted from the start of this year
+	sscanf(msg->issued, "%3d%2d%2d", &jday, &hour, &minute);
+	time_t now = time(NULL);
+	struct tm tm;
+	gmtime_r(&now, &tm);
+	tm.tm_mon = 0;
+	tm.tm_mday = jday + SameDBDateOffset();
+	tm.tm_hour = 12;
+	timegm(&tm);
+	snprintf(f[F_TIME], FIELD_LEN, "%02d:%02d", hour, minute);
+	snprintf(f[F_DATE], FIELD_LEN, "%d/%d/%d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+	snprintf(f[F_PURGE], FIELD_LEN, "%.2s:%.2s", msg->purge, &msg->purge[2]);
+
+	f[F_AREAS][0] = '\0';
+	for (int i = 0; i < msg->nlocations; i++) {
+		strcat(f[F_AREAS], msg->locations[i]);
+		if (i != msg->nlocations - 1)
+			strcat(f[F_AREAS], " ");
+	}
+}
+
+// send a request and check the status line of the reply
+static BOOL http_request(char *request)
+{
+	struct addrinfo hints, *res, *rp;
+	struct timeval tv = { HTTP_TIMEOUT, 0 };
+	char reply[256];
+	int sock = -1, status = 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(config.serveraddr, config.port, &hints, &res) != 0) {
+		fprintf(stderr, "Cannot resolve %s\n", config.serveraddr);
+		return FALSE;
+	}
+	for (rp = res; rp != NULL; rp = rp->ai_next) {
+		if ((sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol)) < 0)
+			continue;
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0)
+			break;
+		close(sock);
+		sock = -1;
+	}
+	freeaddrinfo(res);
+	if (sock < 0) {
+		fprintf(stderr, "Cannot connect to %s:%s\n", config.serveraddr, config.port);
+		return FALSE;
+	}
+
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "%s\n", request);
+
+	int len = (int)strlen(request);
+	if (write(sock, request, len) == len) {
+		int nread = (int)read(sock, reply, sizeof(reply) - 1);
+		if (nread > 0) {
+			reply[nread] = '\0';
+			sscanf(reply, "HTTP/%*s %d", &status);
+		}
+	}
+	close(sock);
+
+	if ((status < 200) || (status > 299)) {
+		fprintf(stderr, "Server returned status %d\n", status);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void url_encode(char *dest, char *src, int maxlen)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	int len = 0;
+
+	for (; (*src != '\0') && (len < maxlen - 4); src++) {
+		unsigned char c = (unsigned char)*src;
+		if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9'))
+			|| (c == '-') || (c == '_') || (c == '.') || (c == '~') || (c == '/') || (c == ':')) {
+			dest[len++] = c;
+		} else {
+			dest[len++] = '%';
+			dest[len++] = hex[c >> 4];
+			dest[len++] = hex[c & 15];
+		}
+	}
+	dest[len] = '\0';
+}
+
+/*---------------------------------------------------------------------------
+
+	Shutdown and RTL threads
+
+---------------------------------------------------------------------------*/
+static void handle_shutdown(int sig)
+{
+	char c = (char)sig;
+	if (write(shutdown_pipe[1], &c, 1) < 0)
+		_exit(1);
+}
+
+static void *shutdown_thread_fn(void *arg)
+{
+	char c;
+
+	for (;;) {
+		if (read(shutdown_pipe[0], &c, 1) < 0)
+			continue;
+		if (c != SIGHUP)
+			break;
+		reload_source();
+	}
+	fprintf(stderr, "Stopping on signal %d\n", c);
+	StatsServerStop();
+	StopMulticast();
+	StopRTL();
+	exit(0);
+	return NULL;
+}
+
+static void *rtl_thread_fn(void *arg)
+{
+	RunRTL();
+	return NULL;
+}
+
+#ifdef ARENA_CHECK
+/*---------------------------------------------------------------------------
+
+	Heap checking: these replace the C library's for the whole process,
+	so the arena sees every allocation made by a pipeline thread
+
+---------------------------------------------------------------------------*/
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	ArenaHeapCheck(size);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	ArenaHeapCheck(n * size);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	ArenaHeapCheck(size);
+	return __libc_realloc(ptr, size);
+}
+#endif
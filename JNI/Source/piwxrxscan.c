@@ -0,0 +1,503 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Batch scanner
+
+	File Name:		  piwxrxscan.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Scans many recordings, or one very long one, for SAME
+					  messages using every core. The audio is cut into chunks
+					  that overlap by more than a full header, and worker
+					  processes decode the chunks with the offline decoder.
+					  The demodulator state is global, so the workers are
+					  forked processes rather than threads. Each starts with
+					  its own range of chunks in shared memory and steals from
+					  the others when it runs out. The messages come back over
+					  a pipe, and are merged and deduplicated.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "rtl.h"
+
+#define	SCAN_CHUNK_SECS		60				// default chunk length
+#define	SCAN_OVERLAP_SECS	10				// default overlap between chunks
+#define	SCAN_GROUP_SECS		15				// the framer's grouping of bursts and EOMs
+#define	SCAN_DUP_SAMPLES	(SAMPLE_RATE / 520)	// one bit, the same position
+#define	SCAN_LINE_LEN		(SAME_MAXLEN + 48)	// one message on the pipe
+#define	MAX_WORKERS			256
+
+// preamble and longest header, in seconds at 520.83 baud
+#define	SAME_HEADER_SECS	((16 + SAME_MAXLEN) * BITSPERBYTE / 520.83)
+
+int debuglevel = 0;
+
+// a recording, mapped in
+typedef struct scan_file_t {
+	char		*name;						// file name
+	unsigned char	*data;					// mapped file
+	size_t		size;						// bytes
+	int64_t		nsamples;					// samples at the pipe rate
+} SCAN_FILE;
+
+// a piece of a recording
+typedef struct scan_chunk_t {
+	int			file;						// index of the recording
+	int64_t		start;						// first sample, pipe rate
+	int64_t		len;						// samples, pipe rate
+} SCAN_CHUNK;
+
+// a decoded message
+typedef struct scan_msg_t {
+	int			file;						// index of the recording
+	int			chunk;						// chunk it was decoded from
+	int64_t		sample;						// offset, pipe rate
+	char		raw[SAME_MAXLEN + 1];		// header or NNNN
+} SCAN_MSG;
+
+// per worker deque of chunk indices, head and tail packed in one word so
+// that the owner popping and thieves stealing both use a single CAS
+typedef struct scan_deque_t {
+	uint64_t	range;						// tail << 32 | head
+	char		pad[56];					// one cache line each
+} SCAN_DEQUE;
+
+struct scan_t {
+	int			rate;						// of the recordings
+	BOOL		bigendian;					// sample byte order
+	int			nfiles;						// recordings
+	SCAN_FILE	*files;
+	int			nchunks;					// chunks
+	SCAN_CHUNK	*chunks;
+	int			nworkers;					// worker processes
+	SCAN_DEQUE	*deques;					// shared with the workers
+	int			pipefd;						// worker's end of the pipe
+	int			file;						// recording being decoded
+	int			chunk;						// and the chunk of it
+	int			nmsgs;						// messages collected
+	SCAN_MSG	*msgs;
+} scan;
+
+// internals
+static BOOL add_path(char *path);
+static BOOL add_file(char *name);
+static void make_chunks(int64_t chunklen, int64_t overlap);
+static void worker(int id);
+static BOOL take_chunk(int id, int *chunk);
+static void decode_chunk(SCAN_CHUNK *c);
+static void workerRx(SAME_MESSAGE *msg);
+static void collect(int fd);
+static BOOL overlap_repeat(int i);
+static int compare_msgs(const void *a, const void *b);
+static void usage(void);
+
+int main(int argc, char *argv[])
+{
+	double chunksecs = SCAN_CHUNK_SECS, overlapsecs = SCAN_OVERLAP_SECS;
+	int rate = SAMPLE_RATE, opt;
+	int pipefd[2];
+	pid_t pids[MAX_WORKERS];
+
+	scan.nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "j:c:o:R:bd:")) != -1) {
+		switch (opt) {
+
+		case 'j':
+			scan.nworkers = atoi(optarg);
+			break;
+
+		case 'c':
+			chunksecs = atof(optarg);
+			break;
+
+		case 'o':
+			overlapsecs = atof(optarg);
+			break;
+
+		case 'R':
+			rate = atoi(optarg);
+			break;
+
+		case 'b':
+			scan.bigendian = TRUE;
+			break;
+
+		case 'd':
+			sscanf(optarg, "%x", (unsigned int *)&debuglevel);
+			break;
+
+		default:
+			usage();
+		}
+	}
+	if (optind == argc)
+		usage();
+
+	RESAMPLER rs;
+	scan.rate = rate;
+	if (!ResampleInit(&rs, rate, FALSE, 0)) {
+		fprintf(stderr, "Sample rate %d cannot be converted\n", rate);
+		exit(100);
+	}
+	ResampleFree(&rs);
+	if (overlapsecs < SAME_HEADER_SECS) {
+		fprintf(stderr, "Overlap raised to %.1f seconds, one full header\n", SAME_HEADER_SECS);
+		overlapsecs = SAME_HEADER_SECS;
+	}
+	if (chunksecs <= overlapsecs) {
+		fprintf(stderr, "Chunks must be longer than the overlap\n");
+		exit(100);
+	}
+	if (scan.nworkers < 1)
+		scan.nworkers = 1;
+	if (scan.nworkers > MAX_WORKERS)
+		scan.nworkers = MAX_WORKERS;
+
+	for (int i = optind; i < argc; i++)
+		if (!add_path(argv[i]))
+			exit(100);
+	make_chunks((int64_t)(chunksecs * SAMPLE_RATE), (int64_t)(overlapsecs * SAMPLE_RATE));
+	if (scan.nchunks == 0) {
+		fprintf(stderr, "Nothing to scan\n");
+		exit(100);
+	}
+	if (scan.nworkers > scan.nchunks)
+		scan.nworkers = scan.nchunks;
+
+	// deal out contiguous ranges of chunks
+	scan.deques = mmap(NULL, scan.nworkers * sizeof(SCAN_DEQUE), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (scan.deques == MAP_FAILED) {
+		fprintf(stderr, "Cannot map the work queues\n");
+		exit(200);
+	}
+	for (int w = 0; w < scan.nworkers; w++) {
+		uint64_t head = (uint64_t)scan.nchunks * w / scan.nworkers;
+		uint64_t tail = (uint64_t)scan.nchunks * (w + 1) / scan.nworkers;
+		scan.deques[w].range = (tail << 32) | head;
+	}
+
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "%d recordings, %d chunks, %d workers\n", scan.nfiles, scan.nchunks, scan.nworkers);
+
+	if (pipe(pipefd) < 0) {
+		fprintf(stderr, "Cannot create the pipe\n");
+		exit(200);
+	}
+	for (int w = 0; w < scan.nworkers; w++) {
+		if ((pids[w] = fork()) < 0) {
+			fprintf(stderr, "Cannot fork worker %d\n", w);
+			exit(200);
+		}
+		if (pids[w] == 0) {
+			close(pipefd[0]);
+			scan.pipefd = pipefd[1];
+			worker(w);
+			_exit(0);
+		}
+	}
+	close(pipefd[1]);
+
+	collect(pipefd[0]);
+	close(pipefd[0]);
+
+	int failed = 0;
+	for (int w = 0; w < scan.nworkers; w++) {
+		int status;
+		waitpid(pids[w], &status, 0);
+		if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+			failed++;
+	}
+	if (failed)
+		fprintf(stderr, "%d workers failed, the results are incomplete\n", failed);
+
+	// in order, dropping the second decode of anything in an overlap; the
+	// workers pass up every EOM burst, and they are held back here as the
+	// framer would in a single pass
+	qsort(scan.msgs, scan.nmsgs, sizeof(SCAN_MSG), compare_msgs);
+	int64_t lasteom = 0;
+	for (int i = 0; i < scan.nmsgs; i++) {
+		SCAN_MSG *m = &scan.msgs[i];
+		DEBUGLEVEL(DEBUG_MSGS)
+			fprintf(stderr, "chunk %d: %lld %s\n", m->chunk, (long long)m->sample, m->raw);
+		if ((i == 0) || (m->file != scan.msgs[i - 1].file))
+			lasteom = -(SCAN_GROUP_SECS + 1) * (int64_t)SAMPLE_RATE;
+		if (overlap_repeat(i))
+			continue;
+		if (!strcmp(m->raw, "NNNN")) {
+			if ((m->sample / SAMPLE_RATE - lasteom / SAMPLE_RATE) <= SCAN_GROUP_SECS)
+				continue;
+			lasteom = m->sample;
+		}
+		printf("%s %.3f %lld %s\n", scan.files[m->file].name, (double)m->sample / SAMPLE_RATE,
+			(long long)m->sample, m->raw);
+	}
+	return failed ? 200 : 0;
+}
+
+/****************************************************************************
+ * 			Recordings and chunks
+ ***************************************************************************/
+// a file, or every regular file in a directory
+static BOOL add_path(char *path)
+{
+	struct stat st;
+	struct dirent **names;
+	int n;
+
+	if (stat(path, &st) < 0) {
+		fprintf(stderr, "Cannot find %s\n", path);
+		return FALSE;
+	}
+	if (!S_ISDIR(st.st_mode))
+		return add_file(path);
+
+	if ((n = scandir(path, &names, NULL, alphasort)) < 0) {
+		fprintf(stderr, "Cannot read directory %s\n", path);
+		return FALSE;
+	}
+	// entries after a failure are still freed
+	BOOL ok = TRUE;
+	for (int i = 0; i < n; i++) {
+		char name[PATH_MAX];
+		snprintf(name, sizeof(name), "%s/%s", path, names[i]->d_name);
+		if (ok && (names[i]->d_name[0] != '.') && (stat(name, &st) == 0) && S_ISREG(st.st_mode))
+			ok = add_file(name);
+		free(names[i]);
+	}
+	free(names);
+	return ok;
+}
+
+static BOOL add_file(char *name)
+{
+	SCAN_FILE *f;
+	struct stat st;
+	int fd;
+
+	if ((scan.files = realloc(scan.files, (scan.nfiles + 1) * sizeof(SCAN_FILE))) == NULL)
+		return FALSE;
+	f = &scan.files[scan.nfiles];
+	memset(f, 0, sizeof(SCAN_FILE));
+	if (((f->name = strdup(name)) == NULL) || ((fd = open(name, O_RDONLY)) < 0)) {
+		fprintf(stderr, "Cannot open %s\n", name);
+		return FALSE;
+	}
+	fstat(fd, &st);
+	f->size = st.st_size;
+	f->nsamples = (int64_t)(f->size / sizeof(RTL_SAMPLE)) * SAMPLE_RATE / scan.rate;
+	if (f->nsamples != 0) {
+		f->data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (f->data == MAP_FAILED) {
+			fprintf(stderr, "Cannot map %s\n", name);
+			close(fd);
+			return FALSE;
+		}
+		madvise(f->data, f->size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	scan.nfiles++;
+	return TRUE;
+}
+
+// chunks start every chunklen - overlap samples
+static void make_chunks(int64_t chunklen, int64_t overlap)
+{
+	int64_t step = chunklen - overlap;
+
+	for (int f = 0; f < scan.nfiles; f++) {
+		for (int64_t start = 0; start < scan.files[f].nsamples; start += step) {
+			scan.chunks = realloc(scan.chunks, (scan.nchunks + 1) * sizeof(SCAN_CHUNK));
+			if (scan.chunks == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				exit(200);
+			}
+			SCAN_CHUNK *c = &scan.chunks[scan.nchunks++];
+			c->file = f;
+			c->start = start;
+			c->len = scan.files[f].nsamples - start;
+			if (c->len > chunklen)
+				c->len = chunklen;
+			if (start + chunklen >= scan.files[f].nsamples)
+				break;
+		}
+	}
+}
+
+/****************************************************************************
+ * 			Workers
+ ***************************************************************************/
+static void worker(int id)
+{
+	int chunk;
+
+	while (take_chunk(id, &chunk))
+		decode_chunk(&scan.chunks[chunk]);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	take_chunk
+
+	INPUTS:		worker ID, where to put the chunk index
+
+	OUTPUTS:	FALSE when there is no work left anywhere
+
+	DESCRIPTION:	take the next chunk from the front of our own range;
+					when that is empty, steal one from the back of another
+					worker's range
+
+---------------------------------------------------------------------------*/
+static BOOL take_chunk(int id, int *chunk)
+{
+	for (int k = 0; k < scan.nworkers; k++) {
+		SCAN_DEQUE *d = &scan.deques[(id + k) % scan.nworkers];
+		uint64_t range = __atomic_load_n(&d->range, __ATOMIC_ACQUIRE);
+
+		for (;;) {
+			uint32_t head = (uint32_t)range, tail = (uint32_t)(range >> 32);
+			uint64_t next;
+
+			if (head >= tail)
+				break;
+			if (k == 0) {
+				next = ((uint64_t)tail << 32) | (head + 1);
+				*chunk = head;
+			} else {
+				next = ((uint64_t)(tail - 1) << 32) | head;
+				*chunk = tail - 1;
+			}
+			if (__atomic_compare_exchange_n(&d->range, &range, next, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// convert a chunk to pipe rate samples and decode it
+static void decode_chunk(SCAN_CHUNK *c)
+{
+	SCAN_FILE *f = &scan.files[c->file];
+	int64_t first = c->start * scan.rate / SAMPLE_RATE, last = (c->start + c->len) * scan.rate / SAMPLE_RATE;
+	int nbytes = (int)((last - first) * sizeof(RTL_SAMPLE)), n;
+	RESAMPLER rs;
+	RTL_SAMPLE *samples;
+
+	// the chunk overlap covers the filter settling
+	ResampleInit(&rs, scan.rate, scan.bigendian, 0);
+	if ((samples = malloc(ResampleMaxOut(&rs, nbytes) * sizeof(RTL_SAMPLE))) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		_exit(200);
+	}
+	n = Resample(&rs, f->data + first * sizeof(RTL_SAMPLE), nbytes, samples);
+	ResampleFree(&rs);
+
+	scan.file = c->file;
+	scan.chunk = (int)(c - scan.chunks);
+	OfflineInit(c->start, &workerRx, debuglevel);
+	SameFramerEveryEOM(TRUE);
+	OfflineDecode(samples, n);
+	OfflineFlush();
+	free(samples);
+}
+
+// one line per message, short enough that the pipe keeps it in one piece
+static void workerRx(SAME_MESSAGE *msg)
+{
+	char line[SCAN_LINE_LEN];
+	int len = snprintf(line, sizeof(line), "%d %d %lld %s\n", scan.file, scan.chunk, (long long)msg->sample, msg->raw);
+
+	if (write(scan.pipefd, line, len) != len)
+		_exit(200);
+}
+
+/****************************************************************************
+ * 			Results
+ ***************************************************************************/
+// read the workers' messages until they have all finished
+static void collect(int fd)
+{
+	FILE *fp = fdopen(fd, "r");
+	char line[SCAN_LINE_LEN];
+	int size = 0;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		SCAN_MSG m;
+		long long sample;
+
+		if (sscanf(line, "%d %d %lld %268s", &m.file, &m.chunk, &sample, m.raw) != 4)
+			continue;
+		m.sample = sample;
+		if (scan.nmsgs == size) {
+			size = size ? 2 * size : 64;
+			if ((scan.msgs = realloc(scan.msgs, size * sizeof(SCAN_MSG))) == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				exit(200);
+			}
+		}
+		scan.msgs[scan.nmsgs++] = m;
+	}
+}
+
+/*
+ * Neighbouring chunks both decode what lies in their overlap: the later one
+ * at the same position if it started before the header, or from a later
+ * burst if it started part way through. Only the message just before, with
+ * the same text and from another chunk, can be such a copy; anything in
+ * between, an NNNN in particular, means the text was really sent again.
+ */
+static BOOL overlap_repeat(int i)
+{
+	SCAN_MSG *m = &scan.msgs[i], *prev;
+
+	if (i == 0)
+		return FALSE;
+	prev = &scan.msgs[i - 1];
+	if ((prev->file != m->file) || (prev->chunk == m->chunk) || strcmp(prev->raw, m->raw))
+		return FALSE;
+	if (m->sample - prev->sample <= SCAN_DUP_SAMPLES)
+		return TRUE;
+	return (scan.chunks[m->chunk].start > prev->sample - (int64_t)(SAME_HEADER_SECS * SAMPLE_RATE))
+		&& (m->sample - prev->sample <= SCAN_GROUP_SECS * SAMPLE_RATE);
+}
+
+static int compare_msgs(const void *a, const void *b)
+{
+	const SCAN_MSG *ma = a, *mb = b;
+
+	if (ma->file != mb->file)
+		return ma->file - mb->file;
+	if (ma->sample != mb->sample)
+		return (ma->sample < mb->sample) ? -1 : 1;
+	return strcmp(ma->raw, mb->raw);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: piwxrx-scan [-j workers] [-c chunk secs] [-o overlap secs] [-R <sample rate>] [-b]\n"
+		"\t[-d <hex debug flags>] <recording or directory> ...\n");
+	exit(100);
+}
@@ -39,6 +39,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 
 #include "rtl.h"
@@ -52,20 +53,34 @@
 
 #define	MARK		    0x80	// mark bit
 
+#define	GAP_THRESHOLD	    (2*PIPE_READ_LEN)	// samples owed before filling a gap
+#define	GAP_MAX_DEFICIT	    (10*PIPE_READ_LEN)	// don't try to catch up more than this
+
 // struct to manage timed thread
 struct timer_threads_t {
 	BOOL			exit;
 	RTL_SAMPLE		*PipeBufferPtr;
 	BOOL			SendingUDP;
+	BOOL			SendingMulticast;
+	int			rtp_deficit;				// samples the RTP clock is owed
+	int			mcast_deficit;				// and the multicast one
 	int			debuglevel;
+	int64_t			ticktime;					// when the timer last fired
+	char			*pendingshm;				// ring to switch to, owned by whoever takes it
+	int				shmretry;					// ticks before looking for it again
+#ifndef _WIN32
+	timer_t			timerid;					// 30 ms timer
+#endif
 	pthread_t		timer_fn;
 	pthread_mutex_t	timer_mutex;				// timer mutex
+	pthread_mutex_t	send_mutex;					// held while a tick sends, so a stop waits
 	pthread_cond_t	timer_wait_cond;			// timer wait condition
 	pthread_mutex_t	timer_exit_mutex;			// timer exit mutex
 	pthread_cond_t	timer_exit_wait_cond;		// timer exit wait condition    
 } timer_threads;
 
 static void *timer_threads_fn(void *arg);
+static void switch_source(struct timer_threads_t *s);
 
 #ifndef __DEBUGLEVEL
 #define	__DEBUGLEVEL
@@ -88,16 +103,27 @@ BOOL InitRTL(char *cmdline, void (*rx_func)(DEMOD_BYTE x), int debug)
 
 	debuglevel = debug;
 
-	// start the child process
-	if (!initChildProcess((char *)cmdline)) {
+	// a filereader already running, or start the child process
+	if (!strncmp(cmdline, SHM_PREFIX, strlen(SHM_PREFIX))) {
+		if (!ShmSourceOpen(cmdline)) {
+			DEBUGPRINTF("Could not open shared memory source\n");
+			return(FALSE);
+		}
+	} else if (!initChildProcess((char *)cmdline)) {
 		DEBUGPRINTF("Could not start child process\n");
 		return(FALSE);
-	}
-	DEBUGPRINTF("Child process started successfully\n");
+	} else
+		DEBUGPRINTF("Child process started successfully\n");
 
+	StatsInit(NULL);
+	if (!ArenaInit(ARENA_PIPELINE_SIZE)) {
+		DEBUGPRINTF("Memory Allocation Error\n");
+		return(FALSE);
+	}
 	DSPInit(rx_func, debuglevel);
 
 	timer_threads.SendingUDP = FALSE;
+	timer_threads.SendingMulticast = FALSE;
 	timer_threads.exit = FALSE;
 #ifdef _WIN32
 	timer_threads.timer_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -108,6 +134,7 @@ BOOL InitRTL(char *cmdline, void (*rx_func)(DEMOD_BYTE x), int debug)
 	timer_threads.debuglevel = debug;
 
 	pthread_mutex_init(&timer_threads.timer_mutex, NULL);
+	pthread_mutex_init(&timer_threads.send_mutex, NULL);
 	pthread_cond_init(&timer_threads.timer_wait_cond, NULL);
 	pthread_mutex_init(&timer_threads.timer_exit_mutex, NULL);
 	pthread_cond_init(&timer_threads.timer_exit_wait_cond, NULL);    
@@ -134,10 +161,9 @@ BOOL InitRTL(char *cmdline, void (*rx_func)(DEMOD_BYTE x), int debug)
 BOOL RunRTL(void)
 {
 	// alloc buffers...
-	if ((timer_threads.PipeBufferPtr = (RTL_SAMPLE *)malloc((size_t)(sizeof(RTL_SAMPLE) * (PIPE_READ_LEN + SPARE)))) == NULL) {
-		DEBUGPRINTF("Memory Allocation Error\n");
+	// from the arena, so a restart gets the same buffer back
+	if ((timer_threads.PipeBufferPtr = (RTL_SAMPLE *)ArenaAlloc("pipe", (size_t)(sizeof(RTL_SAMPLE) * (PIPE_READ_SIZE + SPARE)))) == NULL)
 		return(FALSE);
-	}
 	DEBUGPRINTF("Alloc passed\n");
 
 
@@ -145,7 +171,6 @@ BOOL RunRTL(void)
 	// windows timer code...
 	if ((hTimer = CreateWaitableTimer(NULL, TRUE, NULL)) == NULL) {
 		DEBUGPRINTF("Create Timer failed\n");
-		free(timer_threads.PipeBufferPtr);
 		return(FALSE);
 	}
 	DEBUGPRINTF("Timer created\n");
@@ -166,7 +191,7 @@ BOOL RunRTL(void)
     // stop the background thread
     pthread_join(timer_threads.timer_fn, NULL);
 
-	free(timer_threads.PipeBufferPtr);
+	timer_threads.PipeBufferPtr = NULL;
 	DEBUGLEVEL(DEBUG_MSGS)
 		fprintf(stderr, "RTL process stopped\n");
 	return TRUE;
@@ -192,6 +217,9 @@ RTL_timer_signal(int sig, siginfo_t *si, void *uc)
     if (!si || si->si_code != SI_TIMER)	{
         return;
     }
+	timer_threads.ticktime = LatencyNow();
+	STATS_INC(STAT_TIMER_TICKS);
+	STATS_ADD(STAT_TIMER_OVERRUNS, timer_getoverrun(timer_threads.timerid));
     
 	pthread_mutex_lock(&timer_threads.timer_mutex);
 	pthread_cond_signal(&timer_threads.timer_wait_cond);
@@ -205,13 +233,11 @@ BOOL RunRTL(void)
     sigset_t mask;
     long long freq_nanosecs;
     struct itimerspec its;    
-    timer_t timerid;
 
 	// alloc buffers...
-	if ((timer_threads.PipeBufferPtr = (RTL_SAMPLE *)malloc((size_t)(sizeof(RTL_SAMPLE) * (PIPE_READ_SIZE + SPARE)))) == NULL) {
-		DEBUGPRINTF("Memory Allocation Error\n");
+	// from the arena, so a restart gets the same buffer back
+	if ((timer_threads.PipeBufferPtr = (RTL_SAMPLE *)ArenaAlloc("pipe", (size_t)(sizeof(RTL_SAMPLE) * (PIPE_READ_SIZE + SPARE)))) == NULL)
 		return(FALSE);
-	}
 	DEBUGPRINTF("Alloc passed\n");
 
     // step 1: establish a handle for timer signal
@@ -234,8 +260,8 @@ BOOL RunRTL(void)
     // step 3: create the timer
     sev.sigev_notify = SIGEV_SIGNAL;
     sev.sigev_signo = SIG;
-    sev.sigev_value.sival_ptr = &timerid;
-    if (timer_create(CLOCKID, &sev, &timerid) == -1)    {
+    sev.sigev_value.sival_ptr = &timer_threads.timerid;
+    if (timer_create(CLOCKID, &sev, &timer_threads.timerid) == -1)    {
         DEBUGPRINTF("timer_create Error\n");
 		return(FALSE);
 	}   
@@ -249,7 +275,7 @@ BOOL RunRTL(void)
     its.it_value.tv_nsec = freq_nanosecs % 1000000000;
     its.it_interval.tv_sec = its.it_value.tv_sec;
     its.it_interval.tv_nsec = its.it_value.tv_nsec;
-    if (timer_settime(timerid, 0, &its, NULL) == -1)    {
+    if (timer_settime(timer_threads.timerid, 0, &its, NULL) == -1)    {
         DEBUGPRINTF("timer_settime Error\n");
 		return(FALSE);
     }
@@ -271,12 +297,12 @@ BOOL RunRTL(void)
     its.it_value.tv_nsec = 0;
     its.it_interval.tv_sec = 0;
     its.it_interval.tv_nsec = 0;
-    timer_settime(timerid, 0, &its, NULL);
+    timer_settime(timer_threads.timerid, 0, &its, NULL);
     
     // stop the background thread
     pthread_join(timer_threads.timer_fn, NULL);
 
-	free(timer_threads.PipeBufferPtr);
+	timer_threads.PipeBufferPtr = NULL;
 	DEBUGLEVEL(DEBUG_MSGS)
 		fprintf(stderr, "Timer process stopped\n");
 	return TRUE;
@@ -296,30 +322,111 @@ BOOL RunRTL(void)
 ---------------------------------------------------------------------------*/
 static void *timer_threads_fn(void *arg)
 {
-	int samples_read = 0;
+	int samples_read = 0, ticks = 0;
 	struct timer_threads_t *s = arg;
 
+	ArenaThread();
+	RTApply(RT_TIMER);
+
     // read the pipe every 30 ms
 	while (!s->exit) {
 		pthread_mutex_lock(&s->timer_mutex);
 		pthread_cond_wait(&s->timer_wait_cond, &s->timer_mutex);
 		pthread_mutex_unlock(&s->timer_mutex);
-		samples_read = ReadFromPipe(s->PipeBufferPtr, PIPE_READ_SIZE);
+		if (++ticks == ARENA_WARMUP_TICKS)
+			ArenaSeal();
+		LatencyRecord(LAT_TIMER, s->ticktime);
+		uint64_t cpu = StatsThreadTime(), now;
+		switch_source(s);
+		samples_read = ShmSourceActive() ? ShmSourceRead(s->PipeBufferPtr, PIPE_READ_SIZE)
+			: ReadFromPipe(s->PipeBufferPtr, PIPE_READ_SIZE);
+		int64_t capture = LatencyNow();
+
+		// every tick owes the RTP stream one frame of audio
+		pthread_mutex_lock(&s->send_mutex);
+		if (s->SendingUDP) {
+			s->rtp_deficit += PIPE_READ_LEN;
+			if (s->rtp_deficit > GAP_MAX_DEFICIT)
+				s->rtp_deficit = GAP_MAX_DEFICIT;
+		}
+		if (s->SendingMulticast) {
+			s->mcast_deficit += PIPE_READ_LEN;
+			if (s->mcast_deficit > GAP_MAX_DEFICIT)
+				s->mcast_deficit = GAP_MAX_DEFICIT;
+		}
+
 		if (samples_read > 0) {
 			int newsamples = PipeDecimate(s->PipeBufferPtr, samples_read, PIPE_READ_LEN);
+			BOOL udpsent = FALSE;
+			BlackboxWrite(s->PipeBufferPtr, newsamples);
+			now = StatsThreadTime();
+			STATS_ADD(STAT_CPU_PIPE, now - cpu);
+			cpu = now;
 			if (s->SendingUDP) {
-				SendUDPPacket(s->PipeBufferPtr, newsamples);
-				DEBUGPRINTF("Packet Sent\n");
+				// a burst after a filled gap would only overrun the far end
+				if (s->rtp_deficit > -PIPE_READ_LEN) {
+					SendUDPPacket(s->PipeBufferPtr, newsamples);
+					s->rtp_deficit -= newsamples;
+					udpsent = TRUE;
+					DEBUGPRINTF("Packet Sent\n");
+				}
 			} else {
 				DEBUGLEVEL(DEBUG_MSGS)
 					fprintf(stderr, "Read %d samples: %x\n", newsamples, debuglevel);
 			}
-			DSPDemod(s->PipeBufferPtr, newsamples);
-		} 
+			if (s->SendingMulticast && (s->mcast_deficit > -PIPE_READ_LEN)) {
+				SendMulticastPacket(s->PipeBufferPtr, newsamples, udpsent);
+				s->mcast_deficit -= newsamples;
+			}
+			now = StatsThreadTime();
+			STATS_ADD(STAT_CPU_RTP, now - cpu);
+			cpu = now;
+			DSPDemod(s->PipeBufferPtr, newsamples, capture);
+			STATS_ADD(STAT_CPU_QUEUE, StatsThreadTime() - cpu);
+		} else {
+			// source has stalled: keep the audio clocks running
+			if (s->SendingUDP && (s->rtp_deficit >= GAP_THRESHOLD)) {
+				DEBUGLEVEL(DEBUG_UDP)
+					fprintf(stderr, "Source underrun: %d samples owed\n", s->rtp_deficit);
+				if (SendUDPGap(PIPE_READ_LEN))
+					s->rtp_deficit -= PIPE_READ_LEN;
+			}
+			if (s->SendingMulticast && (s->mcast_deficit >= GAP_THRESHOLD)
+				&& SendMulticastGap(PIPE_READ_LEN))
+				s->mcast_deficit -= PIPE_READ_LEN;
+		}
+		pthread_mutex_unlock(&s->send_mutex);
     }
+	RTRelease(RT_TIMER);
 	return NULL;
 }
 
+// between ticks, move to a source ReconfigureSource asked for once it is ready
+static void switch_source(struct timer_threads_t *s)
+{
+	char *spec, *none = NULL;
+
+	if (SwitchChild()) {
+		if (ShmSourceActive())
+			ShmSourceClose();
+		STATS_INC(STAT_SOURCE_SWITCHES);
+	}
+	if ((__atomic_load_n(&s->pendingshm, __ATOMIC_ACQUIRE) == NULL) || (s->shmretry-- > 0))
+		return;
+	if ((spec = __atomic_exchange_n(&s->pendingshm, NULL, __ATOMIC_ACQ_REL)) == NULL)
+		return;
+	if (ShmSourceOpen(spec)) {
+		RetireChildren();
+		STATS_INC(STAT_SOURCE_SWITCHES);
+		free(spec);
+		return;
+	}
+	// not there yet: try again later, unless something newer was asked for
+	s->shmretry = SHM_RETRY_TICKS;
+	if (!__atomic_compare_exchange_n(&s->pendingshm, &none, spec, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		free(spec);
+}
+
 /*---------------------------------------------------------------------------
 
 	FUNCTION:	StopRTL
@@ -335,7 +442,10 @@ void StopRTL(void)
 {
 	timer_threads.exit = TRUE;
 	DSPStop();
+	if (ShmSourceActive())
+		ShmSourceClose();
 	CloseChildProcess();
+	free(__atomic_exchange_n(&timer_threads.pendingshm, NULL, __ATOMIC_ACQ_REL));
     
 #ifndef __WIN32
 // linux process is waiting on a signal
@@ -345,6 +455,34 @@ void StopRTL(void)
 #endif    
 }
 
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	ReconfigureSource
+
+	INPUTS:		command line or shm:<name>:<tag> of the new source
+
+	OUTPUTS:	TRUE if the switch is under way
+
+	DESCRIPTION:	change the source while the DSP thread, UDP session and
+					stats carry on. A new child is started beside the old
+					one and the timer thread moves over on the first tick it
+					has samples; a ring is taken as soon as it can be opened.
+					Until then the old source is still read
+
+---------------------------------------------------------------------------*/
+BOOL ReconfigureSource(char *cmdline)
+{
+	char *spec = NULL;
+
+	if (!strncmp(cmdline, SHM_PREFIX, strlen(SHM_PREFIX)) && ((spec = strdup(cmdline)) == NULL))
+		return FALSE;
+	timer_threads.shmretry = 0;
+	free(__atomic_exchange_n(&timer_threads.pendingshm, spec, __ATOMIC_ACQ_REL));
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "Switching source to %s\n", cmdline);
+	return (spec != NULL) ? TRUE : ReconfigureChild(cmdline);
+}
+
 /*---------------------------------------------------------------------------
 
 	FUNCTION:	ClrFSKSync
@@ -381,6 +519,7 @@ BOOL StartUDP(unsigned char *hdrPtr, int nhdrbytes, char *remoteip, int remotePo
     }
 
 	DEBUGPRINTF("UDP Started\n");
+	timer_threads.rtp_deficit = 0;
     timer_threads.SendingUDP = TRUE;
 
 	return TRUE;
@@ -399,8 +538,62 @@ BOOL StartUDP(unsigned char *hdrPtr, int nhdrbytes, char *remoteip, int remotePo
 ---------------------------------------------------------------------------*/
 void StopUDP(void)
 {	
+	// not while the timer thread is part way through a send
+	pthread_mutex_lock(&timer_threads.send_mutex);
 	timer_threads.SendingUDP = FALSE;
+	pthread_mutex_unlock(&timer_threads.send_mutex);
     CloseUDP();
 }
 
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	StartMulticast
+
+	INPUTS:		group, port, ttl, interface, codec, gain
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	start sending RTP packets to a multicast group; it
+					must be stopped before it can be started again
+
+---------------------------------------------------------------------------*/
+BOOL StartMulticast(char *group, int port, int ttl, char *ifname, int codec, int gain)
+{
+	if (timer_threads.SendingMulticast) {
+		fprintf(stderr, "Multicast already started\n");
+		return FALSE;
+	}
+
+	if (!InitMulticast(group, port, ttl, ifname, codec, gain)) {
+		DEBUGPRINTF("Start Multicast failed\n");
+		return FALSE;
+	}
+
+	DEBUGPRINTF("Multicast Started\n");
+	timer_threads.mcast_deficit = 0;
+	timer_threads.SendingMulticast = TRUE;
 
+	return TRUE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	StopMulticast
+
+	INPUTS:		none
+
+	OUTPUTS:	none
+
+	DESCRIPTION:	stop sending to the multicast group
+
+---------------------------------------------------------------------------*/
+void StopMulticast(void)
+{
+	pthread_mutex_lock(&timer_threads.send_mutex);
+	BOOL sending = timer_threads.SendingMulticast;
+	timer_threads.SendingMulticast = FALSE;
+	pthread_mutex_unlock(&timer_threads.send_mutex);
+	if (!sending)
+		return;
+	CloseMulticast();
+}
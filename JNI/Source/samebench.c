@@ -0,0 +1,214 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      SAME decode sensitivity bench
+
+	File Name:		  samebench.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Sweeps the signal to noise ratio of generated SAME
+					  transmissions through the demodulator and the framer,
+					  and prints the decode probability and CPU cost at each
+					  step as CSV. The other impairments are fixed for a run.
+					  With -o, writes one transmission to a raw file instead,
+					  or -t of them back to back, for use with filereader,
+					  dspbench or the scanner check.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rtl.h"
+
+#define	DEFAULT_HEADER		"ZCZC-WXR-TOR-048113-048439+0030-1231517-KOUN/NWS-"
+#define	DEFAULT_TRIALS		20
+#define	DEFAULT_AMPLITUDE	8000.0
+
+int debuglevel = 0;
+
+// results of one trial
+struct bench_trial_t {
+	char		*header;					// what was sent
+	int			headers;					// correct headers decoded
+	int			eoms;						// end of messages decoded
+	int			errors;						// wrong headers delivered
+} trial;
+
+// internals
+static void messageRx(SAME_MESSAGE *msg);
+static void usage(void);
+static double cpu_seconds(void);
+
+int main(int argc, char *argv[])
+{
+	SAME_GEN g = { .amplitude = DEFAULT_AMPLITUDE, .noise = TRUE, .wat_seconds = 1.0, .seed = 1 };
+	double snr_start = -3.0, snr_stop = 15.0, snr_step = 1.5;
+	int ntrials = DEFAULT_TRIALS, repeats = 1;
+	char *header = DEFAULT_HEADER, *outfile = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:n:Fc:k:f:r:w:a:S:m:o:t:")) != -1) {
+		switch (opt) {
+
+		case 's':
+			if (sscanf(optarg, "%lf:%lf:%lf", &snr_start, &snr_stop, &snr_step) == 1)
+				snr_stop = snr_start;
+			break;
+
+		case 'n':
+			ntrials = atoi(optarg);
+			break;
+
+		case 'F':
+			g.fm_noise = TRUE;
+			break;
+
+		case 'c':
+			g.carrier_offset = atof(optarg);
+			break;
+
+		case 'k':
+			g.clock_ppm = atof(optarg);
+			break;
+
+		case 'f':
+			g.fade_hz = atof(optarg);
+			break;
+
+		case 'r':
+			g.click_rate = atof(optarg);
+			break;
+
+		case 'w':
+			g.wat_seconds = atof(optarg);
+			break;
+
+		case 'a':
+			g.amplitude = atof(optarg);
+			break;
+
+		case 'S':
+			g.seed = (unsigned)atoi(optarg);
+			break;
+
+		case 'm':
+			header = optarg;
+			break;
+
+		case 'o':
+			outfile = optarg;
+			break;
+
+		case 't':
+			repeats = atoi(optarg);
+			break;
+
+		default:
+			usage();
+		}
+	}
+	if ((ntrials <= 0) || (snr_step <= 0.0) || (repeats <= 0))
+		usage();
+
+	// write one transmission and quit
+	if (outfile != NULL) {
+		RTL_SAMPLE *samples;
+		FILE *fp;
+		g.snr_db = snr_start;
+		int n = SameGenerate(&g, header, &samples);
+		if ((n == 0) || ((fp = fopen(outfile, "wb")) == NULL)) {
+			fprintf(stderr, "Cannot write %s\n", outfile);
+			exit(200);
+		}
+		for (int r = 0; r < repeats; r++)
+			fwrite(samples, sizeof(RTL_SAMPLE), n, fp);
+		fclose(fp);
+		free(samples);
+		fprintf(stderr, "%s: %d samples at %d Hz, %.1f dB SNR\n", outfile, n * repeats, SAMPLE_RATE, snr_start);
+		return 0;
+	}
+
+	printf("# %s noise, carrier %.1f Hz, clock %.0f ppm, fade %.2f Hz, clicks %.1f/s, %d trials\n",
+		g.fm_noise ? "FM" : "white", g.carrier_offset, g.clock_ppm, g.fade_hz, g.click_rate, ntrials);
+	printf("snr_db,trials,p_header,p_eom,false_headers,cpu_ms_per_trial,realtime_x\n");
+
+	for (double snr = snr_start; snr <= snr_stop + 1e-9; snr += snr_step) {
+		int headers = 0, eoms = 0, errors = 0;
+		double cpu = 0.0, audio = 0.0;
+
+		for (int t = 0; t < ntrials; t++) {
+			RTL_SAMPLE *samples;
+			g.snr_db = snr;
+			g.seed = g.seed * 1103515245u + 12345u;
+			int n = SameGenerate(&g, header, &samples);
+			if (n == 0) {
+				fprintf(stderr, "Out of memory\n");
+				exit(200);
+			}
+
+			memset(&trial, 0, sizeof(trial));
+			trial.header = header;
+			DSPInitSync(&SameFramerByte, debuglevel);
+			SameFramerInit(&messageRx, &DSPClearSync);
+
+			// feed it in pipe sized frames, as RunRTL would
+			double start = cpu_seconds();
+			for (int i = 0; i < n; i += PIPE_READ_LEN)
+				DSPDemodSync(&samples[i], (n - i < PIPE_READ_LEN) ? n - i : PIPE_READ_LEN);
+			cpu += cpu_seconds() - start;
+			audio += (double)n / SAMPLE_RATE;
+			free(samples);
+
+			headers += (trial.headers != 0);
+			eoms += (trial.eoms != 0);
+			errors += trial.errors;
+		}
+		printf("%.1f,%d,%.3f,%.3f,%d,%.2f,%.1f\n", snr, ntrials, (double)headers / ntrials,
+			(double)eoms / ntrials, errors, 1000.0 * cpu / ntrials, (cpu > 0.0) ? audio / cpu : 0.0);
+		fflush(stdout);
+	}
+	return 0;
+}
+
+// score what the framer delivers
+static void messageRx(SAME_MESSAGE *msg)
+{
+	if (msg->eom)
+		trial.eoms++;
+	else if (!strcmp(msg->raw, trial.header))
+		trial.headers++;
+	else
+		trial.errors++;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: samebench [-s start:stop:step dB] [-n trials] [-F] [-c carrier offset Hz]\n"
+		"\t[-k clock offset ppm] [-f fade Hz] [-r clicks/s] [-w alarm tone secs] [-a amplitude]\n"
+		"\t[-S seed] [-m header] [-o raw file to write] [-t transmissions in it]\n");
+	exit(100);
+}
+
+static double cpu_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
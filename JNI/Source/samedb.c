@@ -0,0 +1,650 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      SAME database
+
+	File Name:		  samedb.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Loads the SAME database used to translate agency,
+					  bulletin and location codes for the native daemon. The
+					  JSON is the editable source; samedbc compiles it into a
+					  binary image of perfect hash tables, which is mapped in
+					  directly when it is present and up to date. The JSON
+					  parser only understands the layout of SameDB.json: named
+					  arrays of [ "code", "name" ] pairs and integer offsets.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rtl.h"
+
+#define	SAMEDB_MAGIC		"SAMD"			// image signature
+#define	SAMEDB_VERSION		1				// image layout version
+#define	SAMEDB_NTABLES		3				// agencies, bulletins, locations
+#define	SAMEDB_BUCKETSIZE	4				// average keys per hash bucket
+#define	SAMEDB_MAXSEED		1000000			// give up on a bucket after this
+
+// image layout: header, then per table the bucket seeds and the slots,
+// then the string pool. All offsets are from the start of the image.
+typedef struct samedb_htable_t {
+	uint32_t	nentries;				// codes in the table
+	uint32_t	nbuckets;				// hash buckets
+	uint32_t	nslots;					// slots, some are empty
+	uint32_t	seeds;					// offset of the bucket seeds
+	uint32_t	slots;					// offset of the code/name slots
+} SAMEDB_HTABLE;
+
+typedef struct samedb_header_t {
+	char		magic[4];				// SAMEDB_MAGIC
+	uint32_t	version;				// SAMEDB_VERSION
+	uint32_t	size;					// total image size
+	int32_t		dateoffset;				// offset to add to the date
+	int32_t		houroffset;				// hours before GMT
+	SAMEDB_HTABLE	tables[SAMEDB_NTABLES];	// agencies, bulletins, locations
+} SAMEDB_HEADER;
+
+typedef struct samedb_slot_t {
+	uint32_t	code;					// string offset, 0 if empty
+	uint32_t	name;					// string offset
+} SAMEDB_SLOT;
+
+// a table of code/name pairs
+typedef struct same_table_t {
+	int			nentries;				// entries in the table
+	char		**codes;				// codes
+	char		**names;				// names
+	SAMEDB_HTABLE	*hash;				// hash table in the image, or NULL
+} SAME_TABLE;
+
+// the database
+struct same_db_t {
+	char		*text;					// file contents while parsing
+	SAME_TABLE	agencies;				// agency names
+	SAME_TABLE	bulletins;				// event codes
+	SAME_TABLE	locations;				// PSSCCC codes
+	int			dateoffset;				// offset to add to the date
+	int			houroffset;				// hours before GMT
+	char		*image;					// mapped image, or NULL
+	size_t		imagesize;				// size of the mapping
+	BOOL		buildfailed;			// an image being built ran out of memory
+} same_db;
+
+// internals
+static BOOL samedb_parse(char *filename);
+static BOOL samedb_map(char *filename);
+static BOOL samedb_check(char *image, size_t size);
+static BOOL samedb_image_name(char *filename, char *image);
+static BOOL samedb_table(char *key, SAME_TABLE *table);
+static int samedb_int(char *key);
+static char *samedb_string(char **p);
+static char *samedb_find(SAME_TABLE *table, char *code);
+static uint32_t samedb_hash(char *key, uint32_t seed);
+static BOOL samedb_build(SAME_TABLE *table, SAMEDB_HTABLE *htable, char **image, uint32_t *size);
+static uint32_t samedb_append(char **image, uint32_t *size, void *data, uint32_t len);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameDBLoad
+
+	INPUTS:		database file name
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	map in the compiled image if the file is one, or if there
+					is a .bin next to the JSON that is not older than it.
+					Otherwise fall back to parsing the JSON.
+
+---------------------------------------------------------------------------*/
+BOOL SameDBLoad(char *filename)
+{
+	char image[PATH_MAX];
+
+	if (samedb_map(filename))
+		return TRUE;
+	if (samedb_image_name(filename, image) && samedb_map(image))
+		return TRUE;
+	return samedb_parse(filename);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameDBCompile
+
+	INPUTS:		JSON file name, image file name
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	build a perfect hash table for each code table and write
+					the image. It is written to a temporary file and renamed,
+					so a daemon that has the old image mapped is not disturbed.
+
+---------------------------------------------------------------------------*/
+BOOL SameDBCompile(char *jsonfile, char *imagefile)
+{
+	SAME_TABLE *tables[SAMEDB_NTABLES] = { &same_db.agencies, &same_db.bulletins, &same_db.locations };
+	SAMEDB_HEADER hdr;
+	char tmpname[PATH_MAX];
+	char *image = NULL;
+	uint32_t size = 0;
+	FILE *fp;
+
+	if (!samedb_parse(jsonfile))
+		return FALSE;
+
+	// header first, patched up at the end
+	memset(&hdr, 0, sizeof(hdr));
+	same_db.buildfailed = FALSE;
+	samedb_append(&image, &size, &hdr, sizeof(hdr));
+	samedb_append(&image, &size, "", 1);		// string offset 0 means empty
+
+	for (int i = 0; i < SAMEDB_NTABLES; i++) {
+		if (!samedb_build(tables[i], &hdr.tables[i], &image, &size)) {
+			fprintf(stderr, "Cannot build hash table %d\n", i);
+			free(image);
+			return FALSE;
+		}
+	}
+	if (same_db.buildfailed) {
+		fprintf(stderr, "Out of memory building the image\n");
+		return FALSE;
+	}
+
+	memcpy(hdr.magic, SAMEDB_MAGIC, sizeof(hdr.magic));
+	hdr.version = SAMEDB_VERSION;
+	hdr.size = size;
+	hdr.dateoffset = same_db.dateoffset;
+	hdr.houroffset = same_db.houroffset;
+	memcpy(image, &hdr, sizeof(hdr));
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", imagefile);
+	if ((fp = fopen(tmpname, "wb")) == NULL) {
+		fprintf(stderr, "Cannot create %s\n", tmpname);
+		free(image);
+		return FALSE;
+	}
+	BOOL written = (fwrite(image, 1, size, fp) == size);
+	written = (fclose(fp) == 0) && written;
+	free(image);
+	if (!written || (rename(tmpname, imagefile) < 0)) {
+		fprintf(stderr, "Cannot write %s\n", imagefile);
+		unlink(tmpname);
+		return FALSE;
+	}
+
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "%s: %u bytes\n", imagefile, size);
+	return TRUE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameDBAgency
+
+	INPUTS:		sender ID (LLLLLLLL)
+
+	OUTPUTS:	agency name or NULL
+
+	DESCRIPTION:	match the whole sender ID, or the part after the last
+					'/' (i.e. KOUN/NWS matches NWS)
+
+---------------------------------------------------------------------------*/
+char *SameDBAgency(char *sender)
+{
+	char *name, *slash;
+
+	if ((name = samedb_find(&same_db.agencies, sender)) != NULL)
+		return name;
+	if ((slash = strrchr(sender, '/')) != NULL)
+		return samedb_find(&same_db.agencies, slash + 1);
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameDBEvent
+
+	INPUTS:		event code (EEE)
+
+	OUTPUTS:	bulletin name or NULL
+
+	DESCRIPTION:	exact match first, then the ??x wildcard entries
+
+---------------------------------------------------------------------------*/
+char *SameDBEvent(char *event)
+{
+	char wildcard[4];
+	char *name;
+
+	if ((name = samedb_find(&same_db.bulletins, event)) != NULL)
+		return name;
+
+	sprintf(wildcard, "??%c", event[2]);
+	return samedb_find(&same_db.bulletins, wildcard);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameDBLocation
+
+	INPUTS:		location code (PSSCCC)
+
+	OUTPUTS:	location name or NULL
+
+	DESCRIPTION:	exact match first, then the whole county (P = 0)
+
+---------------------------------------------------------------------------*/
+char *SameDBLocation(char *location)
+{
+	char county[7];
+	char *name;
+
+	if ((name = samedb_find(&same_db.locations, location)) != NULL)
+		return name;
+
+	strcpy(county, location);
+	county[0] = '0';
+	return samedb_find(&same_db.locations, county);
+}
+
+int SameDBDateOffset(void)
+{
+	return same_db.dateoffset;
+}
+
+int SameDBHourOffset(void)
+{
+	return same_db.houroffset;
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// read the JSON into memory
+static BOOL samedb_parse(char *filename)
+{
+	FILE *fp;
+	long len;
+
+	if ((fp = fopen(filename, "rb")) == NULL) {
+		fprintf(stderr, "Cannot open SAME database %s\n", filename);
+		return FALSE;
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if ((same_db.text = malloc(len + 1)) == NULL) {
+		fclose(fp);
+		return FALSE;
+	}
+	len = (long)fread(same_db.text, 1, len, fp);
+	same_db.text[len] = '\0';
+	fclose(fp);
+
+	same_db.dateoffset = samedb_int("DateOffset");
+	same_db.houroffset = samedb_int("HourOffset");
+
+	if (!samedb_table("Agencies", &same_db.agencies)
+		|| !samedb_table("Bulletins", &same_db.bulletins)
+		|| !samedb_table("Locations", &same_db.locations)) {
+		fprintf(stderr, "SAME database %s is not valid\n", filename);
+		free(same_db.text);
+		return FALSE;
+	}
+	free(same_db.text);
+
+	DEBUGPRINTF("SAME database loaded\n");
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "%d agencies, %d bulletins, %d locations\n", same_db.agencies.nentries,
+			same_db.bulletins.nentries, same_db.locations.nentries);
+	return TRUE;
+}
+
+// map in a compiled image, quietly returns FALSE if the file is not one
+static BOOL samedb_map(char *filename)
+{
+	SAME_TABLE *tables[SAMEDB_NTABLES] = { &same_db.agencies, &same_db.bulletins, &same_db.locations };
+	struct stat st;
+	SAMEDB_HEADER *hdr;
+	char *image;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return FALSE;
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(SAMEDB_HEADER))) {
+		close(fd);
+		return FALSE;
+	}
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED)
+		return FALSE;
+
+	hdr = (SAMEDB_HEADER *)image;
+	if (memcmp(hdr->magic, SAMEDB_MAGIC, sizeof(hdr->magic)) || (hdr->version != SAMEDB_VERSION)
+		|| (hdr->size != (uint32_t)st.st_size) || !samedb_check(image, st.st_size)) {
+		munmap(image, st.st_size);
+		return FALSE;
+	}
+
+	same_db.image = image;
+	same_db.imagesize = st.st_size;
+	same_db.dateoffset = hdr->dateoffset;
+	same_db.houroffset = hdr->houroffset;
+	for (int i = 0; i < SAMEDB_NTABLES; i++) {
+		tables[i]->hash = &hdr->tables[i];
+		tables[i]->nentries = hdr->tables[i].nentries;
+	}
+
+	DEBUGPRINTF("SAME database image mapped\n");
+	DEBUGLEVEL(DEBUG_MSGS)
+		fprintf(stderr, "%s: %d agencies, %d bulletins, %d locations\n", filename, same_db.agencies.nentries,
+			same_db.bulletins.nentries, same_db.locations.nentries);
+	return TRUE;
+}
+
+// every table and string an image refers to must lie inside it
+static BOOL samedb_check(char *image, size_t size)
+{
+	SAMEDB_HEADER *hdr = (SAMEDB_HEADER *)image;
+
+	for (int i = 0; i < SAMEDB_NTABLES; i++) {
+		SAMEDB_HTABLE *h = &hdr->tables[i];
+		if ((h->nbuckets == 0) && (h->nslots != 0))
+			return FALSE;
+		if ((h->seeds & 3) || (h->slots & 3)
+			|| ((uint64_t)h->seeds + (uint64_t)h->nbuckets * sizeof(uint32_t) > size)
+			|| ((uint64_t)h->slots + (uint64_t)h->nslots * sizeof(SAMEDB_SLOT) > size))
+			return FALSE;
+
+		SAMEDB_SLOT *slot = (SAMEDB_SLOT *)(image + h->slots);
+		for (uint32_t n = 0; n < h->nslots; n++, slot++) {
+			if (slot->code == 0)
+				continue;
+			if ((slot->code >= size) || (slot->name >= size)
+				|| (memchr(image + slot->code, '\0', size - slot->code) == NULL)
+				|| (memchr(image + slot->name, '\0', size - slot->name) == NULL))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// name.json -> name.bin, only if it exists and is not older than the JSON
+static BOOL samedb_image_name(char *filename, char *image)
+{
+	struct stat jst, ist;
+	char *dot;
+
+	if (strlen(filename) + 5 > PATH_MAX)
+		return FALSE;
+	strcpy(image, filename);
+	if (((dot = strrchr(image, '.')) == NULL) || (strchr(dot, '/') != NULL))
+		dot = image + strlen(image);
+	strcpy(dot, ".bin");
+
+	if ((stat(filename, &jst) < 0) || (stat(image, &ist) < 0))
+		return FALSE;
+	return (ist.st_mtime >= jst.st_mtime);
+}
+
+// parse "key" : [ [ "code", "name" ], ... ]
+static BOOL samedb_table(char *key, SAME_TABLE *table)
+{
+	char quoted[32];
+	char *p, *code, *name;
+	int size = 0;
+
+	sprintf(quoted, "\"%s\"", key);
+	if ((p = strstr(same_db.text, quoted)) == NULL)
+		return FALSE;
+	p += strlen(quoted);
+	if ((p = strchr(p, '[')) == NULL)
+		return FALSE;
+	p++;
+
+	table->nentries = 0;
+	table->codes = table->names = NULL;
+
+	// pairs until the closing bracket of the outer array
+	for (;;) {
+		while ((*p != '\0') && (*p != '[') && (*p != ']'))
+			p++;
+		if (*p != '[')
+			break;
+		p++;
+		if (((code = samedb_string(&p)) == NULL) || ((name = samedb_string(&p)) == NULL))
+			return FALSE;
+		if ((p = strchr(p, ']')) == NULL)
+			return FALSE;
+		p++;
+
+		if (table->nentries == size) {
+			size = size ? size * 2 : 64;
+			table->codes = realloc(table->codes, size * sizeof(char *));
+			table->names = realloc(table->names, size * sizeof(char *));
+			if ((table->codes == NULL) || (table->names == NULL))
+				return FALSE;
+		}
+		table->codes[table->nentries] = code;
+		table->names[table->nentries++] = name;
+	}
+	return TRUE;
+}
+
+// parse "key" : number
+static int samedb_int(char *key)
+{
+	char quoted[32];
+	char *p;
+
+	sprintf(quoted, "\"%s\"", key);
+	if ((p = strstr(same_db.text, quoted)) == NULL)
+		return 0;
+	if ((p = strchr(p + strlen(quoted), ':')) == NULL)
+		return 0;
+	return atoi(p + 1);
+}
+
+// copy of the next quoted string
+static char *samedb_string(char **p)
+{
+	char *start, *end;
+
+	if ((start = strchr(*p, '"')) == NULL)
+		return NULL;
+	start++;
+	if ((end = strchr(start, '"')) == NULL)
+		return NULL;
+	*p = end + 1;
+	return strndup(start, end - start);
+}
+
+static char *samedb_find(SAME_TABLE *table, char *code)
+{
+	SAMEDB_HTABLE *h = table->hash;
+
+	if (h != NULL) {
+		if (h->nslots == 0)
+			return NULL;
+		uint32_t *seeds = (uint32_t *)(same_db.image + h->seeds);
+		SAMEDB_SLOT *slot = (SAMEDB_SLOT *)(same_db.image + h->slots);
+		slot += samedb_hash(code, seeds[samedb_hash(code, 0) % h->nbuckets]) % h->nslots;
+		if ((slot->code == 0) || strcmp(same_db.image + slot->code, code))
+			return NULL;
+		return same_db.image + slot->name;
+	}
+
+	for (int i = 0; i < table->nentries; i++)
+		if (!strcmp(table->codes[i], code))
+			return table->names[i];
+	return NULL;
+}
+
+// FNV-1a, with the seed folded into the basis
+static uint32_t samedb_hash(char *key, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ (seed * 16777619u);
+
+	while (*key != '\0') {
+		h ^= (unsigned char)*key++;
+		h *= 16777619u;
+	}
+	return h ^ (h >> 15);
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	samedb_build
+
+	INPUTS:		parsed table, hash table descriptor, image being built
+
+	OUTPUTS:	TRUE or FALSE
+
+	DESCRIPTION:	hash and displace: the codes are split into buckets, then
+					starting with the largest bucket, a seed is found that
+					puts every code in the bucket into a free slot. A lookup
+					is two hashes and one string compare. Duplicate codes
+					keep the first entry, as the linear search does.
+
+---------------------------------------------------------------------------*/
+static BOOL samedb_build(SAME_TABLE *table, SAMEDB_HTABLE *htable, char **image, uint32_t *size)
+{
+	uint32_t n = (uint32_t)table->nentries;
+	uint32_t nbuckets = n / SAMEDB_BUCKETSIZE + 1;
+	uint32_t nslots = n + n / 4 + 1;
+	uint32_t *bucketof = malloc((n + 1) * sizeof(uint32_t));
+	uint32_t *order = malloc(nbuckets * sizeof(uint32_t));
+	uint32_t *count = calloc(nbuckets, sizeof(uint32_t));
+	uint32_t *seeds = calloc(nbuckets, sizeof(uint32_t));
+	int32_t *slotkey = malloc(nslots * sizeof(int32_t));
+	uint32_t *trial = malloc((n + 1) * sizeof(uint32_t));
+	SAMEDB_SLOT *slots = calloc(nslots, sizeof(SAMEDB_SLOT));
+	BOOL ok = (bucketof && order && count && seeds && slotkey && trial && slots);
+
+	if (!ok)
+		goto done;
+
+	for (uint32_t i = 0; i < nslots; i++)
+		slotkey[i] = -1;
+	for (uint32_t i = 0; i < n; i++) {
+		bucketof[i] = samedb_hash(table->codes[i], 0) % nbuckets;
+		for (uint32_t j = 0; j < i; j++) {
+			if ((bucketof[j] == bucketof[i]) && !strcmp(table->codes[j], table->codes[i])) {
+				bucketof[i] = UINT32_MAX;
+				break;
+			}
+		}
+		if (bucketof[i] != UINT32_MAX)
+			count[bucketof[i]]++;
+	}
+
+	// largest buckets first, they are the hardest to place
+	for (uint32_t i = 0; i < nbuckets; i++)
+		order[i] = i;
+	for (uint32_t i = 1; i < nbuckets; i++) {
+		uint32_t b = order[i], j = i;
+		for (; (j > 0) && (count[order[j - 1]] < count[b]); j--)
+			order[j] = order[j - 1];
+		order[j] = b;
+	}
+
+	htable->nentries = 0;
+	for (uint32_t k = 0; (k < nbuckets) && ok && (count[order[k]] != 0); k++) {
+		uint32_t b = order[k], ntrial = 0, seed;
+
+		for (seed = 1; seed < SAMEDB_MAXSEED; seed++) {
+			ntrial = 0;
+			for (uint32_t i = 0; (i < n) && (ntrial < count[b]); i++) {
+				if (bucketof[i] != b)
+					continue;
+				uint32_t slot = samedb_hash(table->codes[i], seed) % nslots;
+				if (slotkey[slot] >= 0)
+					break;
+				slotkey[slot] = (int32_t)i;
+				trial[ntrial++] = slot;
+			}
+			if (ntrial == count[b])
+				break;
+			// clash, undo this attempt
+			for (uint32_t t = 0; t < ntrial; t++)
+				slotkey[trial[t]] = -1;
+		}
+		if (seed == SAMEDB_MAXSEED)
+			ok = FALSE;
+		seeds[b] = seed;
+		htable->nentries += ntrial;
+	}
+	if (!ok)
+		goto done;
+
+	for (uint32_t i = 0; i < nslots; i++) {
+		if (slotkey[i] < 0)
+			continue;
+		char *code = table->codes[slotkey[i]], *name = table->names[slotkey[i]];
+		slots[i].code = samedb_append(image, size, code, strlen(code) + 1);
+		slots[i].name = samedb_append(image, size, name, strlen(name) + 1);
+	}
+
+	// keep the arrays aligned
+	while (*size & 3)
+		samedb_append(image, size, "", 1);
+	htable->nbuckets = nbuckets;
+	htable->nslots = nslots;
+	htable->seeds = samedb_append(image, size, seeds, nbuckets * sizeof(uint32_t));
+	htable->slots = samedb_append(image, size, slots, nslots * sizeof(SAMEDB_SLOT));
+	ok = !same_db.buildfailed;
+
+done:
+	free(bucketof);
+	free(order);
+	free(count);
+	free(seeds);
+	free(slotkey);
+	free(trial);
+	free(slots);
+	return ok;
+}
+
+// add data to the image, returns its offset; once one append has failed
+// the rest do nothing, so the image is not started again part way
+static uint32_t samedb_append(char **image, uint32_t *size, void *data, uint32_t len)
+{
+	uint32_t offset = *size;
+	char *grown;
+
+	if (same_db.buildfailed)
+		return 0;
+	if ((grown = realloc(*image, *size + len)) == NULL) {
+		free(*image);
+		*image = NULL;
+		same_db.buildfailed = TRUE;
+		return 0;
+	}
+	*image = grown;
+	memcpy(*image + offset, data, len);
+	*size += len;
+	return offset;
+}
@@ -0,0 +1,58 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      SAME database compiler
+
+	File Name:		  samedbc.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Compiles a SameDB.json into the binary image that the
+					  native daemon maps in. The image is written next to the
+					  JSON with a .bin extension unless a name is given.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "rtl.h"
+
+int debuglevel = DEBUG_MSGS;
+
+int main(int argc, char *argv[])
+{
+	char image[PATH_MAX];
+	char *dot;
+
+	if ((argc < 2) || (argc > 3) || (strlen(argv[1]) + 5 > PATH_MAX)) {
+		fprintf(stderr, "Usage: samedbc <SameDB.json> [<image file>]\n");
+		exit(100);
+	}
+
+	if (argc == 3) {
+		snprintf(image, sizeof(image), "%s", argv[2]);
+	} else {
+		strcpy(image, argv[1]);
+		if (((dot = strrchr(image, '.')) == NULL) || (strchr(dot, '/') != NULL))
+			dot = image + strlen(image);
+		strcpy(dot, ".bin");
+	}
+
+	if (!SameDBCompile(argv[1], image))
+		exit(200);
+	return 0;
+}
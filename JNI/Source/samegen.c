@@ -0,0 +1,228 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      SAME signal generator
+
+	File Name:		  samegen.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Generates a complete SAME transmission at the 24 KHz pipe
+					  rate: three header bursts, the warning alarm tone and
+					  three end of message bursts, each burst with its 16 byte
+					  preamble. The signal can be degraded with white or FM
+					  shaped noise, a tone offset, a bit clock offset, flat Rayleigh fading
+					  and FM discriminator clicks, for sensitivity testing.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "rtl.h"
+
+#define	MARK_FREQ			2083.3			// logic 1
+#define	SPACE_FREQ			1562.5			// logic 0
+#define	BAUD_RATE			520.83			// bits/sec
+#define	WAT_FREQ			1050.0			// NWR warning alarm tone
+#define	PREAMBLE_BYTES		16				// 0xAB bytes before each burst
+#define	BURST_GAP			1.0				// seconds between bursts
+#define	LEAD_TIME			0.5				// seconds before and after
+#define	FADE_PATHS			8				// sinusoids in the fading model
+#define	CLICK_LEN			5				// samples in a discriminator click
+
+// generator state while building one transmission
+struct same_gen_state_t {
+	SAME_GEN	*g;							// parameters
+	RTL_SAMPLE	*out;						// output buffer
+	int			len;						// samples written
+	int			size;						// buffer size
+	double		phase;						// tone phase
+	double		bitclock;					// bit clock phase
+	uint64_t	rng;						// noise generator
+	double		fade_freq[FADE_PATHS];		// fading path dopplers
+	double		fade_phase[2][FADE_PATHS];	// fading path phases
+	double		last_noise;					// previous noise sample
+	int			click;						// samples left in a click
+	double		click_sign;					// its polarity
+} gen;
+
+// internals
+static void gen_burst(char *text);
+static void gen_tone(double freq, double seconds);
+static void gen_silence(double seconds);
+static void gen_sample(double signal);
+static double gen_fade(void);
+static double gen_uniform(void);
+static double gen_gauss(void);
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:	SameGenerate
+
+	INPUTS:		parameters, header (ZCZC-...-), pointer to the output
+
+	OUTPUTS:	number of 24 KHz samples, 0 on error
+
+	DESCRIPTION:	build a transmission in a malloc'd buffer, which the
+					caller frees
+
+---------------------------------------------------------------------------*/
+int SameGenerate(SAME_GEN *g, char *header, RTL_SAMPLE **out)
+{
+	double bytes = 3 * (PREAMBLE_BYTES + strlen(header)) + 3 * (PREAMBLE_BYTES + 4);
+	double seconds = 2 * LEAD_TIME + 6 * BURST_GAP + g->wat_seconds
+		+ bytes * BITSPERBYTE / (BAUD_RATE * (1.0 + g->clock_ppm * 1e-6));
+
+	memset(&gen, 0, sizeof(gen));
+	gen.g = g;
+	gen.size = (int)(seconds * SAMPLE_RATE) + SAMPLE_RATE;
+	gen.rng = ((uint64_t)g->seed << 1) | 1;
+	if ((gen.out = malloc(gen.size * sizeof(RTL_SAMPLE))) == NULL)
+		return 0;
+
+	// random path angles and phases for the fading sum of sinusoids
+	for (int k = 0; k < FADE_PATHS; k++) {
+		gen.fade_freq[k] = g->fade_hz * cos(2.0 * M_PI * (k + gen_uniform()) / FADE_PATHS);
+		gen.fade_phase[0][k] = 2.0 * M_PI * gen_uniform();
+		gen.fade_phase[1][k] = 2.0 * M_PI * gen_uniform();
+	}
+
+	gen_silence(LEAD_TIME);
+	for (int i = 0; i < 3; i++) {
+		gen_burst(header);
+		gen_silence(BURST_GAP);
+	}
+	if (g->wat_seconds > 0.0) {
+		gen_tone(WAT_FREQ, g->wat_seconds);
+		gen_silence(BURST_GAP);
+	}
+	for (int i = 0; i < 3; i++) {
+		gen_burst("NNNN");
+		gen_silence((i == 2) ? LEAD_TIME : BURST_GAP);
+	}
+
+	*out = gen.out;
+	return gen.len;
+}
+
+/****************************************************************************
+ * 			Local Methods
+ ***************************************************************************/
+// preamble and text, LSB first, phase continuous
+static void gen_burst(char *text)
+{
+	double baud = BAUD_RATE * (1.0 + gen.g->clock_ppm * 1e-6);
+	int nbytes = PREAMBLE_BYTES + (int)strlen(text);
+
+	gen.bitclock = 0.0;
+	for (int byte = 0; byte < nbytes; byte++) {
+		int c = (byte < PREAMBLE_BYTES) ? SYNC_BYTE : (unsigned char)text[byte - PREAMBLE_BYTES];
+		for (int bit = 0; bit < BITSPERBYTE; bit++) {
+			double freq = (((c >> bit) & 1) ? MARK_FREQ : SPACE_FREQ) + gen.g->carrier_offset;
+			while (gen.bitclock < 1.0) {
+				gen.phase = fmod(gen.phase + 2.0 * M_PI * freq / SAMPLE_RATE, 2.0 * M_PI);
+				gen_sample(sin(gen.phase));
+				gen.bitclock += baud / SAMPLE_RATE;
+			}
+			gen.bitclock -= 1.0;
+		}
+	}
+}
+
+static void gen_tone(double freq, double seconds)
+{
+	for (int i = 0; i < (int)(seconds * SAMPLE_RATE); i++) {
+		gen.phase = fmod(gen.phase + 2.0 * M_PI * freq / SAMPLE_RATE, 2.0 * M_PI);
+		gen_sample(sin(gen.phase));
+	}
+}
+
+static void gen_silence(double seconds)
+{
+	for (int i = 0; i < (int)(seconds * SAMPLE_RATE); i++)
+		gen_sample(0.0);
+}
+
+// apply the channel to one sample of unit amplitude signal
+static void gen_sample(double signal)
+{
+	SAME_GEN *g = gen.g;
+	double amplitude = g->amplitude;
+	double x;
+
+	if (gen.len == gen.size)
+		return;
+
+	x = signal * amplitude;
+	if (g->fade_hz > 0.0)
+		x *= gen_fade();
+
+	// noise power relative to the unfaded sine, across the whole band. After an
+	// FM discriminator the noise rises with frequency: difference white noise
+	if (g->noise) {
+		double n = gen_gauss();
+		if (g->fm_noise) {
+			double white = n;
+			n = (white - gen.last_noise) / sqrt(2.0);
+			gen.last_noise = white;
+		}
+		x += n * amplitude / sqrt(2.0) * pow(10.0, -g->snr_db / 20.0);
+	}
+
+	// discriminator clicks are short impulses of either sign
+	if ((gen.click == 0) && (g->click_rate > 0.0) && (gen_uniform() < g->click_rate / SAMPLE_RATE)) {
+		gen.click = CLICK_LEN;
+		gen.click_sign = (gen_uniform() < 0.5) ? -1.0 : 1.0;
+	}
+	if (gen.click != 0) {
+		int i = CLICK_LEN - gen.click--;
+		x += 1.5 * amplitude * gen.click_sign * 0.5 * (1.0 - cos(2.0 * M_PI * (i + 1) / (CLICK_LEN + 1)));
+	}
+
+	gen.out[gen.len++] = (RTL_SAMPLE)fmax(-32768.0, fmin(32767.0, x));
+}
+
+// Rayleigh envelope with unit mean power, from a sum of sinusoids
+static double gen_fade(void)
+{
+	double t = (double)gen.len / SAMPLE_RATE;
+	double i = 0.0, q = 0.0;
+
+	for (int k = 0; k < FADE_PATHS; k++) {
+		i += cos(2.0 * M_PI * gen.fade_freq[k] * t + gen.fade_phase[0][k]);
+		q += cos(2.0 * M_PI * gen.fade_freq[k] * t + gen.fade_phase[1][k]);
+	}
+	return sqrt((i * i + q * q) / FADE_PATHS);
+}
+
+// xorshift64*
+static double gen_uniform(void)
+{
+	gen.rng ^= gen.rng >> 12;
+	gen.rng ^= gen.rng << 25;
+	gen.rng ^= gen.rng >> 27;
+	return (double)((gen.rng * 2685821657736338717ull) >> 11) / 9007199254740992.0;
+}
+
+static double gen_gauss(void)
+{
+	double u1 = gen_uniform(), u2 = gen_uniform();
+
+	if (u1 < 1e-300)
+		u1 = 1e-300;
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
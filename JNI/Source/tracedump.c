@@ -0,0 +1,112 @@
+/*---------------------------------------------------------------------------
+	Project:	      PiWxRx Weather receiver
+
+	Module:		      Trace decoder
+
+	File Name:		  tracedump.c
+
+	Author:		      Martin C. Alcock, VE6VH
+
+	Revision:	      1.05
+
+	Description:	  Turns a binary trace from the DSP thread into CSV, one
+					  row per event. Sample values are scaled to +/-1.0 as the
+					  old debug output was.
+
+					  This program is free software: you can redistribute it and/or modify
+					  it under the terms of the GNU General Public License as published by
+					  the Free Software Foundation, either version 2 of the License, or
+					  (at your option) any later version, provided this copyright notice
+					  is included.
+
+					  Copyright (c) 2018-2022 Praebius Communications Inc.
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rtl.h"
+
+static char *event_names[] = { "", "input", "lpf", "demod", "bit", "byte", "sync" };
+#define	N_EVENTS	(sizeof(event_names) / sizeof(event_names[0]))
+
+// internals
+static void usage(void);
+
+int main(int argc, char *argv[])
+{
+	TRACE_HEADER hdr;
+	TRACE_EVENT e;
+	FILE *fp;
+	int only = 0, opt;
+
+	while ((opt = getopt(argc, argv, "e:")) != -1) {
+		switch (opt) {
+
+		case 'e':
+			for (only = 1; (only < (int)N_EVENTS) && strcmp(optarg, event_names[only]); only++)
+				;
+			if (only == N_EVENTS)
+				usage();
+			break;
+
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+
+	if ((fp = fopen(argv[optind], "rb")) == NULL) {
+		fprintf(stderr, "Cannot open %s\n", argv[optind]);
+		exit(100);
+	}
+	if ((fread(&hdr, sizeof(hdr), 1, fp) != 1) || (hdr.magic != TRACE_MAGIC)) {
+		fprintf(stderr, "%s is not a trace file\n", argv[optind]);
+		exit(100);
+	}
+	if ((hdr.version != TRACE_VERSION) || (hdr.eventsize != sizeof(TRACE_EVENT))) {
+		fprintf(stderr, "%s is trace version %u, expected %u\n", argv[optind], hdr.version, TRACE_VERSION);
+		exit(100);
+	}
+
+	printf("sample,seconds,ring,event,a,b,c\n");
+	while (fread(&e, sizeof(e), 1, fp) == 1) {
+		double secs = (double)e.sample / hdr.rate;
+
+		if ((only != 0) && (e.type != only))
+			continue;
+		printf("%llu,%.6f,%d,%s,", (unsigned long long)e.sample, secs, e.ring,
+			(e.type < N_EVENTS) ? event_names[e.type] : "unknown");
+
+		switch (e.type) {
+
+		// signal values, in full scale
+		case TRACE_INPUT:
+		case TRACE_LPF:
+		case TRACE_DEMOD:
+			printf("%f,%f,%d\n", e.a / 32767.0, e.b / 32767.0, e.c);
+			break;
+
+		case TRACE_BYTE:
+			printf("0x%02x,%d,%d\n", e.a & 0xff, e.b, e.c);
+			break;
+
+		default:
+			printf("%d,%d,%d\n", e.a, e.b, e.c);
+			break;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: tracedump [-e input|lpf|demod|bit|byte|sync] <trace file>\n");
+	exit(100);
+}
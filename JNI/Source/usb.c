@@ -7,7 +7,7 @@
 
 	Author:		      Martin C. Alcock
 
-	Revision:	      3.02
+	Revision:	      3.06
 
 	Description:
 
@@ -16,14 +16,23 @@
 
 	Revision History:
 		3.02:	Added recovery for broken pipe on read
+		3.03:	Open hw directly at the device's own rate
+		3.04:	mmap capture from a poll loop, overruns recovered at once
+		3.05:	Several devices open at once
+		3.06:	Hotplug events, so a device that comes back is found again
 
 ---------------------------------------------------------------------------*/
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
 #include <libusb-1.0/libusb.h>
 #include <alsa/asoundlib.h>
 
@@ -32,13 +41,43 @@
 struct libusb_context *context=NULL;			// USB Context
 
 // ALSA structures
-snd_pcm_t *pcm_handle;
 snd_pcm_stream_t capture= SND_PCM_STREAM_CAPTURE;
 snd_pcm_hw_params_t *hwparams;
-char pcm_name[100];
+
+// mmap capture, one per open device
+typedef struct usb_capture_t {
+	snd_pcm_t			*pcm;					// NULL when the slot is free
+	char				name[32];				// hw:<card>,0
+	int					card;					// card number
+	snd_pcm_uframes_t	period;					// frames in a period
+	unsigned int		rate;					// of the device
+	struct pollfd		fds[USB_MAX_FDS];		// ALSA's poll descriptors
+	int					nfds;
+	int					xruns;					// overruns so far
+	long				gap;					// frames of silence owed
+	struct timespec		lastread;				// when frames were last taken
+	snd_pcm_sframes_t	lastavail;				// and how many were left
+} USB_CAPTURE;
+
+USB_CAPTURE usbcap[USB_MAX_DEVICES];
+
+// USB devices arriving, and ALSA devices appearing in /dev/snd after them
+struct usb_hotplug_t {
+	BOOL				libusb;					// arrivals from libusb
+	libusb_hotplug_callback_handle handle;
+	int					inotify;				// on /dev/snd, -1 if not
+	BOOL				arrived;				// since the last look
+} hotplug = { FALSE, 0, -1, FALSE };
 
 // internals
 BOOL getUSBCardNum(int ndev, char *usbId, USB_AUDIO_DEV *usrdev);
+BOOL openPCM(USB_CAPTURE *c, USB_AUDIO_DEV *usrdev, char *plugin);
+BOOL closePCM(USB_CAPTURE *c);
+int takeFrames(USB_CAPTURE *c, RTL_SAMPLE *samples, int len);
+BOOL recoverPCM(USB_CAPTURE *c, USB_AUDIO_DEV *usrdev, int err);
+BOOL cardInUse(int card);
+void cardUSBId(USB_AUDIO_DEV *usrdev);
+int LIBUSB_CALL usbArrived(libusb_context *ctx, libusb_device *dev, libusb_hotplug_event event, void *arg);
 
 #ifndef __DEBUGLEVEL
 #define	__DEBUGLEVEL
@@ -70,6 +109,7 @@ BOOL InitUSB(int debug)
 BOOL FindUSBDevice(USB_AUDIO_DEV *usrdev)
 {
 	char usbId[100];
+	BOOL found = FALSE;
 
 	// first get a list of devices
 	libusb_device **usb_dev = NULL;
@@ -78,7 +118,7 @@ BOOL FindUSBDevice(USB_AUDIO_DEV *usrdev)
 	if(debuglevel&DEBUG_USB)
 		fprintf(stderr, "get_device returned %d\n", ndev);
 
-	if(ndev == 0)
+	if(ndev <= 0)
 		return FALSE;
 
 	for(int i=0;i<ndev; i++)	{
@@ -89,7 +129,7 @@ BOOL FindUSBDevice(USB_AUDIO_DEV *usrdev)
 		if(ndesc != 0)	{
 			if(debuglevel&DEBUG_USB)
 				fprintf(stderr, "get_device_descriptor returned %d\n", ndesc);
-			return FALSE;
+			break;
 		}
 
 		if(debuglevel&DEBUG_USB)
@@ -101,10 +141,13 @@ BOOL FindUSBDevice(USB_AUDIO_DEV *usrdev)
 			if(debuglevel&DEBUG_USB)
 				fprintf(stderr, "Selected Device %s\n", usbId);
 			usrdev->partID = ((usrdev->idVendor) << 16) | usrdev->idProduct;
-			return(getUSBCardNum(ndev, usbId, usrdev));
+			found = getUSBCardNum(ndev, usbId, usrdev);
+			break;
 		}
 	}
-	return(FALSE);
+	// looked for again and again while a device is lost
+	libusb_free_device_list(usb_dev, 1);
+	return(found);
 }
 
 /*
@@ -121,7 +164,8 @@ BOOL getUSBCardNum(int ndev, char *usbId, USB_AUDIO_DEV *usrdev)
 			fgets(devID, sizeof(devID)-1, fp);
 			if(devID[strlen(devID)-1] == '\n')
 				devID[strlen(devID)-1] = '\0';
-			if(!strcmp(devID, usbId))	{
+			// the next one of several identical cards
+			if(!strcmp(devID, usbId) && !cardInUse(i))	{
 				if(debuglevel&DEBUG_USB)
 					fprintf(stderr, "Found %s on card %d\n", devID, i);
 				usrdev->cardNum = i;
@@ -136,128 +180,420 @@ BOOL getUSBCardNum(int ndev, char *usbId, USB_AUDIO_DEV *usrdev)
 }
 
 /*
- * Open a USB device
+ * Open a USB device: the hw device first, at whatever rate it runs, so no
+ * plug layer sits in the capture path; the rate is converted by the
+ * resampler instead. plughw at 48 KHz is the fallback for a device that
+ * cannot give 16 bit samples itself. Several devices can be open at once.
  */
 BOOL OpenUSBDevice(USB_AUDIO_DEV *usrdev)
+{
+	USB_CAPTURE *c = NULL;
+
+	for(int i=0;(c == NULL) && (i<USB_MAX_DEVICES);i++)
+		if(usbcap[i].pcm == NULL)	{
+			c = &usbcap[i];
+			usrdev->slot = i;
+		}
+	if(c == NULL)	{
+		fprintf(stderr, "No more than %d USB devices can be open\n", USB_MAX_DEVICES);
+		return FALSE;
+	}
+
+	if(!openPCM(c, usrdev, "hw"))	{
+		if(debuglevel&DEBUG_USB)
+			fprintf(stderr, "Cannot use hw:%d,0 directly, trying plughw\n", usrdev->cardNum);
+		if(!openPCM(c, usrdev, "plughw"))
+			return FALSE;
+	}
+
+	// a device opened by card is found again by its ID
+	if(usrdev->idVendor == 0)
+		cardUSBId(usrdev);
+	return TRUE;
+}
+
+void CloseUSBDevice(USB_AUDIO_DEV *usrdev)
+{
+	USB_CAPTURE *c = &usbcap[usrdev->slot];
+
+	if(c->pcm != NULL)
+		closePCM(c);
+}
+
+// the device's poll descriptors, to wait on with the others
+int USBPollDescriptors(USB_AUDIO_DEV *usrdev, struct pollfd *fds)
+{
+	USB_CAPTURE *c = &usbcap[usrdev->slot];
+
+	memcpy(fds, c->fds, c->nfds*sizeof(struct pollfd));
+	return c->nfds;
+}
+
+BOOL openPCM(USB_CAPTURE *c, USB_AUDIO_DEV *usrdev, char *plugin)
 {
 	int errno;
+	BOOL direct = !strcmp(plugin, "hw");
 
 	// Step 1: allocate memory for a hwparams struct
 	snd_pcm_hw_params_alloca(&hwparams);
 
 
 	// Step 2: open the device
-	sprintf(pcm_name, "plughw:%d,0", usrdev->cardNum);
-	if((errno=snd_pcm_open(&pcm_handle, pcm_name, capture, 0)) < 0)	{
-		fprintf(stderr, "Error %s opening device %s\n", snd_strerror(errno), pcm_name);
+	sprintf(c->name, "%s:%d,0", plugin, usrdev->cardNum);
+	c->card = usrdev->cardNum;
+	if((errno=snd_pcm_open(&c->pcm, c->name, capture, 0)) < 0)	{
+		fprintf(stderr, "Error %s opening device %s\n", snd_strerror(errno), c->name);
+		c->pcm = NULL;
 		return FALSE;
 	}
 
 	// Step 3: get the current configuration
-	if((errno=snd_pcm_hw_params_any(pcm_handle, hwparams)) < 0)	{
-		fprintf(stderr, "Error %s getting parameters for %s\n", snd_strerror(errno), pcm_name);
-		return FALSE;
+	if((errno=snd_pcm_hw_params_any(c->pcm, hwparams)) < 0)	{
+		fprintf(stderr, "Error %s getting parameters for %s\n", snd_strerror(errno), c->name);
+		return closePCM(c);
 	}
 
-	// set non-interleaved access
-	if((errno=snd_pcm_hw_params_set_access(pcm_handle, hwparams, SND_PCM_ACCESS_RW_NONINTERLEAVED)) < 0)	{
-		fprintf(stderr, "Error %s setting access mode on %s\n", snd_strerror(errno), pcm_name);
-		return FALSE;
+	// set mmap access, the first channel is taken from the ring as it is laid out
+	snd_pcm_access_mask_t *access;
+	snd_pcm_access_mask_alloca(&access);
+	snd_pcm_access_mask_none(access);
+	snd_pcm_access_mask_set(access, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+	snd_pcm_access_mask_set(access, SND_PCM_ACCESS_MMAP_NONINTERLEAVED);
+	if((errno=snd_pcm_hw_params_set_access_mask(c->pcm, hwparams, access)) < 0)	{
+		fprintf(stderr, "Error %s setting access mode on %s\n", snd_strerror(errno), c->name);
+		return closePCM(c);
 	}
 
-	// set blocking mode
-	if((errno=snd_pcm_nonblock(pcm_handle, 0)) < 0)	{
-		fprintf(stderr, "Error %s setting blocking mode on %s\n", snd_strerror(errno), pcm_name);
-		return FALSE;
+	// set non-blocking mode, the capture waits in poll
+	if((errno=snd_pcm_nonblock(c->pcm, 1)) < 0)	{
+		fprintf(stderr, "Error %s setting blocking mode on %s\n", snd_strerror(errno), c->name);
+		return closePCM(c);
 	}
 
-	//  Step 3d: set resampling
-	if(snd_pcm_hw_params_set_rate_resample(pcm_handle, hwparams, 1) < 0)	{
+	//  Step 3d: resample only through the plug layer
+	if(snd_pcm_hw_params_set_rate_resample(c->pcm, hwparams, direct ? 0 : 1) < 0)	{
 			fprintf(stderr, "Error setting resampling\n");
-			return FALSE;
+			return closePCM(c);
 	}
 
 	// now setup the HW params struct
 	// Step 3a: set the endian format
-	if((errno=snd_pcm_hw_params_set_format(pcm_handle, hwparams, SND_PCM_FORMAT_S16_LE)) < 0)	{
-		fprintf(stderr, "Error %s setting format on %s\n", snd_strerror(errno), pcm_name);
-		return FALSE;
+	if((errno=snd_pcm_hw_params_set_format(c->pcm, hwparams, SND_PCM_FORMAT_S16_LE)) < 0)	{
+		fprintf(stderr, "Error %s setting format on %s\n", snd_strerror(errno), c->name);
+		return closePCM(c);
 	}
 
-	//  Step 3b: set the sample rate
+	//  Step 3b: set the sample rate, taking what the device has nearest
 	unsigned int sample_rate = RAW_SAMPLE_RATE;
-	if(snd_pcm_hw_params_set_rate_near(pcm_handle, hwparams, &sample_rate, 0) < 0)	{
+	if(snd_pcm_hw_params_set_rate_near(c->pcm, hwparams, &sample_rate, 0) < 0)	{
 		fprintf(stderr, "Error setting sample rate\n");
-		return FALSE;
+		return closePCM(c);
 	}
-	if(sample_rate != (unsigned int)RAW_SAMPLE_RATE)
-		fprintf(stderr, "Sample rate set to %d, some functions may not work\n", sample_rate);
+	usrdev->sampleRate = c->rate = sample_rate;
+	if(debuglevel&DEBUG_USB)
+		fprintf(stderr, "%s sample rate %d\n", c->name, sample_rate);
 
-	//  Step 3c: set the number of channels
-	if(snd_pcm_hw_params_set_channels(pcm_handle, hwparams, 1) < 0)	{
+	//  Step 3c: set the number of channels, the first is used
+	unsigned int channels = 1;
+	if(snd_pcm_hw_params_set_channels_near(c->pcm, hwparams, &channels) < 0)	{
 			fprintf(stderr, "Error setting number of channels\n");
-			return FALSE;
+			return closePCM(c);
 	}
+	usrdev->channels = channels;
 
 	//  Step 3e: set the period and buffer size
-	unsigned int per_size = usrdev->recordSize;
-	if((errno=snd_pcm_hw_params_set_periods(pcm_handle, hwparams, per_size, 0)) < 0)	{
-		fprintf(stderr, "Error %s setting period size on %s\n", snd_strerror(errno), pcm_name);
-		return FALSE;
+	snd_pcm_uframes_t per_size = usrdev->recordSize;
+	if((errno=snd_pcm_hw_params_set_period_size_near(c->pcm, hwparams, &per_size, 0)) < 0)	{
+		fprintf(stderr, "Error %s setting period size on %s\n", snd_strerror(errno), c->name);
+		return closePCM(c);
 	}
 
-	// set buffer to 4 periods
-	snd_pcm_uframes_t buf_size = 4;
-	if(snd_pcm_hw_params_set_buffer_size_near(pcm_handle, hwparams, &buf_size) < 0)	{
+	// set the buffer to ride out the reader being held up for a while
+	snd_pcm_uframes_t buf_size = USB_PERIODS*per_size;
+	if(snd_pcm_hw_params_set_buffer_size_near(c->pcm, hwparams, &buf_size) < 0)	{
 		fprintf(stderr, "Error setting buffer size\n");
-		return FALSE;
+		return closePCM(c);
 	}
 
 	//  Step 4: now set the params
-	if(snd_pcm_hw_params(pcm_handle, hwparams) < 0)	{
+	if(snd_pcm_hw_params(c->pcm, hwparams) < 0)	{
 		fprintf(stderr, "Error setting hardware parameters\n");
-		return FALSE;
+		return closePCM(c);
+	}
+	snd_pcm_hw_params_get_period_size(hwparams, &c->period, 0);
+
+	// wake the poll once a period is in
+	snd_pcm_sw_params_t *swparams;
+	snd_pcm_sw_params_alloca(&swparams);
+	snd_pcm_sw_params_current(c->pcm, swparams);
+	snd_pcm_sw_params_set_avail_min(c->pcm, swparams, c->period);
+	if((errno=snd_pcm_sw_params(c->pcm, swparams)) < 0)	{
+		fprintf(stderr, "Error %s setting software parameters on %s\n", snd_strerror(errno), c->name);
+		return closePCM(c);
+	}
+
+	c->nfds = snd_pcm_poll_descriptors_count(c->pcm);
+	if((c->nfds <= 0) || (c->nfds > USB_MAX_FDS))	{
+		fprintf(stderr, "%s has %d poll descriptors\n", c->name, c->nfds);
+		return closePCM(c);
 	}
+	snd_pcm_poll_descriptors(c->pcm, c->fds, c->nfds);
+	if(debuglevel&DEBUG_USB)
+		fprintf(stderr, "%s period %lu frames, buffer %lu\n", c->name, c->period, buf_size);
 
-	// step 4: start the device
-	if((errno=snd_pcm_prepare(pcm_handle)) < 0)	{
+	// step 4: start the device; a capture in mmap mode does not start itself
+	if(((errno=snd_pcm_prepare(c->pcm)) < 0) || ((errno=snd_pcm_start(c->pcm)) < 0))	{
 		fprintf(stderr, "Error starting device: %s\n", snd_strerror(errno));
-		return FALSE;
+		return closePCM(c);
 	}
+	clock_gettime(CLOCK_MONOTONIC, &c->lastread);
+	c->lastavail = 0;
+	c->gap = 0;
+	c->xruns = usrdev->xruns = 0;
+	usrdev->gapSamples = 0;
 
 	return TRUE;
 }
 
+// give up on a device that is half set up, or done with
+BOOL closePCM(USB_CAPTURE *c)
+{
+	snd_pcm_close(c->pcm);
+	c->pcm = NULL;
+	return FALSE;
+}
+
+// a card already open is not found again for another device
+// the ID of the device on a card, if it is USB
+void cardUSBId(USB_AUDIO_DEV *usrdev)
+{
+	char fname[100];
+	FILE *fp;
+
+	sprintf(fname, "/proc/asound/card%d/usbid", usrdev->cardNum);
+	if((fp=fopen(fname, "r")) != NULL)	{
+		if(fscanf(fp, "%hx:%hx", &usrdev->idVendor, &usrdev->idProduct) != 2)
+			usrdev->idVendor = usrdev->idProduct = 0;
+		fclose(fp);
+	}
+}
+
+int LIBUSB_CALL usbArrived(libusb_context *ctx, libusb_device *dev, libusb_hotplug_event event, void *arg)
+{
+	struct libusb_device_descriptor desc = {0};
+
+	if((debuglevel&DEBUG_USB) && (libusb_get_device_descriptor(dev, &desc) == 0))
+		fprintf(stderr, "USB device %04x:%04x arrived\n", desc.idVendor, desc.idProduct);
+	hotplug.arrived = TRUE;
+	return 0;
+}
+
+BOOL cardInUse(int card)
+{
+	for(int i=0;i<USB_MAX_DEVICES;i++)
+		if((usbcap[i].pcm != NULL) && (usbcap[i].card == card))
+			return TRUE;
+	return FALSE;
+}
+
+/*---------------------------------------------------------------------------
+
+	FUNCTION:		USBHotplugInit
+
+	INPUTS:			none
+
+	OUTPUTS:		TRUE if there will be any events
+
+	DESCRIPTION:	watch for USB devices arriving, and for their ALSA
+					devices, which come a little later
+
+---------------------------------------------------------------------------*/
+BOOL USBHotplugInit(void)
+{
+	if(libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)
+		&& (libusb_hotplug_register_callback(context, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, LIBUSB_HOTPLUG_NO_FLAGS,
+			LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, usbArrived, NULL,
+			&hotplug.handle) == LIBUSB_SUCCESS))
+		hotplug.libusb = TRUE;
+
+	// udev changing the owner of a new device is an attribute change
+	if(((hotplug.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0)
+		&& (inotify_add_watch(hotplug.inotify, "/dev/snd", IN_CREATE | IN_ATTRIB) < 0))	{
+		close(hotplug.inotify);
+		hotplug.inotify = -1;
+	}
+
+	if(debuglevel&DEBUG_USB)
+		fprintf(stderr, "Hotplug events from%s%s\n", hotplug.libusb ? " libusb" : "",
+			(hotplug.inotify >= 0) ? " /dev/snd" : "");
+	return(hotplug.libusb || (hotplug.inotify >= 0));
+}
+
+// descriptors to wait on for hotplug events, at most USB_HOTPLUG_FDS
+int USBHotplugDescriptors(struct pollfd *fds)
+{
+	int n = 0;
+
+	if(hotplug.inotify >= 0)	{
+		fds[n].fd = hotplug.inotify;
+		fds[n++].events = POLLIN;
+	}
+	if(hotplug.libusb)	{
+		const struct libusb_pollfd **usbfds = libusb_get_pollfds(context);
+		for(int i=0;(usbfds != NULL) && (usbfds[i] != NULL) && (n < USB_HOTPLUG_FDS);i++)	{
+			fds[n].fd = usbfds[i]->fd;
+			fds[n++].events = usbfds[i]->events;
+		}
+		libusb_free_pollfds(usbfds);
+	}
+	return n;
+}
+
+// TRUE if a device has come since the last call; does not wait
+BOOL USBHotplugEvents(void)
+{
+	struct timeval zero = { 0, 0 };
+	char buf[1024];
+	BOOL arrived;
+
+	if(hotplug.libusb)
+		libusb_handle_events_timeout_completed(context, &zero, NULL);
+	while((hotplug.inotify >= 0) && (read(hotplug.inotify, buf, sizeof(buf)) > 0))
+		hotplug.arrived = TRUE;
+
+	arrived = hotplug.arrived;
+	hotplug.arrived = FALSE;
+	return arrived;
+}
+
 int nframesRead=0;
 
 /*
- * Read a USB device. The length specification is in frames, but it returns
- * the record length in bytes to be compatible with the file mode
+ * Read a USB device without waiting. The length specification is in frames,
+ * but it returns the record length in bytes of the first channel, to be
+ * compatible with the file mode: 0 when nothing has come in yet, and -1
+ * when the device has failed. Frames are taken straight from the ALSA ring;
+ * after an overrun the frames lost are made up with silence, so the samples
+ * stay in step with the time, and a gap marker is written for the parent.
  */
-int readUSB(void *buffer, int len)
+int readUSB(USB_AUDIO_DEV *usrdev, void *buffer, int len)
 {
-	void *frame = buffer;
-	snd_pcm_uframes_t nframes = len;
-	snd_pcm_sframes_t nread = 0;
-
-	// continue while in error or no data state
-	while(nread <= 0)	{
-
-		nread = snd_pcm_readn(pcm_handle, &frame, nframes);
-
-		// broken pipe error
-		if(nread == -EPIPE)	{
-			fprintf(stderr, "Buffer overrun..attempting to recover\n");
-			sleep(1);
-			snd_pcm_prepare(pcm_handle);
-		} else {
-			if(nread < 0)	{
-				fprintf(stderr, "USB Read error %ld: %s\n",  nread, snd_strerror(errno));
-				fprintf(stderr, "%d frames were read\n", nframesRead);
-				return 0;
-			}
+	USB_CAPTURE *c = &usbcap[usrdev->slot];
+	RTL_SAMPLE *samples = buffer;
+	int nread = 0;
+
+	// silence for what an overrun lost
+	if(c->gap > 0)	{
+		nread = (c->gap > len) ? len : (int)c->gap;
+		memset(samples, 0, nread*sizeof(RTL_SAMPLE));
+		c->gap -= nread;
+		return nread*USB_FRAME_SIZE;
+	}
+
+	while(nread < len)	{
+		int n = takeFrames(c, &samples[nread], len - nread);
+
+		if(n > 0)	{
+			nread += n;
+			continue;
+		}
+		if(n == 0)
+			break;
+		if(!recoverPCM(c, usrdev, n))	{
+			fprintf(stderr, "%d frames were read\n", nframesRead);
+			return -1;
 		}
+		// what was read before the overrun goes first, the silence after it
+		if(nread == 0)
+			return readUSB(usrdev, buffer, len);
+		break;
 	}
-	nframes++;
+
+	// a device that has stopped sending is as good as gone
+	if(nread == 0)	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if((now.tv_sec - c->lastread.tv_sec)*1000 + (now.tv_nsec - c->lastread.tv_nsec)/1000000 > USB_POLL_MS)	{
+			fprintf(stderr, "No audio from %s for %d ms\n", c->name, USB_POLL_MS);
+			return -1;
+		}
+	}
+	nframesRead += nread;
 	return nread*USB_FRAME_SIZE;
 }
+
+/*
+ * Copy up to len frames of the first channel out of the ring. Returns the
+ * frames taken, 0 if there are none yet, or a negative ALSA error.
+ */
+int takeFrames(USB_CAPTURE *c, RTL_SAMPLE *samples, int len)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset, frames = len;
+	snd_pcm_sframes_t avail, committed;
+	int err;
+
+	if((avail=snd_pcm_avail_update(c->pcm)) <= 0)
+		return (int)avail;
+
+	if((err=snd_pcm_mmap_begin(c->pcm, &areas, &offset, &frames)) < 0)
+		return err;
+
+	// the first channel, interleaved or not
+	unsigned char *src = (unsigned char *)areas[0].addr + (areas[0].first + offset*areas[0].step)/8;
+	int step = areas[0].step/8;
+	for(snd_pcm_uframes_t i=0;i<frames;i++)
+		samples[i] = *(RTL_SAMPLE *)(src + i*step);
+
+	if((committed=snd_pcm_mmap_commit(c->pcm, offset, frames)) < 0)
+		return (int)committed;
+	if((snd_pcm_uframes_t)committed != frames)
+		return -EPIPE;
+
+	clock_gettime(CLOCK_MONOTONIC, &c->lastread);
+	c->lastavail = avail - frames;
+	return (int)frames;
+}
+
+/*
+ * Get going again at once after an overrun or a suspend. Everything in the
+ * ring at the last read, and all since, is gone; that many frames of
+ * silence are owed, and the gap is passed up to the parent on stderr.
+ */
+BOOL recoverPCM(USB_CAPTURE *c, USB_AUDIO_DEV *usrdev, int err)
+{
+	struct timespec now, wall;
+
+	if((err == -EPIPE) || (err == -ESTRPIPE))	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		clock_gettime(CLOCK_REALTIME, &wall);
+		double secs = (now.tv_sec - c->lastread.tv_sec) + (now.tv_nsec - c->lastread.tv_nsec)/1e9;
+		long lost = c->lastavail + (long)(secs*c->rate);
+		if(lost > (long)USB_MAX_GAP_SECS*c->rate)
+			lost = (long)USB_MAX_GAP_SECS*c->rate;
+		c->gap += lost;
+		c->xruns++;
+		usrdev->xruns = c->xruns;
+		usrdev->gapSamples += (int64_t)lost*SAMPLE_RATE/c->rate;
+
+		fprintf(stderr, SOURCE_GAP_MARKER " %d %lld %ld.%06ld\n", c->xruns,
+			(long long)lost*SAMPLE_RATE/c->rate, (long)wall.tv_sec, wall.tv_nsec/1000);
+		if(debuglevel&DEBUG_USB)
+			fprintf(stderr, "%s %s %d: %ld frames lost\n", c->name,
+				(err == -EPIPE) ? "overrun" : "suspend", c->xruns, lost);
+
+		if(err == -ESTRPIPE)
+			while((err=snd_pcm_resume(c->pcm)) == -EAGAIN)
+				usleep(10000);
+		// a resumed stream is already running, a prepared one needs a start
+		if((err < 0) && ((err=snd_pcm_prepare(c->pcm)) == 0))
+			err = snd_pcm_start(c->pcm);
+	}
+	if(err < 0)	{
+		fprintf(stderr, "USB Read error on %s %d: %s\n", c->name, err, snd_strerror(err));
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &c->lastread);
+	c->lastavail = 0;
+	return TRUE;
+}